@@ -3,6 +3,7 @@
 
 #include "common.h"
 #include "value.h"
+#include "shape.h"
 
 /**
  * Opcodes
@@ -22,9 +23,9 @@ typedef enum {
     // Variables
     OP_GET_LOCAL,
     OP_SET_LOCAL,
-    OP_GET_GLOBAL,
-    OP_DEFINE_GLOBAL,
-    OP_SET_GLOBAL,
+    OP_GET_GLOBAL_SLOT,     // 16-bit index into vm.globalValues
+    OP_DEFINE_GLOBAL_SLOT,
+    OP_SET_GLOBAL_SLOT,
     OP_GET_UPVALUE,
     OP_SET_UPVALUE,
     OP_CLOSE_UPVALUE,
@@ -36,6 +37,7 @@ typedef enum {
     OP_DIVIDE,
     OP_MODULO,
     OP_NEGATE,
+    OP_IN,              // Array element, map key or substring test
     
     // Comparison
     OP_EQUAL,
@@ -54,6 +56,7 @@ typedef enum {
     OP_JUMP,
     OP_JUMP_IF_FALSE,
     OP_LOOP,
+    OP_FOR_ITER,        // Next array element into the loop variable, or jump out
     
     // Functions
     OP_CALL,
@@ -64,11 +67,12 @@ typedef enum {
     OP_CLASS,
     OP_INHERIT,
     OP_METHOD,
-    OP_GET_PROPERTY,
+    OP_GET_PROPERTY,    // Name constant, then a 16-bit inline cache index
     OP_SET_PROPERTY,
     OP_GET_SUPER,
-    OP_INVOKE,
+    OP_INVOKE,          // Name constant, argument count, cache index
     OP_SUPER_INVOKE,
+    OP_NEW,             // Instance of the class on top, without calling init
     
     // Collections
     OP_ARRAY,           // Create array with N elements on stack
@@ -76,9 +80,36 @@ typedef enum {
     OP_INDEX_GET,       // array[index] or map[key]
     OP_INDEX_SET,       // array[index] = val or map[key] = val
     
-    // Built-in
-    OP_PRINT,
-    OP_PRINTLN,
+    // Modules
+    OP_IMPORT,          // Run a module's top level the first time it is imported
+    
+    // Exceptions
+    OP_TRY,             // Push a handler that resumes at the catch block
+    OP_END_TRY,         // Pop it when the try block completes
+    
+    // Superinstructions: never emitted by the compiler. The peephole pass
+    // in optimizer.c fuses the most frequent sequences into them.
+    OP_GET_LOCAL2,          // Two locals: GET_LOCAL a; GET_LOCAL b
+    OP_ADD_CONSTANT,        // CONSTANT k; ADD
+    OP_INCREMENT_LOCAL,     // GET_LOCAL a; CONSTANT k; ADD; SET_LOCAL a; POP
+    OP_JUMP_IF_NOT_LESS,    // LESS; JUMP_IF_FALSE; POP, jumping past the exit POP
+    OP_JUMP_IF_NOT_LESS_EQUAL,
+    OP_JUMP_IF_NOT_GREATER,
+    OP_JUMP_IF_NOT_GREATER_EQUAL,
+    
+    // Quickened forms: never emitted by the compiler. The VM rewrites a
+    // generic instruction into one once it has seen the operand types,
+    // and back when the guard fails.
+    OP_ADD_INT,
+    OP_ADD_STR,
+    OP_SUBTRACT_INT,
+    OP_MULTIPLY_INT,
+    OP_GREATER_INT,
+    OP_GREATER_EQUAL_INT,
+    OP_LESS_INT,
+    OP_LESS_EQUAL_INT,
+    OP_INDEX_GET_ARRAY_INT,
+    OP_INDEX_SET_ARRAY_INT,
     
 } OpCode;
 
@@ -92,11 +123,16 @@ typedef struct {
     uint8_t* code;
     int* lines;         // Line numbers for debugging
     ValueArray constants;
+    InlineCache* caches;    // One per property and invoke site
+    int cacheCount;
+    int cacheCapacity;
 } Chunk;
 
 void initChunk(Chunk* chunk);
 void freeChunk(Chunk* chunk);
 void writeChunk(Chunk* chunk, uint8_t byte, int line);
 int addConstant(Chunk* chunk, Value value);
+int addCache(Chunk* chunk);
+int instructionLength(Chunk* chunk, int offset);   // Opcode and operands, in bytes
 
 #endif // SOMNIA_CHUNK_H
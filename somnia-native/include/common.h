@@ -16,13 +16,45 @@
 // Debug flags
 #define DEBUG_TRACE_EXECUTION 0
 #define DEBUG_PRINT_CODE 0
+#ifndef DEBUG_STRESS_GC
 #define DEBUG_STRESS_GC 0
+#endif
 #define DEBUG_LOG_GC 0
 
+// Value representation: 8-byte NaN-boxed words, or 16-byte tagged structs
+#ifndef NAN_BOXING
+#define NAN_BOXING 1
+#endif
+
+// Threaded dispatch through a table of label addresses (GCC/Clang only)
+#ifndef COMPUTED_GOTO
+#if defined(__GNUC__) && !DEBUG_TRACE_EXECUTION
+#define COMPUTED_GOTO 1
+#else
+#define COMPUTED_GOTO 0
+#endif
+#endif
+
+// Peephole pass over compiled chunks: folding, superinstructions, jump threading
+#ifndef OPTIMIZE_CHUNKS
+#define OPTIMIZE_CHUNKS 1
+#endif
+
+// Baseline JIT for hot functions, switched on at run time with --jit. It
+// emits x86-64 code for NaN-boxed values, so other builds leave it out
+#ifndef BASELINE_JIT
+#if defined(__x86_64__) && defined(__linux__) && NAN_BOXING
+#define BASELINE_JIT 1
+#else
+#define BASELINE_JIT 0
+#endif
+#endif
+
 // VM limits
 #define UINT8_COUNT (UINT8_MAX + 1)
-#define FRAMES_MAX 64
+#define FRAMES_MAX 256
 #define STACK_MAX (FRAMES_MAX * UINT8_COUNT)
+#define HANDLERS_MAX 64
 
 // Platform detection
 #if defined(_WIN32) || defined(_WIN64)
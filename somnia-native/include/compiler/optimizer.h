@@ -0,0 +1,14 @@
+#ifndef SOMNIA_OPTIMIZER_H
+#define SOMNIA_OPTIMIZER_H
+
+#include "chunk.h"
+
+/**
+ * Peephole pass over a finished chunk.
+ * Folds constant arithmetic, fuses frequent sequences into superinstructions,
+ * threads jumps to jumps and drops unreachable code, rewriting the lines
+ * table with the code. A chunk whose rewrite would not encode is left as is.
+ */
+void optimizeChunk(Chunk* chunk);
+
+#endif // SOMNIA_OPTIMIZER_H
@@ -0,0 +1,30 @@
+#ifndef SOMNIA_ENGINE_H
+#define SOMNIA_ENGINE_H
+
+/**
+ * Bytecode Engine
+ * 
+ * Entry point from the tree-walker's driver into the bytecode VM. The two
+ * runtimes have separate heaps and value types, so this header exposes
+ * nothing from either.
+ */
+
+#include <stdbool.h>
+
+typedef enum {
+    ENGINE_OK,
+    ENGINE_FALLBACK,        // Program not compilable to bytecode: nothing ran
+    ENGINE_RUNTIME_ERROR,
+} EngineResult;
+
+typedef struct {
+    bool jit;               // Compile hot functions to native code
+    int jit_threshold;      // Calls or loop backedges before compiling; 0 for the defaults
+    bool full_gc;           // Stop-the-world collections instead of incremental steps
+    int gc_pause_target;    // Longest incremental GC step in microseconds; 0 for the default
+} EngineOptions;
+
+// Compiles the program and its imports, then runs it on a fresh VM
+EngineResult engine_run_bytecode(const char* source, EngineOptions options);
+
+#endif // SOMNIA_ENGINE_H
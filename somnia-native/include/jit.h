@@ -0,0 +1,82 @@
+#ifndef SOMNIA_JIT_H
+#define SOMNIA_JIT_H
+
+#include "common.h"
+#include "vm.h"
+
+/**
+ * Baseline JIT
+ * Translates a hot function's chunk, one instruction at a time, into x86-64
+ * code that keeps the VM stack as its storage. Locals, temporaries and
+ * frames stay where the interpreter expects them, so a frame can move
+ * between native code and the interpreter at any instruction boundary.
+ * Stack shuffling, jumps and int arithmetic are inlined. Other instructions
+ * call the helpers below, and the rare ones bail out to the interpreter.
+ *
+ * Code lives in an mmap'd cache whose pages are never writable and
+ * executable at once. Each function is listed in /tmp/perf-<pid>.map so
+ * perf can symbolize native frames.
+ */
+
+// Defaults for vm.jitCallThreshold and vm.jitLoopThreshold
+#define JIT_CALL_THRESHOLD 100
+#define JIT_LOOP_THRESHOLD 1000
+
+#define JIT_CACHE_SIZE (16 * 1024 * 1024)
+
+/**
+ * What native code, or a helper it called, left the VM to do
+ */
+typedef enum {
+    JIT_CONTINUE,       // Helpers only: go on with the next instruction
+    JIT_RETURNED,       // The frame returned; its result is on the caller's stack
+    JIT_BAILOUT,        // The interpreter resumes the top frame at its ip
+    JIT_ERROR,          // A runtime error was reported
+} JitStatus;
+
+/**
+ * Native code of one function
+ */
+typedef struct JitCode {
+    uint8_t* code;
+    size_t size;
+    uint32_t* entries;      // Native offset of each instruction, by bytecode offset
+    int entryCount;
+} JitCode;
+
+#if BASELINE_JIT
+
+// Maps the code cache and installs the entry trampoline; false if either
+// fails. The perf map is best-effort: without it perf can't name the code
+bool initJit(void);
+void freeJit(void);
+
+// Compiles a function; on failure it is marked and never tried again
+bool jitCompile(ObjFunction* function);
+void freeJitCode(JitCode* code);
+
+// Runs the compiled function of the top frame from the frame's ip
+JitStatus jitEnter(CallFrame* frame);
+
+// Helpers native code calls, defined in vm.c. The stack is in vm.stackTop
+// and the frame's ip is past the instruction being run.
+JitStatus jitOperator(uint8_t op);      // Generic forms, without quickening
+JitStatus jitUndefinedGlobal(int slot);
+JitStatus jitCall(int argCount);
+JitStatus jitInvoke(ObjString* name, int argCount, InlineCache* cache);
+JitStatus jitSuperInvoke(ObjString* name, int argCount);
+JitStatus jitReturn(void);
+void jitGetProperty(ObjString* name, InlineCache* cache);
+void jitSetProperty(ObjString* name, InlineCache* cache);
+JitStatus jitGetSuper(ObjString* name);
+JitStatus jitNew(void);
+void jitArray(int count);
+void jitMap(int count);
+void jitIndexGet(void);
+void jitIndexSet(void);
+void jitCloseUpvalue(void);
+bool jitForIter(Value* locals);         // Next element into locals[2], or false
+
+#endif
+
+#endif // SOMNIA_JIT_H
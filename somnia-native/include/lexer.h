@@ -26,16 +26,17 @@ typedef enum {
     // Literals
     TOKEN_IDENTIFIER, TOKEN_STRING, TOKEN_NUMBER, TOKEN_INT,
     
-    // Keywords
+    // Keywords ('not' scans as TOKEN_BANG, 'this' as TOKEN_SELF)
     TOKEN_AND, TOKEN_CLASS, TOKEN_ELSE, TOKEN_FALSE,
     TOKEN_FOR, TOKEN_FUN, TOKEN_IF, TOKEN_NULL,
-    TOKEN_OR, TOKEN_PRINT, TOKEN_PRINTLN, TOKEN_RETURN, TOKEN_SUPER,
+    TOKEN_OR, TOKEN_RETURN, TOKEN_SUPER,
     TOKEN_SELF, TOKEN_TRUE, TOKEN_VAR, TOKEN_CONST, TOKEN_WHILE,
-    TOKEN_EXTENDS, TOKEN_IMPORT, TOKEN_FROM, TOKEN_AS,
-    TOKEN_BREAK, TOKEN_CONTINUE, TOKEN_IN, TOKEN_MATCH, TOKEN_CASE,
+    TOKEN_EXTENDS, TOKEN_IMPORT, TOKEN_EXPORT, TOKEN_FROM,
+    TOKEN_BREAK, TOKEN_CONTINUE, TOKEN_IN, TOKEN_WHEN,
+    TOKEN_NEW, TOKEN_FIELD, TOKEN_METHOD, TOKEN_TRY, TOKEN_CATCH,
     
     // Somnia-specific (psychological blocks)
-    TOKEN_ID, TOKEN_EGO, TOKEN_ACT, TOKEN_ACTION,
+    TOKEN_ID, TOKEN_EGO, TOKEN_ACT,
     
     TOKEN_ERROR,
     TOKEN_EOF
@@ -4,6 +4,7 @@
 #include "common.h"
 #include "value.h"
 #include "object.h"
+#include "vm.h"
 
 /**
  * Memory Allocation Macros
@@ -24,6 +25,23 @@
 #define FREE_ARRAY(type, pointer, oldCount) \
     reallocate(pointer, sizeof(type) * (oldCount), 0)
 
+/**
+ * Write barrier
+ * While a cycle marks, a reference stored into an already marked object
+ * would never be traced, so the stored value is marked on the spot. Every
+ * write of a value into a heap object goes through one. Roots (the stack,
+ * globals, open upvalues) are marked again when marking ends instead.
+ */
+#define WRITE_BARRIER(owner, value) \
+    do { \
+        if (vm.gcPhase == GC_MARK && ((Obj*)(owner))->isMarked) markValue(value); \
+    } while (0)
+
+#define WRITE_BARRIER_OBJ(owner, object) \
+    do { \
+        if (vm.gcPhase == GC_MARK && ((Obj*)(owner))->isMarked) markObject((Obj*)(object)); \
+    } while (0)
+
 /**
  * Core memory functions
  */
@@ -39,12 +57,25 @@ void markObject(Obj* object);
 
 /**
  * GC Metrics (for introspection)
+ * Pauses are in microseconds, one per incremental step or full collection.
+ * pauseHistogram[i] counts the pauses up to gcPauseBounds[i]; the last
+ * bucket takes the longer ones.
  */
+#define GC_PAUSE_BUCKETS 8
+#define GC_PAUSE_TARGET 1000    // Default vm.gcPauseTarget
+
+extern const uint64_t gcPauseBounds[GC_PAUSE_BUCKETS - 1];
+
 typedef struct {
     size_t bytesAllocated;
     size_t nextGC;
     size_t totalCollections;
     size_t totalFreed;
+    size_t pauses;
+    uint64_t maxPause;
+    uint64_t totalPause;
+    uint64_t pauseTarget;       // vm.gcPauseTarget
+    size_t pauseHistogram[GC_PAUSE_BUCKETS];
 } GCMetrics;
 
 GCMetrics* getGCMetrics(void);
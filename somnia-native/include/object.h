@@ -4,6 +4,8 @@
 #include "common.h"
 #include "value.h"
 #include "chunk.h"
+#include "table.h"
+#include "shape.h"
 
 /**
  * Object Types
@@ -53,6 +55,12 @@ struct ObjFunction {
     int upvalueCount;
     Chunk chunk;
     ObjString* name;
+    
+    // Baseline JIT (jit.h): native code once the function is hot
+    struct JitCode* jit;
+    int calls;              // Counted only while jit is NULL
+    int backedges;
+    bool jitFailed;         // Not compilable: stays interpreted
 };
 
 /**
@@ -80,12 +88,12 @@ typedef struct ObjUpvalue {
 /**
  * Closure
  */
-typedef struct {
+struct ObjClosure {
     Obj obj;
     ObjFunction* function;
     ObjUpvalue** upvalues;
     int upvalueCount;
-} ObjClosure;
+};
 
 /**
  * Class
@@ -99,11 +107,14 @@ struct ObjClass {
 
 /**
  * Instance
+ * Fields live in `slots`, in the order `shape` gives them.
  */
 struct ObjInstance {
     Obj obj;
     ObjClass* klass;
-    struct Table fields;
+    Shape* shape;
+    Value* slots;
+    int slotCapacity;
 };
 
 /**
@@ -124,11 +135,14 @@ typedef struct {
 } ObjArray;
 
 /**
- * Map (hash table)
+ * Map
+ * Iterates and prints in insertion order, like the tree-walker's maps.
  */
 typedef struct {
     Obj obj;
-    struct Table entries;
+    struct Table index;     // Key -> INT_VAL(position in keys/values)
+    ValueArray keys;
+    ValueArray values;
 } ObjMap;
 
 // Object type checking
@@ -172,6 +186,16 @@ ObjBoundMethod* newBoundMethod(Value receiver, ObjClosure* method);
 ObjArray* newArray(void);
 ObjMap* newMap(void);
 
+// Map operations (callers keep the map and key reachable)
+bool mapGet(ObjMap* map, ObjString* key, Value* value);
+void mapSet(ObjMap* map, ObjString* key, Value value);
+bool mapDelete(ObjMap* map, ObjString* key);
+
+// Instance fields (callers keep the instance, name and value reachable)
+bool instanceGet(ObjInstance* instance, ObjString* name, Value* value);
+void instanceSet(ObjInstance* instance, ObjString* name, Value value);
+void instanceAddField(ObjInstance* instance, Shape* shape, Value value);
+
 void printObject(Value value);
 
 #endif // SOMNIA_OBJECT_H
@@ -0,0 +1,25 @@
+#ifndef SOMNIA_SERVE_H
+#define SOMNIA_SERVE_H
+
+/**
+ * Multi-worker Server
+ *
+ * `somnia serve` forks one worker process per core. Each worker loads and
+ * runs the program on its own runtime, and each listening socket is bound
+ * with SO_REUSEPORT, so the kernel spreads connections across workers. The
+ * supervisor restarts workers that crash. On SIGTERM or SIGINT it asks
+ * every worker to drain its connections and waits for them. SIGUSR1 prints
+ * each worker's network counters and their total.
+ */
+
+// Grace period for draining workers before they are killed
+#define SERVE_DRAIN_TIMEOUT_MS 30000
+
+// A worker crashing sooner than this after starting is restarted with a delay
+#define SERVE_RESTART_DELAY_MS 1000
+
+// Runs `run(context)` in `workers` processes until they exit or are stopped;
+// returns the exit status for the supervisor
+int serve_workers(int workers, int (*run)(void* context), void* context);
+
+#endif // SOMNIA_SERVE_H
@@ -0,0 +1,51 @@
+#ifndef SOMNIA_SHAPE_H
+#define SOMNIA_SHAPE_H
+
+#include "common.h"
+#include "value.h"
+
+/**
+ * Shape
+ * Hidden class: instances that gained the same fields in the same order
+ * share one, and keep the field values in a slot array in that order.
+ * Shapes form one transition tree from vm.rootShape and live until freeVM.
+ */
+typedef struct Shape {
+    struct Shape* parent;
+    ObjString* key;             // Field added by the transition into this shape
+    int fieldCount;             // Slots used by instances of this shape
+    struct Shape** transitions;
+    int transitionCount;
+    int transitionCapacity;
+} Shape;
+
+/**
+ * Inline Cache
+ * Side-table state of one GET_PROPERTY, SET_PROPERTY or INVOKE site: the
+ * receiver shapes seen there and what the name resolved to for each.
+ * One entry is monomorphic, up to CACHE_ENTRIES_MAX polymorphic; a site
+ * that misses past that is megamorphic and stops adding entries.
+ */
+#define CACHE_ENTRIES_MAX 4
+
+typedef struct {
+    Shape* shape;               // Receiver shape this entry answers for
+    int slot;                   // Field slot, or -1 for a method
+    Shape* transition;          // SET_PROPERTY adding the field: the shape after it
+    ObjClass* klass;            // Method entries: the receiver's class...
+    ObjClosure* method;         // ...and the method it binds the name to
+} CacheEntry;
+
+typedef struct {
+    CacheEntry entries[CACHE_ENTRIES_MAX];
+    int count;
+    bool megamorphic;
+} InlineCache;
+
+Shape* newRootShape(void);
+Shape* shapeTransition(Shape* shape, ObjString* key);
+int shapeSlot(Shape* shape, ObjString* key);
+void markShapes(Shape* shape);
+void freeShapes(Shape* shape);
+
+#endif // SOMNIA_SHAPE_H
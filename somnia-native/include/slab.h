@@ -0,0 +1,34 @@
+#ifndef SOMNIA_SLAB_H
+#define SOMNIA_SLAB_H
+
+#include "common.h"
+
+/**
+ * Slab Allocator
+ * Small blocks (objects, string characters, short arrays) come from
+ * SLAB_SIZE slabs, each cut into blocks of one size class and keeping its
+ * free blocks in a list. reallocate() sends every size up to SLAB_MAX_BLOCK
+ * here and larger ones to the system allocator. A slab that empties goes
+ * back to the system unless it is the last one of its class with room.
+ */
+#define SLAB_SIZE (64 * 1024)
+#define SLAB_MAX_BLOCK 128
+#define SLAB_CLASS_COUNT 6
+
+typedef struct {
+    size_t blockSize;
+    size_t slabs;               // Slabs of this class held from the system
+    size_t used;                // Blocks handed out
+    size_t free;                // Blocks the slabs have room for
+} SlabClassStats;
+
+// Bytes a request of `size` takes: its class's block size, or `size` when large
+size_t slabBlockSize(size_t size);
+
+// `size` must be 1..SLAB_MAX_BLOCK, and slabFree get the block back whole
+void* slabAllocate(size_t size);
+void slabFree(void* block);
+
+void slabStats(SlabClassStats stats[SLAB_CLASS_COUNT]);
+
+#endif // SOMNIA_SLAB_H
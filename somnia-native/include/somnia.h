@@ -136,6 +136,8 @@ typedef enum {
     VAL_FUNCTION,
     VAL_NATIVE_FN,
     VAL_OBJECT,
+    VAL_CLASS,
+    VAL_BUILDER,
     VAL_BLOB
 } ValueType;
 
@@ -152,6 +154,9 @@ struct Array;
 struct Map;
 struct Function;
 struct Object;
+struct Class;
+struct String;
+struct StringBuilder;
 
 /* ============================================================================
  * OBJECT HEADER (GC)
@@ -162,13 +167,16 @@ typedef enum {
     OBJ_MAP,
     OBJ_FUNCTION,
     OBJ_OBJECT,
+    OBJ_CLASS,
+    OBJ_BUILDER,
     OBJ_STRING
 } ObjType;
 
 typedef struct Obj {
     ObjType type;
-    bool marked;
-    struct Obj* next;
+    bool marked;        // Nursery objects: set once evacuated
+    bool remembered;    // Old object in the remembered set
+    struct Obj* next;   // Nursery objects: the evacuated copy
 } Obj;
 
 /* Global object list head */
@@ -180,12 +188,14 @@ typedef struct Value {
     union {
         bool boolean;
         double number;
-        char* string; // Not tracking strings yet (simple)
+        struct String* string;
+        struct StringBuilder* builder;
         struct Array* array;
         struct Map* map;
         struct Function* function;
         struct Value (*native_fn)(struct Value* args, int arg_count, struct Env* env);
         struct Object* object;
+        struct Class* klass;
         Blob* blob;
     } as;
 } Value;
@@ -193,6 +203,29 @@ typedef struct Value {
 /* Native function pointer */
 typedef Value (*NativeFn)(Value* args, int arg_count, struct Env* env);
 
+/* Immutable string: shared by pointer, length and hash cached */
+typedef struct String {
+    Obj obj;            // GC Header
+    int length;
+    int capacity;       // Bytes available in chars (excluding NUL)
+    uint32_t hash;
+    bool interned;      // In the intern table (weak: removed when swept)
+    bool pinned;        // Literal referenced by the AST, never swept
+    bool unique;        // Held only by the variable it was appended into
+    char chars[];
+} String;
+
+/* Mutable byte buffer behind sb_new/sb_append/sb_finish */
+typedef struct StringBuilder {
+    Obj obj;            // GC Header
+    char* chars;
+    int length;
+    int capacity;
+} StringBuilder;
+
+/* Strings up to this length are interned (0 = literals only) */
+#define STRING_INTERN_MAX 32
+
 /* Array structure */
 typedef struct Array {
     Obj obj;            // GC Header
@@ -201,36 +234,83 @@ typedef struct Array {
     int capacity;
 } Array;
 
+/* Hidden class: ordered field layout shared by objects built the same way */
+typedef struct Shape {
+    struct Shape* parent;
+    char* key;                  // Field added by the transition into this shape
+    int field_count;            // Slots used by objects of this shape
+    struct Shape** transitions;
+    int transition_count;
+    int transition_capacity;
+} Shape;
+
+/* Class structure: one method table shared by all instances */
+typedef struct Class {
+    Obj obj;            // GC Header
+    char* name;
+    uint32_t id;        // Unique per class, guards method cache entries
+    struct Env* methods;
+    struct ASTNode* ast;
+    Shape* instance_shape;  // Layout of the declared fields
+} Class;
+
 /* Object structure */
 typedef struct Object {
     Obj obj;            // GC Header
-    char* class_name;
-    struct Env* fields;
-    struct ASTNode* ast;
+    struct Class* klass;
+    Shape* shape;
+    Value* slots;       // Field values, indexed by shape slot
+    int slot_capacity;
 } Object;
 
+/* Per-site inline cache for property access */
+typedef struct {
+    Shape* shape;       // NULL = empty
+    int slot;           // Field slot, or -1 for a class method
+    uint32_t class_id;  // Method entries only
+    int method;         // Index in the class's method Env
+    int misses;
+} InlineCache;
+
+/* Sites that miss this often stop updating their cache */
+#define IC_MEGAMORPHIC_MISSES 16
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t megamorphic_sites;
+} InlineCacheStats;
+
+extern InlineCacheStats ic_stats;
+
 /* Map entry */
 typedef struct MapEntry {
-    char* key;
+    char* key;          // NULL once deleted, until the entries are compacted
+    uint32_t hash;      // Cached hash of key
     Value value;
 } MapEntry;
 
-/* Map structure */
+/* Map structure: entries in insertion order + open-addressing index */
 typedef struct Map {
     Obj obj;            // GC Header
     MapEntry* entries;
-    int count;
+    int count;          // Live keys
+    int used;           // Entries filled, deleted ones included
     int capacity;
+    int* index;         // Entry position per bucket, -1 = empty
+    int index_capacity; // Power of two
 } Map;
 
 /* Function structure */
 typedef struct Function {
     Obj obj;            // GC Header
-    char* name;
+    const char* name;   // Borrowed from the declaring AST node, like params
     char** params;
     int param_count;
     struct ASTNode* body;
     struct Env* closure;
+    int local_count;    // Resolved frame size (0 = unresolved, bind by name)
+    bool captured;      // Call frames may be referenced by inner closures
 } Function;
 
 /* ============================================================================
@@ -300,8 +380,12 @@ typedef struct ASTNode {
         // Literals
         Value literal;
         
-        // Variable
-        char* var_name;
+        // Variable (depth/slot filled in by the resolver, -1 = look up by name)
+        struct {
+            char* name;
+            int depth;
+            int slot;
+        } variable;
         
         // Binary/Unary
         struct {
@@ -319,6 +403,8 @@ typedef struct ASTNode {
         struct {
             char* name;
             struct ASTNode* value;
+            int depth;
+            int slot;
         } assign;
         
         // Call
@@ -334,12 +420,16 @@ typedef struct ASTNode {
             char** params;
             int param_count;
             struct ASTNode* body;
+            int slot;           // Slot of the name binding in the enclosing scope
+            int local_count;    // Frame size: self, this, params, locals
+            bool captured;      // Frame may outlive the call (nested closures)
         } fun_decl;
         
         // Variable declaration
         struct {
             char* name;
             struct ASTNode* initializer;
+            int slot;
         } var_decl;
         
         // Block
@@ -372,12 +462,17 @@ typedef struct ASTNode {
             char* var_name;
             struct ASTNode* iterable;
             struct ASTNode* body;
+            int slot;
+            int local_count;
+            bool captured;
         } for_stmt;
         
         // While loop
         struct {
             struct ASTNode* condition;
             struct ASTNode* body;
+            int local_count;
+            bool captured;
         } while_stmt;
         
         // Return
@@ -408,6 +503,7 @@ typedef struct ASTNode {
         struct {
             struct ASTNode* object;
             char* property;
+            InlineCache cache;
         } get_expr;
         
         // Property set
@@ -415,12 +511,14 @@ typedef struct ASTNode {
             struct ASTNode* object;
             char* property;
             struct ASTNode* value;
+            InlineCache cache;
         } set_expr;
         
         // Import
         struct {
             char* path;
             char** names;
+            int* slots;
             int count;
         } import_stmt;
         
@@ -437,6 +535,7 @@ typedef struct ASTNode {
             int field_count;
             struct ASTNode** methods;
             int method_count;
+            int slot;
         } class_decl;
         
         // Object Instantiation (Class { ... })
@@ -481,15 +580,30 @@ typedef struct {
     char* name;
     Value value;
     bool is_const;
+    bool owns_name;     // false: name is borrowed from the AST
 } Variable;
 
+/* Resolved function frame layout (see resolver.c) */
+#define FRAME_SELF_SLOT 0
+#define FRAME_THIS_SLOT 1
+#define FRAME_PARAM_BASE 2
+
 typedef struct Env {
     Variable* vars;
     int var_count;
     int var_capacity;
     struct Env* parent;
+    uint32_t mark_epoch;    // Last collection that scanned this Env
+    bool remembered;        // Scanned by every minor collection (see nursery.c)
 } Env;
 
+/* Recycled call/loop frames, bucketed by slot count (see env.c) */
+#define ENV_POOL_CLASSES 32
+
+typedef struct {
+    Env* free_lists[ENV_POOL_CLASSES];
+} EnvPool;
+
 /* ============================================================================
  * LEXER
  * ============================================================================ */
@@ -519,7 +633,8 @@ typedef struct {
  * ============================================================================ */
 
 #define MAX_RECURSION_DEPTH 500
-#define MAX_TEMP_STACK 1024
+#define MAX_TEMP_STACK 8192
+#define MAX_FRAME_STACK 4096
 
 typedef struct {
     Env* global_env;
@@ -531,6 +646,9 @@ typedef struct {
     Value return_value;
     int recur_depth;       // Recursion guard
     
+    // Call and loop frames
+    EnvPool frame_pool;
+    
     // Cognitive State
     Env* cognitive_state;
     
@@ -538,8 +656,11 @@ typedef struct {
     Map* vfs;              // Virtual File System (Path -> Source)
     
     // GC Roots (Shadow Stack)
+    // Counts may run past the arrays; the collector then waits (see gc_collect)
     Value temp_stack[MAX_TEMP_STACK];
     int temp_count;
+    Env* frame_stack[MAX_FRAME_STACK];  // Suspended current_envs of callers and loops
+    int frame_count;
 } Interpreter;
 
 /* ============================================================================
@@ -557,6 +678,9 @@ ASTNode* parser_parse(Parser* parser);
 void parser_free(Parser* parser);
 void ast_free(ASTNode* node);
 
+/* Resolver */
+void resolver_resolve(ASTNode* program);
+
 /* Interpreter */
 Interpreter* interpreter_create(void);
 Value interpreter_run(Interpreter* interp, ASTNode* program);
@@ -564,16 +688,33 @@ void interpreter_free(Interpreter* interp);
 
 /* Environment */
 Env* env_create(Env* parent);
+Env* env_create_sized(Env* parent, int capacity);
 void env_define(Env* env, const char* name, Value value, bool is_const);
 Value* env_get(Env* env, const char* name);
 bool env_set(Env* env, const char* name, Value value);
+void env_reserve(Env* env, int count);
+void env_define_at(Env* env, int slot, const char* name, Value value, bool is_const);
+Value* env_get_at(Env* env, int depth, int slot, const char* name);
+bool env_set_at(Env* env, int depth, int slot, const char* name, Value value);
 void env_free(Env* env);
+Env* env_acquire(EnvPool* pool, Env* parent, int slot_count);
+void env_release(EnvPool* pool, Env* env);
+void env_pool_init(EnvPool* pool);
+void env_pool_free(EnvPool* pool);
 
 /* Value */
 Value value_null(void);
 Value value_bool(bool b);
 Value value_number(double n);
 Value value_string(const char* s);
+Value value_string_len(const char* s, int length);
+Value value_string_literal(const char* s);
+Value value_string_concat(String* a, String* b);
+bool string_equals(String* a, String* b);
+String* string_append(String* s, const char* chars, int length);
+char* copy_string(const char* chars, int length);
+Value value_builder(void);
+void builder_append(StringBuilder* sb, const char* chars, int length);
 Value value_array(void);
 Value value_map(void);
 char* value_to_string(Value val);
@@ -581,11 +722,63 @@ void value_print(Value val);
 bool value_is_truthy(Value val);
 bool value_equals(Value a, Value b);
 Value value_copy(Value val);
-Value value_object(const char* class_name, Env* fields);
-Value value_function(void);
+Value value_object(Class* klass);
+Value value_class(const char* name, struct ASTNode* ast, Env* methods);
+Value value_function(Env* closure);
 void value_free(Value* val);
 void free_objects(void);
-void gc_collect(Env* env);
+
+/* Garbage collection: allocation-triggered, run at statement boundaries */
+#define GC_INITIAL_THRESHOLD (1024 * 1024)
+#define GC_HEAP_GROW_FACTOR 2
+extern size_t gc_bytes_allocated;
+extern size_t gc_next_collection;
+extern uint32_t gc_epoch;
+void gc_collect(Interpreter* interp);
+void gc_request(void);
+void gc_track_frame(Env* frame);
+int gc_frame_count(void);
+void gc_rebuild_remembered_envs(void);
+
+/* Nursery: bump-allocated young generation, evacuated by minor collections */
+#define NURSERY_SIZE (1024 * 1024)
+extern char* nursery_start;
+extern char* nursery_top;
+extern char* nursery_end;
+extern char* nursery_limit;    // Past this a minor collection is due
+
+static inline bool nursery_contains(const void* p) {
+    return (const char*)p >= nursery_start && (const char*)p < nursery_end;
+}
+
+void* nursery_alloc(size_t size);
+char* nursery_strdup(const char* s);
+void nursery_track(Obj* obj);
+void nursery_free(void);
+void* gc_grow_buffer(Obj* owner, void* buffer, size_t old_size, size_t new_size);
+void gc_free_buffer(void* buffer);
+void gc_remember(Obj* obj);
+void gc_remember_env(Env* env);
+void gc_collect_young(Interpreter* interp);
+
+/* Write barrier: call after storing `val` into `owner` */
+static inline void gc_write_barrier(Obj* owner, Value val) {
+    if ((val.type == VAL_ARRAY || val.type == VAL_MAP ||
+         val.type == VAL_OBJECT || val.type == VAL_FUNCTION) &&
+        nursery_contains(val.as.array) && !owner->remembered && !nursery_contains(owner)) {
+        gc_remember(owner);
+    }
+}
+
+/* Shapes and object fields */
+Shape* shape_root(void);
+Shape* shape_transition(Shape* shape, const char* key);
+int shape_lookup(Shape* shape, const char* key);
+void shape_free_all(void);
+Value* object_get_field(Object* obj, const char* name);
+void object_set_field(Object* obj, const char* name, Value val);
+Value* object_get_cached(Object* obj, const char* name, InlineCache* ic);
+void object_set_cached(Object* obj, const char* name, Value val, InlineCache* ic);
 
 /* Array operations */
 void array_push(Array* arr, Value val);
@@ -596,16 +789,63 @@ void array_set(Array* arr, int index, Value val);
 void map_set(Map* m, const char* key, Value val);
 Value* map_get(Map* m, const char* key);
 bool map_has(Map* m, const char* key);
+bool map_delete(Map* m, const char* key);
 
 /* Standard library */
 void stdlib_register(Env* env);
 
+/* Network counters. net_stats points at a static block, or under
+ * `somnia serve` at the worker's slot in memory the supervisor reads */
+typedef struct {
+    long connections;       // Accepted by native_net_accept_all
+    long requests;          // Taken by native_net_conn_next
+    long open;              // Connections open now
+} NetStats;
+
+extern NetStats* net_stats;
+
+/* Makes SIGTERM and SIGINT set the flag native_net_draining reports */
+void net_drain_on_signals(void);
+
 /* Network primitives (Native functions) */
 Value native_net_listen(Value* args, int arg_count, Env* env);
 Value native_net_accept(Value* args, int arg_count, Env* env);
 Value native_net_read(Value* args, int arg_count, Env* env);
 Value native_net_write(Value* args, int arg_count, Env* env);
 Value native_net_close(Value* args, int arg_count, Env* env);
+Value native_net_accept_all(Value* args, int arg_count, Env* env);
+Value native_net_set_nonblocking(Value* args, int arg_count, Env* env);
+Value native_net_poll_create(Value* args, int arg_count, Env* env);
+Value native_net_poll_add(Value* args, int arg_count, Env* env);
+Value native_net_poll_mod(Value* args, int arg_count, Env* env);
+Value native_net_poll_del(Value* args, int arg_count, Env* env);
+Value native_net_poll_wait(Value* args, int arg_count, Env* env);
+Value native_net_conn_open(Value* args, int arg_count, Env* env);
+Value native_net_conn_read(Value* args, int arg_count, Env* env);
+Value native_net_conn_next(Value* args, int arg_count, Env* env);
+Value native_net_conn_flush(Value* args, int arg_count, Env* env);
+Value native_net_conn_end(Value* args, int arg_count, Env* env);
+Value native_net_conn_close(Value* args, int arg_count, Env* env);
+Value native_net_conn_sweep(Value* args, int arg_count, Env* env);
+Value native_net_conn_count(Value* args, int arg_count, Env* env);
+Value native_net_draining(Value* args, int arg_count, Env* env);
+Value native_net_file_info(Value* args, int arg_count, Env* env);
+Value native_net_sendfile(Value* args, int arg_count, Env* env);
+Value native_net_write_blob(Value* args, int arg_count, Env* env);
+
+/* HTTP primitives */
+
+/* How far a chunked body still arriving has been walked, so that the next
+ * parse of the same request resumes there; all zero for a new request */
+typedef struct {
+    size_t offset;          // From the body's start, at a chunk-size or trailer line
+    size_t decoded;         // Chunk data before offset
+    bool trailers;          // Past the last chunk
+} HttpChunkScan;
+
+Value http_parse_request(const char* buffer, size_t length, size_t base, size_t* consumed,
+                         HttpChunkScan* scan);
+Value native_http_parse(Value* args, int arg_count, Env* env);
 
 /* SQL Primitives */
 Value native_sql_connect(Value* args, int arg_count, Env* env);
@@ -29,7 +29,6 @@ bool tableSet(Table* table, ObjString* key, Value value);
 bool tableDelete(Table* table, ObjString* key);
 void tableAddAll(Table* from, Table* to);
 ObjString* tableFindString(Table* table, const char* chars, int length, uint32_t hash);
-void tableRemoveWhite(Table* table);
 void markTable(Table* table);
 
 #endif // SOMNIA_TABLE_H
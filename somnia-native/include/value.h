@@ -7,12 +7,14 @@
 typedef struct Obj Obj;
 typedef struct ObjString ObjString;
 typedef struct ObjFunction ObjFunction;
+typedef struct ObjClosure ObjClosure;
 typedef struct ObjClass ObjClass;
 typedef struct ObjInstance ObjInstance;
 
 /**
  * Value Types
- * Somnia has a dynamic type system with these base types.
+ * Somnia has a dynamic type system with these base types. UNDEFINED_VAL
+ * is not one of them: it only marks global slots nothing has defined yet.
  */
 typedef enum {
     VAL_NULL,
@@ -22,10 +24,93 @@ typedef enum {
     VAL_OBJECT,  // Heap-allocated objects (strings, classes, etc.)
 } ValueType;
 
+#if NAN_BOXING
+
+/**
+ * Value
+ * A NaN-boxed 64-bit word. Doubles are stored as themselves; everything
+ * else lives in the payload of a quiet NaN no arithmetic produces:
+ *
+ *   object   1 11111111111 11 <48-bit pointer>
+ *   int      0 11111111111 11 1-<48-bit two's complement>
+ *   null     0 11111111111 11 0-...01
+ *   false    0 11111111111 11 0-...10
+ *   true     0 11111111111 11 0-...11
+ *
+ * Ints outside 48 bits are stored as doubles.
+ */
+typedef uint64_t Value;
+
+#define SIGN_BIT ((uint64_t)0x8000000000000000)
+#define QNAN     ((uint64_t)0x7ffc000000000000)
+#define INT_TAG  ((uint64_t)0x0002000000000000)
+#define INT_MASK ((uint64_t)0x0000ffffffffffff)
+
+#define TAG_NULL      1
+#define TAG_FALSE     2
+#define TAG_TRUE      3
+#define TAG_UNDEFINED 4
+
+#define INT_BOX_MIN (-((int64_t)1 << 47))
+#define INT_BOX_MAX (((int64_t)1 << 47) - 1)
+
+static inline Value doubleToValue(double number) {
+    Value value;
+    memcpy(&value, &number, sizeof(double));
+    return value;
+}
+
+static inline double valueToNumber(Value value) {
+    double number;
+    memcpy(&number, &value, sizeof(Value));
+    return number;
+}
+
+static inline Value intToValue(int64_t integer) {
+    if (integer < INT_BOX_MIN || integer > INT_BOX_MAX) return doubleToValue((double)integer);
+    return QNAN | INT_TAG | ((uint64_t)integer & INT_MASK);
+}
+
+// Value constructors
+#define NULL_VAL           ((Value)(QNAN | TAG_NULL))
+#define FALSE_VAL          ((Value)(QNAN | TAG_FALSE))
+#define TRUE_VAL           ((Value)(QNAN | TAG_TRUE))
+#define BOOL_VAL(value)    ((value) ? TRUE_VAL : FALSE_VAL)
+#define INT_VAL(value)     intToValue(value)
+#define DOUBLE_VAL(value)  doubleToValue(value)
+#define OBJ_VAL(object)    ((Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(object)))
+#define UNDEFINED_VAL      ((Value)(QNAN | TAG_UNDEFINED))
+
+// Value accessors
+#define AS_BOOL(value)     ((value) == TRUE_VAL)
+#define AS_INT(value)      ((int64_t)((value) << 16) >> 16)
+#define AS_DOUBLE(value)   valueToNumber(value)
+#define AS_OBJ(value)      ((Obj*)(uintptr_t)((value) & ~(SIGN_BIT | QNAN)))
+
+// Type checking
+#define IS_NULL(value)     ((value) == NULL_VAL)
+#define IS_BOOL(value)     (((value) | 1) == TRUE_VAL)
+#define IS_INT(value)      (((value) & (SIGN_BIT | QNAN | INT_TAG)) == (QNAN | INT_TAG))
+#define IS_DOUBLE(value)   (((value) & QNAN) != QNAN)
+#define IS_NUMBER(value)   (IS_INT(value) || IS_DOUBLE(value))
+#define IS_OBJ(value)      (((value) & (SIGN_BIT | QNAN)) == (SIGN_BIT | QNAN))
+#define IS_UNDEFINED(value) ((value) == UNDEFINED_VAL)
+
+static inline ValueType valueTypeOf(Value value) {
+    if (IS_DOUBLE(value)) return VAL_DOUBLE;
+    if (IS_OBJ(value)) return VAL_OBJECT;
+    if (IS_INT(value)) return VAL_INT;
+    return IS_NULL(value) ? VAL_NULL : VAL_BOOL;
+}
+
+#define VALUE_TYPE(value)  valueTypeOf(value)
+
+#else
+
 /**
  * Value
  * A tagged union representing any Somnia value.
- * Uses NaN-boxing optimization for 64-bit efficiency.
+ * Build with NAN_BOXING=1 for the 8-byte representation.
  */
 typedef struct {
     ValueType type;
@@ -43,6 +128,7 @@ typedef struct {
 #define INT_VAL(value)     ((Value){VAL_INT, {.integer = value}})
 #define DOUBLE_VAL(value)  ((Value){VAL_DOUBLE, {.number = value}})
 #define OBJ_VAL(object)    ((Value){VAL_OBJECT, {.obj = (Obj*)object}})
+#define UNDEFINED_VAL      ((Value){VAL_NULL, {.integer = 1}})
 
 // Value accessors
 #define AS_BOOL(value)     ((value).as.boolean)
@@ -57,6 +143,11 @@ typedef struct {
 #define IS_DOUBLE(value)   ((value).type == VAL_DOUBLE)
 #define IS_NUMBER(value)   (IS_INT(value) || IS_DOUBLE(value))
 #define IS_OBJ(value)      ((value).type == VAL_OBJECT)
+#define IS_UNDEFINED(value) ((value).type == VAL_NULL && (value).as.integer == 1)
+
+#define VALUE_TYPE(value)  ((value).type)
+
+#endif
 
 // Convert to double for arithmetic
 static inline double valueToDouble(Value v) {
@@ -65,6 +156,53 @@ static inline double valueToDouble(Value v) {
     return 0.0;
 }
 
+/* int64 arithmetic that reports overflow instead of wrapping; the caller
+ * redoes the operation in doubles */
+static inline bool addInts(int64_t a, int64_t b, int64_t* result) {
+#if defined(__GNUC__)
+    return !__builtin_add_overflow(a, b, result);
+#else
+    if ((b > 0 && a > INT64_MAX - b) || (b < 0 && a < INT64_MIN - b)) return false;
+    *result = a + b;
+    return true;
+#endif
+}
+
+static inline bool subtractInts(int64_t a, int64_t b, int64_t* result) {
+#if defined(__GNUC__)
+    return !__builtin_sub_overflow(a, b, result);
+#else
+    if ((b < 0 && a > INT64_MAX + b) || (b > 0 && a < INT64_MIN + b)) return false;
+    *result = a - b;
+    return true;
+#endif
+}
+
+static inline bool multiplyInts(int64_t a, int64_t b, int64_t* result) {
+#if defined(__GNUC__)
+    return !__builtin_mul_overflow(a, b, result);
+#else
+    double product = (double)a * (double)b;
+    if (product >= 9.2e18 || product <= -9.2e18) return false;
+    *result = a * b;
+    return true;
+#endif
+}
+
+/* Only exact quotients stay ints: `/` is true division, so 7 / 2 is 3.5 */
+static inline bool divideInts(int64_t a, int64_t b, int64_t* result) {
+    if (b == 0 || (a == INT64_MIN && b == -1) || a % b != 0) return false;
+    *result = a / b;
+    return true;
+}
+
+/* Sign follows the dividend, as with fmod; x % 0 is left to fmod's NaN */
+static inline bool moduloInts(int64_t a, int64_t b, int64_t* result) {
+    if (b == 0) return false;
+    *result = b == -1 ? 0 : a % b;
+    return true;
+}
+
 /**
  * Dynamic array of Values
  */
@@ -80,6 +218,7 @@ void freeValueArray(ValueArray* array);
 
 // Value operations
 void printValue(Value value);
+char* valueToChars(Value value, int* length);   // Display form; caller frees
 bool valuesEqual(Value a, Value b);
 Value valueTruthy(Value value);
 
@@ -17,6 +17,26 @@ typedef struct {
     Value* slots;           // Stack window
 } CallFrame;
 
+/**
+ * Try Handler
+ * Where a runtime error inside `try` resumes: the catch block.
+ */
+typedef struct {
+    int frameCount;         // Frames above this are unwound
+    Value* stackTop;        // Stack height when the try began
+    uint8_t* catchIp;
+} TryHandler;
+
+/**
+ * Collector phase. An incremental cycle marks in steps, then frees the
+ * objects it left white in steps; a full collection runs both at once.
+ */
+typedef enum {
+    GC_IDLE,
+    GC_MARK,                // Gray objects left to blacken
+    GC_SWEEP,               // vm.sweeping still holds objects of the cycle
+} GCPhase;
+
 /**
  * Somnia Virtual Machine
  * The heart of the Somnia runtime.
@@ -30,8 +50,17 @@ typedef struct {
     Value stack[STACK_MAX];
     Value* stackTop;
     
-    // Global variables
+    // Global variables: name -> slot index, values stored densely by slot
     Table globals;
+    ValueArray globalValues;    // UNDEFINED_VAL until the global is defined
+    
+    // Imported modules: path -> true once the module has run
+    Table modules;
+    
+    // Active try blocks, innermost last
+    TryHandler handlers[HANDLERS_MAX];
+    int handlerCount;
+    char errorMessage[256];
     
     // String interning
     Table strings;
@@ -39,11 +68,19 @@ typedef struct {
     // Special strings
     ObjString* initString;
     
+    // Hidden classes: every instance starts at the root shape
+    Shape* rootShape;
+    
     // Upvalues
     ObjUpvalue* openUpvalues;
     
     // GC
     Obj* objects;           // Linked list of all objects
+    Obj* sweeping;          // Objects the running sweep has yet to visit
+    GCPhase gcPhase;
+    bool gcIncremental;     // Collect in steps between allocations
+    int gcPauseTarget;      // Longest step, in microseconds
+    size_t gcDebt;          // Bytes allocated since the last step
     int grayCount;
     int grayCapacity;
     Obj** grayStack;
@@ -51,6 +88,20 @@ typedef struct {
     // GC metrics
     size_t bytesAllocated;
     size_t nextGC;
+    
+    // Quickening metrics, indexed by the quickened opcode
+    uint64_t quickened[UINT8_COUNT];    // Times a generic instruction was rewritten into it
+    uint64_t deopts[UINT8_COUNT];       // Times its guard failed and it was rewritten back
+    
+    // Inline cache metrics
+    uint64_t cacheHits;
+    uint64_t cacheMisses;
+    uint64_t megamorphicSites;
+    
+    // Baseline JIT, off unless run with --jit
+    bool jitEnabled;
+    int jitCallThreshold;       // Calls before a function is compiled
+    int jitLoopThreshold;       // Loop backedges before it is compiled
 } VM;
 
 /**
@@ -71,6 +122,7 @@ void freeVM(void);
 
 // Execution
 InterpretResult interpret(const char* source);
+InterpretResult interpretFunction(ObjFunction* function);   // A compiled script
 InterpretResult interpretFile(const char* path);
 
 // Stack operations
@@ -78,8 +130,13 @@ void push(Value value);
 Value pop(void);
 Value peek(int distance);
 
+// Globals
+int globalSlot(ObjString* name);   // Created on first use, stable after
+
 // Native function registration
 void defineNative(const char* name, NativeFn function, int arity);
+void defineStdlibNatives(void);
+bool isWalkerOnlyNative(const char* name, int length);
 
 // Error reporting
 void runtimeError(const char* format, ...);
@@ -1,4 +1,5 @@
 #include "compiler/compiler.h"
+#include "compiler/optimizer.h"
 #include "lexer.h"
 #include "chunk.h"
 #include "memory.h"
@@ -21,11 +22,11 @@ typedef enum {
     PREC_OR,          // or
     PREC_AND,         // and
     PREC_EQUALITY,    // == !=
-    PREC_COMPARISON,  // < > <= >=
+    PREC_COMPARISON,  // < > <= >= in
     PREC_TERM,        // + -
     PREC_FACTOR,      // * / %
-    PREC_UNARY,       // ! -
-    PREC_CALL,        // . ()
+    PREC_UNARY,       // ! - not
+    PREC_CALL,        // . () []
     PREC_PRIMARY
 } Precedence;
 
@@ -55,6 +56,19 @@ typedef enum {
     TYPE_SCRIPT
 } FunctionType;
 
+/**
+ * Loop
+ * Where break and continue jump to, and what they must unwind first.
+ */
+typedef struct Loop {
+    struct Loop* enclosing;
+    int start;              // continue target
+    int scopeDepth;         // Locals deeper than this belong to the body
+    int tryDepth;           // try blocks open outside the loop
+    int breakJumps[UINT8_COUNT];
+    int breakCount;
+} Loop;
+
 typedef struct Compiler {
     struct Compiler* enclosing;
     ObjFunction* function;
@@ -64,6 +78,9 @@ typedef struct Compiler {
     int localCount;
     Upvalue upvalues[UINT8_COUNT];
     int scopeDepth;
+    
+    Loop* loop;
+    int tryDepth;
 } Compiler;
 
 typedef struct ClassCompiler {
@@ -76,6 +93,9 @@ static Parser parser;
 static Compiler* current = NULL;
 static ClassCompiler* currentClass = NULL;
 
+// Modules compiled so far: path -> ObjFunction
+static Table modules;
+
 // Forward declarations
 static void expression(void);
 static void statement(void);
@@ -83,7 +103,9 @@ static void declaration(void);
 static ParseRule* getRule(TokenType type);
 static void parsePrecedence(Precedence precedence);
 static uint8_t identifierConstant(Token* name);
+static uint16_t globalIndex(Token* name);
 static void block(void);
+static void function(FunctionType type, Token* name);
 
 static Chunk* currentChunk(void) {
     return &current->function->chunk;
@@ -151,6 +173,20 @@ static void emitBytes(uint8_t byte1, uint8_t byte2) {
     emitByte(byte2);
 }
 
+static void emitGlobal(uint8_t instruction, uint16_t slot) {
+    emitByte(instruction);
+    emitByte((slot >> 8) & 0xff);
+    emitByte(slot & 0xff);
+}
+
+/* Operand naming a fresh inline cache for a property or invoke site */
+static void emitCache(void) {
+    int cache = addCache(currentChunk());
+    if (cache > UINT16_MAX) error("Too many property accesses in one function.");
+    emitByte((cache >> 8) & 0xff);
+    emitByte(cache & 0xff);
+}
+
 static void emitLoop(int loopStart) {
     emitByte(OP_LOOP);
     
@@ -177,8 +213,31 @@ static void emitReturn(void) {
     emitByte(OP_RETURN);
 }
 
+static bool sameConstant(Value a, Value b) {
+    if (VALUE_TYPE(a) != VALUE_TYPE(b)) return false;
+    switch (VALUE_TYPE(a)) {
+        case VAL_INT:    return AS_INT(a) == AS_INT(b);
+        case VAL_DOUBLE: {
+            double x = AS_DOUBLE(a);
+            double y = AS_DOUBLE(b);
+            return memcmp(&x, &y, sizeof(double)) == 0;
+        }
+        case VAL_OBJECT: return AS_OBJ(a) == AS_OBJ(b);
+        default:         return false;
+    }
+}
+
 static uint8_t makeConstant(Value value) {
+    // Reuse an equal constant: names and literals repeat a lot in one chunk
+    ValueArray* constants = &currentChunk()->constants;
+    for (int i = 0; i < constants->count; i++) {
+        if (sameConstant(constants->values[i], value)) return (uint8_t)i;
+    }
+    
+    push(value);
     int constant = addConstant(currentChunk(), value);
+    WRITE_BARRIER(current->function, value);
+    pop();
     if (constant > UINT8_MAX) {
         error("Too many constants in one chunk.");
         return 0;
@@ -201,23 +260,28 @@ static void patchJump(int offset) {
     currentChunk()->code[offset + 1] = jump & 0xff;
 }
 
-static void initCompiler(Compiler* compiler, FunctionType type) {
+static void initCompiler(Compiler* compiler, FunctionType type, Token* name) {
     compiler->enclosing = current;
     compiler->function = NULL;
     compiler->type = type;
     compiler->localCount = 0;
     compiler->scopeDepth = 0;
+    compiler->loop = NULL;
+    compiler->tryDepth = 0;
     compiler->function = newFunction();
     current = compiler;
     
-    if (type != TYPE_SCRIPT) {
-        current->function->name = copyString(parser.previous.start, parser.previous.length);
+    if (name != NULL) {
+        current->function->name = copyString(name->start, name->length);
+    } else if (type != TYPE_SCRIPT) {
+        current->function->name = copyString("anonymous", 9);
     }
+    WRITE_BARRIER_OBJ(current->function, current->function->name);
     
     Local* local = &current->locals[current->localCount++];
     local->depth = 0;
     local->isCaptured = false;
-    if (type != TYPE_FUNCTION) {
+    if (type == TYPE_METHOD || type == TYPE_INITIALIZER) {
         local->name.start = "self";
         local->name.length = 4;
     } else {
@@ -229,6 +293,9 @@ static void initCompiler(Compiler* compiler, FunctionType type) {
 static ObjFunction* endCompiler(void) {
     emitReturn();
     ObjFunction* function = current->function;
+#if OPTIMIZE_CHUNKS
+    if (!parser.hadError) optimizeChunk(&function->chunk);
+#endif
     
 #if DEBUG_PRINT_CODE
     if (!parser.hadError) {
@@ -258,6 +325,13 @@ static void endScope(void) {
     }
 }
 
+/* Pops locals deeper than `depth` without ending their scope (break/continue) */
+static void discardLocals(int depth) {
+    for (int i = current->localCount - 1; i >= 0 && current->locals[i].depth > depth; i--) {
+        emitByte(current->locals[i].isCaptured ? OP_CLOSE_UPVALUE : OP_POP);
+    }
+}
+
 static void number(bool canAssign) {
     (void)canAssign;
     if (parser.previous.type == TOKEN_INT) {
@@ -269,9 +343,37 @@ static void number(bool canAssign) {
     }
 }
 
+/* String literal contents with escapes decoded, as the tree-walker's lexer does */
+static ObjString* stringLiteral(Token* token) {
+    const char* source = token->start + 1;
+    int length = token->length - 2;
+    
+    char* chars = ALLOCATE(char, length + 1);
+    int count = 0;
+    for (int i = 0; i < length; i++) {
+        if (source[i] == '\\' && i + 1 < length) {
+            i++;
+            switch (source[i]) {
+                case 'n': chars[count++] = '\n'; break;
+                case 't': chars[count++] = '\t'; break;
+                case 'r': chars[count++] = '\r'; break;
+                default:  chars[count++] = source[i]; break;
+            }
+        } else {
+            chars[count++] = source[i];
+        }
+    }
+    chars[count] = '\0';
+    
+    if (count < length) {
+        chars = GROW_ARRAY(char, chars, length + 1, count + 1);
+    }
+    return takeString(chars, count);
+}
+
 static void string(bool canAssign) {
     (void)canAssign;
-    emitConstant(OBJ_VAL(copyString(parser.previous.start + 1, parser.previous.length - 2)));
+    emitConstant(OBJ_VAL(stringLiteral(&parser.previous)));
 }
 
 static int resolveLocal(Compiler* compiler, Token* name) {
@@ -309,7 +411,8 @@ static int addUpvalue(Compiler* compiler, uint8_t index, bool isLocal) {
 }
 
 static int resolveUpvalue(Compiler* compiler, Token* name) {
-    if (compiler->enclosing == NULL) return -1;
+    // A module's script sees only globals of the program that imports it
+    if (compiler->enclosing == NULL || compiler->type == TYPE_SCRIPT) return -1;
     
     int local = resolveLocal(compiler->enclosing, name);
     if (local != -1) {
@@ -335,9 +438,17 @@ static void namedVariable(Token name, bool canAssign) {
         getOp = OP_GET_UPVALUE;
         setOp = OP_SET_UPVALUE;
     } else {
-        arg = identifierConstant(&name);
-        getOp = OP_GET_GLOBAL;
-        setOp = OP_SET_GLOBAL;
+        if (isWalkerOnlyNative(name.start, name.length)) {
+            error("Native not available in the bytecode VM.");
+        }
+        uint16_t slot = globalIndex(&name);
+        if (canAssign && match(TOKEN_EQUAL)) {
+            expression();
+            emitGlobal(OP_SET_GLOBAL_SLOT, slot);
+        } else {
+            emitGlobal(OP_GET_GLOBAL_SLOT, slot);
+        }
+        return;
     }
     
     if (canAssign && match(TOKEN_EQUAL)) {
@@ -354,8 +465,10 @@ static void variable(bool canAssign) {
 
 static Token syntheticToken(const char* text) {
     Token token;
+    token.type = TOKEN_IDENTIFIER;
     token.start = text;
     token.length = (int)strlen(text);
+    token.line = parser.previous.line;
     return token;
 }
 
@@ -365,7 +478,8 @@ static void self_(bool canAssign) {
         error("Can't use 'self' outside of a class.");
         return;
     }
-    variable(false);
+    // 'this' is an alias
+    namedVariable(syntheticToken("self"), false);
 }
 
 static void super_(bool canAssign) {
@@ -431,6 +545,7 @@ static void binary(bool canAssign) {
         case TOKEN_GREATER_EQUAL: emitByte(OP_GREATER_EQUAL); break;
         case TOKEN_LESS:          emitByte(OP_LESS); break;
         case TOKEN_LESS_EQUAL:    emitByte(OP_LESS_EQUAL); break;
+        case TOKEN_IN:            emitByte(OP_IN); break;
         case TOKEN_PLUS:          emitByte(OP_ADD); break;
         case TOKEN_MINUS:         emitByte(OP_SUBTRACT); break;
         case TOKEN_STAR:          emitByte(OP_MULTIPLY); break;
@@ -468,12 +583,15 @@ static void dot(bool canAssign) {
     if (canAssign && match(TOKEN_EQUAL)) {
         expression();
         emitBytes(OP_SET_PROPERTY, name);
+        emitCache();
     } else if (match(TOKEN_LEFT_PAREN)) {
         uint8_t argCount = argumentList();
         emitBytes(OP_INVOKE, name);
         emitByte(argCount);
+        emitCache();
     } else {
         emitBytes(OP_GET_PROPERTY, name);
+        emitCache();
     }
 }
 
@@ -493,6 +611,7 @@ static void array(bool canAssign) {
     if (!check(TOKEN_RIGHT_BRACKET)) {
         do {
             expression();
+            if (count == 255) error("Can't have more than 255 array elements.");
             count++;
         } while (match(TOKEN_COMMA));
     }
@@ -500,6 +619,60 @@ static void array(bool canAssign) {
     emitBytes(OP_ARRAY, (uint8_t)count);
 }
 
+/* { key: value, ... } where a key is a string or a bare name */
+static void map(bool canAssign) {
+    (void)canAssign;
+    int count = 0;
+    if (!check(TOKEN_RIGHT_BRACE)) {
+        do {
+            if (match(TOKEN_STRING)) {
+                emitConstant(OBJ_VAL(stringLiteral(&parser.previous)));
+            } else {
+                consume(TOKEN_IDENTIFIER, "Expect map key.");
+                emitBytes(OP_CONSTANT, identifierConstant(&parser.previous));
+            }
+            consume(TOKEN_COLON, "Expect ':' after map key.");
+            expression();
+            if (count == 255) error("Can't have more than 255 map entries.");
+            count++;
+        } while (match(TOKEN_COMMA));
+    }
+    consume(TOKEN_RIGHT_BRACE, "Expect '}' after map.");
+    emitBytes(OP_MAP, (uint8_t)count);
+}
+
+/* new ClassName { field: value, ... } -- fills fields, does not call init */
+static void new_(bool canAssign) {
+    (void)canAssign;
+    consume(TOKEN_IDENTIFIER, "Expect class name after 'new'.");
+    namedVariable(parser.previous, false);
+    emitByte(OP_NEW);
+    
+    consume(TOKEN_LEFT_BRACE, "Expect '{' after class name.");
+    if (!check(TOKEN_RIGHT_BRACE)) {
+        do {
+            consume(TOKEN_IDENTIFIER, "Expect field name.");
+            uint8_t name = identifierConstant(&parser.previous);
+            consume(TOKEN_COLON, "Expect ':' after field name.");
+            emitByte(OP_DUP);
+            expression();
+            emitBytes(OP_SET_PROPERTY, name);
+            emitCache();
+            emitByte(OP_POP);
+        } while (match(TOKEN_COMMA));
+    }
+    consume(TOKEN_RIGHT_BRACE, "Expect '}' after instantiation fields.");
+}
+
+/* fun [name](params) { body } as a value */
+static void funExpression(bool canAssign) {
+    (void)canAssign;
+    Token name;
+    bool named = match(TOKEN_IDENTIFIER);
+    if (named) name = parser.previous;
+    function(TYPE_FUNCTION, named ? &name : NULL);
+}
+
 static void index_(bool canAssign) {
     expression();
     consume(TOKEN_RIGHT_BRACKET, "Expect ']' after index.");
@@ -512,12 +685,14 @@ static void index_(bool canAssign) {
     }
 }
 
+// 'and' and 'or' yield booleans, not operands: !! coerces either branch
 static void and_(bool canAssign) {
     (void)canAssign;
     int endJump = emitJump(OP_JUMP_IF_FALSE);
     emitByte(OP_POP);
     parsePrecedence(PREC_AND);
     patchJump(endJump);
+    emitBytes(OP_NOT, OP_NOT);
 }
 
 static void or_(bool canAssign) {
@@ -530,12 +705,13 @@ static void or_(bool canAssign) {
     
     parsePrecedence(PREC_OR);
     patchJump(endJump);
+    emitBytes(OP_NOT, OP_NOT);
 }
 
 ParseRule rules[] = {
     [TOKEN_LEFT_PAREN]    = {grouping, call,   PREC_CALL},
     [TOKEN_RIGHT_PAREN]   = {NULL,     NULL,   PREC_NONE},
-    [TOKEN_LEFT_BRACE]    = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_LEFT_BRACE]    = {map,      NULL,   PREC_NONE},
     [TOKEN_RIGHT_BRACE]   = {NULL,     NULL,   PREC_NONE},
     [TOKEN_LEFT_BRACKET]  = {array,    index_, PREC_CALL},
     [TOKEN_RIGHT_BRACKET] = {NULL,     NULL,   PREC_NONE},
@@ -544,6 +720,7 @@ ParseRule rules[] = {
     [TOKEN_MINUS]         = {unary,    binary, PREC_TERM},
     [TOKEN_PLUS]          = {NULL,     binary, PREC_TERM},
     [TOKEN_SEMICOLON]     = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_COLON]         = {NULL,     NULL,   PREC_NONE},
     [TOKEN_SLASH]         = {NULL,     binary, PREC_FACTOR},
     [TOKEN_STAR]          = {NULL,     binary, PREC_FACTOR},
     [TOKEN_PERCENT]       = {NULL,     binary, PREC_FACTOR},
@@ -555,6 +732,8 @@ ParseRule rules[] = {
     [TOKEN_GREATER_EQUAL] = {NULL,     binary, PREC_COMPARISON},
     [TOKEN_LESS]          = {NULL,     binary, PREC_COMPARISON},
     [TOKEN_LESS_EQUAL]    = {NULL,     binary, PREC_COMPARISON},
+    [TOKEN_ARROW]         = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_FAT_ARROW]     = {NULL,     NULL,   PREC_NONE},
     [TOKEN_IDENTIFIER]    = {variable, NULL,   PREC_NONE},
     [TOKEN_STRING]        = {string,   NULL,   PREC_NONE},
     [TOKEN_NUMBER]        = {number,   NULL,   PREC_NONE},
@@ -564,18 +743,33 @@ ParseRule rules[] = {
     [TOKEN_ELSE]          = {NULL,     NULL,   PREC_NONE},
     [TOKEN_FALSE]         = {literal,  NULL,   PREC_NONE},
     [TOKEN_FOR]           = {NULL,     NULL,   PREC_NONE},
-    [TOKEN_FUN]           = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_FUN]           = {funExpression, NULL, PREC_NONE},
     [TOKEN_IF]            = {NULL,     NULL,   PREC_NONE},
     [TOKEN_NULL]          = {literal,  NULL,   PREC_NONE},
     [TOKEN_OR]            = {NULL,     or_,    PREC_OR},
-    [TOKEN_PRINT]         = {NULL,     NULL,   PREC_NONE},
-    [TOKEN_PRINTLN]       = {NULL,     NULL,   PREC_NONE},
     [TOKEN_RETURN]        = {NULL,     NULL,   PREC_NONE},
     [TOKEN_SUPER]         = {super_,   NULL,   PREC_NONE},
-    [TOKEN_SELF]          = {self_,   NULL,   PREC_NONE},
+    [TOKEN_SELF]          = {self_,    NULL,   PREC_NONE},
     [TOKEN_TRUE]          = {literal,  NULL,   PREC_NONE},
     [TOKEN_VAR]           = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_CONST]         = {NULL,     NULL,   PREC_NONE},
     [TOKEN_WHILE]         = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_EXTENDS]       = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_IMPORT]        = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_EXPORT]        = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_FROM]          = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_BREAK]         = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_CONTINUE]      = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_IN]            = {NULL,     binary, PREC_COMPARISON},
+    [TOKEN_WHEN]          = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_NEW]           = {new_,     NULL,   PREC_NONE},
+    [TOKEN_FIELD]         = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_METHOD]        = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_TRY]           = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_CATCH]         = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_ID]            = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_EGO]           = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_ACT]           = {NULL,     NULL,   PREC_NONE},
     [TOKEN_ERROR]         = {NULL,     NULL,   PREC_NONE},
     [TOKEN_EOF]           = {NULL,     NULL,   PREC_NONE},
 };
@@ -606,6 +800,16 @@ static uint8_t identifierConstant(Token* name) {
     return makeConstant(OBJ_VAL(copyString(name->start, name->length)));
 }
 
+/* Globals are resolved to a slot at compile time, so lookups skip the name */
+static uint16_t globalIndex(Token* name) {
+    int slot = globalSlot(copyString(name->start, name->length));
+    if (slot > UINT16_MAX) {
+        error("Too many global variables.");
+        return 0;
+    }
+    return (uint16_t)slot;
+}
+
 static bool identifiersEqual(Token* a, Token* b) {
     if (a->length != b->length) return false;
     return memcmp(a->start, b->start, a->length) == 0;
@@ -626,28 +830,17 @@ static void addLocal(Token name) {
 static void declareVariable(void) {
     if (current->scopeDepth == 0) return;
     
-    Token* name = &parser.previous;
-    for (int i = current->localCount - 1; i >= 0; i--) {
-        Local* local = &current->locals[i];
-        if (local->depth != -1 && local->depth < current->scopeDepth) {
-            break;
-        }
-        
-        if (identifiersEqual(name, &local->name)) {
-            error("Already a variable with this name in this scope.");
-        }
-    }
-    
-    addLocal(*name);
+    // Redeclaring in the same scope is allowed and shadows, as in the tree-walker
+    addLocal(parser.previous);
 }
 
-static uint8_t parseVariable(const char* errorMessage) {
+static uint16_t parseVariable(const char* errorMessage) {
     consume(TOKEN_IDENTIFIER, errorMessage);
     
     declareVariable();
     if (current->scopeDepth > 0) return 0;
     
-    return identifierConstant(&parser.previous);
+    return globalIndex(&parser.previous);
 }
 
 static void markInitialized(void) {
@@ -655,13 +848,19 @@ static void markInitialized(void) {
     current->locals[current->localCount - 1].depth = current->scopeDepth;
 }
 
-static void defineVariable(uint8_t global) {
+static void defineVariable(uint16_t global) {
     if (current->scopeDepth > 0) {
         markInitialized();
         return;
     }
     
-    emitBytes(OP_DEFINE_GLOBAL, global);
+    emitGlobal(OP_DEFINE_GLOBAL_SLOT, global);
+}
+
+/* Hidden local for a value already on the stack */
+static void addHiddenLocal(const char* name) {
+    addLocal(syntheticToken(name));
+    markInitialized();
 }
 
 static ParseRule* getRule(TokenType type) {
@@ -672,8 +871,21 @@ static void expression(void) {
     parsePrecedence(PREC_ASSIGNMENT);
 }
 
+/* Type annotations are parsed and ignored: ': T' or '-> T' */
+static void skipTypeAnnotation(TokenType stop) {
+    if (match(TOKEN_IDENTIFIER)) return;
+    
+    // Compound types ([int], map<...>): skip to the end of the annotation
+    int line = parser.previous.line;
+    while (!check(stop) && !check(TOKEN_RIGHT_PAREN) && !check(TOKEN_EOF) &&
+           parser.current.line == line) {
+        advance();
+    }
+}
+
 static void varDeclaration(void) {
-    uint8_t global = parseVariable("Expect variable name.");
+    uint16_t global = parseVariable("Expect variable name.");
+    if (match(TOKEN_COLON)) skipTypeAnnotation(TOKEN_EQUAL);
     
     if (match(TOKEN_EQUAL)) {
         expression();
@@ -681,8 +893,6 @@ static void varDeclaration(void) {
         emitByte(OP_NULL);
     }
     
-    emitByte(OP_POP);  // Optional newline handling
-    
     defineVariable(global);
 }
 
@@ -691,38 +901,59 @@ static void expressionStatement(void) {
     emitByte(OP_POP);
 }
 
+static void scopedBlock(void) {
+    beginScope();
+    block();
+    endScope();
+}
+
 static void ifStatement(void) {
     expression();
     
     int thenJump = emitJump(OP_JUMP_IF_FALSE);
     emitByte(OP_POP);
-    statement();
+    consume(TOKEN_LEFT_BRACE, "Expect '{' before if body.");
+    scopedBlock();
     
     int elseJump = emitJump(OP_JUMP);
     
     patchJump(thenJump);
     emitByte(OP_POP);
     
-    if (match(TOKEN_ELSE)) statement();
+    if (match(TOKEN_ELSE)) {
+        if (match(TOKEN_IF)) {
+            ifStatement();
+        } else {
+            consume(TOKEN_LEFT_BRACE, "Expect '{' before else body.");
+            scopedBlock();
+        }
+    }
     patchJump(elseJump);
 }
 
-static void printStatement(void) {
+/* when condition => statement | { block } */
+static void whenStatement(void) {
     expression();
-    emitByte(OP_PRINT);
-}
-
-static void printlnStatement(void) {
-    expression();
-    emitByte(OP_PRINTLN);
+    consume(TOKEN_FAT_ARROW, "Expect '=>' after when condition.");
+    
+    int skipJump = emitJump(OP_JUMP_IF_FALSE);
+    emitByte(OP_POP);
+    if (match(TOKEN_LEFT_BRACE)) {
+        scopedBlock();
+    } else {
+        beginScope();
+        statement();
+        endScope();
+    }
+    
+    int endJump = emitJump(OP_JUMP);
+    patchJump(skipJump);
+    emitByte(OP_POP);
+    patchJump(endJump);
 }
 
 static void returnStatement(void) {
-    if (current->type == TYPE_SCRIPT) {
-        error("Can't return from top-level code.");
-    }
-    
-    if (match(TOKEN_SEMICOLON) || check(TOKEN_RIGHT_BRACE) || check(TOKEN_EOF)) {
+    if (check(TOKEN_RIGHT_BRACE) || check(TOKEN_EOF) || match(TOKEN_SEMICOLON)) {
         emitReturn();
     } else {
         if (current->type == TYPE_INITIALIZER) {
@@ -733,62 +964,241 @@ static void returnStatement(void) {
     }
 }
 
+static void beginLoop(Loop* loop, int start) {
+    loop->enclosing = current->loop;
+    loop->start = start;
+    loop->scopeDepth = current->scopeDepth;
+    loop->tryDepth = current->tryDepth;
+    loop->breakCount = 0;
+    current->loop = loop;
+}
+
+static void endLoop(void) {
+    for (int i = 0; i < current->loop->breakCount; i++) {
+        patchJump(current->loop->breakJumps[i]);
+    }
+    current->loop = current->loop->enclosing;
+}
+
+/* Leaves the body's scopes and try blocks before jumping out of it */
+static void exitLoopBody(Loop* loop) {
+    discardLocals(loop->scopeDepth);
+    for (int i = loop->tryDepth; i < current->tryDepth; i++) {
+        emitByte(OP_END_TRY);
+    }
+}
+
+static void breakStatement(void) {
+    Loop* loop = current->loop;
+    if (loop == NULL) {
+        error("Can't use 'break' outside of a loop.");
+        return;
+    }
+    
+    exitLoopBody(loop);
+    if (loop->breakCount == UINT8_COUNT) {
+        error("Too many breaks in one loop.");
+        return;
+    }
+    loop->breakJumps[loop->breakCount++] = emitJump(OP_JUMP);
+}
+
+static void continueStatement(void) {
+    Loop* loop = current->loop;
+    if (loop == NULL) {
+        error("Can't use 'continue' outside of a loop.");
+        return;
+    }
+    
+    exitLoopBody(loop);
+    emitLoop(loop->start);
+}
+
 static void whileStatement(void) {
     int loopStart = currentChunk()->count;
     expression();
     
     int exitJump = emitJump(OP_JUMP_IF_FALSE);
     emitByte(OP_POP);
-    statement();
+    
+    Loop loop;
+    beginLoop(&loop, loopStart);
+    consume(TOKEN_LEFT_BRACE, "Expect '{' before while body.");
+    scopedBlock();
     emitLoop(loopStart);
     
     patchJump(exitJump);
     emitByte(OP_POP);
+    endLoop();
 }
 
+/* for x in array { body } -- walks the live count, like the tree-walker */
 static void forStatement(void) {
     beginScope();
     
-    // Variable name
     consume(TOKEN_IDENTIFIER, "Expect variable name.");
     Token loopVar = parser.previous;
-    declareVariable();
-    addLocal(loopVar);
-    markInitialized();
-    
     consume(TOKEN_IN, "Expect 'in' after loop variable.");
     
-    // Range start
+    // Hidden locals: the iterable and the next index, then x itself. x is
+    // one variable for the whole loop, so closures see its latest value
     expression();
-    int localStart = current->localCount - 1;
+    addHiddenLocal(" iterable");
+    int iterableSlot = current->localCount - 1;
+    emitConstant(INT_VAL(0));
+    addHiddenLocal(" index");
+    emitByte(OP_NULL);
+    addLocal(loopVar);
+    markInitialized();
     
     int loopStart = currentChunk()->count;
+    emitBytes(OP_FOR_ITER, (uint8_t)iterableSlot);
+    emitByte(0xff);
+    emitByte(0xff);
+    int exitJump = currentChunk()->count - 2;
     
-    // Condition: loop var < end
-    emitBytes(OP_GET_LOCAL, (uint8_t)localStart);
-    expression();  // end value
-    emitByte(OP_LESS);
+    Loop loop;
+    beginLoop(&loop, loopStart);
+    consume(TOKEN_LEFT_BRACE, "Expect '{' before for body.");
+    scopedBlock();
+    emitLoop(loopStart);
     
-    int exitJump = emitJump(OP_JUMP_IF_FALSE);
-    emitByte(OP_POP);
+    patchJump(exitJump);
+    endLoop();
     
-    // Body
-    consume(TOKEN_LEFT_BRACE, "Expect '{' after for clause.");
-    block();
+    endScope();
+}
+
+/* try { ... } catch name { ... } -- name holds the runtime error message */
+static void tryStatement(void) {
+    int handlerJump = emitJump(OP_TRY);
+    current->tryDepth++;
+    consume(TOKEN_LEFT_BRACE, "Expect '{' after try.");
+    scopedBlock();
+    current->tryDepth--;
+    emitByte(OP_END_TRY);
+    int endJump = emitJump(OP_JUMP);
     
-    // Increment
-    emitBytes(OP_GET_LOCAL, (uint8_t)localStart);
-    emitConstant(INT_VAL(1));
-    emitByte(OP_ADD);
-    emitBytes(OP_SET_LOCAL, (uint8_t)localStart);
-    emitByte(OP_POP);
+    patchJump(handlerJump);
+    consume(TOKEN_CATCH, "Expect 'catch' after try block.");
+    consume(TOKEN_IDENTIFIER, "Expect catch variable name.");
+    beginScope();
+    addLocal(parser.previous);
+    markInitialized();
+    consume(TOKEN_LEFT_BRACE, "Expect '{' after catch variable.");
+    scopedBlock();
+    endScope();
     
-    emitLoop(loopStart);
+    patchJump(endJump);
+}
+
+static char* readModule(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return NULL;
     
-    patchJump(exitJump);
+    fseek(file, 0L, SEEK_END);
+    size_t fileSize = ftell(file);
+    rewind(file);
+    
+    char* buffer = (char*)malloc(fileSize + 1);
+    size_t bytesRead = fread(buffer, sizeof(char), fileSize, file);
+    buffer[bytesRead] = '\0';
+    fclose(file);
+    return buffer;
+}
+
+/* The module's top level as a script function, compiled once per program */
+static ObjFunction* compileModule(ObjString* path) {
+    Value cached;
+    if (tableGet(&modules, path, &cached)) return AS_FUNCTION(cached);
+    
+    char* source = readModule(path->chars);
+    if (source == NULL) {
+        error("Could not read imported module.");
+        return NULL;
+    }
+    
+    Parser outerParser = parser;
+    ClassCompiler* outerClass = currentClass;
+    currentClass = NULL;
+    
+    Compiler compiler;
+    initCompiler(&compiler, TYPE_SCRIPT, NULL);
+    compiler.function->name = path;
+    WRITE_BARRIER_OBJ(compiler.function, path);
+    // Registered before the body compiles, so an import cycle finds it
+    tableSet(&modules, path, OBJ_VAL(compiler.function));
+    
+    initLexer(&parser.lexer, source);
+    parser.panicMode = false;
+    advance();
+    while (!match(TOKEN_EOF)) {
+        declaration();
+    }
+    ObjFunction* function = endCompiler();
+    
+    bool hadError = parser.hadError;
+    parser = outerParser;
+    parser.hadError = parser.hadError || hadError;
+    currentClass = outerClass;
+    free(source);
+    return function;
+}
+
+/* import "path" | import { a, b } from "path" */
+static void importStatement(void) {
+    Token names[UINT8_COUNT];
+    int nameCount = 0;
+    
+    if (match(TOKEN_LEFT_BRACE)) {
+        do {
+            consume(TOKEN_IDENTIFIER, "Expect member name.");
+            if (nameCount == UINT8_COUNT) {
+                error("Too many names in one import.");
+                return;
+            }
+            names[nameCount++] = parser.previous;
+        } while (match(TOKEN_COMMA));
+        consume(TOKEN_RIGHT_BRACE, "Expect '}' after import list.");
+        consume(TOKEN_FROM, "Expect 'from' after import list.");
+    }
+    
+    consume(TOKEN_STRING, "Expect import path.");
+    ObjString* literal = stringLiteral(&parser.previous);
+    push(OBJ_VAL(literal));
+    char* chars = ALLOCATE(char, literal->length + 8);
+    memcpy(chars, literal->chars, literal->length);
+    memcpy(chars + literal->length, ".somnia", 8);
+    ObjString* path = takeString(chars, literal->length + 7);
+    pop();
+    
+    push(OBJ_VAL(path));
+    ObjFunction* module = compileModule(path);
+    pop();
+    if (module == NULL) return;
+    
+    emitBytes(OP_IMPORT, makeConstant(OBJ_VAL(module)));
     emitByte(OP_POP);
     
-    endScope();
+    // Modules define globals; a named import inside a scope copies them in
+    if (current->scopeDepth == 0) return;
+    for (int i = 0; i < nameCount; i++) {
+        emitGlobal(OP_GET_GLOBAL_SLOT, globalIndex(&names[i]));
+        addLocal(names[i]);
+        markInitialized();
+    }
+}
+
+/* export { a, b } names what a module offers; everything is global anyway */
+static void exportStatement(void) {
+    if (!match(TOKEN_LEFT_BRACE)) {
+        error("Exporting a declaration is not supported by the bytecode compiler.");
+        return;
+    }
+    do {
+        consume(TOKEN_IDENTIFIER, "Expect member name.");
+    } while (match(TOKEN_COMMA));
+    consume(TOKEN_RIGHT_BRACE, "Expect '}' after export list.");
 }
 
 static void synchronize(void) {
@@ -800,12 +1210,13 @@ static void synchronize(void) {
             case TOKEN_CLASS:
             case TOKEN_FUN:
             case TOKEN_VAR:
+            case TOKEN_CONST:
             case TOKEN_FOR:
             case TOKEN_IF:
             case TOKEN_WHILE:
-            case TOKEN_PRINT:
-            case TOKEN_PRINTLN:
+            case TOKEN_WHEN:
             case TOKEN_RETURN:
+            case TOKEN_IMPORT:
                 return;
             default:
                 ;
@@ -821,9 +1232,9 @@ static void block(void) {
     consume(TOKEN_RIGHT_BRACE, "Expect '}' after block.");
 }
 
-static void function(FunctionType type) {
+static void function(FunctionType type, Token* name) {
     Compiler compiler;
-    initCompiler(&compiler, type);
+    initCompiler(&compiler, type, name);
     beginScope();
     
     consume(TOKEN_LEFT_PAREN, "Expect '(' after function name.");
@@ -833,11 +1244,13 @@ static void function(FunctionType type) {
             if (current->function->arity > 255) {
                 errorAtCurrent("Can't have more than 255 parameters.");
             }
-            uint8_t constant = parseVariable("Expect parameter name.");
-            defineVariable(constant);
+            parseVariable("Expect parameter name.");
+            defineVariable(0);
+            if (match(TOKEN_COLON)) skipTypeAnnotation(TOKEN_COMMA);
         } while (match(TOKEN_COMMA));
     }
     consume(TOKEN_RIGHT_PAREN, "Expect ')' after parameters.");
+    if (match(TOKEN_ARROW)) consume(TOKEN_IDENTIFIER, "Expect return type.");
     consume(TOKEN_LEFT_BRACE, "Expect '{' before function body.");
     block();
     
@@ -852,13 +1265,14 @@ static void function(FunctionType type) {
 
 static void method(void) {
     consume(TOKEN_IDENTIFIER, "Expect method name.");
-    uint8_t constant = identifierConstant(&parser.previous);
+    Token name = parser.previous;
+    uint8_t constant = identifierConstant(&name);
     
     FunctionType type = TYPE_METHOD;
-    if (parser.previous.length == 4 && memcmp(parser.previous.start, "init", 4) == 0) {
+    if (name.length == 4 && memcmp(name.start, "init", 4) == 0) {
         type = TYPE_INITIALIZER;
     }
-    function(type);
+    function(type, &name);
     emitBytes(OP_METHOD, constant);
 }
 
@@ -869,7 +1283,7 @@ static void classDeclaration(void) {
     declareVariable();
     
     emitBytes(OP_CLASS, nameConstant);
-    defineVariable(nameConstant);
+    defineVariable(current->scopeDepth > 0 ? 0 : globalIndex(&className));
     
     ClassCompiler classCompiler;
     classCompiler.hasSuperclass = false;
@@ -879,15 +1293,15 @@ static void classDeclaration(void) {
     if (match(TOKEN_EXTENDS)) {
         consume(TOKEN_IDENTIFIER, "Expect superclass name.");
         variable(false);
-        
+    
         if (identifiersEqual(&className, &parser.previous)) {
             error("A class can't inherit from itself.");
         }
-        
+    
         beginScope();
         addLocal(syntheticToken("super"));
         defineVariable(0);
-        
+    
         namedVariable(className, false);
         emitByte(OP_INHERIT);
         classCompiler.hasSuperclass = true;
@@ -896,15 +1310,17 @@ static void classDeclaration(void) {
     namedVariable(className, false);
     consume(TOKEN_LEFT_BRACE, "Expect '{' before class body.");
     while (!check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF)) {
-        if (match(TOKEN_FUN)) {
+        if (match(TOKEN_METHOD) || match(TOKEN_FUN)) {
             method();
-        } else if (match(TOKEN_VAR)) {
-            // Field declarations
+        } else if (match(TOKEN_FIELD)) {
+            // field name [: Type] [= initializer] -- fields are set on instances,
+            // so the initializer is parsed and its code dropped
             consume(TOKEN_IDENTIFIER, "Expect field name.");
-            // Just skip for now, fields are defined on instances
+            if (match(TOKEN_COLON) && check(TOKEN_IDENTIFIER)) advance();
             if (match(TOKEN_EQUAL)) {
+                int start = currentChunk()->count;
                 expression();
-                emitByte(OP_POP);
+                currentChunk()->count = start;
             }
         } else {
             advance();  // Skip unknown
@@ -921,43 +1337,55 @@ static void classDeclaration(void) {
 }
 
 static void funDeclaration(void) {
-    uint8_t global = parseVariable("Expect function name.");
+    uint16_t global = parseVariable("Expect function name.");
+    Token name = parser.previous;
     markInitialized();
-    function(TYPE_FUNCTION);
+    function(TYPE_FUNCTION, &name);
     defineVariable(global);
 }
 
 static void declaration(void) {
-    if (match(TOKEN_CLASS)) {
-        classDeclaration();
-    } else if (match(TOKEN_FUN)) {
-        funDeclaration();
-    } else if (match(TOKEN_VAR) || match(TOKEN_CONST)) {
-        varDeclaration();
-    } else {
-        statement();
-    }
+    statement();
+    match(TOKEN_SEMICOLON);
     
     if (parser.panicMode) synchronize();
 }
 
 static void statement(void) {
-    if (match(TOKEN_PRINT)) {
-        printStatement();
-    } else if (match(TOKEN_PRINTLN)) {
-        printlnStatement();
+    if (match(TOKEN_ID) || match(TOKEN_EGO) || match(TOKEN_ACT)) {
+        error("ID/EGO/ACT blocks are not supported by the bytecode compiler.");
+    } else if (match(TOKEN_IMPORT)) {
+        importStatement();
+    } else if (match(TOKEN_EXPORT)) {
+        exportStatement();
+    } else if (match(TOKEN_CLASS)) {
+        classDeclaration();
+    } else if (match(TOKEN_VAR) || match(TOKEN_CONST)) {
+        varDeclaration();
+    } else if (check(TOKEN_FUN)) {
+        advance();
+        if (check(TOKEN_IDENTIFIER)) {
+            funDeclaration();
+        } else {
+            funExpression(false);
+            emitByte(OP_POP);
+        }
+    } else if (match(TOKEN_WHEN)) {
+        whenStatement();
+    } else if (match(TOKEN_FOR)) {
+        forStatement();
+    } else if (match(TOKEN_WHILE)) {
+        whileStatement();
     } else if (match(TOKEN_IF)) {
         ifStatement();
     } else if (match(TOKEN_RETURN)) {
         returnStatement();
-    } else if (match(TOKEN_WHILE)) {
-        whileStatement();
-    } else if (match(TOKEN_FOR)) {
-        forStatement();
-    } else if (match(TOKEN_LEFT_BRACE)) {
-        beginScope();
-        block();
-        endScope();
+    } else if (match(TOKEN_BREAK)) {
+        breakStatement();
+    } else if (match(TOKEN_CONTINUE)) {
+        continueStatement();
+    } else if (match(TOKEN_TRY)) {
+        tryStatement();
     } else {
         expressionStatement();
     }
@@ -965,8 +1393,9 @@ static void statement(void) {
 
 ObjFunction* compile(const char* source) {
     initLexer(&parser.lexer, source);
+    initTable(&modules);
     Compiler compiler;
-    initCompiler(&compiler, TYPE_SCRIPT);
+    initCompiler(&compiler, TYPE_SCRIPT, NULL);
     
     parser.hadError = false;
     parser.panicMode = false;
@@ -978,6 +1407,7 @@ ObjFunction* compile(const char* source) {
     }
     
     ObjFunction* function = endCompiler();
+    freeTable(&modules);
     return parser.hadError ? NULL : function;
 }
 
@@ -987,4 +1417,5 @@ void markCompilerRoots(void) {
         markObject((Obj*)compiler->function);
         compiler = compiler->enclosing;
     }
+    markTable(&modules);
 }
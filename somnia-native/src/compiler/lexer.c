@@ -105,13 +105,13 @@ static TokenType checkKeyword(Lexer* lexer, int start, int length, const char* r
 }
 
 static TokenType identifierType(Lexer* lexer) {
+    // Same keyword set as the tree-walker's lexer, plus extends/super
     switch (lexer->start[0]) {
         case 'a':
             if (lexer->current - lexer->start > 1) {
                 switch (lexer->start[1]) {
-                    case 'c': return checkKeyword(lexer, 2, 4, "tion", TOKEN_ACTION);
+                    case 'c': return checkKeyword(lexer, 2, 1, "t", TOKEN_ACT);
                     case 'n': return checkKeyword(lexer, 2, 1, "d", TOKEN_AND);
-                    case 's': return checkKeyword(lexer, 2, 0, "", TOKEN_AS);
                 }
             }
             break;
@@ -119,17 +119,12 @@ static TokenType identifierType(Lexer* lexer) {
         case 'c':
             if (lexer->current - lexer->start > 1) {
                 switch (lexer->start[1]) {
-                    case 'a': return checkKeyword(lexer, 2, 2, "se", TOKEN_CASE);
+                    case 'a': return checkKeyword(lexer, 2, 3, "tch", TOKEN_CATCH);
                     case 'l': return checkKeyword(lexer, 2, 3, "ass", TOKEN_CLASS);
                     case 'o':
-                        if (lexer->current - lexer->start > 2) {
-                            switch (lexer->start[2]) {
-                                case 'n':
-                                    if (lexer->current - lexer->start > 3 && lexer->start[3] == 's') {
-                                        return checkKeyword(lexer, 4, 1, "t", TOKEN_CONST);
-                                    }
-                                    return checkKeyword(lexer, 2, 6, "ntinue", TOKEN_CONTINUE);
-                            }
+                        if (lexer->current - lexer->start > 3 && lexer->start[2] == 'n') {
+                            if (lexer->start[3] == 's') return checkKeyword(lexer, 4, 1, "t", TOKEN_CONST);
+                            if (lexer->start[3] == 't') return checkKeyword(lexer, 4, 4, "inue", TOKEN_CONTINUE);
                         }
                         break;
                 }
@@ -138,8 +133,13 @@ static TokenType identifierType(Lexer* lexer) {
         case 'e':
             if (lexer->current - lexer->start > 1) {
                 switch (lexer->start[1]) {
+                    case 'g': return checkKeyword(lexer, 2, 1, "o", TOKEN_EGO);
                     case 'l': return checkKeyword(lexer, 2, 2, "se", TOKEN_ELSE);
-                    case 'x': return checkKeyword(lexer, 2, 5, "tends", TOKEN_EXTENDS);
+                    case 'x':
+                        if (lexer->current - lexer->start > 2 && lexer->start[2] == 'p') {
+                            return checkKeyword(lexer, 3, 3, "ort", TOKEN_EXPORT);
+                        }
+                        return checkKeyword(lexer, 2, 5, "tends", TOKEN_EXTENDS);
                 }
             }
             break;
@@ -147,6 +147,7 @@ static TokenType identifierType(Lexer* lexer) {
             if (lexer->current - lexer->start > 1) {
                 switch (lexer->start[1]) {
                     case 'a': return checkKeyword(lexer, 2, 3, "lse", TOKEN_FALSE);
+                    case 'i': return checkKeyword(lexer, 2, 3, "eld", TOKEN_FIELD);
                     case 'o': return checkKeyword(lexer, 2, 1, "r", TOKEN_FOR);
                     case 'r': return checkKeyword(lexer, 2, 2, "om", TOKEN_FROM);
                     case 'u': return checkKeyword(lexer, 2, 1, "n", TOKEN_FUN);
@@ -156,20 +157,24 @@ static TokenType identifierType(Lexer* lexer) {
         case 'i':
             if (lexer->current - lexer->start > 1) {
                 switch (lexer->start[1]) {
+                    case 'd': return checkKeyword(lexer, 2, 0, "", TOKEN_ID);
                     case 'f': return checkKeyword(lexer, 2, 0, "", TOKEN_IF);
                     case 'm': return checkKeyword(lexer, 2, 4, "port", TOKEN_IMPORT);
                     case 'n': return checkKeyword(lexer, 2, 0, "", TOKEN_IN);
                 }
             }
             break;
-        case 'm': return checkKeyword(lexer, 1, 4, "atch", TOKEN_MATCH);
-        case 'n': return checkKeyword(lexer, 1, 3, "ull", TOKEN_NULL);
-        case 'o': return checkKeyword(lexer, 1, 1, "r", TOKEN_OR);
-        case 'p':
-            if (lexer->current - lexer->start > 4 && lexer->start[5] == 'l') {
-                return checkKeyword(lexer, 1, 6, "rintln", TOKEN_PRINTLN);
+        case 'm': return checkKeyword(lexer, 1, 5, "ethod", TOKEN_METHOD);
+        case 'n':
+            if (lexer->current - lexer->start > 1) {
+                switch (lexer->start[1]) {
+                    case 'e': return checkKeyword(lexer, 2, 1, "w", TOKEN_NEW);
+                    case 'o': return checkKeyword(lexer, 2, 1, "t", TOKEN_BANG);
+                    case 'u': return checkKeyword(lexer, 2, 2, "ll", TOKEN_NULL);
+                }
             }
-            return checkKeyword(lexer, 1, 4, "rint", TOKEN_PRINT);
+            break;
+        case 'o': return checkKeyword(lexer, 1, 1, "r", TOKEN_OR);
         case 'r': return checkKeyword(lexer, 1, 5, "eturn", TOKEN_RETURN);
         case 's':
             if (lexer->current - lexer->start > 1) {
@@ -179,9 +184,27 @@ static TokenType identifierType(Lexer* lexer) {
                 }
             }
             break;
-        case 't': return checkKeyword(lexer, 1, 3, "rue", TOKEN_TRUE);
+        case 't':
+            if (lexer->current - lexer->start > 1) {
+                switch (lexer->start[1]) {
+                    case 'h': return checkKeyword(lexer, 2, 2, "is", TOKEN_SELF);
+                    case 'r':
+                        if (lexer->current - lexer->start > 2 && lexer->start[2] == 'y') {
+                            return checkKeyword(lexer, 3, 0, "", TOKEN_TRY);
+                        }
+                        return checkKeyword(lexer, 2, 2, "ue", TOKEN_TRUE);
+                }
+            }
+            break;
         case 'v': return checkKeyword(lexer, 1, 2, "ar", TOKEN_VAR);
-        case 'w': return checkKeyword(lexer, 1, 4, "hile", TOKEN_WHILE);
+        case 'w':
+            if (lexer->current - lexer->start > 2 && lexer->start[1] == 'h') {
+                switch (lexer->start[2]) {
+                    case 'e': return checkKeyword(lexer, 3, 1, "n", TOKEN_WHEN);
+                    case 'i': return checkKeyword(lexer, 3, 2, "le", TOKEN_WHILE);
+                }
+            }
+            break;
         
         // Somnia psychological blocks
         case 'I': return checkKeyword(lexer, 1, 1, "D", TOKEN_ID);
@@ -214,18 +237,6 @@ static Token number(Lexer* lexer) {
         }
     }
     
-    // Scientific notation
-    if (peek(lexer) == 'e' || peek(lexer) == 'E') {
-        isFloat = true;
-        advance(lexer);
-        if (peek(lexer) == '+' || peek(lexer) == '-') {
-            advance(lexer);
-        }
-        while (isdigit(peek(lexer))) {
-            advance(lexer);
-        }
-    }
-    
     return makeToken(lexer, isFloat ? TOKEN_NUMBER : TOKEN_INT);
 }
 
@@ -287,7 +298,6 @@ Token scanToken(Lexer* lexer) {
             return makeToken(lexer, match(lexer, '=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER);
             
         case '"': return string(lexer, '"');
-        case '\'': return string(lexer, '\'');
     }
     
     return errorToken(lexer, "Unexpected character.");
@@ -0,0 +1,469 @@
+#include "compiler/optimizer.h"
+#include "object.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Jumps followed when threading one jump, so a cycle of jumps still ends
+#define THREAD_HOPS_MAX 16
+
+/* A decoded instruction. Jumps hold the index of the instruction they land
+ * on rather than a byte offset, so code can disappear around them */
+typedef struct {
+    uint8_t op;
+    uint8_t operands[2];    // Operands of short instructions without a jump
+    int offset;             // Where it started in the compiler's code
+    int length;
+    int target;             // Instruction a jump lands on, or -1
+    int line;
+    bool removed;
+} Instruction;
+
+typedef struct {
+    Chunk* chunk;
+    Instruction* code;
+    int count;
+    bool* isTarget;         // count + 1 entries: a jump may land at the end
+} Optimizer;
+
+static bool isJump(uint8_t op) {
+    switch (op) {
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_LOOP:
+        case OP_FOR_ITER:
+        case OP_TRY:
+        case OP_JUMP_IF_NOT_LESS:
+        case OP_JUMP_IF_NOT_LESS_EQUAL:
+        case OP_JUMP_IF_NOT_GREATER:
+        case OP_JUMP_IF_NOT_GREATER_EQUAL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* Compare-and-branch form of a comparison, or -1 */
+static int compareJump(uint8_t op) {
+    switch (op) {
+        case OP_LESS:          return OP_JUMP_IF_NOT_LESS;
+        case OP_LESS_EQUAL:    return OP_JUMP_IF_NOT_LESS_EQUAL;
+        case OP_GREATER:       return OP_JUMP_IF_NOT_GREATER;
+        case OP_GREATER_EQUAL: return OP_JUMP_IF_NOT_GREATER_EQUAL;
+        default:               return -1;
+    }
+}
+
+static bool decode(Optimizer* opt) {
+    Chunk* chunk = opt->chunk;
+    int* indexAt = malloc(sizeof(int) * (chunk->count + 1));
+    for (int i = 0; i <= chunk->count; i++) indexAt[i] = -1;
+    
+    opt->count = 0;
+    for (int offset = 0; offset < chunk->count; offset += opt->code[opt->count - 1].length) {
+        Instruction* instruction = &opt->code[opt->count];
+        instruction->op = chunk->code[offset];
+        instruction->offset = offset;
+        instruction->length = instructionLength(chunk, offset);
+        instruction->target = -1;
+        instruction->line = chunk->lines[offset];
+        instruction->removed = false;
+        for (int i = 0; i < 2; i++) {
+            instruction->operands[i] = i + 1 < instruction->length ? chunk->code[offset + i + 1] : 0;
+        }
+        indexAt[offset] = opt->count++;
+    }
+    indexAt[chunk->count] = opt->count;
+    
+    bool ok = true;
+    for (int i = 0; i < opt->count && ok; i++) {
+        Instruction* instruction = &opt->code[i];
+        if (!isJump(instruction->op)) continue;
+    
+        int end = instruction->offset + instruction->length;
+        int jump = (chunk->code[end - 2] << 8) | chunk->code[end - 1];
+        int destination = instruction->op == OP_LOOP ? end - jump : end + jump;
+        if (destination < 0 || destination > chunk->count || indexAt[destination] < 0) {
+            ok = false;
+        } else {
+            instruction->target = indexAt[destination];
+        }
+    }
+    
+    free(indexAt);
+    return ok;
+}
+
+/* First instruction at or after `i` that is still there */
+static int nextLive(Optimizer* opt, int i) {
+    while (i < opt->count && opt->code[i].removed) i++;
+    return i;
+}
+
+static void markTargets(Optimizer* opt) {
+    memset(opt->isTarget, 0, sizeof(bool) * (opt->count + 1));
+    for (int i = 0; i < opt->count; i++) {
+        if (!opt->code[i].removed && opt->code[i].target >= 0) {
+            opt->isTarget[opt->code[i].target] = true;
+        }
+    }
+}
+
+/* The `length` instructions starting at `first`, if no jump lands inside
+ * them: a sequence can only be rewritten when it is entered at the top */
+static bool window(Optimizer* opt, int first, int* at, int length) {
+    at[0] = first;
+    for (int i = 1; i < length; i++) {
+        at[i] = nextLive(opt, at[i - 1] + 1);
+        if (at[i] >= opt->count || opt->isTarget[at[i]]) return false;
+    }
+    return true;
+}
+
+static void removeAll(Optimizer* opt, int* at, int from, int to) {
+    for (int i = from; i < to; i++) opt->code[at[i]].removed = true;
+}
+
+/* ============================================================================
+ * CONSTANT FOLDING
+ * ============================================================================ */
+
+/* Index of a number in the constant table, added if new; -1 once it is full */
+static int numberConstant(Chunk* chunk, Value value) {
+    ValueArray* constants = &chunk->constants;
+    for (int i = 0; i < constants->count; i++) {
+        Value existing = constants->values[i];
+        if (IS_INT(value) && IS_INT(existing) && AS_INT(existing) == AS_INT(value)) return i;
+        if (IS_DOUBLE(value) && IS_DOUBLE(existing)) {
+            double x = AS_DOUBLE(value);
+            double y = AS_DOUBLE(existing);
+            if (memcmp(&x, &y, sizeof(double)) == 0) return i;
+        }
+    }
+    if (constants->count > UINT8_MAX) return -1;
+    return addConstant(chunk, value);
+}
+
+/* Same int and double rules as the VM's handlers; x / 0 and x % 0 are left
+ * for the VM, which reports them */
+static bool foldArithmetic(uint8_t op, Value a, Value b, Value* result) {
+    if (!IS_NUMBER(a) || !IS_NUMBER(b)) return false;
+    
+    bool ints = IS_INT(a) && IS_INT(b);
+    double x = valueToDouble(a);
+    double y = valueToDouble(b);
+    int64_t value;
+    switch (op) {
+        case OP_ADD:
+            *result = ints && addInts(AS_INT(a), AS_INT(b), &value) ? INT_VAL(value) : DOUBLE_VAL(x + y);
+            return true;
+        case OP_SUBTRACT:
+            *result = ints && subtractInts(AS_INT(a), AS_INT(b), &value) ? INT_VAL(value) : DOUBLE_VAL(x - y);
+            return true;
+        case OP_MULTIPLY:
+            *result = ints && multiplyInts(AS_INT(a), AS_INT(b), &value) ? INT_VAL(value) : DOUBLE_VAL(x * y);
+            return true;
+        case OP_DIVIDE:
+            if (y == 0) return false;
+            *result = ints && divideInts(AS_INT(a), AS_INT(b), &value) ? INT_VAL(value) : DOUBLE_VAL(x / y);
+            return true;
+        case OP_MODULO:
+            if (y == 0) return false;
+            *result = ints && moduloInts(AS_INT(a), AS_INT(b), &value) ? INT_VAL(value) : DOUBLE_VAL(fmod(x, y));
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool foldNegate(Value a, Value* result) {
+    if (IS_INT(a) && AS_INT(a) != INT64_MIN) {
+        *result = INT_VAL(-AS_INT(a));
+    } else if (IS_NUMBER(a)) {
+        *result = DOUBLE_VAL(-valueToDouble(a));
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/* Rewrites the CONSTANT at `i` to load `value` */
+static bool loadConstant(Optimizer* opt, int i, Value value) {
+    int index = numberConstant(opt->chunk, value);
+    if (index < 0) return false;
+    opt->code[i].operands[0] = (uint8_t)index;
+    return true;
+}
+
+/* CONSTANT a; CONSTANT b; op and CONSTANT a; NEGATE become one CONSTANT;
+ * TRUE; JUMP_IF_FALSE; POP (`while true`) disappears */
+static bool foldConstants(Optimizer* opt) {
+    Instruction* code = opt->code;
+    Value* constants = opt->chunk->constants.values;
+    bool changed = false;
+    int at[3];
+    
+    markTargets(opt);
+    for (int i = nextLive(opt, 0); i < opt->count; i = nextLive(opt, i + 1)) {
+        Value result;
+        if (code[i].op == OP_CONSTANT && window(opt, i, at, 2) && code[at[1]].op == OP_NEGATE) {
+            if (foldNegate(constants[code[i].operands[0]], &result) && loadConstant(opt, i, result)) {
+                removeAll(opt, at, 1, 2);
+                changed = true;
+            }
+        } else if (code[i].op == OP_CONSTANT && window(opt, i, at, 3) && code[at[1]].op == OP_CONSTANT) {
+            Value a = constants[code[i].operands[0]];
+            Value b = constants[code[at[1]].operands[0]];
+            if (foldArithmetic(code[at[2]].op, a, b, &result) && loadConstant(opt, i, result)) {
+                removeAll(opt, at, 1, 3);
+                changed = true;
+            }
+        } else if (code[i].op == OP_TRUE && window(opt, i, at, 3) &&
+                   code[at[1]].op == OP_JUMP_IF_FALSE && code[at[2]].op == OP_POP) {
+            // A jump landing on the TRUE now falls through to what follows
+            removeAll(opt, at, 0, 3);
+            changed = true;
+        }
+        // loadConstant may have grown the table
+        constants = opt->chunk->constants.values;
+    }
+    return changed;
+}
+
+/* ============================================================================
+ * SUPERINSTRUCTIONS
+ * ============================================================================ */
+
+static void rewrite(Instruction* instruction, uint8_t op, int length) {
+    instruction->op = op;
+    instruction->length = length;
+}
+
+/* GET_LOCAL a; CONSTANT k; ADD; SET_LOCAL a; POP -- i = i + 1 as a statement */
+static bool fuseIncrementLocal(Optimizer* opt, int i) {
+    Instruction* code = opt->code;
+    int at[5];
+    if (code[i].op != OP_GET_LOCAL || !window(opt, i, at, 5)) return false;
+    if (code[at[1]].op != OP_CONSTANT || code[at[2]].op != OP_ADD ||
+        code[at[3]].op != OP_SET_LOCAL || code[at[4]].op != OP_POP ||
+        code[at[3]].operands[0] != code[i].operands[0]) {
+        return false;
+    }
+    
+    rewrite(&code[i], OP_INCREMENT_LOCAL, 3);
+    code[i].operands[1] = code[at[1]].operands[0];
+    removeAll(opt, at, 1, 5);
+    return true;
+}
+
+/* LESS; JUMP_IF_FALSE; POP where the jump lands on a POP too: neither
+ * branch needs the flag, so the fused jump goes past the target's POP */
+static bool fuseCompareJump(Optimizer* opt, int i) {
+    Instruction* code = opt->code;
+    int op = compareJump(code[i].op);
+    int at[3];
+    if (op < 0 || !window(opt, i, at, 3)) return false;
+    if (code[at[1]].op != OP_JUMP_IF_FALSE || code[at[2]].op != OP_POP) return false;
+    
+    int exit = code[at[1]].target;
+    if (exit >= opt->count || code[exit].removed || code[exit].op != OP_POP) return false;
+    
+    rewrite(&code[i], (uint8_t)op, 3);
+    code[i].target = nextLive(opt, exit + 1);
+    opt->isTarget[code[i].target] = true;
+    removeAll(opt, at, 1, 3);
+    return true;
+}
+
+/* GET_LOCAL a; GET_LOCAL b -- the operands of most binary expressions */
+static bool fuseGetLocals(Optimizer* opt, int i) {
+    Instruction* code = opt->code;
+    int at[2];
+    if (code[i].op != OP_GET_LOCAL || !window(opt, i, at, 2)) return false;
+    if (code[at[1]].op != OP_GET_LOCAL) return false;
+    
+    rewrite(&code[i], OP_GET_LOCAL2, 3);
+    code[i].operands[1] = code[at[1]].operands[0];
+    removeAll(opt, at, 1, 2);
+    return true;
+}
+
+/* CONSTANT k; ADD */
+static bool fuseAddConstant(Optimizer* opt, int i) {
+    Instruction* code = opt->code;
+    int at[2];
+    if (code[i].op != OP_CONSTANT || !window(opt, i, at, 2)) return false;
+    if (code[at[1]].op != OP_ADD) return false;
+    
+    rewrite(&code[i], OP_ADD_CONSTANT, 2);
+    removeAll(opt, at, 1, 2);
+    return true;
+}
+
+/* Longest pattern first: an increment starts with a GET_LOCAL that would
+ * otherwise pair with the next one */
+static void fuseInstructions(Optimizer* opt) {
+    markTargets(opt);
+    for (int i = nextLive(opt, 0); i < opt->count; i = nextLive(opt, i + 1)) {
+        if (fuseIncrementLocal(opt, i)) continue;
+        if (fuseCompareJump(opt, i)) continue;
+        if (fuseGetLocals(opt, i)) continue;
+        fuseAddConstant(opt, i);
+    }
+}
+
+/* ============================================================================
+ * CONTROL FLOW
+ * ============================================================================ */
+
+/* A jump landing on JUMP or LOOP goes straight to where that one lands.
+ * Only unconditional jumps may end up going backwards (as a LOOP) */
+static void threadJumps(Optimizer* opt) {
+    for (int i = nextLive(opt, 0); i < opt->count; i = nextLive(opt, i + 1)) {
+        Instruction* instruction = &opt->code[i];
+        if (!isJump(instruction->op)) continue;
+    
+        bool unconditional = instruction->op == OP_JUMP || instruction->op == OP_LOOP;
+        for (int hop = 0; hop < THREAD_HOPS_MAX; hop++) {
+            int landing = nextLive(opt, instruction->target);
+            if (landing >= opt->count) break;
+    
+            Instruction* next = &opt->code[landing];
+            if (next->op != OP_JUMP && next->op != OP_LOOP) break;
+            if (!unconditional && next->target <= i) break;
+            instruction->target = next->target;
+        }
+    }
+}
+
+/* Drops everything no path from the entry reaches: code after a RETURN,
+ * after a loop's back edge, and jumps nothing lands on any more */
+static void removeUnreachable(Optimizer* opt) {
+    bool* reached = calloc(opt->count, sizeof(bool));
+    int* worklist = malloc(sizeof(int) * (opt->count * 2 + 1));
+    int pending = 0;
+    
+    worklist[pending++] = nextLive(opt, 0);
+    while (pending > 0) {
+        int i = worklist[--pending];
+        if (i >= opt->count || reached[i]) continue;
+        reached[i] = true;
+    
+        Instruction* instruction = &opt->code[i];
+        if (isJump(instruction->op)) {
+            worklist[pending++] = nextLive(opt, instruction->target);
+        }
+        if (instruction->op != OP_RETURN && instruction->op != OP_JUMP && instruction->op != OP_LOOP) {
+            worklist[pending++] = nextLive(opt, i + 1);
+        }
+    }
+    
+    for (int i = 0; i < opt->count; i++) {
+        if (!reached[i]) opt->code[i].removed = true;
+    }
+    free(reached);
+    free(worklist);
+}
+
+/* A JUMP to the instruction right after it, left behind by the other passes */
+static void removeJumpsToNext(Optimizer* opt) {
+    for (int i = nextLive(opt, 0); i < opt->count; i = nextLive(opt, i + 1)) {
+        Instruction* instruction = &opt->code[i];
+        if (instruction->op == OP_JUMP &&
+            nextLive(opt, instruction->target) == nextLive(opt, i + 1)) {
+            instruction->removed = true;
+        }
+    }
+}
+
+/* ============================================================================
+ * ENCODING
+ * ============================================================================ */
+
+/* Writes the surviving instructions back over the chunk's code and lines.
+ * Fails, leaving the chunk untouched, if a jump no longer fits its operand */
+static bool encode(Optimizer* opt) {
+    Chunk* chunk = opt->chunk;
+    
+    // A removed instruction's position is that of the next one still there,
+    // which is where a jump landing on it now goes
+    int* position = malloc(sizeof(int) * (opt->count + 1));
+    int size = 0;
+    for (int i = 0; i < opt->count; i++) {
+        position[i] = size;
+        if (!opt->code[i].removed) size += opt->code[i].length;
+    }
+    position[opt->count] = size;
+    
+    uint8_t* code = malloc(size > 0 ? size : 1);
+    int* lines = malloc(sizeof(int) * (size > 0 ? size : 1));
+    bool ok = size <= chunk->count;
+    
+    for (int i = 0; i < opt->count && ok; i++) {
+        Instruction* instruction = &opt->code[i];
+        if (instruction->removed) continue;
+    
+        int start = position[i];
+        int end = start + instruction->length;
+        uint8_t op = instruction->op;
+    
+        if (isJump(op)) {
+            int destination = position[instruction->target];
+            int jump = destination - end;
+            if (op == OP_JUMP || op == OP_LOOP) {
+                op = jump >= 0 ? OP_JUMP : OP_LOOP;
+                if (jump < 0) jump = -jump;
+            }
+            if (jump < 0 || jump > UINT16_MAX) {
+                ok = false;
+                break;
+            }
+            if (op == OP_FOR_ITER) code[start + 1] = instruction->operands[0];
+            code[end - 2] = (jump >> 8) & 0xff;
+            code[end - 1] = jump & 0xff;
+        } else if (instruction->length > 3) {
+            // Never rewritten: CLOSURE, the property ops and INVOKE
+            memcpy(code + start + 1, chunk->code + instruction->offset + 1, instruction->length - 1);
+        } else {
+            for (int k = 1; k < instruction->length; k++) {
+                code[start + k] = instruction->operands[k - 1];
+            }
+        }
+        code[start] = op;
+        for (int k = start; k < end; k++) lines[k] = instruction->line;
+    }
+    
+    if (ok) {
+        memcpy(chunk->code, code, size);
+        memcpy(chunk->lines, lines, sizeof(int) * size);
+        chunk->count = size;
+    }
+    free(position);
+    free(code);
+    free(lines);
+    return ok;
+}
+
+void optimizeChunk(Chunk* chunk) {
+    if (chunk->count == 0) return;
+    
+    Optimizer opt;
+    opt.chunk = chunk;
+    opt.code = malloc(sizeof(Instruction) * chunk->count);
+    opt.isTarget = malloc(sizeof(bool) * (chunk->count + 1));
+    opt.count = 0;
+    
+    if (decode(&opt)) {
+        while (foldConstants(&opt)) {
+        }
+        removeUnreachable(&opt);
+        fuseInstructions(&opt);
+        threadJumps(&opt);
+        removeUnreachable(&opt);
+        removeJumpsToNext(&opt);
+        encode(&opt);
+    }
+    
+    free(opt.code);
+    free(opt.isTarget);
+}
@@ -10,18 +10,40 @@
  * ============================================================================ */
 
 Env* env_create(Env* parent) {
+    return env_create_sized(parent, 64);
+}
+
+Env* env_create_sized(Env* parent, int capacity) {
     Env* env = malloc(sizeof(Env));
-    env->vars = malloc(sizeof(Variable) * 64);
+    env->vars = capacity > 0 ? malloc(sizeof(Variable) * capacity) : NULL;
     env->var_count = 0;
-    env->var_capacity = 64;
+    env->var_capacity = capacity;
     env->parent = parent;
+    env->mark_epoch = 0;
+    env->remembered = false;
     return env;
 }
 
+/* Pooled frames keep their slots in the same block, right after the Env */
+static bool env_vars_inline(Env* env) {
+    return env->vars == (Variable*)(env + 1);
+}
+
+static void env_grow(Env* env, int capacity) {
+    if (env_vars_inline(env)) {
+        Variable* vars = malloc(sizeof(Variable) * capacity);
+        memcpy(vars, env->vars, sizeof(Variable) * env->var_count);
+        env->vars = vars;
+    } else {
+        env->vars = realloc(env->vars, sizeof(Variable) * capacity);
+    }
+    env->var_capacity = capacity;
+}
+
 void env_define(Env* env, const char* name, Value value, bool is_const) {
     // Check if already defined in this scope
     for (int i = 0; i < env->var_count; i++) {
-        if (strcmp(env->vars[i].name, name) == 0) {
+        if (env->vars[i].name != NULL && strcmp(env->vars[i].name, name) == 0) {
             env->vars[i].value = value;
             return;
         }
@@ -29,21 +51,21 @@ void env_define(Env* env, const char* name, Value value, bool is_const) {
     
     // Grow if needed
     if (env->var_count >= env->var_capacity) {
-        env->var_capacity *= 2;
-        env->vars = realloc(env->vars, sizeof(Variable) * env->var_capacity);
+        env_grow(env, env->var_capacity < 8 ? 8 : env->var_capacity * 2);
     }
     
     // Add new variable
     env->vars[env->var_count].name = strdup(name);
     env->vars[env->var_count].value = value;
     env->vars[env->var_count].is_const = is_const;
+    env->vars[env->var_count].owns_name = true;
     env->var_count++;
 }
 
 Value* env_get(Env* env, const char* name) {
     // Search in current scope
     for (int i = 0; i < env->var_count; i++) {
-        if (strcmp(env->vars[i].name, name) == 0) {
+        if (env->vars[i].name != NULL && strcmp(env->vars[i].name, name) == 0) {
             return &env->vars[i].value;
         }
     }
@@ -59,7 +81,7 @@ Value* env_get(Env* env, const char* name) {
 bool env_set(Env* env, const char* name, Value value) {
     // Search in current scope
     for (int i = 0; i < env->var_count; i++) {
-        if (strcmp(env->vars[i].name, name) == 0) {
+        if (env->vars[i].name != NULL && strcmp(env->vars[i].name, name) == 0) {
             if (env->vars[i].is_const) {
                 fprintf(stderr, "[ERROR] Cannot reassign constant '%s'\n", name);
                 return false;
@@ -77,14 +99,141 @@ bool env_set(Env* env, const char* name, Value value) {
     return false;
 }
 
+/* ============================================================================
+ * RESOLVED (SLOT) ACCESS
+ * ============================================================================ */
+
+/*
+ * Reserve `count` undefined slots for the locals the resolver found in this
+ * scope. A slot stays invisible to name lookups until it is defined.
+ */
+void env_reserve(Env* env, int count) {
+    if (count > env->var_capacity) {
+        env_grow(env, count);
+    }
+    
+    for (int i = env->var_count; i < count; i++) {
+        env->vars[i].name = NULL;
+        env->vars[i].value = value_null();
+        env->vars[i].is_const = false;
+        env->vars[i].owns_name = false;
+    }
+    if (count > env->var_count) env->var_count = count;
+}
+
+/* `name` must outlive the Env; callers pass names owned by the AST */
+void env_define_at(Env* env, int slot, const char* name, Value value, bool is_const) {
+    Variable* var = &env->vars[slot];
+    if (var->name == NULL) {
+        var->name = (char*)name;
+        var->is_const = is_const;
+    }
+    var->value = value;
+}
+
+/*
+ * A slot that has not been defined yet (e.g. read before its `var` ran)
+ * falls back to a name lookup from the use site, which is exactly what an
+ * unresolved access would have found.
+ */
+Value* env_get_at(Env* env, int depth, int slot, const char* name) {
+    Env* target = env;
+    for (int i = 0; i < depth; i++) target = target->parent;
+    
+    Variable* var = &target->vars[slot];
+    if (var->name != NULL) return &var->value;
+    
+    return env_get(env, name);
+}
+
+bool env_set_at(Env* env, int depth, int slot, const char* name, Value value) {
+    Env* target = env;
+    for (int i = 0; i < depth; i++) target = target->parent;
+    
+    Variable* var = &target->vars[slot];
+    if (var->name == NULL) return env_set(env, name, value);
+    
+    if (var->is_const) {
+        fprintf(stderr, "[ERROR] Cannot reassign constant '%s'\n", name);
+        return false;
+    }
+    var->value = value;
+    return true;
+}
+
 void env_free(Env* env) {
     if (env == NULL) return;
     
     for (int i = 0; i < env->var_count; i++) {
-        free(env->vars[i].name);
+        if (env->vars[i].owns_name) free(env->vars[i].name);
         // Don't free values as they might be shared
     }
     
-    free(env->vars);
+    if (!env_vars_inline(env)) free(env->vars);
     free(env);
 }
+
+/* ============================================================================
+ * FRAME POOL
+ * ============================================================================ */
+
+void env_pool_init(EnvPool* pool) {
+    for (int i = 0; i < ENV_POOL_CLASSES; i++) {
+        pool->free_lists[i] = NULL;
+    }
+}
+
+/*
+ * Get a frame with exactly `slot_count` reserved slots. Frames come from a
+ * per-size free list; a new one is a single allocation holding the Env and
+ * its slots.
+ */
+Env* env_acquire(EnvPool* pool, Env* parent, int slot_count) {
+    Env* env = NULL;
+    
+    if (slot_count < ENV_POOL_CLASSES && pool->free_lists[slot_count] != NULL) {
+        env = pool->free_lists[slot_count];
+        pool->free_lists[slot_count] = env->parent;
+    } else {
+        env = malloc(sizeof(Env) + sizeof(Variable) * slot_count);
+        env->vars = (Variable*)(env + 1);
+        env->var_capacity = slot_count;
+        env->mark_epoch = 0;
+        env->remembered = false;
+    }
+    
+    env->var_count = 0;
+    env->parent = parent;
+    env_reserve(env, slot_count);
+    return env;
+}
+
+void env_release(EnvPool* pool, Env* env) {
+    if (env == NULL) return;
+    
+    // Frames that grew past their slots (name-based defines) are not reused
+    int size = env->var_capacity;
+    if (!env_vars_inline(env) || size >= ENV_POOL_CLASSES) {
+        env_free(env);
+        return;
+    }
+    
+    for (int i = 0; i < env->var_count; i++) {
+        if (env->vars[i].owns_name) free(env->vars[i].name);
+    }
+    
+    env->parent = pool->free_lists[size];
+    pool->free_lists[size] = env;
+}
+
+void env_pool_free(EnvPool* pool) {
+    for (int i = 0; i < ENV_POOL_CLASSES; i++) {
+        Env* env = pool->free_lists[i];
+        while (env != NULL) {
+            Env* next = env->parent;
+            free(env);
+            env = next;
+        }
+        pool->free_lists[i] = NULL;
+    }
+}
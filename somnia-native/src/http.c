@@ -0,0 +1,417 @@
+/*
+ * Somnia Programming Language
+ * Native HTTP/1.1 Request Parser
+ *
+ * The parser walks the caller's buffer in place: the request line, headers
+ * and chunk framing are kept as spans into it, and only the fields handed
+ * back to the program are copied into values. A request still arriving is
+ * reported as incomplete and its head parsed again once more bytes are
+ * appended; a chunked body is walked from where the caller's HttpChunkScan
+ * left off, so each chunk is scanned once. Lines are found with memchr,
+ * which the C library vectorizes.
+ */
+
+#include "../include/somnia.h"
+
+/* Largest request line plus headers; a longer head is rejected */
+#define HTTP_MAX_HEAD (64 * 1024)
+#define HTTP_MAX_HEADERS 100
+#define HTTP_MAX_HEADER_NAME 255
+
+/* Content-Length and chunk sizes above this are rejected */
+#define HTTP_MAX_BODY ((size_t)1 << 40)
+
+typedef struct {
+    const char* start;
+    size_t length;
+} HttpSpan;
+
+typedef struct {
+    HttpSpan name;
+    HttpSpan value;
+} HttpHeader;
+
+typedef enum {
+    HTTP_PARSED,
+    HTTP_INCOMPLETE,
+    HTTP_INVALID,
+} HttpResult;
+
+typedef struct {
+    HttpSpan method;
+    HttpSpan target;
+    HttpSpan version;
+    HttpHeader headers[HTTP_MAX_HEADERS];
+    int header_count;
+    size_t head_length;         // Request line and headers, blank line included
+    size_t body_length;         // Decoded length for chunked bodies
+    size_t length;              // Whole request, framing included
+    bool chunked;
+    const char* error;
+} HttpRequest;
+
+/* Characters of a method or header name (RFC 9110 tchar), by ASCII code */
+static const bool token_chars[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 1, 0, 1, 1, 1, 1, 1, 0, 0, 1, 1, 0, 1, 1, 0,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0,
+    0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 1, 0, 1, 0,
+};
+
+static bool is_token_char(char c) {
+    return token_chars[(unsigned char)c];
+}
+
+static bool span_equals(HttpSpan span, const char* text) {
+    size_t length = strlen(text);
+    if (span.length != length) return false;
+    for (size_t i = 0; i < length; i++) {
+        if (tolower((unsigned char)span.start[i]) != text[i]) return false;
+    }
+    return true;
+}
+
+/* Next line from `at`, without its CRLF (or bare LF); false if none ends before `end` */
+static bool next_line(const char* at, const char* end, HttpSpan* line, const char** next) {
+    const char* newline = memchr(at, '\n', (size_t)(end - at));
+    if (newline == NULL) return false;
+    
+    line->start = at;
+    line->length = (size_t)(newline - at);
+    if (line->length > 0 && at[line->length - 1] == '\r') line->length--;
+    *next = newline + 1;
+    return true;
+}
+
+static HttpResult invalid(HttpRequest* request, const char* error) {
+    request->error = error;
+    return HTTP_INVALID;
+}
+
+static HttpResult parse_request_line(HttpSpan line, HttpRequest* request) {
+    const char* at = line.start;
+    const char* end = line.start + line.length;
+    
+    request->method.start = at;
+    while (at < end && is_token_char(*at)) at++;
+    request->method.length = (size_t)(at - request->method.start);
+    if (request->method.length == 0 || at == end || *at != ' ') {
+        return invalid(request, "malformed request line");
+    }
+    
+    request->target.start = ++at;
+    while (at < end && *at != ' ') at++;
+    request->target.length = (size_t)(at - request->target.start);
+    if (request->target.length == 0 || at == end) return invalid(request, "malformed request line");
+    
+    request->version.start = at + 1;
+    request->version.length = (size_t)(end - request->version.start);
+    if (request->version.length != 8 || memcmp(request->version.start, "HTTP/1.", 7) != 0 ||
+        (request->version.start[7] != '0' && request->version.start[7] != '1')) {
+        return invalid(request, "unsupported HTTP version");
+    }
+    return HTTP_PARSED;
+}
+
+static HttpResult parse_header(HttpSpan line, HttpRequest* request) {
+    if (line.start[0] == ' ' || line.start[0] == '\t') return invalid(request, "folded header line");
+    if (request->header_count == HTTP_MAX_HEADERS) return invalid(request, "too many headers");
+    
+    const char* at = line.start;
+    const char* end = line.start + line.length;
+    HttpHeader* header = &request->headers[request->header_count++];
+    
+    header->name.start = at;
+    while (at < end && is_token_char(*at)) at++;
+    header->name.length = (size_t)(at - line.start);
+    if (header->name.length == 0 || at == end || *at != ':') return invalid(request, "malformed header");
+    if (header->name.length > HTTP_MAX_HEADER_NAME) return invalid(request, "header name too long");
+    
+    // Value without the whitespace around it
+    at++;
+    while (at < end && (*at == ' ' || *at == '\t')) at++;
+    while (end > at && (end[-1] == ' ' || end[-1] == '\t')) end--;
+    header->value.start = at;
+    header->value.length = (size_t)(end - at);
+    return HTTP_PARSED;
+}
+
+static HttpResult parse_head(const char* buffer, size_t length, HttpRequest* request) {
+    const char* at = buffer;
+    const char* end = buffer + length;
+    HttpSpan line;
+    const char* next;
+    
+    // Empty lines before the request line are skipped (RFC 9112, 2.2)
+    do {
+        if (!next_line(at, end, &line, &next)) goto incomplete;
+        at = next;
+    } while (line.length == 0);
+    if (parse_request_line(line, request) != HTTP_PARSED) return HTTP_INVALID;
+    
+    for (;;) {
+        if (!next_line(at, end, &line, &next)) goto incomplete;
+        at = next;
+        if (line.length == 0) break;
+        if (parse_header(line, request) != HTTP_PARSED) return HTTP_INVALID;
+    }
+    
+    request->head_length = (size_t)(at - buffer);
+    if (request->head_length > HTTP_MAX_HEAD) return invalid(request, "request head too large");
+    return HTTP_PARSED;
+
+incomplete:
+    if (length > HTTP_MAX_HEAD) return invalid(request, "request head too large");
+    return HTTP_INCOMPLETE;
+}
+
+static bool parse_content_length(HttpSpan value, size_t* length) {
+    if (value.length == 0) return false;
+    size_t result = 0;
+    for (size_t i = 0; i < value.length; i++) {
+        if (!isdigit((unsigned char)value.start[i])) return false;
+        result = result * 10 + (size_t)(value.start[i] - '0');
+        if (result > HTTP_MAX_BODY) return false;
+    }
+    *length = result;
+    return true;
+}
+
+/*
+ * Walks the chunked body at `body` from where `scan` stopped, copying the
+ * data into `out` when it is not NULL, and moves `scan` past each chunk and
+ * trailer line as it is completed. Sets the bytes the framing took,
+ * trailers included.
+ */
+static HttpResult scan_chunks(const char* body, const char* end, char* out,
+                              HttpChunkScan* scan, size_t* consumed, HttpRequest* request) {
+    const char* at = body + scan->offset;
+    HttpSpan line;
+    const char* next;
+    
+    while (!scan->trailers) {
+        if (!next_line(at, end, &line, &next)) return HTTP_INCOMPLETE;
+        
+        // Hex size, then extensions that are ignored
+        size_t size = 0;
+        size_t digits = 0;
+        while (digits < line.length && isxdigit((unsigned char)line.start[digits])) {
+            char c = (char)tolower((unsigned char)line.start[digits]);
+            size = size * 16 + (size_t)(isdigit((unsigned char)c) ? c - '0' : c - 'a' + 10);
+            if (size > HTTP_MAX_BODY) return invalid(request, "chunk too large");
+            digits++;
+        }
+        if (digits == 0 || (digits < line.length && line.start[digits] != ';' &&
+                            line.start[digits] != ' ' && line.start[digits] != '\t')) {
+            return invalid(request, "malformed chunk size");
+        }
+        if (size == 0) {
+            at = next;
+            scan->trailers = true;
+            scan->offset = (size_t)(at - body);
+            break;
+        }
+        
+        if ((size_t)(end - next) < size + 2) return HTTP_INCOMPLETE;
+        at = next;
+        if (at[size] != '\r' || at[size + 1] != '\n') return invalid(request, "malformed chunk");
+        if (out != NULL) memcpy(out + scan->decoded, at, size);
+        scan->decoded += size;
+        at += size + 2;
+        scan->offset = (size_t)(at - body);
+    }
+    
+    // Trailer fields, up to the blank line
+    do {
+        if (!next_line(at, end, &line, &next)) return HTTP_INCOMPLETE;
+        at = next;
+        scan->offset = (size_t)(at - body);
+    } while (line.length > 0);
+    
+    *consumed = (size_t)(at - body);
+    return HTTP_PARSED;
+}
+
+static HttpResult parse_request(const char* buffer, size_t length, HttpRequest* request,
+                                HttpChunkScan* scan) {
+    memset(request, 0, sizeof(HttpRequest));
+    HttpResult result = parse_head(buffer, length, request);
+    if (result != HTTP_PARSED) return result;
+    
+    bool has_length = false;
+    for (int i = 0; i < request->header_count; i++) {
+        HttpHeader* header = &request->headers[i];
+        if (span_equals(header->name, "content-length")) {
+            size_t body_length;
+            if (!parse_content_length(header->value, &body_length) ||
+                (has_length && body_length != request->body_length)) {
+                return invalid(request, "invalid content-length");
+            }
+            request->body_length = body_length;
+            has_length = true;
+        } else if (span_equals(header->name, "transfer-encoding")) {
+            if (!span_equals(header->value, "chunked") || request->chunked) {
+                return invalid(request, "unsupported transfer-encoding");
+            }
+            request->chunked = true;
+        }
+    }
+    if (has_length && request->chunked) return invalid(request, "both content-length and chunked");
+    
+    const char* body = buffer + request->head_length;
+    const char* end = buffer + length;
+    if (request->chunked) {
+        size_t consumed;
+        result = scan_chunks(body, end, NULL, scan, &consumed, request);
+        if (result != HTTP_PARSED) return result;
+        request->body_length = scan->decoded;
+        request->length = request->head_length + consumed;
+    } else {
+        if ((size_t)(end - body) < request->body_length) return HTTP_INCOMPLETE;
+        request->length = request->head_length + request->body_length;
+    }
+    return HTTP_PARSED;
+}
+
+/* Connection is a comma-separated list of options, e.g. "keep-alive, Upgrade" */
+static bool wants_keep_alive(HttpRequest* request) {
+    bool keep_alive = request->version.start[7] == '1';
+    for (int i = 0; i < request->header_count; i++) {
+        HttpHeader* header = &request->headers[i];
+        if (!span_equals(header->name, "connection")) continue;
+        
+        const char* at = header->value.start;
+        const char* end = at + header->value.length;
+        while (at < end) {
+            const char* comma = memchr(at, ',', (size_t)(end - at));
+            HttpSpan option = { at, (size_t)((comma != NULL ? comma : end) - at) };
+            at = comma != NULL ? comma + 1 : end;
+            
+            while (option.length > 0 && (*option.start == ' ' || *option.start == '\t')) {
+                option.start++;
+                option.length--;
+            }
+            while (option.length > 0 && (option.start[option.length - 1] == ' ' ||
+                                         option.start[option.length - 1] == '\t')) {
+                option.length--;
+            }
+            if (span_equals(option, "close")) return false;
+            if (span_equals(option, "keep-alive")) keep_alive = true;
+        }
+    }
+    return keep_alive;
+}
+
+/* Header map with lowercase names; repeated fields are joined with ", " */
+static Value header_map(HttpRequest* request) {
+    Value headers = value_map();
+    char name[HTTP_MAX_HEADER_NAME + 1];
+    for (int i = 0; i < request->header_count; i++) {
+        HttpHeader* header = &request->headers[i];
+        for (size_t c = 0; c < header->name.length; c++) {
+            name[c] = (char)tolower((unsigned char)header->name.start[c]);
+        }
+        name[header->name.length] = '\0';
+        
+        Value* existing = map_get(headers.as.map, name);
+        if (existing == NULL) {
+            map_set(headers.as.map, name, value_string_len(header->value.start, (int)header->value.length));
+            continue;
+        }
+        
+        size_t length = existing->as.string->length + 2 + header->value.length;
+        char* joined = malloc(length + 1);
+        memcpy(joined, existing->as.string->chars, existing->as.string->length);
+        memcpy(joined + existing->as.string->length, ", ", 2);
+        memcpy(joined + existing->as.string->length + 2, header->value.start, header->value.length);
+        map_set(headers.as.map, name, value_string_len(joined, (int)length));
+        free(joined);
+    }
+    return headers;
+}
+
+/*
+ * Request map for the bytes at `buffer`, null while they hold only part of
+ * a request, or { "error": message }. Offsets in the map count from `base`;
+ * `consumed` is set to the request's length when one is parsed. `scan` is
+ * kept by the caller across calls for the same request, or NULL to walk a
+ * chunked body from its start.
+ */
+Value http_parse_request(const char* buffer, size_t length, size_t base, size_t* consumed,
+                         HttpChunkScan* scan) {
+    HttpChunkScan fresh = {0, 0, false};
+    if (scan == NULL) scan = &fresh;
+    
+    HttpRequest request;
+    HttpResult result = parse_request(buffer, length, &request, scan);
+    if (result == HTTP_INCOMPLETE) return value_null();
+    if (result == HTTP_INVALID) {
+        Value error = value_map();
+        map_set(error.as.map, "error", value_string(request.error));
+        return error;
+    }
+    
+    HttpSpan path = request.target;
+    HttpSpan query = { request.target.start + request.target.length, 0 };
+    const char* mark = memchr(path.start, '?', path.length);
+    if (mark != NULL) {
+        path.length = (size_t)(mark - path.start);
+        query.start = mark + 1;
+        query.length = request.target.length - path.length - 1;
+    }
+    
+    Value body;
+    if (request.chunked) {
+        // The framing is known to be whole now; one more pass copies the data
+        char* decoded = malloc(request.body_length + 1);
+        HttpChunkScan copy = {0, 0, false};
+        size_t framing;
+        scan_chunks(buffer + request.head_length, buffer + request.length, decoded,
+                    &copy, &framing, &request);
+        body = value_string_len(decoded, (int)copy.decoded);
+        free(decoded);
+    } else {
+        body = value_string_len(buffer + request.head_length, (int)request.body_length);
+    }
+    
+    Value parsed = value_map();
+    map_set(parsed.as.map, "method", value_string_len(request.method.start, (int)request.method.length));
+    map_set(parsed.as.map, "path", value_string_len(path.start, (int)path.length));
+    map_set(parsed.as.map, "query", value_string_len(query.start, (int)query.length));
+    map_set(parsed.as.map, "version", value_string_len(request.version.start, (int)request.version.length));
+    map_set(parsed.as.map, "headers", header_map(&request));
+    map_set(parsed.as.map, "body", body);
+    map_set(parsed.as.map, "body_offset", value_number((double)(base + request.head_length)));
+    map_set(parsed.as.map, "keep_alive", value_bool(wants_keep_alive(&request)));
+    map_set(parsed.as.map, "end", value_number((double)(base + request.length)));
+    *consumed = request.length;
+    return parsed;
+}
+
+/*
+ * native_http_parse(buf: string, start?: number) -> request: map | null
+ * Parses the request at `start` (0 by default). Returns null while the
+ * request is incomplete and { "error": message } when it is malformed.
+ * Otherwise the map has method, path, query, version, headers, body,
+ * body_offset, keep_alive and end, the offset just past the request where
+ * a pipelined one would start.
+ */
+Value native_http_parse(Value* args, int arg_count, Env* env) {
+    (void)env;
+    if (arg_count < 1 || args[0].type != VAL_STRING ||
+        (arg_count > 1 && args[1].type != VAL_NUMBER)) {
+        fprintf(stderr, "[HTTP ERROR] native_http_parse expects (buf: string, start?: number)\n");
+        return value_null();
+    }
+    
+    String* buffer = args[0].as.string;
+    size_t start = arg_count > 1 && args[1].as.number > 0 ? (size_t)args[1].as.number : 0;
+    if (start > (size_t)buffer->length) start = (size_t)buffer->length;
+    
+    size_t consumed;
+    return http_parse_request(buffer->chars + start, (size_t)buffer->length - start, start, &consumed, NULL);
+}
@@ -24,6 +24,8 @@ Interpreter* interpreter_create(void) {
     interp->return_value = value_null();
     interp->recur_depth = 0;
     interp->temp_count = 0;
+    interp->frame_count = 0;
+    env_pool_init(&interp->frame_pool);
     interp->cognitive_state = env_create(NULL);
     interp->vfs = value_map().as.map;
     
@@ -36,7 +38,9 @@ Interpreter* interpreter_create(void) {
 void interpreter_free(Interpreter* interp) {
     if (interp != NULL) {
         env_free(interp->global_env);
+        env_pool_free(&interp->frame_pool);
         free_objects();
+        shape_free_all();
         free(interp);
     }
 }
@@ -45,10 +49,16 @@ void interpreter_free(Interpreter* interp) {
  * GC SHADOW STACK HELPERS
  * ============================================================================ */
 
+/*
+ * A collection can run at any statement boundary, so a value held in a C
+ * local across a nested evaluate() or execute() must be pushed here first.
+ * Past the end of the arrays only the counts move (gc_collect then skips).
+ */
 static void gc_push_temp(Interpreter* interp, Value v) {
     if (interp->temp_count < MAX_TEMP_STACK) {
-        interp->temp_stack[interp->temp_count++] = v;
+        interp->temp_stack[interp->temp_count] = v;
     }
+    interp->temp_count++;
 }
 
 static void gc_pop_temp(Interpreter* interp) {
@@ -57,6 +67,26 @@ static void gc_pop_temp(Interpreter* interp) {
     }
 }
 
+/* Read back a pushed value: a minor collection may have moved its object */
+static Value gc_temp(Interpreter* interp, int index, Value pushed) {
+    // Past the array nothing was recorded, and no collection could run
+    return index < MAX_TEMP_STACK ? interp->temp_stack[index] : pushed;
+}
+
+/* Same for a current_env set aside while a call or loop body runs */
+static void gc_push_frame(Interpreter* interp, Env* env) {
+    if (interp->frame_count < MAX_FRAME_STACK) {
+        interp->frame_stack[interp->frame_count] = env;
+    }
+    interp->frame_count++;
+}
+
+static void gc_pop_frame(Interpreter* interp) {
+    if (interp->frame_count > 0) {
+        interp->frame_count--;
+    }
+}
+
 /* ============================================================================
  * EXPRESSION EVALUATION
  * ============================================================================ */
@@ -76,13 +106,20 @@ static Value eval_binary(Interpreter* interp, ASTNode* node) {
     }
     
     Value right;
+    int temp = interp->temp_count;
+    gc_push_temp(interp, left);
     right = evaluate(interp, node->as.binary.right);
+    left = gc_temp(interp, temp, left);
+    gc_pop_temp(interp);
     
     switch (node->as.binary.op) {
         case TOKEN_PLUS:
             if (left.type == VAL_NUMBER && right.type == VAL_NUMBER) {
                 return value_number(left.as.number + right.as.number);
             }
+            if (left.type == VAL_STRING && right.type == VAL_STRING) {
+                return value_string_concat(left.as.string, right.as.string);
+            }
             if (left.type == VAL_STRING || right.type == VAL_STRING) {
                 char* ls = value_to_string(left);
                 char* rs = value_to_string(right);
@@ -151,10 +188,10 @@ static Value eval_binary(Interpreter* interp, ASTNode* node) {
                 return value_bool(false);
             }
             if (right.type == VAL_MAP && left.type == VAL_STRING) {
-                return value_bool(map_has(right.as.map, left.as.string));
+                return value_bool(map_has(right.as.map, left.as.string->chars));
             }
             if (right.type == VAL_STRING && left.type == VAL_STRING) {
-                return value_bool(strstr(right.as.string, left.as.string) != NULL);
+                return value_bool(strstr(right.as.string->chars, left.as.string->chars) != NULL);
             }
             break;
         
@@ -181,10 +218,26 @@ static Value eval_unary(Interpreter* interp, ASTNode* node) {
     return value_null();
 }
 
+static Value function_from_decl(Interpreter* interp, ASTNode* decl) {
+    Value val;
+    val = value_function(interp->current_env);
+    Function* fn = val.as.function;
+    
+    // Names are borrowed: the AST outlives every function made from it
+    fn->name = decl->as.fun_decl.name ? decl->as.fun_decl.name : "anonymous";
+    fn->params = decl->as.fun_decl.params;
+    fn->param_count = decl->as.fun_decl.param_count;
+    fn->body = decl->as.fun_decl.body;
+    fn->local_count = decl->as.fun_decl.local_count;
+    fn->captured = decl->as.fun_decl.captured;
+    return val;
+}
+
 static Value eval_call(Interpreter* interp, ASTNode* node) {
     Value callee;
     Value self_val;
     bool has_self = false;
+    int temp_base = interp->temp_count;
     
     self_val = value_null();
 
@@ -192,7 +245,9 @@ static Value eval_call(Interpreter* interp, ASTNode* node) {
     if (node->as.call.callee->type == AST_GET) {
         self_val = evaluate(interp, node->as.call.callee->as.get_expr.object);
         if (self_val.type == VAL_OBJECT) {
-            Value* method_ptr = env_get(self_val.as.object->fields, node->as.call.callee->as.get_expr.property);
+            ASTNode* get = node->as.call.callee;
+            Value* method_ptr = object_get_cached(self_val.as.object, get->as.get_expr.property,
+                                                  &get->as.get_expr.cache);
             if (method_ptr != NULL) {
                 callee = *method_ptr;
                 has_self = true;
@@ -208,6 +263,8 @@ static Value eval_call(Interpreter* interp, ASTNode* node) {
     } else {
         callee = evaluate(interp, node->as.call.callee);
     }
+    gc_push_temp(interp, self_val);
+    gc_push_temp(interp, callee);
     
     // Evaluate arguments
     Value args[MAX_ARGS];
@@ -215,46 +272,140 @@ static Value eval_call(Interpreter* interp, ASTNode* node) {
     if (arg_count > MAX_ARGS) arg_count = MAX_ARGS;
     for (int i = 0; i < arg_count; i++) {
         args[i] = evaluate(interp, node->as.call.args[i]);
+        gc_push_temp(interp, args[i]);
+    }
+    self_val = gc_temp(interp, temp_base, self_val);
+    callee = gc_temp(interp, temp_base + 1, callee);
+    for (int i = 0; i < arg_count; i++) {
+        args[i] = gc_temp(interp, temp_base + 2 + i, args[i]);
     }
     
     if (callee.type == VAL_NATIVE_FN) {
-        return callee.as.native_fn(args, arg_count, interp->current_env);
+        Value result = callee.as.native_fn(args, arg_count, interp->current_env);
+        interp->temp_count = temp_base;
+        return result;
     }
     
     if (callee.type == VAL_FUNCTION) {
         Function* fn = callee.as.function;
-        Env* fn_env = env_create(fn->closure);
+        Env* fn_env = env_acquire(&interp->frame_pool, fn->closure, fn->local_count);
         
-        // Bind self/this for method calls
-        if (has_self) {
-            env_define(fn_env, "self", self_val, false);
-            env_define(fn_env, "this", self_val, false);
+        if (fn->local_count > 0) {
+            // Resolved frame: self, this, params, locals
+            if (has_self) {
+                env_define_at(fn_env, FRAME_SELF_SLOT, "self", self_val, false);
+                env_define_at(fn_env, FRAME_THIS_SLOT, "this", self_val, false);
+            }
+            for (int i = 0; i < fn->param_count && i < arg_count; i++) {
+                env_define_at(fn_env, FRAME_PARAM_BASE + i, fn->params[i], args[i], false);
+            }
+        } else {
+            // Bind self/this for method calls
+            if (has_self) {
+                env_define(fn_env, "self", self_val, false);
+                env_define(fn_env, "this", self_val, false);
+            }
+            
+            for (int i = 0; i < fn->param_count && i < arg_count; i++) {
+                env_define(fn_env, fn->params[i], args[i], false);
+            }
         }
         
-        for (int i = 0; i < fn->param_count && i < arg_count; i++) {
-            env_define(fn_env, fn->params[i], args[i], false);
-        }
+        // Frames unresolved or captured by inner closures may outlive the
+        // call; the collector releases them once nothing reaches them
+        bool release = fn->local_count > 0 && !fn->captured;
+        if (!release) gc_track_frame(fn_env);
         
         Env* previous = interp->current_env;
+        gc_push_frame(interp, previous);
         interp->current_env = fn_env;
         execute(interp, fn->body);
         Value result = interp->return_value;
         interp->returning = false;
         interp->return_value = value_null();
         interp->current_env = previous;
-        env_free(fn_env);
+        gc_pop_frame(interp);
+        interp->temp_count = temp_base;
+        if (release) env_release(&interp->frame_pool, fn_env);
         return result;
     }
     
+    interp->temp_count = temp_base;
     fprintf(stderr, "[ERROR] Cannot call non-function value\n");
     return value_null();
 }
 
+/*
+ * Statement `x = x + a + b ...` with x holding a string: evaluate the
+ * operands, then append them to x's string in place (see string_append).
+ * Returns false, having evaluated nothing, if the pattern does not apply.
+ */
+static bool exec_append_assign(Interpreter* interp, ASTNode* assign) {
+    ASTNode* operands[MAX_ARGS];
+    int count = 0;
+    
+    ASTNode* left = assign->as.assign.value;
+    while (left->type == AST_BINARY && left->as.binary.op == TOKEN_PLUS && count < MAX_ARGS) {
+        operands[count++] = left->as.binary.right;
+        left = left->as.binary.left;
+    }
+    if (count == 0 || left->type != AST_VARIABLE ||
+        strcmp(left->as.variable.name, assign->as.assign.name) != 0) {
+        return false;
+    }
+    
+    Value* target = assign->as.assign.depth >= 0
+        ? env_get_at(interp->current_env, assign->as.assign.depth,
+                     assign->as.assign.slot, assign->as.assign.name)
+        : env_get(interp->current_env, assign->as.assign.name);
+    if (target == NULL || target->type != VAL_STRING) return false;
+    
+    // Evaluate every operand first: they may read (and so share) x
+    Value values[MAX_ARGS];
+    int temp_base = interp->temp_count;
+    Value str = *target;
+    gc_push_temp(interp, str);
+    for (int i = count - 1; i >= 0; i--) {
+        values[i] = evaluate(interp, operands[i]);
+        gc_push_temp(interp, values[i]);
+    }
+    for (int i = count - 1; i >= 0; i--) {
+        values[i] = gc_temp(interp, temp_base + count - i, values[i]);
+    }
+    
+    String* s = str.as.string;
+    for (int i = count - 1; i >= 0; i--) {
+        if (values[i].type == VAL_STRING) {
+            s = string_append(s, values[i].as.string->chars, values[i].as.string->length);
+        } else {
+            char* part = value_to_string(values[i]);
+            s = string_append(s, part, (int)strlen(part));
+            free(part);
+        }
+    }
+    str.as.string = s;
+    
+    while (interp->temp_count > temp_base) gc_pop_temp(interp);
+    
+    bool assigned = assign->as.assign.depth >= 0
+        ? env_set_at(interp->current_env, assign->as.assign.depth,
+                     assign->as.assign.slot, assign->as.assign.name, str)
+        : env_set(interp->current_env, assign->as.assign.name, str);
+    if (!assigned) {
+        fprintf(stderr, "[ERROR] Undefined variable '%s'\n", assign->as.assign.name);
+    }
+    return true;
+}
+
 static Value eval_index(Interpreter* interp, ASTNode* node) {
     Value object;
     Value index;
     object = evaluate(interp, node->as.index_expr.object);
+    int temp = interp->temp_count;
+    gc_push_temp(interp, object);
     index = evaluate(interp, node->as.index_expr.index);
+    object = gc_temp(interp, temp, object);
+    gc_pop_temp(interp);
     
     if (object.type == VAL_ARRAY && index.type == VAL_NUMBER) {
         int idx = (int)index.as.number;
@@ -265,17 +416,16 @@ static Value eval_index(Interpreter* interp, ASTNode* node) {
     }
     
     if (object.type == VAL_MAP && index.type == VAL_STRING) {
-        Value* val = map_get(object.as.map, index.as.string);
+        Value* val = map_get(object.as.map, index.as.string->chars);
         return val != NULL ? *val : value_null();
     }
     
     if (object.type == VAL_STRING && index.type == VAL_NUMBER) {
         int idx = (int)index.as.number;
-        if (idx < 0 || idx >= (int)strlen(object.as.string)) {
+        if (idx < 0 || idx >= object.as.string->length) {
             return value_string("");
         }
-        char buf[2] = { object.as.string[idx], '\0' };
-        return value_string(buf);
+        return value_string_len(&object.as.string->chars[idx], 1);
     }
     
     return value_null();
@@ -304,51 +454,42 @@ static Value evaluate_impl(Interpreter* interp, ASTNode* node) {
     
     switch (node->type) {
         case AST_LITERAL:
-            return value_copy(node->as.literal);
+            // Immutable: string literals are pinned, shared Strings
+            return node->as.literal;
         
         case AST_VARIABLE: {
-            Value* val = env_get(interp->current_env, node->as.var_name);
+            Value* val = node->as.variable.depth >= 0
+                ? env_get_at(interp->current_env, node->as.variable.depth,
+                             node->as.variable.slot, node->as.variable.name)
+                : env_get(interp->current_env, node->as.variable.name);
             if (val == NULL) {
-                fprintf(stderr, "[ERROR] Undefined variable '%s'\n", node->as.var_name);
+                fprintf(stderr, "[ERROR] Undefined variable '%s'\n", node->as.variable.name);
                 return value_null();
             }
+            // The string may now be aliased: no more in-place appends
+            if (val->type == VAL_STRING) val->as.string->unique = false;
             return *val;
         }
         
         case AST_OBJECT: {
             Value* klass_ptr = env_get(interp->current_env, node->as.obj_inst.class_name);
-            if (klass_ptr != NULL && klass_ptr->type == VAL_OBJECT && klass_ptr->as.object->ast != NULL) {
-                ASTNode* class_node = klass_ptr->as.object->ast;
+            if (klass_ptr != NULL && klass_ptr->type == VAL_CLASS) {
+                Class* klass = klass_ptr->as.klass;
                 Value obj;
-                obj = value_object(class_node->as.class_decl.name, env_create(interp->global_env));
-                
-                // 1. Initialize registered fields to null
-                for (int i = 0; i < class_node->as.class_decl.field_count; i++) {
-                    env_define(obj.as.object->fields, class_node->as.class_decl.fields[i], value_null(), false);
-                }
+                // 1. Registered fields start out null (klass->instance_shape)
+                obj = value_object(klass);
                 
                 // 2. Assign constructor literal values: Class { field: val }
+                int temp = interp->temp_count;
+                gc_push_temp(interp, obj);
                 for (int i = 0; i < node->as.obj_inst.count; i++) {
                     Value val = evaluate(interp, node->as.obj_inst.values[i]);
-                    if (!env_set(obj.as.object->fields, node->as.obj_inst.fields[i], val)) {
-                        env_define(obj.as.object->fields, node->as.obj_inst.fields[i], val, false);
-                    }
+                    obj = gc_temp(interp, temp, obj);
+                    object_set_field(obj.as.object, node->as.obj_inst.fields[i], val);
                 }
+                gc_pop_temp(interp);
                 
-                for (int i = 0; i < class_node->as.class_decl.method_count; i++) {
-                    ASTNode* m_node = class_node->as.class_decl.methods[i];
-                    Value m_val;
-                    m_val = value_function();
-                    Function* fn = m_val.as.function;
-                    
-                    fn->name = strdup(m_node->as.fun_decl.name);
-                    fn->params = m_node->as.fun_decl.params;
-                    fn->param_count = m_node->as.fun_decl.param_count;
-                    fn->body = m_node->as.fun_decl.body;
-                    fn->closure = interp->current_env;
-                    
-                    env_define(obj.as.object->fields, m_node->as.fun_decl.name, m_val, true);
-                }
+                // Methods live on the class
                 return obj;
             }
             fprintf(stderr, "[ERROR] Class '%s' not found\n", node->as.obj_inst.class_name);
@@ -360,13 +501,20 @@ static Value evaluate_impl(Interpreter* interp, ASTNode* node) {
             Value idx;
             Value val;
             obj = evaluate(interp, node->as.index_set.object);
+            int temp = interp->temp_count;
+            gc_push_temp(interp, obj);
             idx = evaluate(interp, node->as.index_set.index);
+            gc_push_temp(interp, idx);
             val = evaluate(interp, node->as.index_set.value);
+            obj = gc_temp(interp, temp, obj);
+            idx = gc_temp(interp, temp + 1, idx);
+            gc_pop_temp(interp);
+            gc_pop_temp(interp);
             
             if (obj.type == VAL_ARRAY && idx.type == VAL_NUMBER) {
                 array_set(obj.as.array, (int)idx.as.number, val);
             } else if (obj.type == VAL_MAP && idx.type == VAL_STRING) {
-                map_set(obj.as.map, idx.as.string, val);
+                map_set(obj.as.map, idx.as.string->chars, val);
             }
             return val;
         }
@@ -386,7 +534,11 @@ static Value evaluate_impl(Interpreter* interp, ASTNode* node) {
         case AST_ASSIGN: {
             Value val;
             val = evaluate(interp, node->as.assign.value);
-            if (!env_set(interp->current_env, node->as.assign.name, val)) {
+            bool assigned = node->as.assign.depth >= 0
+                ? env_set_at(interp->current_env, node->as.assign.depth,
+                             node->as.assign.slot, node->as.assign.name, val)
+                : env_set(interp->current_env, node->as.assign.name, val);
+            if (!assigned) {
                 fprintf(stderr, "[ERROR] Undefined variable '%s'\n", node->as.assign.name);
             }
             return val;
@@ -395,19 +547,28 @@ static Value evaluate_impl(Interpreter* interp, ASTNode* node) {
         case AST_ARRAY: {
             Value arr;
             arr = value_array();
+            int temp = interp->temp_count;
+            gc_push_temp(interp, arr);
             for (int i = 0; i < node->as.array_lit.count; i++) {
-                array_push(arr.as.array, evaluate(interp, node->as.array_lit.elements[i]));
+                Value item = evaluate(interp, node->as.array_lit.elements[i]);
+                arr = gc_temp(interp, temp, arr);
+                array_push(arr.as.array, item);
             }
+            gc_pop_temp(interp);
             return arr;
         }
         
         case AST_MAP: {
             Value m;
             m = value_map();
+            int temp = interp->temp_count;
+            gc_push_temp(interp, m);
             for (int i = 0; i < node->as.map_lit.count; i++) {
                 Value val = evaluate(interp, node->as.map_lit.values[i]);
+                m = gc_temp(interp, temp, m);
                 map_set(m.as.map, node->as.map_lit.keys[i], val);
             }
+            gc_pop_temp(interp);
             return m;
         }
         
@@ -419,7 +580,8 @@ static Value evaluate_impl(Interpreter* interp, ASTNode* node) {
                 return val != NULL ? *val : value_null();
             }
             if (obj.type == VAL_OBJECT) {
-                Value* val = env_get(obj.as.object->fields, node->as.get_expr.property);
+                Value* val = object_get_cached(obj.as.object, node->as.get_expr.property,
+                                               &node->as.get_expr.cache);
                 return val != NULL ? *val : value_null();
             }
             return value_null();
@@ -429,34 +591,30 @@ static Value evaluate_impl(Interpreter* interp, ASTNode* node) {
             Value obj;
             Value val;
             obj = evaluate(interp, node->as.set_expr.object);
+            int temp = interp->temp_count;
+            gc_push_temp(interp, obj);
             val = evaluate(interp, node->as.set_expr.value);
+            obj = gc_temp(interp, temp, obj);
+            gc_pop_temp(interp);
             
             if (obj.type == VAL_MAP) {
                 map_set(obj.as.map, node->as.set_expr.property, val);
             } else if (obj.type == VAL_OBJECT) {
-                // Try to set existing field, if not found, define it
-                if (!env_set(obj.as.object->fields, node->as.set_expr.property, val)) {
-                    env_define(obj.as.object->fields, node->as.set_expr.property, val, false);
-                }
+                // Set existing field, or add it (shape transition)
+                object_set_cached(obj.as.object, node->as.set_expr.property, val,
+                                  &node->as.set_expr.cache);
             }
             return val;
         }
         
         case AST_FUN_DECL: {
             Value val;
-            val = value_function();
+            val = function_from_decl(interp, node);
             Function* fn = val.as.function;
             
-            fn->name = node->as.fun_decl.name ? strdup(node->as.fun_decl.name) : strdup("anonymous");
-            fn->params = malloc(sizeof(char*) * node->as.fun_decl.param_count);
-            fn->param_count = node->as.fun_decl.param_count;
-            for (int i = 0; i < fn->param_count; i++) {
-                fn->params[i] = strdup(node->as.fun_decl.params[i]);
-            }
-            fn->body = node->as.fun_decl.body;
-            fn->closure = interp->current_env;
-            
-            if (node->as.fun_decl.name) {
+            if (node->as.fun_decl.slot >= 0) {
+                env_define_at(interp->current_env, node->as.fun_decl.slot, node->as.fun_decl.name, val, false);
+            } else if (node->as.fun_decl.name) {
                 env_define(interp->current_env, fn->name, val, false);
             }
             return val;
@@ -474,6 +632,16 @@ static Value evaluate_impl(Interpreter* interp, ASTNode* node) {
 static void execute(Interpreter* interp, ASTNode* node) {
     if (node == NULL || interp->returning || interp->breaking) return;
     
+    // GC safe point
+#ifdef SOMNIA_GC_STRESS
+    static int stress_count = 0;
+    if (++stress_count % 16 == 0) gc_collect(interp);
+    else gc_collect_young(interp);
+#else
+    if (gc_bytes_allocated > gc_next_collection) gc_collect(interp);
+    else if (nursery_top > nursery_limit) gc_collect_young(interp);
+#endif
+    
     switch (node->type) {
         case AST_PROGRAM:
         case AST_BLOCK:
@@ -496,7 +664,13 @@ static void execute(Interpreter* interp, ASTNode* node) {
                 char* source = NULL;
                 Value* vfs_entry = map_get(interp->vfs, full_path);
                 if (vfs_entry != NULL && vfs_entry->type == VAL_STRING) {
-                    source = strdup(vfs_entry->as.string);
+                    String* text = vfs_entry->as.string;
+                    // The lexer stops at the first NUL, so a module holding one is refused
+                    if (memchr(text->chars, '\0', text->length) != NULL) {
+                        fprintf(stderr, "[IMPORT ERROR] Module '%s' contains a NUL byte\n", full_path);
+                    } else {
+                        source = copy_string(text->chars, text->length);
+                    }
                 } else {
                     source = read_file(full_path);
                 }
@@ -508,10 +682,13 @@ static void execute(Interpreter* interp, ASTNode* node) {
                     ASTNode* program = parser_parse(parser);
                     
                     if (program) {
+                        resolver_resolve(program);
                         Env* old_env = interp->current_env;
+                        gc_push_frame(interp, old_env);
                         interp->current_env = interp->global_env; // Run in global scope
                         execute(interp, program);
                         interp->current_env = old_env;
+                        gc_pop_frame(interp);
                     }
                     free(source);
                 }
@@ -521,8 +698,14 @@ static void execute(Interpreter* interp, ASTNode* node) {
             if (node->as.import_stmt.count > 0) {
                 for (int i = 0; i < node->as.import_stmt.count; i++) {
                     char* name = node->as.import_stmt.names[i];
+                    int slot = node->as.import_stmt.slots[i];
                     Value* val_ptr = env_get(interp->global_env, name);
-                    if (val_ptr != NULL) {
+                    if (val_ptr != NULL && val_ptr->type == VAL_STRING) {
+                        val_ptr->as.string->unique = false; // Now shared by two bindings
+                    }
+                    if (val_ptr != NULL && slot >= 0) {
+                        env_define_at(interp->current_env, slot, name, *val_ptr, false);
+                    } else if (val_ptr != NULL) {
                         env_define(interp->current_env, name, *val_ptr, false);
                     } else {
                         fprintf(stderr, "[IMPORT ERROR] Member '%s' not found in global scope after importing '%s'\n", name, path);
@@ -564,10 +747,23 @@ static void execute(Interpreter* interp, ASTNode* node) {
         }
         
         case AST_CLASS: {
+            Env* methods = env_create_sized(NULL, node->as.class_decl.method_count);
+            for (int i = 0; i < node->as.class_decl.method_count; i++) {
+                ASTNode* m_node = node->as.class_decl.methods[i];
+                env_define(methods, m_node->as.fun_decl.name, function_from_decl(interp, m_node), true);
+            }
+            
             Value class_val;
-            class_val = value_object(node->as.class_decl.name, env_create(interp->global_env));
-            class_val.as.object->ast = node;
-            env_define(interp->current_env, node->as.class_decl.name, class_val, true);
+            class_val = value_class(node->as.class_decl.name, node, methods);
+            for (int i = 0; i < node->as.class_decl.field_count; i++) {
+                Class* klass = class_val.as.klass;
+                klass->instance_shape = shape_transition(klass->instance_shape, node->as.class_decl.fields[i]);
+            }
+            if (node->as.class_decl.slot >= 0) {
+                env_define_at(interp->current_env, node->as.class_decl.slot, node->as.class_decl.name, class_val, true);
+            } else {
+                env_define(interp->current_env, node->as.class_decl.name, class_val, true);
+            }
             break;
         }
         
@@ -577,7 +773,11 @@ static void execute(Interpreter* interp, ASTNode* node) {
             if (node->as.var_decl.initializer != NULL) {
                 val = evaluate(interp, node->as.var_decl.initializer);
             }
-            env_define(interp->current_env, node->as.var_decl.name, val, false);
+            if (node->as.var_decl.slot >= 0) {
+                env_define_at(interp->current_env, node->as.var_decl.slot, node->as.var_decl.name, val, false);
+            } else {
+                env_define(interp->current_env, node->as.var_decl.name, val, false);
+            }
             break;
         }
         
@@ -617,15 +817,26 @@ static void execute(Interpreter* interp, ASTNode* node) {
             Value iterable;
             iterable = evaluate(interp, node->as.for_stmt.iterable);
             
-            Env* loop_env = env_create(interp->current_env);
+            Env* loop_env = env_acquire(&interp->frame_pool, interp->current_env,
+                                        node->as.for_stmt.local_count);
+            if (node->as.for_stmt.captured) gc_track_frame(loop_env);
             Env* previous = interp->current_env;
+            gc_push_frame(interp, previous);
+            int temp = interp->temp_count;
+            gc_push_temp(interp, iterable);
             interp->current_env = loop_env;
             
             if (iterable.type == VAL_ARRAY) {
                 for (int i = 0; i < iterable.as.array->count; i++) {
-                    env_define(loop_env, node->as.for_stmt.var_name, 
-                              iterable.as.array->items[i], false);
+                    if (node->as.for_stmt.slot >= 0) {
+                        env_define_at(loop_env, node->as.for_stmt.slot, node->as.for_stmt.var_name,
+                                      iterable.as.array->items[i], false);
+                    } else {
+                        env_define(loop_env, node->as.for_stmt.var_name, 
+                                  iterable.as.array->items[i], false);
+                    }
                     execute(interp, node->as.for_stmt.body);
+                    iterable = gc_temp(interp, temp, iterable);
                     
                     if (interp->breaking) {
                         interp->breaking = false;
@@ -639,13 +850,18 @@ static void execute(Interpreter* interp, ASTNode* node) {
             }
             
             interp->current_env = previous;
-            env_free(loop_env);
+            gc_pop_temp(interp);
+            gc_pop_frame(interp);
+            if (!node->as.for_stmt.captured) env_release(&interp->frame_pool, loop_env);
             break;
         }
         
         case AST_WHILE: {
-            Env* loop_env = env_create(interp->current_env);
+            Env* loop_env = env_acquire(&interp->frame_pool, interp->current_env,
+                                        node->as.while_stmt.local_count);
+            if (node->as.while_stmt.captured) gc_track_frame(loop_env);
             Env* previous = interp->current_env;
+            gc_push_frame(interp, previous);
             interp->current_env = loop_env;
             
             while (value_is_truthy(evaluate(interp, node->as.while_stmt.condition))) {
@@ -662,7 +878,8 @@ static void execute(Interpreter* interp, ASTNode* node) {
             }
             
             interp->current_env = previous;
-            env_free(loop_env);
+            gc_pop_frame(interp);
+            if (!node->as.while_stmt.captured) env_release(&interp->frame_pool, loop_env);
             break;
         }
         
@@ -676,7 +893,9 @@ static void execute(Interpreter* interp, ASTNode* node) {
         
         case AST_EXPR_STMT:
             if (node->as.block.stmt_count > 0) {
-                evaluate(interp, node->as.block.statements[0]);
+                ASTNode* expr = node->as.block.statements[0];
+                if (expr->type == AST_ASSIGN && exec_append_assign(interp, expr)) break;
+                evaluate(interp, expr);
             }
             break;
         
@@ -149,7 +149,7 @@ static Token scan_string(Lexer* lexer) {
     buf[len] = '\0';
     
     Token token = make_token(lexer, TOKEN_STRING);
-    token.literal = value_string(buf);
+    token.literal = value_string_literal(buf);
     free(buf);
     
     return token;
@@ -201,7 +201,9 @@ static TokenType identifier_type(Lexer* lexer) {
             if (len > 1) {
                 switch (start[1]) {
                     case 'l': return check_keyword(start + 2, len - 2, "ass", TOKEN_CLASS);
-                    case 'a': return check_keyword(start + 2, len - 2, "se", TOKEN_CASE);
+                    case 'a':
+                        if (len > 2 && start[2] == 't') return check_keyword(start + 3, len - 3, "ch", TOKEN_CATCH);
+                        return check_keyword(start + 2, len - 2, "se", TOKEN_CASE);
                     case 'o':
                         if (len > 3 && start[2] == 'n') {
                             if (start[3] == 's') return check_keyword(start + 4, len - 4, "t", TOKEN_CONST);
@@ -295,7 +297,7 @@ static TokenType identifier_type(Lexer* lexer) {
         case 't':
             if (len > 1) {
                 if (start[1] == 'r') {
-                    if (len > 2 && start[2] == 'y') return TOKEN_TRY;
+                    if (len > 2 && start[2] == 'y') return len == 3 ? TOKEN_TRY : TOKEN_IDENTIFIER;
                     return check_keyword(start + 2, len - 2, "ue", TOKEN_TRUE);
                 }
                 if (start[1] == 'o') return check_keyword(start + 2, len - 2, "p", TOKEN_TOP);
@@ -4,6 +4,8 @@
  */
 
 #include "../include/somnia.h"
+#include "../include/engine.h"
+#include "../include/serve.h"
 
 /* ============================================================================
  * UTILITIES
@@ -71,7 +73,7 @@ void somnia_error(const char* message, int line) {
  * RUN FILE
  * ============================================================================ */
 
-static int run_file(const char* path) {
+static int run_file(const char* path, bool use_vm, EngineOptions options) {
     printf("\n");
     printf("   _____  ____  __  __ _   _ _____          \n");
     printf("  / ____|/ __ \\|  \\/  | \\ | |_   _|   /\\    \n");
@@ -89,6 +91,18 @@ static int run_file(const char* path) {
     char* source = read_file(path);
     if (source == NULL) return 1;
     
+    // Bytecode VM, unless the program uses something only the tree-walker runs
+    if (use_vm) {
+        EngineResult result = engine_run_bytecode(source, options);
+        if (result != ENGINE_FALLBACK) {
+            free(source);
+            if (result == ENGINE_RUNTIME_ERROR) return 1;
+            printf("\n[DONE] Execution complete\n");
+            return 0;
+        }
+        fprintf(stderr, "[VM] Falling back to the tree-walker for %s\n", path);
+    }
+    
     // Lexer
     Lexer* lexer = lexer_create(source);
     lexer_scan_tokens(lexer);
@@ -96,6 +110,7 @@ static int run_file(const char* path) {
     // Parser
     Parser* parser = parser_create(lexer->tokens, lexer->token_count);
     ASTNode* program = parser_parse(parser);
+    resolver_resolve(program);
     
     // Interpreter
     Interpreter* interp = interpreter_create();
@@ -179,10 +194,11 @@ static int run_bundle(const char* path) {
         return 1;
     }
 
-    Lexer* lexer = lexer_create(entry_source_val->as.string);
+    Lexer* lexer = lexer_create(entry_source_val->as.string->chars);
     lexer_scan_tokens(lexer);
     Parser* parser = parser_create(lexer->tokens, lexer->token_count);
     ASTNode* program = parser_parse(parser);
+    resolver_resolve(program);
 
     interpreter_run(interp, program);
 
@@ -241,6 +257,7 @@ static void run_repl(void) {
         // Parser
         Parser* parser = parser_create(lexer->tokens, lexer->token_count);
         ASTNode* program = parser_parse(parser);
+        resolver_resolve(program);
         
         // Execute
         Value result = interpreter_run(interp, program);
@@ -262,6 +279,21 @@ static void run_repl(void) {
     printf("\nGoodbye!\n");
 }
 
+/* What `run` executes, and each `serve` worker */
+typedef struct {
+    const char* path;
+    bool use_vm;
+    EngineOptions options;
+} Program;
+
+static int run_program(void* context) {
+    Program* program = context;
+    if (strstr(program->path, ".som") != NULL && strstr(program->path, ".somnia") == NULL) {
+        return run_bundle(program->path);
+    }
+    return run_file(program->path, program->use_vm, program->options);
+}
+
 /* ============================================================================
  * MAIN
  * ============================================================================ */
@@ -271,6 +303,14 @@ static void print_usage(const char* prog) {
     printf("\n");
     printf("Commands:\n");
     printf("  run <file.somnia>   Execute a Somnia file\n");
+    printf("      --engine=vm     Run on the bytecode VM (falls back to the tree-walker)\n");
+    printf("      --engine=tree   Run on the tree-walker (default)\n");
+    printf("      --jit           Run on the VM, compiling hot functions to x86-64\n");
+    printf("      --jit-threshold=N  Calls or loop iterations before a function is compiled\n");
+    printf("      --gc=incremental|full  VM collector: bounded steps (default) or stop-the-world\n");
+    printf("      --gc-pause=US   Longest incremental GC step, in microseconds (default 1000)\n");
+    printf("  serve <file.somnia> Run a server in one worker process per core (run's options apply)\n");
+    printf("      --workers=N     Worker processes (default: online cores)\n");
     printf("  repl                Start interactive REPL\n");
     printf("  version             Show version info\n");
     printf("  help                Show this help\n");
@@ -290,15 +330,61 @@ int main(int argc, char* argv[]) {
     
     const char* command = argv[1];
     
-    if (strcmp(command, "run") == 0) {
-        if (argc < 3) {
-            fprintf(stderr, "Usage: %s run <file.somnia|.som>\n", argv[0]);
-            return 1;
+    bool serve = strcmp(command, "serve") == 0;
+    if (strcmp(command, "run") == 0 || serve) {
+        const char* path = NULL;
+        bool use_vm = false;
+        EngineOptions options = {false, 0, false, 0};
+        long workers = sysconf(_SC_NPROCESSORS_ONLN);
+        for (int i = 2; i < argc; i++) {
+            if (serve && strncmp(argv[i], "--workers=", 10) == 0) {
+                workers = atoi(argv[i] + 10);
+                if (workers <= 0) {
+                    fprintf(stderr, "Invalid worker count: %s\n", argv[i] + 10);
+                    return 1;
+                }
+            } else if (strcmp(argv[i], "--engine=vm") == 0) {
+                use_vm = true;
+            } else if (strcmp(argv[i], "--jit") == 0) {
+                use_vm = true;
+                options.jit = true;
+            } else if (strncmp(argv[i], "--jit-threshold=", 16) == 0) {
+                options.jit_threshold = atoi(argv[i] + 16);
+                if (options.jit_threshold <= 0) {
+                    fprintf(stderr, "Invalid JIT threshold: %s\n", argv[i] + 16);
+                    return 1;
+                }
+            } else if (strcmp(argv[i], "--gc=incremental") == 0) {
+                options.full_gc = false;
+            } else if (strcmp(argv[i], "--gc=full") == 0) {
+                options.full_gc = true;
+            } else if (strncmp(argv[i], "--gc=", 5) == 0) {
+                fprintf(stderr, "Unknown collector: %s (expected incremental or full)\n", argv[i] + 5);
+                return 1;
+            } else if (strncmp(argv[i], "--gc-pause=", 11) == 0) {
+                options.gc_pause_target = atoi(argv[i] + 11);
+                if (options.gc_pause_target <= 0) {
+                    fprintf(stderr, "Invalid GC pause target: %s\n", argv[i] + 11);
+                    return 1;
+                }
+            } else if (strcmp(argv[i], "--engine=tree") == 0) {
+                use_vm = false;
+            } else if (strncmp(argv[i], "--engine=", 9) == 0) {
+                fprintf(stderr, "Unknown engine: %s (expected vm or tree)\n", argv[i] + 9);
+                return 1;
+            } else if (path == NULL) {
+                path = argv[i];
+            }
         }
-        if (strstr(argv[2], ".som") != NULL && strstr(argv[2], ".somnia") == NULL) {
-            return run_bundle(argv[2]);
+        if (path == NULL) {
+            fprintf(stderr, "Usage: %s %s [--engine=vm|tree] [--jit]%s <file.somnia|.som>\n",
+                    argv[0], command, serve ? " [--workers=N]" : "");
+            return 1;
         }
-        return run_file(argv[2]);
+        
+        Program program = {path, use_vm, options};
+        if (serve) return serve_workers(workers > 0 ? (int)workers : 1, run_program, &program);
+        return run_program(&program);
     }
     
     if (strcmp(command, "repl") == 0) {
@@ -319,7 +405,7 @@ int main(int argc, char* argv[]) {
     
     // If command looks like a file, run it directly
     if (strstr(command, ".som") != NULL) {
-        if (strstr(command, ".somnia") != NULL) return run_file(command);
+        if (strstr(command, ".somnia") != NULL) return run_file(command, false, (EngineOptions){false, 0, false, 0});
         return run_bundle(command);
     }
     
@@ -5,13 +5,51 @@
 
 #include "../include/somnia.h"
 #include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <errno.h>
 
+/* Events one native_net_poll_wait call returns at most */
+#define NET_MAX_EVENTS 1024
+
+/* Unparsed bytes a connection may hold before it is dropped */
+#define NET_MAX_BUFFER (16 * 1024 * 1024)
+#define NET_READ_CHUNK (16 * 1024)
+
+/* Files native_net_sendfile keeps open, and how often one is stat'ed again */
+#define NET_FILE_CACHE 64
+#define NET_FILE_RECHECK_MS 1000
+
+static NetStats process_stats;
+NetStats* net_stats = &process_stats;
+
+static volatile sig_atomic_t draining = 0;
+
+static void request_drain(int sig) {
+    (void)sig;
+    draining = 1;
+}
+
+void net_drain_on_signals(void) {
+    // No SA_RESTART: a blocked epoll_wait returns so the loop sees the flag
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = request_drain;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGTERM, &action, NULL);
+    sigaction(SIGINT, &action, NULL);
+}
+
 /* native_net_listen(port: number) -> server_id: number */
 Value native_net_listen(Value* args, int arg_count, Env* env) {
+    (void)env;
     if (arg_count < 1 || args[0].type != VAL_NUMBER) {
         fprintf(stderr, "[NETWORK ERROR] native_net_listen expects (port: number)\n");
         return value_number(-1);
@@ -22,7 +60,7 @@ Value native_net_listen(Value* args, int arg_count, Env* env) {
     struct sockaddr_in address;
     int opt = 1;
 
-    if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) == 0) {
+    if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
         perror("socket failed");
         return value_number(-1);
     }
@@ -41,7 +79,7 @@ Value native_net_listen(Value* args, int arg_count, Env* env) {
         return value_number(-1);
     }
 
-    if (listen(server_fd, 3) < 0) {
+    if (listen(server_fd, SOMAXCONN) < 0) {
         perror("listen");
         return value_number(-1);
     }
@@ -51,6 +89,7 @@ Value native_net_listen(Value* args, int arg_count, Env* env) {
 
 /* native_net_accept(server_id: number) -> client_id: number */
 Value native_net_accept(Value* args, int arg_count, Env* env) {
+    (void)env;
     if (arg_count < 1 || args[0].type != VAL_NUMBER) {
         fprintf(stderr, "[NETWORK ERROR] native_net_accept expects (server_id: number)\n");
         return value_number(-1);
@@ -69,8 +108,11 @@ Value native_net_accept(Value* args, int arg_count, Env* env) {
     return value_number(new_socket);
 }
 
-/* native_net_read(client_id: number) -> data: string */
+/* native_net_read(client_id: number) -> data: string
+ * "" at end of stream, null on error, and false when a non-blocking socket
+ * has nothing more to read */
 Value native_net_read(Value* args, int arg_count, Env* env) {
+    (void)env;
     if (arg_count < 1 || args[0].type != VAL_NUMBER) {
         fprintf(stderr, "[NETWORK ERROR] native_net_read expects (client_id: number)\n");
         return value_null();
@@ -81,30 +123,58 @@ Value native_net_read(Value* args, int arg_count, Env* env) {
     int valread = read(client_fd, buffer, sizeof(buffer) - 1);
     
     if (valread < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return value_bool(false);
         perror("read failed");
         return value_null();
     }
 
     buffer[valread] = '\0';
-    return value_string(buffer);
+    return value_string_len(buffer, valread);
 }
 
-/* native_net_write(client_id: number, data: string) -> success: bool */
+/* Sends all of data to a socket that is not a connection. A blocking
+ * socket waits inside send; a non-blocking one fails once it is full */
+static bool send_all(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+        if (sent >= 0) {
+            data += sent;
+            length -= (size_t)sent;
+        } else if (errno != EINTR) {
+            return false;
+        }
+    }
+    return true;
+}
+
+typedef struct Connection Connection;
+static Connection* connection_at(int fd);
+static bool connection_send(Connection* connection, int fd, const char* data, size_t length);
+
+/* native_net_write(client_id: number, data: string) -> success: bool
+ * On a connection (native_net_conn_open), sends what the socket takes now
+ * and queues the rest for native_net_conn_flush, so it never blocks. Any
+ * other socket gets all of data before this returns. A peer that hung up
+ * fails the write instead of raising SIGPIPE */
 Value native_net_write(Value* args, int arg_count, Env* env) {
+    (void)env;
     if (arg_count < 2 || args[0].type != VAL_NUMBER || args[1].type != VAL_STRING) {
         fprintf(stderr, "[NETWORK ERROR] native_net_write expects (client_id: number, data: string)\n");
         return value_bool(false);
     }
 
     int client_fd = (int)args[0].as.number;
-    const char* data = args[1].as.string;
-    
-    ssize_t sent = send(client_fd, data, strlen(data), 0);
-    return value_bool(sent >= 0);
+    String* data = args[1].as.string;
+    Connection* connection = connection_at(client_fd);
+    if (connection != NULL) {
+        return value_bool(connection_send(connection, client_fd, data->chars, (size_t)data->length));
+    }
+    return value_bool(send_all(client_fd, data->chars, (size_t)data->length));
 }
 
 /* native_net_close(id: number) -> success: bool */
 Value native_net_close(Value* args, int arg_count, Env* env) {
+    (void)env;
     if (arg_count < 1 || args[0].type != VAL_NUMBER) {
         fprintf(stderr, "[NETWORK ERROR] native_net_close expects (id: number)\n");
         return value_bool(false);
@@ -114,3 +184,609 @@ Value native_net_close(Value* args, int arg_count, Env* env) {
     int res = close(fd);
     return value_bool(res == 0);
 }
+
+/* ===== Event loop =====
+ * A poll is an edge-triggered epoll instance. It reports a socket once each
+ * time it becomes readable or writable, so a handler must read (or accept)
+ * until the socket would block before waiting again. Interest is "r", "w"
+ * or "rw"; ready events come back as a string of the same letters, plus
+ * "h" when the peer hung up or the socket failed. */
+
+static bool parse_interest(Value value, uint32_t* events) {
+    if (value.type != VAL_STRING) return false;
+    const char* interest = value.as.string->chars;
+    *events = EPOLLET | EPOLLRDHUP;
+    if (strchr(interest, 'r') != NULL) *events |= EPOLLIN;
+    if (strchr(interest, 'w') != NULL) *events |= EPOLLOUT;
+    return (*events & (EPOLLIN | EPOLLOUT)) != 0;
+}
+
+static Value poll_control(Value* args, int arg_count, int operation, const char* name) {
+    uint32_t events = 0;
+    if (arg_count < 2 || args[0].type != VAL_NUMBER || args[1].type != VAL_NUMBER ||
+        (operation != EPOLL_CTL_DEL && (arg_count < 3 || !parse_interest(args[2], &events)))) {
+        fprintf(stderr, "[NETWORK ERROR] %s expects (poll_id: number, fd: number%s)\n",
+                name, operation == EPOLL_CTL_DEL ? "" : ", interest: \"r\" | \"w\" | \"rw\"");
+        return value_bool(false);
+    }
+    
+    int fd = (int)args[1].as.number;
+    struct epoll_event event = {0};
+    event.events = events;
+    event.data.fd = fd;
+    return value_bool(epoll_ctl((int)args[0].as.number, operation, fd, &event) == 0);
+}
+
+/* native_net_poll_create() -> poll_id: number */
+Value native_net_poll_create(Value* args, int arg_count, Env* env) {
+    (void)args; (void)arg_count; (void)env;
+    int poll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (poll_fd < 0) {
+        perror("epoll_create1");
+        return value_number(-1);
+    }
+    return value_number(poll_fd);
+}
+
+/* native_net_set_nonblocking(fd: number) -> success: bool */
+Value native_net_set_nonblocking(Value* args, int arg_count, Env* env) {
+    (void)env;
+    if (arg_count < 1 || args[0].type != VAL_NUMBER) {
+        fprintf(stderr, "[NETWORK ERROR] native_net_set_nonblocking expects (fd: number)\n");
+        return value_bool(false);
+    }
+    
+    int fd = (int)args[0].as.number;
+    int flags = fcntl(fd, F_GETFL, 0);
+    return value_bool(flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0);
+}
+
+/* native_net_poll_add(poll_id: number, fd: number, interest: string) -> success: bool */
+Value native_net_poll_add(Value* args, int arg_count, Env* env) {
+    (void)env;
+    return poll_control(args, arg_count, EPOLL_CTL_ADD, "native_net_poll_add");
+}
+
+/* native_net_poll_mod(poll_id: number, fd: number, interest: string) -> success: bool */
+Value native_net_poll_mod(Value* args, int arg_count, Env* env) {
+    (void)env;
+    return poll_control(args, arg_count, EPOLL_CTL_MOD, "native_net_poll_mod");
+}
+
+/* native_net_poll_del(poll_id: number, fd: number) -> success: bool */
+Value native_net_poll_del(Value* args, int arg_count, Env* env) {
+    (void)env;
+    return poll_control(args, arg_count, EPOLL_CTL_DEL, "native_net_poll_del");
+}
+
+/* native_net_poll_wait(poll_id: number, timeout_ms: number) -> [[fd, events], ...]
+ * A negative timeout waits until something is ready */
+Value native_net_poll_wait(Value* args, int arg_count, Env* env) {
+    (void)env;
+    if (arg_count < 2 || args[0].type != VAL_NUMBER || args[1].type != VAL_NUMBER) {
+        fprintf(stderr, "[NETWORK ERROR] native_net_poll_wait expects (poll_id: number, timeout_ms: number)\n");
+        return value_null();
+    }
+    
+    struct epoll_event events[NET_MAX_EVENTS];
+    int ready = epoll_wait((int)args[0].as.number, events, NET_MAX_EVENTS, (int)args[1].as.number);
+    if (ready < 0 && errno != EINTR) {
+        perror("epoll_wait");
+        return value_null();
+    }
+    
+    Value result = value_array();
+    for (int i = 0; i < ready; i++) {
+        char flags[4];
+        int length = 0;
+        if (events[i].events & EPOLLIN) flags[length++] = 'r';
+        if (events[i].events & EPOLLOUT) flags[length++] = 'w';
+        if (events[i].events & (EPOLLHUP | EPOLLRDHUP | EPOLLERR)) flags[length++] = 'h';
+        
+        Value pair = value_array();
+        array_push(pair.as.array, value_number(events[i].data.fd));
+        array_push(pair.as.array, value_string_len(flags, length));
+        array_push(result.as.array, pair);
+    }
+    return result;
+}
+
+/* native_net_accept_all(server_id: number) -> [client_id, ...]
+ * Accepts every pending connection of a non-blocking listener, each one
+ * already non-blocking, until the backlog is empty */
+Value native_net_accept_all(Value* args, int arg_count, Env* env) {
+    (void)env;
+    if (arg_count < 1 || args[0].type != VAL_NUMBER) {
+        fprintf(stderr, "[NETWORK ERROR] native_net_accept_all expects (server_id: number)\n");
+        return value_array();
+    }
+    
+    int server_fd = (int)args[0].as.number;
+    Value clients = value_array();
+    for (;;) {
+        int client_fd = accept4(server_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_fd >= 0) {
+            array_push(clients.as.array, value_number(client_fd));
+            net_stats->connections++;
+        } else if (errno == EINTR || errno == ECONNABORTED) {
+            continue;
+        } else {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("accept4");
+            break;
+        }
+    }
+    return clients;
+}
+
+/* ===== Connections =====
+ * A connection keeps what was read from a client and not yet parsed, so a
+ * request split across reads waits for the rest and requests pipelined in
+ * one read come out one at a time, in order. Connections are indexed by fd
+ * and remember when they were last active and how many requests they
+ * served, for idle eviction and the per-connection request cap.
+ *
+ * Writes to a connection never wait for the client. What the socket does
+ * not take is queued, bytes or a range of a file, and native_net_conn_flush
+ * sends more of it each time the poll reports the socket writable. */
+
+/* Output the socket could not take yet */
+typedef struct {
+    char* data;                 // NULL for a range of a file
+    int file;                   // The range's own descriptor of the file
+    off_t offset;               // Next byte to send, in data or in the file
+    off_t end;
+} Output;
+
+struct Connection {
+    char* data;
+    size_t start;               // First byte no request has used
+    size_t length;
+    size_t capacity;
+    HttpChunkScan scan;         // Of the request at start
+    Output* output;             // Queued in order from output_head
+    int output_head;
+    int output_count;
+    int output_capacity;
+    size_t queued;              // Bytes left in the output queue
+    double last_active;         // Milliseconds, from now_ms()
+    int requests;
+    int max_requests;           // 0 for no cap
+    bool open;
+    bool ending;                // Closes once the output queue is empty
+};
+
+static Connection* connections = NULL;
+static int connection_capacity = 0;
+
+static double now_ms(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (double)tv.tv_sec * 1000 + (double)tv.tv_usec / 1000;
+}
+
+static Connection* connection_at(int fd) {
+    if (fd < 0 || fd >= connection_capacity || !connections[fd].open) return NULL;
+    return &connections[fd];
+}
+
+static Connection* find_connection(Value fd) {
+    return fd.type == VAL_NUMBER ? connection_at((int)fd.as.number) : NULL;
+}
+
+static void free_buffers(Connection* connection) {
+    for (int i = connection->output_head; i < connection->output_count; i++) {
+        Output* output = &connection->output[i];
+        if (output->data != NULL) free(output->data);
+        else close(output->file);
+    }
+    free(connection->output);
+    free(connection->data);
+    memset(connection, 0, sizeof(Connection));
+}
+
+static void drop_connection(int fd) {
+    free_buffers(&connections[fd]);
+    close(fd);
+    net_stats->open--;
+}
+
+static Output* queue_output(Connection* connection, off_t offset, off_t end) {
+    if (connection->output_count == connection->output_capacity) {
+        if (connection->output_head > 0) {
+            connection->output_count -= connection->output_head;
+            memmove(connection->output, connection->output + connection->output_head,
+                    sizeof(Output) * connection->output_count);
+            connection->output_head = 0;
+        } else {
+            connection->output_capacity = connection->output_capacity < 4 ? 4 : connection->output_capacity * 2;
+            connection->output = realloc(connection->output, sizeof(Output) * connection->output_capacity);
+        }
+    }
+    
+    Output* output = &connection->output[connection->output_count++];
+    output->data = NULL;
+    output->file = -1;
+    output->offset = offset;
+    output->end = end;
+    connection->queued += (size_t)(end - offset);
+    return output;
+}
+
+/* Sends one queued output until the socket would block: the bytes sent,
+ * 0 if the file shrank under it, or -1 */
+static ssize_t send_output(int fd, Output* output) {
+    size_t length = (size_t)(output->end - output->offset);
+    if (output->data == NULL) return sendfile(fd, output->file, &output->offset, length);
+    
+    ssize_t sent = send(fd, output->data + output->offset, length, MSG_NOSIGNAL);
+    if (sent > 0) output->offset += sent;
+    return sent;
+}
+
+/* Sends queued output until the socket would block; false if it failed */
+static bool flush_output(Connection* connection, int fd) {
+    while (connection->output_head < connection->output_count) {
+        Output* output = &connection->output[connection->output_head];
+        ssize_t sent = send_output(fd, output);
+        if (sent == 0) return false;
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        
+        connection->queued -= (size_t)sent;
+        connection->last_active = now_ms();
+        if (output->offset == output->end) {
+            if (output->data != NULL) free(output->data);
+            else close(output->file);
+            connection->output_head++;
+        }
+    }
+    connection->output_head = connection->output_count = 0;
+    return true;
+}
+
+/* Sends data after the queued output: straight from data while nothing is
+ * queued, copying only what the socket does not take */
+static bool connection_send(Connection* connection, int fd, const char* data, size_t length) {
+    while (connection->queued == 0 && length > 0) {
+        ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+        if (sent >= 0) {
+            data += sent;
+            length -= (size_t)sent;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        } else if (errno != EINTR) {
+            return false;
+        }
+    }
+    if (length > 0) {
+        Output* output = queue_output(connection, 0, (off_t)length);
+        output->data = malloc(length);
+        memcpy(output->data, data, length);
+    }
+    return true;
+}
+
+/* native_net_conn_open(fd: number, max_requests?: number) -> success: bool */
+Value native_net_conn_open(Value* args, int arg_count, Env* env) {
+    (void)env;
+    if (arg_count < 1 || args[0].type != VAL_NUMBER || args[0].as.number < 0 ||
+        (arg_count > 1 && args[1].type != VAL_NUMBER)) {
+        fprintf(stderr, "[NETWORK ERROR] native_net_conn_open expects (fd: number, max_requests?: number)\n");
+        return value_bool(false);
+    }
+    
+    int fd = (int)args[0].as.number;
+    if (fd >= connection_capacity) {
+        int capacity = connection_capacity < 64 ? 64 : connection_capacity;
+        while (capacity <= fd) capacity *= 2;
+        connections = realloc(connections, sizeof(Connection) * capacity);
+        memset(connections + connection_capacity, 0, sizeof(Connection) * (capacity - connection_capacity));
+        connection_capacity = capacity;
+    }
+    
+    // An fd the program closed without native_net_conn_close is reused here
+    Connection* connection = &connections[fd];
+    if (!connection->open) net_stats->open++;
+    free_buffers(connection);
+    connection->open = true;
+    connection->last_active = now_ms();
+    connection->max_requests = arg_count > 1 && args[1].as.number > 0 ? (int)args[1].as.number : 0;
+    return value_bool(true);
+}
+
+/* native_net_conn_read(fd: number) -> open: bool
+ * Reads until the socket would block. False once the peer closed or the
+ * socket failed; requests already buffered can still be taken */
+Value native_net_conn_read(Value* args, int arg_count, Env* env) {
+    (void)env;
+    Connection* connection = arg_count < 1 ? NULL : find_connection(args[0]);
+    if (connection == NULL) {
+        fprintf(stderr, "[NETWORK ERROR] native_net_conn_read expects (fd: number) of an open connection\n");
+        return value_bool(false);
+    }
+    
+    int fd = (int)args[0].as.number;
+    connection->last_active = now_ms();
+    for (;;) {
+        // Move unparsed bytes to the front before growing
+        if (connection->start > 0 && connection->start >= connection->length / 2) {
+            memmove(connection->data, connection->data + connection->start, connection->length - connection->start);
+            connection->length -= connection->start;
+            connection->start = 0;
+        }
+        if (connection->capacity - connection->length < NET_READ_CHUNK) {
+            if (connection->length >= NET_MAX_BUFFER) return value_bool(false);
+            size_t capacity = connection->capacity < NET_READ_CHUNK ? NET_READ_CHUNK * 2 : connection->capacity * 2;
+            connection->data = realloc(connection->data, capacity);
+            connection->capacity = capacity;
+        }
+        
+        ssize_t count = read(fd, connection->data + connection->length, connection->capacity - connection->length);
+        if (count > 0) {
+            connection->length += (size_t)count;
+        } else if (count == 0) {
+            return value_bool(false);
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return value_bool(true);
+        } else if (errno != EINTR) {
+            return value_bool(false);
+        }
+    }
+}
+
+/* native_net_conn_next(fd: number) -> request: map | null
+ * Takes the next whole request from the connection's buffer, as
+ * native_http_parse returns it, or null until more arrives and after
+ * native_net_conn_end. keep_alive is false on the connection's last
+ * request under its cap, and while draining */
+Value native_net_conn_next(Value* args, int arg_count, Env* env) {
+    (void)env;
+    Connection* connection = arg_count < 1 ? NULL : find_connection(args[0]);
+    if (connection == NULL) {
+        fprintf(stderr, "[NETWORK ERROR] native_net_conn_next expects (fd: number) of an open connection\n");
+        return value_null();
+    }
+    if (connection->ending) return value_null();
+    
+    size_t consumed = 0;
+    Value request = http_parse_request(connection->data + connection->start,
+                                       connection->length - connection->start, 0, &consumed,
+                                       &connection->scan);
+    if (consumed == 0) return request;
+    
+    connection->start += consumed;
+    memset(&connection->scan, 0, sizeof(HttpChunkScan));
+    connection->requests++;
+    net_stats->requests++;
+    if (draining || (connection->max_requests > 0 && connection->requests >= connection->max_requests)) {
+        map_set(request.as.map, "keep_alive", value_bool(false));
+    }
+    return request;
+}
+
+/* native_net_conn_flush(fd: number) -> queued: number
+ * Sends queued output until the socket would block and returns the bytes
+ * still queued. -1 once the connection is gone: its socket failed (it is
+ * closed then), or native_net_conn_end closed it after its last byte */
+Value native_net_conn_flush(Value* args, int arg_count, Env* env) {
+    (void)env;
+    Connection* connection = arg_count < 1 ? NULL : find_connection(args[0]);
+    if (connection == NULL) return value_number(-1);
+    
+    int fd = (int)args[0].as.number;
+    if (!flush_output(connection, fd) || (connection->ending && connection->queued == 0)) {
+        drop_connection(fd);
+        return value_number(-1);
+    }
+    return value_number((double)connection->queued);
+}
+
+/* native_net_conn_end(fd: number) -> closed: bool
+ * Takes no more requests from the connection and closes it once its queued
+ * output is sent; true if that happened right away */
+Value native_net_conn_end(Value* args, int arg_count, Env* env) {
+    (void)env;
+    Connection* connection = arg_count < 1 ? NULL : find_connection(args[0]);
+    if (connection == NULL) return value_bool(false);
+    
+    connection->ending = true;
+    if (connection->queued > 0) return value_bool(false);
+    drop_connection((int)args[0].as.number);
+    return value_bool(true);
+}
+
+/* native_net_conn_close(fd: number) -> success: bool
+ * Frees the connection's buffers, queued output included, and closes the socket */
+Value native_net_conn_close(Value* args, int arg_count, Env* env) {
+    (void)env;
+    Connection* connection = arg_count < 1 ? NULL : find_connection(args[0]);
+    if (connection == NULL) return value_bool(false);
+    
+    drop_connection((int)args[0].as.number);
+    return value_bool(true);
+}
+
+/* native_net_conn_sweep(idle_ms: number) -> [fd, ...]
+ * Closes the connections with no reads for idle_ms and returns their fds */
+Value native_net_conn_sweep(Value* args, int arg_count, Env* env) {
+    (void)env;
+    if (arg_count < 1 || args[0].type != VAL_NUMBER) {
+        fprintf(stderr, "[NETWORK ERROR] native_net_conn_sweep expects (idle_ms: number)\n");
+        return value_array();
+    }
+    
+    double cutoff = now_ms() - args[0].as.number;
+    Value evicted = value_array();
+    for (int fd = 0; fd < connection_capacity; fd++) {
+        if (!connections[fd].open || connections[fd].last_active > cutoff) continue;
+        drop_connection(fd);
+        array_push(evicted.as.array, value_number(fd));
+    }
+    return evicted;
+}
+
+/* native_net_conn_count() -> open connections: number */
+Value native_net_conn_count(Value* args, int arg_count, Env* env) {
+    (void)args; (void)arg_count; (void)env;
+    return value_number((double)net_stats->open);
+}
+
+/* native_net_draining() -> bool
+ * True once SIGTERM or SIGINT asked a `somnia serve` worker to stop: the
+ * server should stop accepting and close its connections as they finish */
+Value native_net_draining(Value* args, int arg_count, Env* env) {
+    (void)args; (void)arg_count; (void)env;
+    return value_bool(draining != 0);
+}
+
+/* ===== Files =====
+ * Static files go from the page cache to the socket with sendfile(2), so
+ * no byte is copied through user space and a download of any size takes
+ * constant memory. The files last sent stay open, and each is stat'ed
+ * again at most once per NET_FILE_RECHECK_MS so edits are picked up. */
+
+typedef struct {
+    char* path;
+    int fd;
+    off_t size;
+    struct timespec mtime;
+    double checked;             // When stat last ran, from now_ms()
+    double used;
+} OpenFile;
+
+static OpenFile open_files[NET_FILE_CACHE];
+
+static void close_file(OpenFile* file) {
+    free(file->path);
+    close(file->fd);
+    memset(file, 0, sizeof(OpenFile));
+}
+
+/* The cached open regular file at `path`, or NULL if there is none */
+static OpenFile* open_file(const char* path) {
+    double now = now_ms();
+    OpenFile* slot = &open_files[0];
+    for (int i = 0; i < NET_FILE_CACHE; i++) {
+        OpenFile* file = &open_files[i];
+        if (file->path == NULL || strcmp(file->path, path) != 0) {
+            if (file->used < slot->used) slot = file;
+            continue;
+        }
+        
+        struct stat st;
+        if (now - file->checked < NET_FILE_RECHECK_MS) {
+            file->used = now;
+            return file;
+        }
+        if (stat(path, &st) == 0 && st.st_size == file->size &&
+            st.st_mtim.tv_sec == file->mtime.tv_sec && st.st_mtim.tv_nsec == file->mtime.tv_nsec) {
+            file->checked = file->used = now;
+            return file;
+        }
+        // Changed or gone: open it again
+        close_file(file);
+        slot = file;
+        break;
+    }
+    
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return NULL;
+    }
+    
+    // Least recently used entry, or a free one
+    if (slot->path != NULL) close_file(slot);
+    slot->path = strdup(path);
+    slot->fd = fd;
+    slot->size = st.st_size;
+    slot->mtime = st.st_mtim;
+    slot->checked = slot->used = now;
+    return slot;
+}
+
+/* native_net_file_info(path: string) -> { size, mtime, etag } | null
+ * null unless path is a regular file that can be opened. The ETag is
+ * derived from size and modification time */
+Value native_net_file_info(Value* args, int arg_count, Env* env) {
+    (void)env;
+    if (arg_count < 1 || args[0].type != VAL_STRING) {
+        fprintf(stderr, "[NETWORK ERROR] native_net_file_info expects (path: string)\n");
+        return value_null();
+    }
+    
+    OpenFile* file = open_file(args[0].as.string->chars);
+    if (file == NULL) return value_null();
+    
+    char etag[64];
+    snprintf(etag, sizeof(etag), "\"%llx-%llx%05lx\"", (unsigned long long)file->size,
+             (unsigned long long)file->mtime.tv_sec, (unsigned long)(file->mtime.tv_nsec / 10000));
+    
+    Value info = value_map();
+    map_set(info.as.map, "size", value_number((double)file->size));
+    map_set(info.as.map, "mtime", value_number((double)file->mtime.tv_sec));
+    map_set(info.as.map, "etag", value_string(etag));
+    return info;
+}
+
+/* native_net_sendfile(client_id: number, path: string, offset?: number, len?: number) -> success: bool
+ * Sends len bytes of the file from offset (the rest of it by default). On
+ * a connection, what the socket does not take now is queued with the
+ * connection's offset into the file, and native_net_conn_flush resumes it;
+ * the file stays open for that range even if it leaves the cache */
+Value native_net_sendfile(Value* args, int arg_count, Env* env) {
+    (void)env;
+    if (arg_count < 2 || args[0].type != VAL_NUMBER || args[1].type != VAL_STRING ||
+        (arg_count > 2 && args[2].type != VAL_NUMBER) || (arg_count > 3 && args[3].type != VAL_NUMBER)) {
+        fprintf(stderr, "[NETWORK ERROR] native_net_sendfile expects (client_id: number, path: string, offset?: number, len?: number)\n");
+        return value_bool(false);
+    }
+    
+    OpenFile* file = open_file(args[1].as.string->chars);
+    if (file == NULL) return value_bool(false);
+    
+    int client_fd = (int)args[0].as.number;
+    off_t offset = arg_count > 2 && args[2].as.number > 0 ? (off_t)args[2].as.number : 0;
+    if (offset > file->size) return value_bool(false);
+    off_t remaining = arg_count > 3 && args[3].as.number >= 0 ? (off_t)args[3].as.number : file->size - offset;
+    if (remaining > file->size - offset) return value_bool(false);
+    off_t end = offset + remaining;
+    
+    // Straight to the socket while nothing is queued before the file
+    Connection* connection = connection_at(client_fd);
+    while (offset < end && (connection == NULL || connection->queued == 0)) {
+        ssize_t sent = sendfile(client_fd, file->fd, &offset, (size_t)(end - offset));
+        if (sent > 0 || (sent < 0 && errno == EINTR)) continue;
+        if (sent < 0 && connection != NULL && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        return value_bool(false);                       // Failed, or the file shrank under us
+    }
+    
+    if (offset < end) {
+        int own = dup(file->fd);
+        if (own < 0) return value_bool(false);
+        queue_output(connection, offset, end)->file = own;
+    }
+    return value_bool(true);
+}
+
+/* native_net_write_blob(client_id: number, blob: Blob) -> success: bool
+ * Sends the blob's bytes, NULs included */
+Value native_net_write_blob(Value* args, int arg_count, Env* env) {
+    (void)env;
+    if (arg_count < 2 || args[0].type != VAL_NUMBER || args[1].type != VAL_BLOB) {
+        fprintf(stderr, "[NETWORK ERROR] native_net_write_blob expects (client_id: number, blob: Blob)\n");
+        return value_bool(false);
+    }
+    
+    int client_fd = (int)args[0].as.number;
+    Blob* blob = args[1].as.blob;
+    Connection* connection = connection_at(client_fd);
+    if (connection != NULL) {
+        return value_bool(connection_send(connection, client_fd, (const char*)blob->data, blob->size));
+    }
+    return value_bool(send_all(client_fd, (const char*)blob->data, blob->size));
+}
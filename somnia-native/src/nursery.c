@@ -0,0 +1,398 @@
+/*
+ * Somnia Programming Language
+ * Nursery (Young Generation)
+ *
+ * New arrays, maps, objects and functions are bump-allocated here together
+ * with their first buffers. A minor collection copies the survivors out to
+ * malloc'd old space (vm_objects) and resets the nursery, so its cost
+ * follows the survivors and the roots rather than the size of the heap.
+ *
+ * Old objects that get a young value stored into them are kept in a
+ * remembered set by gc_write_barrier(). Envs have no barrier: the Envs of
+ * old closures and class methods are remembered as a whole and scanned by
+ * every minor collection.
+ */
+
+#include "../include/somnia.h"
+
+char* nursery_start = NULL;
+char* nursery_top = NULL;
+char* nursery_end = NULL;
+char* nursery_limit = NULL;
+
+#define NURSERY_ALIGN 8
+
+typedef struct {
+    Obj** items;
+    int count;
+    int capacity;
+} ObjList;
+
+static ObjList tracked;         // Young objects that own malloc'd buffers
+static size_t tracked_bytes;    // ... and how much they have malloc'd
+static ObjList remembered;      // Old objects that may reference young ones
+static ObjList gray;            // Evacuated, fields not yet forwarded
+
+static Env** remembered_envs = NULL;
+static int remembered_env_count = 0;
+static int remembered_env_capacity = 0;
+
+static void list_push(ObjList* list, Obj* obj) {
+    if (list->count >= list->capacity) {
+        list->capacity = list->capacity < 64 ? 64 : list->capacity * 2;
+        list->items = realloc(list->items, sizeof(Obj*) * list->capacity);
+    }
+    list->items[list->count++] = obj;
+}
+
+static void list_free(ObjList* list) {
+    free(list->items);
+    list->items = NULL;
+    list->count = 0;
+    list->capacity = 0;
+}
+
+/* ============================================================================
+ * ALLOCATION
+ * ============================================================================ */
+
+static void nursery_reset(void) {
+    nursery_top = nursery_start;
+    nursery_limit = nursery_start + NURSERY_SIZE / 8 * 7;
+    tracked_bytes = 0;
+}
+
+/* Bump-allocate `size` bytes, or NULL when the nursery is full */
+void* nursery_alloc(size_t size) {
+    if (nursery_start == NULL) {
+        nursery_start = malloc(NURSERY_SIZE);
+        nursery_end = nursery_start + NURSERY_SIZE;
+        nursery_reset();
+    }
+
+    size = (size + NURSERY_ALIGN - 1) & ~(size_t)(NURSERY_ALIGN - 1);
+    if ((size_t)(nursery_end - nursery_top) < size) return NULL;
+
+    void* p = nursery_top;
+    nursery_top += size;
+    return p;
+}
+
+char* nursery_strdup(const char* s) {
+    size_t length = strlen(s);
+    char* copy = nursery_alloc(length + 1);
+    if (copy != NULL) memcpy(copy, s, length + 1);
+    return copy;
+}
+
+/* `obj` is young and owns malloc'd memory, freed if it dies young */
+void nursery_track(Obj* obj) {
+    list_push(&tracked, obj);
+}
+
+/*
+ * Grow an object's buffer. The first growth moves it out of the nursery
+ * block it was allocated with; later ones are plain reallocs.
+ */
+void* gc_grow_buffer(Obj* owner, void* buffer, size_t old_size, size_t new_size) {
+    void* grown;
+    if (nursery_contains(buffer)) {
+        grown = malloc(new_size);
+        memcpy(grown, buffer, old_size);
+    } else {
+        grown = realloc(buffer, new_size);
+    }
+
+    if (nursery_contains(owner)) {
+        nursery_track(owner);
+        // Big young buffers make a minor collection due early
+        tracked_bytes += new_size;
+        if (tracked_bytes > NURSERY_SIZE) nursery_limit = nursery_start;
+    } else {
+        gc_bytes_allocated += new_size - old_size;
+    }
+    return grown;
+}
+
+void gc_free_buffer(void* buffer) {
+    if (!nursery_contains(buffer)) free(buffer);
+}
+
+/* ============================================================================
+ * REMEMBERED SETS
+ * ============================================================================ */
+
+void gc_remember(Obj* obj) {
+    obj->remembered = true;
+    list_push(&remembered, obj);
+}
+
+void gc_remember_env(Env* env) {
+    if (env == NULL || env->remembered) return;
+    env->remembered = true;
+
+    if (remembered_env_count >= remembered_env_capacity) {
+        remembered_env_capacity = remembered_env_capacity < 64 ? 64 : remembered_env_capacity * 2;
+        remembered_envs = realloc(remembered_envs, sizeof(Env*) * remembered_env_capacity);
+    }
+    remembered_envs[remembered_env_count++] = env;
+}
+
+/*
+ * Called by gc_collect between mark and sweep: keep only the Envs of the
+ * functions and classes that survive, before the sweep frees the rest.
+ */
+void gc_rebuild_remembered_envs(void) {
+    for (int i = 0; i < remembered_env_count; i++) {
+        remembered_envs[i]->remembered = false;
+    }
+    remembered_env_count = 0;
+
+    for (Obj* obj = vm_objects; obj != NULL; obj = obj->next) {
+        if (!obj->marked) continue;
+        if (obj->type == OBJ_FUNCTION) gc_remember_env(((Function*)obj)->closure);
+        if (obj->type == OBJ_CLASS) gc_remember_env(((Class*)obj)->methods);
+    }
+}
+
+/* ============================================================================
+ * MINOR COLLECTION
+ * ============================================================================ */
+
+/* Buffer for an evacuated object: nursery copies move, malloc'd ones are kept */
+static void* promote_buffer(void* buffer, size_t capacity, size_t used) {
+    if (!nursery_contains(buffer)) return buffer;
+    void* copy = malloc(capacity);
+    memcpy(copy, buffer, used);
+    return copy;
+}
+
+/* Copy a young object to old space, once; the copy is scanned later */
+static Obj* evacuate(Obj* young) {
+    if (young->marked) return young->next;
+
+    Obj* old;
+    size_t size;
+    switch (young->type) {
+        case OBJ_ARRAY: {
+            Array* from = (Array*)young;
+            Array* to = malloc(sizeof(Array));
+            *to = *from;
+            to->items = promote_buffer(from->items, sizeof(Value) * from->capacity,
+                                       sizeof(Value) * from->count);
+            size = sizeof(Array) + sizeof(Value) * to->capacity;
+            old = &to->obj;
+            break;
+        }
+        case OBJ_MAP: {
+            Map* from = (Map*)young;
+            Map* to = malloc(sizeof(Map));
+            *to = *from;
+            to->entries = promote_buffer(from->entries, sizeof(MapEntry) * from->capacity,
+                                         sizeof(MapEntry) * from->used);
+            to->index = promote_buffer(from->index, sizeof(int) * from->index_capacity,
+                                       sizeof(int) * from->index_capacity);
+            for (int i = 0; i < to->used; i++) {
+                if (nursery_contains(to->entries[i].key)) {
+                    to->entries[i].key = copy_string(to->entries[i].key, (int)strlen(to->entries[i].key));
+                }
+            }
+            size = sizeof(Map) + sizeof(MapEntry) * to->capacity + sizeof(int) * to->index_capacity;
+            old = &to->obj;
+            break;
+        }
+        case OBJ_OBJECT: {
+            Object* from = (Object*)young;
+            Object* to = malloc(sizeof(Object));
+            *to = *from;
+            to->slots = promote_buffer(from->slots, sizeof(Value) * from->slot_capacity,
+                                       sizeof(Value) * from->shape->field_count);
+            size = sizeof(Object) + sizeof(Value) * to->slot_capacity;
+            old = &to->obj;
+            break;
+        }
+        case OBJ_FUNCTION: {
+            Function* to = malloc(sizeof(Function));
+            *to = *(Function*)young;
+            size = sizeof(Function);
+            old = &to->obj;
+            break;
+        }
+        default:
+            return young; // Strings, builders and classes are never young
+    }
+
+    old->marked = false;
+    old->remembered = false;
+    old->next = vm_objects;
+    vm_objects = old;
+    gc_bytes_allocated += size;
+
+    // Forwarding: later references to the young copy find the old one
+    young->marked = true;
+    young->next = old;
+
+    list_push(&gray, old);
+    return old;
+}
+
+static void forward_value(Value* v) {
+    switch (v->type) {
+        case VAL_ARRAY:
+            if (nursery_contains(v->as.array)) v->as.array = (Array*)evacuate(&v->as.array->obj);
+            break;
+        case VAL_MAP:
+            if (nursery_contains(v->as.map)) v->as.map = (Map*)evacuate(&v->as.map->obj);
+            break;
+        case VAL_OBJECT:
+            if (nursery_contains(v->as.object)) v->as.object = (Object*)evacuate(&v->as.object->obj);
+            break;
+        case VAL_FUNCTION:
+            if (nursery_contains(v->as.function)) v->as.function = (Function*)evacuate(&v->as.function->obj);
+            break;
+        default:
+            break;
+    }
+}
+
+static void forward_env(Env* env) {
+    for (; env != NULL && env->mark_epoch != gc_epoch; env = env->parent) {
+        env->mark_epoch = gc_epoch;
+        for (int i = 0; i < env->var_count; i++) {
+            forward_value(&env->vars[i].value);
+        }
+    }
+}
+
+/* Forward the young values held by an old object */
+static void scan_object(Obj* obj) {
+    switch (obj->type) {
+        case OBJ_ARRAY: {
+            Array* arr = (Array*)obj;
+            for (int i = 0; i < arr->count; i++) forward_value(&arr->items[i]);
+            break;
+        }
+        case OBJ_MAP: {
+            Map* map = (Map*)obj;
+            for (int i = 0; i < map->used; i++) forward_value(&map->entries[i].value);
+            break;
+        }
+        case OBJ_OBJECT: {
+            Object* o = (Object*)obj;
+            for (int i = 0; i < o->shape->field_count; i++) forward_value(&o->slots[i]);
+            break;
+        }
+        case OBJ_FUNCTION:
+            // Now old: its closure has to be scanned by later minor collections
+            gc_remember_env(((Function*)obj)->closure);
+            break;
+        default:
+            break;
+    }
+}
+
+/* A young object died: free what it malloc'd (may run twice per object) */
+static void release_young(Obj* obj) {
+    switch (obj->type) {
+        case OBJ_ARRAY: {
+            Array* arr = (Array*)obj;
+            gc_free_buffer(arr->items);
+            arr->items = NULL;
+            break;
+        }
+        case OBJ_MAP: {
+            Map* map = (Map*)obj;
+            for (int i = 0; i < map->used; i++) gc_free_buffer(map->entries[i].key);
+            map->count = 0;
+            map->used = 0;
+            gc_free_buffer(map->entries);
+            map->entries = NULL;
+            gc_free_buffer(map->index);
+            map->index = NULL;
+            break;
+        }
+        case OBJ_OBJECT: {
+            Object* o = (Object*)obj;
+            gc_free_buffer(o->slots);
+            o->slots = NULL;
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+/*
+ * Evacuate everything reachable in the nursery, then reset it. Runs at
+ * statement boundaries only, like gc_collect; the interpreter reloads any
+ * value it pushed on the temp stack, since the object may have moved.
+ */
+void gc_collect_young(Interpreter* interp) {
+    if (nursery_start == NULL) return;
+    if (interp->temp_count > MAX_TEMP_STACK || interp->frame_count > MAX_FRAME_STACK) return;
+
+    // 1. Roots
+    gc_epoch++;
+    forward_env(interp->global_env);
+    forward_env(interp->current_env);
+    for (int i = 0; i < interp->frame_count; i++) {
+        forward_env(interp->frame_stack[i]);
+    }
+    for (int i = 0; i < interp->temp_count; i++) {
+        forward_value(&interp->temp_stack[i]);
+    }
+    forward_value(&interp->return_value);
+    forward_env(interp->cognitive_state);
+    if (nursery_contains(interp->vfs)) interp->vfs = (Map*)evacuate(&interp->vfs->obj);
+
+    // 2. Old objects written since the last collection
+    for (int i = 0; i < remembered.count; i++) {
+        remembered.items[i]->remembered = false;
+        scan_object(remembered.items[i]);
+    }
+    remembered.count = 0;
+
+    // 3. Transitively copy; scanned functions may remember more Envs
+    int env_cursor = 0;
+    while (gray.count > 0 || env_cursor < remembered_env_count) {
+        while (gray.count > 0) {
+            scan_object(gray.items[--gray.count]);
+        }
+        if (env_cursor < remembered_env_count) {
+            forward_env(remembered_envs[env_cursor++]);
+        }
+    }
+
+    // 4. Free what the dead young objects malloc'd, then start over
+    for (int i = 0; i < tracked.count; i++) {
+        if (!tracked.items[i]->marked) release_young(tracked.items[i]);
+    }
+    tracked.count = 0;
+
+#ifdef SOMNIA_GC_STRESS
+    // Stale pointers into the nursery read garbage instead of old values
+    memset(nursery_start, 0xAB, nursery_top - nursery_start);
+#endif
+    nursery_reset();
+}
+
+/* At exit: everything still young is dropped */
+void nursery_free(void) {
+    for (int i = 0; i < tracked.count; i++) {
+        if (!tracked.items[i]->marked) release_young(tracked.items[i]);
+    }
+    list_free(&tracked);
+    list_free(&remembered);
+    list_free(&gray);
+
+    free(remembered_envs);
+    remembered_envs = NULL;
+    remembered_env_count = 0;
+    remembered_env_capacity = 0;
+
+    free(nursery_start);
+    nursery_start = NULL;
+    nursery_top = NULL;
+    nursery_end = NULL;
+    nursery_limit = NULL;
+}
@@ -130,7 +130,9 @@ static ASTNode* parse_primary(Parser* parser) {
     if (match_p(parser, TOKEN_IDENTIFIER)) {
         Token name = previous(parser);
         ASTNode* node = create_node(AST_VARIABLE, name.line);
-        node->as.var_name = strdup(name.lexeme);
+        node->as.variable.name = strdup(name.lexeme);
+        node->as.variable.depth = -1;
+        node->as.variable.slot = -1;
         return node;
     }
     
@@ -169,7 +171,7 @@ static ASTNode* parse_primary(Parser* parser) {
                 // Key (string or identifier)
                 char* key;
                 if (match_p(parser, TOKEN_STRING)) {
-                    key = strdup(previous(parser).literal.as.string);
+                    key = strdup(previous(parser).literal.as.string->chars);
                 } else if (match_p(parser, TOKEN_IDENTIFIER)) {
                     key = strdup(previous(parser).lexeme);
                 } else {
@@ -362,8 +364,10 @@ static ASTNode* parse_assignment(Parser* parser) {
         
         if (expr->type == AST_VARIABLE) {
             ASTNode* node = create_node(AST_ASSIGN, expr->line);
-            node->as.assign.name = strdup(expr->as.var_name);
+            node->as.assign.name = strdup(expr->as.variable.name);
             node->as.assign.value = value;
+            node->as.assign.depth = -1;
+            node->as.assign.slot = -1;
             return node;
         } else if (expr->type == AST_GET) {
             ASTNode* node = create_node(AST_SET, expr->line);
@@ -409,6 +413,7 @@ static ASTNode* parse_var_declaration(Parser* parser) {
     ASTNode* node = create_node(AST_VAR_DECL, name.line);
     node->as.var_decl.name = strdup(name.lexeme);
     node->as.var_decl.initializer = NULL;
+    node->as.var_decl.slot = -1;
     
     if (match_p(parser, TOKEN_EQ)) {
         node->as.var_decl.initializer = parse_expression(parser);
@@ -428,6 +433,9 @@ static ASTNode* parse_function_declaration(Parser* parser) {
     node->as.fun_decl.name = name_str;
     node->as.fun_decl.params = malloc(sizeof(char*) * MAX_ARGS);
     node->as.fun_decl.param_count = 0;
+    node->as.fun_decl.slot = -1;
+    node->as.fun_decl.local_count = 0;
+    node->as.fun_decl.captured = false;
     
     // Parameters
     consume(parser, TOKEN_LPAREN, "Expected '(' after function name");
@@ -481,6 +489,9 @@ static ASTNode* parse_for_statement(Parser* parser) {
     ASTNode* node = create_node(AST_FOR, previous(parser).line);
     node->as.for_stmt.var_name = strdup(var.lexeme);
     node->as.for_stmt.iterable = parse_expression(parser);
+    node->as.for_stmt.slot = -1;
+    node->as.for_stmt.local_count = 0;
+    node->as.for_stmt.captured = false;
     
     consume(parser, TOKEN_LBRACE, "Expected '{' before for body");
     node->as.for_stmt.body = parse_block(parser);
@@ -491,6 +502,8 @@ static ASTNode* parse_for_statement(Parser* parser) {
 static ASTNode* parse_while_statement(Parser* parser) {
     ASTNode* node = create_node(AST_WHILE, previous(parser).line);
     node->as.while_stmt.condition = parse_expression(parser);
+    node->as.while_stmt.local_count = 0;
+    node->as.while_stmt.captured = false;
     
     consume(parser, TOKEN_LBRACE, "Expected '{' before while body");
     node->as.while_stmt.body = parse_block(parser);
@@ -549,9 +562,11 @@ static ASTNode* parse_import_statement(Parser* parser) {
     if (match_p(parser, TOKEN_LBRACE)) {
         // import { a, b } from "..."
         node->as.import_stmt.names = malloc(sizeof(char*) * MAX_ARGS);
+        node->as.import_stmt.slots = malloc(sizeof(int) * MAX_ARGS);
         node->as.import_stmt.count = 0;
         do {
             Token name = consume(parser, TOKEN_IDENTIFIER, "Expected member name");
+            node->as.import_stmt.slots[node->as.import_stmt.count] = -1;
             node->as.import_stmt.names[node->as.import_stmt.count++] = strdup(name.lexeme);
         } while (match_p(parser, TOKEN_COMMA));
         consume(parser, TOKEN_RBRACE, "Expected '}' after import list");
@@ -559,7 +574,7 @@ static ASTNode* parse_import_statement(Parser* parser) {
     }
     
     Token path = consume(parser, TOKEN_STRING, "Expected import path");
-    node->as.import_stmt.path = strdup(path.literal.as.string);
+    node->as.import_stmt.path = strdup(path.literal.as.string->chars);
     
     return node;
 }
@@ -592,6 +607,7 @@ static ASTNode* parse_class_declaration(Parser* parser) {
     node->as.class_decl.field_count = 0;
     node->as.class_decl.methods = malloc(sizeof(ASTNode*) * MAX_FIELDS);
     node->as.class_decl.method_count = 0;
+    node->as.class_decl.slot = -1;
     
     consume(parser, TOKEN_LBRACE, "Expected '{' before class body");
     
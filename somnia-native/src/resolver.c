@@ -0,0 +1,343 @@
+/*
+ * Somnia Programming Language
+ * Static Scope Resolver
+ *
+ * Runs between parser_parse() and interpreter_run(). Every runtime Env that
+ * the interpreter pushes (function call, for/while loop) has a matching
+ * static scope here, so each local variable reference can be annotated with
+ * the number of Env hops (depth) and the index in Env.vars (slot). Globals
+ * and import-time definitions at top level stay unresolved (-1) and are
+ * looked up by name.
+ */
+
+#include "../include/somnia.h"
+
+/* ============================================================================
+ * SCOPES
+ * ============================================================================ */
+
+typedef struct Scope {
+    struct Scope* enclosing;
+    const char** names;
+    int count;
+    int capacity;
+    bool captured;          // A closure created here keeps the runtime Env alive
+} Scope;
+
+static void scope_init(Scope* scope, Scope* enclosing) {
+    scope->enclosing = enclosing;
+    scope->names = NULL;
+    scope->count = 0;
+    scope->capacity = 0;
+    scope->captured = false;
+}
+
+static void scope_free(Scope* scope) {
+    free(scope->names);
+}
+
+static int scope_declare(Scope* scope, const char* name) {
+    for (int i = 0; i < scope->count; i++) {
+        if (strcmp(scope->names[i], name) == 0) return i;
+    }
+
+    if (scope->count >= scope->capacity) {
+        scope->capacity = scope->capacity < 8 ? 8 : scope->capacity * 2;
+        scope->names = realloc(scope->names, sizeof(const char*) * scope->capacity);
+    }
+
+    scope->names[scope->count] = name;
+    return scope->count++;
+}
+
+static bool scope_lookup(Scope* scope, const char* name, int* depth, int* slot) {
+    int hops = 0;
+    for (Scope* s = scope; s != NULL; s = s->enclosing) {
+        for (int i = 0; i < s->count; i++) {
+            if (strcmp(s->names[i], name) == 0) {
+                *depth = hops;
+                *slot = i;
+                return true;
+            }
+        }
+        hops++;
+    }
+    return false;
+}
+
+/* A closure created in this scope references every enclosing Env */
+static void scope_capture(Scope* scope) {
+    for (Scope* s = scope; s != NULL; s = s->enclosing) {
+        s->captured = true;
+    }
+}
+
+/* ============================================================================
+ * TRAVERSAL
+ * ============================================================================ */
+
+typedef void (*VisitFn)(Scope* scope, ASTNode* node);
+
+/* Visit the children of a node that are evaluated in the node's own scope */
+static void visit_children(Scope* scope, ASTNode* node, VisitFn visit) {
+    switch (node->type) {
+        case AST_PROGRAM:
+        case AST_BLOCK:
+        case AST_EXPR_STMT:
+            for (int i = 0; i < node->as.block.stmt_count; i++) {
+                visit(scope, node->as.block.statements[i]);
+            }
+            break;
+
+        case AST_ID_BLOCK:
+        case AST_EGO_BLOCK:
+        case AST_ACT_BLOCK:
+            for (int i = 0; i < node->as.agentic_block.count; i++) {
+                visit(scope, node->as.agentic_block.statements[i]);
+            }
+            break;
+
+        case AST_VAR_DECL:
+            visit(scope, node->as.var_decl.initializer);
+            break;
+
+        case AST_IF:
+            visit(scope, node->as.if_stmt.condition);
+            visit(scope, node->as.if_stmt.then_branch);
+            visit(scope, node->as.if_stmt.else_branch);
+            break;
+
+        case AST_WHEN:
+            visit(scope, node->as.when_stmt.condition);
+            visit(scope, node->as.when_stmt.body);
+            break;
+
+        case AST_RETURN:
+            visit(scope, node->as.return_stmt.value);
+            break;
+
+        case AST_ASSIGN:
+            visit(scope, node->as.assign.value);
+            break;
+
+        case AST_BINARY:
+            visit(scope, node->as.binary.left);
+            visit(scope, node->as.binary.right);
+            break;
+
+        case AST_UNARY:
+            visit(scope, node->as.unary.operand);
+            break;
+
+        case AST_CALL:
+            visit(scope, node->as.call.callee);
+            for (int i = 0; i < node->as.call.arg_count; i++) {
+                visit(scope, node->as.call.args[i]);
+            }
+            break;
+
+        case AST_GET:
+            visit(scope, node->as.get_expr.object);
+            break;
+
+        case AST_SET:
+            visit(scope, node->as.set_expr.object);
+            visit(scope, node->as.set_expr.value);
+            break;
+
+        case AST_INDEX:
+            visit(scope, node->as.index_expr.object);
+            visit(scope, node->as.index_expr.index);
+            break;
+
+        case AST_INDEX_SET:
+            visit(scope, node->as.index_set.object);
+            visit(scope, node->as.index_set.index);
+            visit(scope, node->as.index_set.value);
+            break;
+
+        case AST_ARRAY:
+            for (int i = 0; i < node->as.array_lit.count; i++) {
+                visit(scope, node->as.array_lit.elements[i]);
+            }
+            break;
+
+        case AST_MAP:
+            for (int i = 0; i < node->as.map_lit.count; i++) {
+                visit(scope, node->as.map_lit.values[i]);
+            }
+            break;
+
+        case AST_OBJECT:
+            for (int i = 0; i < node->as.obj_inst.count; i++) {
+                visit(scope, node->as.obj_inst.values[i]);
+            }
+            break;
+
+        case AST_DRIVE_DECL:
+        case AST_AFFECT_DECL:
+            visit(scope, node->as.cognitive_decl.value);
+            break;
+
+        case AST_FORBID:
+            visit(scope, node->as.rule.condition);
+            break;
+
+        case AST_BUDGET:
+            visit(scope, node->as.budget_stmt.limit);
+            break;
+
+        default:
+            break;
+    }
+}
+
+/*
+ * Pre-declare every name that will be defined in this scope's Env, so uses
+ * that run before the declaration (loop bodies, forward calls) still get
+ * the right slot.
+ */
+static void hoist(Scope* scope, ASTNode* node) {
+    if (node == NULL) return;
+
+    switch (node->type) {
+        case AST_VAR_DECL:
+            scope_declare(scope, node->as.var_decl.name);
+            break;
+
+        case AST_FUN_DECL:
+            if (node->as.fun_decl.name) scope_declare(scope, node->as.fun_decl.name);
+            return; // Body is its own scope
+
+        case AST_CLASS:
+            scope_declare(scope, node->as.class_decl.name);
+            return;
+
+        case AST_IMPORT:
+            for (int i = 0; i < node->as.import_stmt.count; i++) {
+                scope_declare(scope, node->as.import_stmt.names[i]);
+            }
+            return;
+
+        case AST_FOR:
+            hoist(scope, node->as.for_stmt.iterable);
+            return; // Body runs in the loop Env
+
+        case AST_WHILE:
+            return; // Condition and body run in the loop Env
+
+        default:
+            break;
+    }
+
+    visit_children(scope, node, hoist);
+}
+
+static void resolve(Scope* scope, ASTNode* node);
+
+static void resolve_function(Scope* enclosing, ASTNode* node) {
+    Scope scope;
+    scope_init(&scope, enclosing);
+
+    // Frame layout: self, this, params..., locals...
+    scope_declare(&scope, "self");
+    scope_declare(&scope, "this");
+    for (int i = 0; i < node->as.fun_decl.param_count; i++) {
+        scope_declare(&scope, node->as.fun_decl.params[i]);
+    }
+
+    hoist(&scope, node->as.fun_decl.body);
+    resolve(&scope, node->as.fun_decl.body);
+
+    node->as.fun_decl.local_count = scope.count;
+    node->as.fun_decl.captured = scope.captured;
+    scope_free(&scope);
+}
+
+static void resolve(Scope* scope, ASTNode* node) {
+    if (node == NULL) return;
+
+    switch (node->type) {
+        case AST_VARIABLE:
+            scope_lookup(scope, node->as.variable.name,
+                         &node->as.variable.depth, &node->as.variable.slot);
+            return;
+
+        case AST_ASSIGN:
+            resolve(scope, node->as.assign.value);
+            scope_lookup(scope, node->as.assign.name,
+                         &node->as.assign.depth, &node->as.assign.slot);
+            return;
+
+        case AST_VAR_DECL:
+            resolve(scope, node->as.var_decl.initializer);
+            if (scope) node->as.var_decl.slot = scope_declare(scope, node->as.var_decl.name);
+            return;
+
+        case AST_FUN_DECL:
+            if (scope && node->as.fun_decl.name) {
+                node->as.fun_decl.slot = scope_declare(scope, node->as.fun_decl.name);
+            }
+            scope_capture(scope);
+            resolve_function(scope, node);
+            return;
+
+        case AST_CLASS:
+            if (scope) node->as.class_decl.slot = scope_declare(scope, node->as.class_decl.name);
+            // Methods close over the Env the class is declared in
+            scope_capture(scope);
+            for (int i = 0; i < node->as.class_decl.method_count; i++) {
+                resolve_function(scope, node->as.class_decl.methods[i]);
+            }
+            return;
+
+        case AST_IMPORT:
+            if (scope) {
+                for (int i = 0; i < node->as.import_stmt.count; i++) {
+                    node->as.import_stmt.slots[i] = scope_declare(scope, node->as.import_stmt.names[i]);
+                }
+            }
+            return;
+
+        case AST_FOR: {
+            resolve(scope, node->as.for_stmt.iterable);
+
+            Scope loop;
+            scope_init(&loop, scope);
+            node->as.for_stmt.slot = scope_declare(&loop, node->as.for_stmt.var_name);
+            hoist(&loop, node->as.for_stmt.body);
+            resolve(&loop, node->as.for_stmt.body);
+            node->as.for_stmt.local_count = loop.count;
+            node->as.for_stmt.captured = loop.captured;
+            scope_free(&loop);
+            return;
+        }
+
+        case AST_WHILE: {
+            Scope loop;
+            scope_init(&loop, scope);
+            hoist(&loop, node->as.while_stmt.condition);
+            hoist(&loop, node->as.while_stmt.body);
+            resolve(&loop, node->as.while_stmt.condition);
+            resolve(&loop, node->as.while_stmt.body);
+            node->as.while_stmt.local_count = loop.count;
+            node->as.while_stmt.captured = loop.captured;
+            scope_free(&loop);
+            return;
+        }
+
+        default:
+            visit_children(scope, node, resolve);
+            return;
+    }
+}
+
+/* ============================================================================
+ * PUBLIC API
+ * ============================================================================ */
+
+void resolver_resolve(ASTNode* program) {
+    // Top-level code runs in the global Env, which is filled by name
+    // (stdlib, imports), so the outermost scope is left unresolved.
+    resolve(NULL, program);
+}
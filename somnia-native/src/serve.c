@@ -0,0 +1,170 @@
+/*
+ * Somnia Programming Language
+ * Multi-worker Server Supervisor
+ */
+
+#include "../include/somnia.h"
+#include "../include/serve.h"
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+/* One worker, in memory shared with it so its counters can be read */
+typedef struct {
+    pid_t pid;                  // 0 while not running
+    int restarts;
+    double started;             // Milliseconds, from now_ms()
+    double restart_at;          // When a crashed worker comes back; 0 if not due
+    NetStats stats;             // Written by the worker, across its restarts
+} WorkerSlot;
+
+static double now_ms(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (double)tv.tv_sec * 1000 + (double)tv.tv_usec / 1000;
+}
+
+static void spawn_worker(WorkerSlot* slot, const sigset_t* supervised,
+                         int (*run)(void* context), void* context) {
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        slot->restart_at = now_ms() + SERVE_RESTART_DELAY_MS;
+        return;
+    }
+    
+    if (pid == 0) {
+        // The connections of a crashed predecessor are gone
+        slot->stats.open = 0;
+        net_stats = &slot->stats;
+        net_drain_on_signals();
+        // SIGUSR1 is for the supervisor; sent to the group it would kill workers
+        signal(SIGUSR1, SIG_IGN);
+        sigprocmask(SIG_UNBLOCK, supervised, NULL);
+        exit(run(context));
+    }
+    
+    slot->pid = pid;
+    slot->started = now_ms();
+    slot->restart_at = 0;
+}
+
+static void print_stats(WorkerSlot* slots, int workers) {
+    NetStats total = {0, 0, 0};
+    double now = now_ms();
+    printf("[Serve] worker      pid  restarts  uptime s  connections    requests   open\n");
+    for (int i = 0; i < workers; i++) {
+        WorkerSlot* slot = &slots[i];
+        double uptime = slot->pid != 0 ? (now - slot->started) / 1000 : 0;
+        printf("[Serve] %6d %8d %9d %9.1f %12ld %11ld %6ld\n", i, (int)slot->pid, slot->restarts,
+               uptime, slot->stats.connections, slot->stats.requests, slot->stats.open);
+        total.connections += slot->stats.connections;
+        total.requests += slot->stats.requests;
+        total.open += slot->stats.open;
+    }
+    printf("[Serve]  total %38ld %11ld %6ld\n", total.connections, total.requests, total.open);
+    fflush(stdout);
+}
+
+static bool any_worker(WorkerSlot* slots, int workers) {
+    for (int i = 0; i < workers; i++) {
+        if (slots[i].pid != 0 || slots[i].restart_at != 0) return true;
+    }
+    return false;
+}
+
+/* Collects exited workers and schedules the crashed ones for a restart */
+static void reap_workers(WorkerSlot* slots, int workers, bool stopping) {
+    pid_t pid;
+    int status;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        WorkerSlot* slot = NULL;
+        for (int i = 0; i < workers; i++) {
+            if (slots[i].pid == pid) slot = &slots[i];
+        }
+        if (slot == NULL) continue;
+        slot->pid = 0;
+        
+        bool crashed = WIFSIGNALED(status) || (WIFEXITED(status) && WEXITSTATUS(status) != 0);
+        if (!crashed || stopping) continue;
+        
+        if (WIFSIGNALED(status)) {
+            fprintf(stderr, "[Serve] Worker %d killed by signal %d, restarting\n", (int)pid, WTERMSIG(status));
+        } else {
+            fprintf(stderr, "[Serve] Worker %d exited with status %d, restarting\n", (int)pid, WEXITSTATUS(status));
+        }
+        
+        // A worker that dies right away waits before coming back, so a
+        // program that crashes on startup does not fork in a loop
+        double now = now_ms();
+        slot->restarts++;
+        slot->restart_at = now - slot->started < SERVE_RESTART_DELAY_MS ? now + SERVE_RESTART_DELAY_MS : now;
+    }
+}
+
+int serve_workers(int workers, int (*run)(void* context), void* context) {
+    WorkerSlot* slots = mmap(NULL, sizeof(WorkerSlot) * workers, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (slots == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    memset(slots, 0, sizeof(WorkerSlot) * workers);
+    
+    // The supervisor takes its signals with sigtimedwait instead of handlers
+    sigset_t supervised;
+    sigemptyset(&supervised);
+    sigaddset(&supervised, SIGCHLD);
+    sigaddset(&supervised, SIGTERM);
+    sigaddset(&supervised, SIGINT);
+    sigaddset(&supervised, SIGUSR1);
+    sigprocmask(SIG_BLOCK, &supervised, NULL);
+    
+    printf("[Serve] Starting %d workers (supervisor %d)\n", workers, (int)getpid());
+    for (int i = 0; i < workers; i++) {
+        spawn_worker(&slots[i], &supervised, run, context);
+    }
+    
+    bool stopping = false;
+    double deadline = 0;
+    while (any_worker(slots, workers)) {
+        struct timespec timeout = {0, 200 * 1000 * 1000};
+        int sig = sigtimedwait(&supervised, NULL, &timeout);
+        
+        if ((sig == SIGTERM || sig == SIGINT) && !stopping) {
+            stopping = true;
+            deadline = now_ms() + SERVE_DRAIN_TIMEOUT_MS;
+            printf("[Serve] Draining workers\n");
+            fflush(stdout);
+            for (int i = 0; i < workers; i++) {
+                slots[i].restart_at = 0;
+                if (slots[i].pid != 0) kill(slots[i].pid, SIGTERM);
+            }
+        } else if (sig == SIGUSR1) {
+            print_stats(slots, workers);
+        }
+        
+        // SIGCHLDs arriving together are delivered once, so reap every time
+        reap_workers(slots, workers, stopping);
+        
+        double now = now_ms();
+        for (int i = 0; i < workers; i++) {
+            WorkerSlot* slot = &slots[i];
+            if (stopping && slot->pid != 0 && now > deadline) {
+                fprintf(stderr, "[Serve] Worker %d did not drain in time, killing it\n", (int)slot->pid);
+                kill(slot->pid, SIGKILL);
+            } else if (!stopping && slot->restart_at != 0 && now >= slot->restart_at) {
+                spawn_worker(slot, &supervised, run, context);
+            }
+        }
+    }
+    
+    print_stats(slots, workers);
+    munmap(slots, sizeof(WorkerSlot) * workers);
+    return 0;
+}
@@ -0,0 +1,172 @@
+/*
+ * Somnia Programming Language
+ * Hidden-Class Shapes and Property Inline Caches
+ *
+ * Every object points at a Shape: a node in a global transition tree whose
+ * path from the root spells out the object's field names in slot order.
+ * Objects built the same way share a Shape, so a property site can cache
+ * the (shape, slot) it last saw and skip the name lookup next time.
+ */
+
+#include "../include/somnia.h"
+
+InlineCacheStats ic_stats = {0, 0, 0};
+
+static Shape* root = NULL;
+
+/* ============================================================================
+ * SHAPES
+ * ============================================================================ */
+
+static Shape* shape_new(Shape* parent, const char* key) {
+    Shape* shape = malloc(sizeof(Shape));
+    shape->parent = parent;
+    shape->key = key ? copy_string(key, (int)strlen(key)) : NULL;
+    shape->field_count = parent ? parent->field_count + 1 : 0;
+    shape->transitions = NULL;
+    shape->transition_count = 0;
+    shape->transition_capacity = 0;
+    return shape;
+}
+
+Shape* shape_root(void) {
+    if (root == NULL) root = shape_new(NULL, NULL);
+    return root;
+}
+
+/* Shape reached by adding `key` as the next field */
+Shape* shape_transition(Shape* shape, const char* key) {
+    for (int i = 0; i < shape->transition_count; i++) {
+        if (strcmp(shape->transitions[i]->key, key) == 0) {
+            return shape->transitions[i];
+        }
+    }
+
+    if (shape->transition_count >= shape->transition_capacity) {
+        shape->transition_capacity = shape->transition_capacity < 4 ? 4 : shape->transition_capacity * 2;
+        shape->transitions = realloc(shape->transitions, sizeof(Shape*) * shape->transition_capacity);
+    }
+
+    Shape* child = shape_new(shape, key);
+    shape->transitions[shape->transition_count++] = child;
+    return child;
+}
+
+/* Slot of `key` in objects of this shape, or -1 */
+int shape_lookup(Shape* shape, const char* key) {
+    for (Shape* s = shape; s->parent != NULL; s = s->parent) {
+        if (strcmp(s->key, key) == 0) return s->field_count - 1;
+    }
+    return -1;
+}
+
+static void shape_free(Shape* shape) {
+    for (int i = 0; i < shape->transition_count; i++) {
+        shape_free(shape->transitions[i]);
+    }
+    free(shape->transitions);
+    free(shape->key);
+    free(shape);
+}
+
+void shape_free_all(void) {
+    if (root != NULL) shape_free(root);
+    root = NULL;
+}
+
+/* ============================================================================
+ * OBJECT FIELDS
+ * ============================================================================ */
+
+Value* object_get_field(Object* obj, const char* name) {
+    int slot = shape_lookup(obj->shape, name);
+    return slot >= 0 ? &obj->slots[slot] : NULL;
+}
+
+void object_set_field(Object* obj, const char* name, Value val) {
+    int slot = shape_lookup(obj->shape, name);
+    if (slot < 0) {
+        obj->shape = shape_transition(obj->shape, name);
+        slot = obj->shape->field_count - 1;
+
+        if (slot >= obj->slot_capacity) {
+            int capacity = obj->slot_capacity < 4 ? 4 : obj->slot_capacity * 2;
+            obj->slots = gc_grow_buffer(&obj->obj, obj->slots, sizeof(Value) * obj->slot_capacity,
+                                        sizeof(Value) * capacity);
+            obj->slot_capacity = capacity;
+        }
+    }
+    obj->slots[slot] = val;
+    gc_write_barrier(&obj->obj, val);
+}
+
+/* ============================================================================
+ * INLINE CACHES
+ * ============================================================================ */
+
+/* Count a miss; returns false once the site has gone megamorphic */
+static bool ic_miss(InlineCache* ic) {
+    ic_stats.misses++;
+    if (ic->misses > IC_MEGAMORPHIC_MISSES) return false;
+    if (++ic->misses > IC_MEGAMORPHIC_MISSES) {
+        ic_stats.megamorphic_sites++;
+        return false;
+    }
+    return true;
+}
+
+/* Field first, then the class's methods; NULL if neither has `name` */
+Value* object_get_cached(Object* obj, const char* name, InlineCache* ic) {
+    if (ic->shape == obj->shape) {
+        if (ic->slot >= 0) {
+            ic_stats.hits++;
+            return &obj->slots[ic->slot];
+        }
+        if (ic->class_id == obj->klass->id) {
+            ic_stats.hits++;
+            return &obj->klass->methods->vars[ic->method].value;
+        }
+    }
+
+    bool update = ic_miss(ic);
+
+    int slot = shape_lookup(obj->shape, name);
+    if (slot >= 0) {
+        if (update) {
+            ic->shape = obj->shape;
+            ic->slot = slot;
+        }
+        return &obj->slots[slot];
+    }
+
+    Env* methods = obj->klass->methods;
+    for (int i = 0; i < methods->var_count; i++) {
+        if (strcmp(methods->vars[i].name, name) == 0) {
+            if (update) {
+                ic->shape = obj->shape;
+                ic->slot = -1;
+                ic->class_id = obj->klass->id;
+                ic->method = i;
+            }
+            return &methods->vars[i].value;
+        }
+    }
+    return NULL;
+}
+
+void object_set_cached(Object* obj, const char* name, Value val, InlineCache* ic) {
+    if (ic->shape == obj->shape && ic->slot >= 0) {
+        ic_stats.hits++;
+        obj->slots[ic->slot] = val;
+        gc_write_barrier(&obj->obj, val);
+        return;
+    }
+
+    bool update = ic_miss(ic);
+    object_set_field(obj, name, val);
+
+    if (update) {
+        ic->shape = obj->shape;
+        ic->slot = shape_lookup(obj->shape, name);
+    }
+}
@@ -16,11 +16,12 @@ Value native_sql_connect(Value* args, int arg_count, Env* env) {
     fprintf(stderr, "[SQL ERROR] SQL support not available in this build.\n");
     return value_null();
 #else
+    (void)env;
     if (arg_count < 1 || args[0].type != VAL_STRING) {
         return value_number(-1);
     }
     
-    PGconn* conn = PQconnectdb(args[0].as.string);
+    PGconn* conn = PQconnectdb(args[0].as.string->chars);
     if (PQstatus(conn) != CONNECTION_OK) {
         fprintf(stderr, "[SQL ERROR] Connection failed: %s\n", PQerrorMessage(conn));
         PQfinish(conn);
@@ -38,12 +39,13 @@ Value native_sql_query(Value* args, int arg_count, Env* env) {
     (void)args; (void)arg_count; (void)env;
     return value_null();
 #else
+    (void)env;
     if (arg_count < 3 || args[0].type != VAL_NUMBER || args[1].type != VAL_STRING) {
         return value_null();
     }
     
     PGconn* conn = (PGconn*)(uintptr_t)args[0].as.number;
-    const char* sql = args[1].as.string;
+    const char* sql = args[1].as.string->chars;
     Array* params = args[2].as.array;
     
     // Convert Somnia params to C strings for PQexecParams
@@ -96,12 +98,13 @@ Value native_sql_exec(Value* args, int arg_count, Env* env) {
     (void)args; (void)arg_count; (void)env;
     return value_null();
 #else
+    (void)env;
     if (arg_count < 3 || args[0].type != VAL_NUMBER || args[1].type != VAL_STRING) {
         return value_number(-1);
     }
     
     PGconn* conn = (PGconn*)(uintptr_t)args[0].as.number;
-    const char* sql = args[1].as.string;
+    const char* sql = args[1].as.string->chars;
     Array* params = args[2].as.array;
     
     const char** param_values = malloc(sizeof(char*) * params->count);
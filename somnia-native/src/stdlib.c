@@ -54,7 +54,7 @@ static Value native_len(Value* args, int arg_count, Env* env) {
     
     switch (args[0].type) {
         case VAL_STRING:
-            return value_number(strlen(args[0].as.string));
+            return value_number(args[0].as.string->length);
         case VAL_ARRAY:
             return value_number(args[0].as.array->count);
         case VAL_MAP:
@@ -78,6 +78,8 @@ static Value native_type(Value* args, int arg_count, Env* env) {
         case VAL_FUNCTION: return value_string("function");
         case VAL_NATIVE_FN: return value_string("native_function");
         case VAL_OBJECT: return value_string("object");
+        case VAL_CLASS: return value_string("class");
+        case VAL_BUILDER: return value_string("builder");
         default: return value_string("unknown");
     }
 }
@@ -85,7 +87,12 @@ static Value native_type(Value* args, int arg_count, Env* env) {
 static Value native_to_string(Value* args, int arg_count, Env* env) {
     (void)env;
     if (arg_count < 1) return value_string("");
-    return value_string(value_to_string(args[0]));
+    if (args[0].type == VAL_STRING) return args[0];
+    
+    char* str = value_to_string(args[0]);
+    Value v = value_string(str);
+    free(str);
+    return v;
 }
 
 static Value native_to_number(Value* args, int arg_count, Env* env) {
@@ -93,7 +100,7 @@ static Value native_to_number(Value* args, int arg_count, Env* env) {
     if (arg_count < 1) return value_number(0);
     
     if (args[0].type == VAL_NUMBER) return args[0];
-    if (args[0].type == VAL_STRING) return value_number(atof(args[0].as.string));
+    if (args[0].type == VAL_STRING) return value_number(atof(args[0].as.string->chars));
     if (args[0].type == VAL_BOOL) return value_number(args[0].as.boolean ? 1 : 0);
     
     return value_number(0);
@@ -130,11 +137,16 @@ static Value native_get_fields(Value* args, int arg_count, Env* env) {
     Value map_val = value_map();
     Map* m = map_val.as.map;
     
-    // Copy fields from object's environment to a new map
-    Env* fields = obj->fields;
-    for (int i = 0; i < fields->var_count; i++) {
-        map_set(m, fields->vars[i].name, value_copy(fields->vars[i].value));
+    // Field names in slot order, from the shape's transition path
+    int count = obj->shape->field_count;
+    const char** names = malloc(sizeof(char*) * (count > 0 ? count : 1));
+    for (Shape* s = obj->shape; s->parent != NULL; s = s->parent) {
+        names[s->field_count - 1] = s->key;
+    }
+    for (int i = 0; i < count; i++) {
+        map_set(m, names[i], value_copy(obj->slots[i]));
     }
+    free(names);
     
     return map_val;
 }
@@ -164,7 +176,8 @@ static Value native_keys(Value* args, int arg_count, Env* env) {
     Value arr = value_array();
     Map* m = args[0].as.map;
     
-    for (int i = 0; i < m->count; i++) {
+    for (int i = 0; i < m->used; i++) {
+        if (m->entries[i].key == NULL) continue;
         array_push(arr.as.array, value_string(m->entries[i].key));
     }
     
@@ -178,13 +191,31 @@ static Value native_values(Value* args, int arg_count, Env* env) {
     Value arr = value_array();
     Map* m = args[0].as.map;
     
-    for (int i = 0; i < m->count; i++) {
+    for (int i = 0; i < m->used; i++) {
+        if (m->entries[i].key == NULL) continue;
         array_push(arr.as.array, value_copy(m->entries[i].value));
     }
     
     return arr;
 }
 
+static Value native_remove(Value* args, int arg_count, Env* env) {
+    (void)env;
+    if (arg_count < 2 || args[0].type != VAL_MAP || args[1].type != VAL_STRING) {
+        return value_bool(false);
+    }
+    return value_bool(map_delete(args[0].as.map, args[1].as.string->chars));
+}
+
+static Value native_ic_stats(Value* args, int arg_count, Env* env) {
+    (void)args; (void)arg_count; (void)env;
+    Value stats = value_map();
+    map_set(stats.as.map, "hits", value_number((double)ic_stats.hits));
+    map_set(stats.as.map, "misses", value_number((double)ic_stats.misses));
+    map_set(stats.as.map, "megamorphic", value_number((double)ic_stats.megamorphic_sites));
+    return stats;
+}
+
 static Value native_time_ms(Value* args, int arg_count, Env* env) {
     (void)args; (void)arg_count; (void)env;
     struct timeval tv;
@@ -197,7 +228,7 @@ static Value native_hash(Value* args, int arg_count, Env* env) {
     if (arg_count < 1 || args[0].type != VAL_STRING) return value_string("0000");
     unsigned long hash = 5381;
     int c;
-    const char* str = args[0].as.string;
+    const char* str = args[0].as.string->chars;
     while ((c = *str++))
         hash = ((hash << 5) + hash) + c;
     char buf[32];
@@ -208,7 +239,7 @@ static Value native_hash(Value* args, int arg_count, Env* env) {
 static Value native_parse_number(Value* args, int arg_count, Env* env) {
     (void)env;
     if (arg_count < 1 || args[0].type != VAL_STRING) return value_number(0);
-    return value_number(atof(args[0].as.string));
+    return value_number(atof(args[0].as.string->chars));
 }
 
 static Value native_parse_timestamp(Value* args, int arg_count, Env* env) {
@@ -232,7 +263,7 @@ static Value native_fs_read(Value* args, int arg_count, Env* env) {
     (void)env;
     if (arg_count < 1 || args[0].type != VAL_STRING) return value_null();
     
-    FILE* file = fopen(args[0].as.string, "rb");
+    FILE* file = fopen(args[0].as.string->chars, "rb");
     if (!file) return value_null();
     
     fseek(file, 0, SEEK_END);
@@ -245,11 +276,11 @@ static Value native_fs_read(Value* args, int arg_count, Env* env) {
         return value_null();
     }
     
-    fread(buffer, 1, size, file);
-    buffer[size] = '\0';
+    size_t read = fread(buffer, 1, size, file);
+    buffer[read] = '\0';
     fclose(file);
     
-    Value v = value_string(buffer);
+    Value v = value_string_len(buffer, (int)read);
     free(buffer);
     return v;
 }
@@ -258,13 +289,13 @@ static Value native_fs_write(Value* args, int arg_count, Env* env) {
     (void)env;
     if (arg_count < 2 || args[0].type != VAL_STRING || args[1].type != VAL_STRING) return value_bool(false);
     
-    FILE* file = fopen(args[0].as.string, "wb");
+    FILE* file = fopen(args[0].as.string->chars, "wb");
     if (!file) return value_bool(false);
     
-    size_t written = fwrite(args[1].as.string, 1, strlen(args[1].as.string), file);
+    size_t written = fwrite(args[1].as.string->chars, 1, args[1].as.string->length, file);
     fclose(file);
     
-    return value_bool(written == strlen(args[1].as.string));
+    return value_bool(written == (size_t)args[1].as.string->length);
 }
 
 static Value native_input(Value* args, int arg_count, Env* env) {
@@ -290,7 +321,7 @@ static Value native_fs_read_blob(Value* args, int arg_count, Env* env) {
     (void)env;
     if (arg_count < 1 || args[0].type != VAL_STRING) return value_null();
     
-    FILE* file = fopen(args[0].as.string, "rb");
+    FILE* file = fopen(args[0].as.string->chars, "rb");
     if (!file) return value_null();
     
     fseek(file, 0, SEEK_END);
@@ -326,7 +357,7 @@ static Value native_blob_append_string(Value* args, int arg_count, Env* env) {
     if (arg_count < 2 || args[0].type != VAL_BLOB || args[1].type != VAL_STRING) return value_null();
     
     Blob* blob = args[0].as.blob;
-    const char* str = args[1].as.string;
+    const char* str = args[1].as.string->chars;
     size_t len = strlen(str);
     
     blob->data = realloc(blob->data, blob->size + len);
@@ -367,7 +398,7 @@ static Value native_fs_write_blob(Value* args, int arg_count, Env* env) {
     (void)env;
     if (arg_count < 2 || args[0].type != VAL_STRING || args[1].type != VAL_BLOB) return value_bool(false);
     
-    FILE* file = fopen(args[0].as.string, "wb");
+    FILE* file = fopen(args[0].as.string->chars, "wb");
     if (!file) return value_bool(false);
     
     size_t written = fwrite(args[1].as.blob->data, 1, args[1].as.blob->size, file);
@@ -380,7 +411,7 @@ static Value native_fs_list(Value* args, int arg_count, Env* env) {
     (void)env;
     if (arg_count < 1 || args[0].type != VAL_STRING) return value_array();
     
-    DIR* dir = opendir(args[0].as.string);
+    DIR* dir = opendir(args[0].as.string->chars);
     if (!dir) return value_array();
     
     Value arr = value_array();
@@ -398,7 +429,7 @@ static Value native_fs_is_dir(Value* args, int arg_count, Env* env) {
     if (arg_count < 1 || args[0].type != VAL_STRING) return value_bool(false);
     
     struct stat st;
-    if (stat(args[0].as.string, &st) != 0) return value_bool(false);
+    if (stat(args[0].as.string->chars, &st) != 0) return value_bool(false);
     return value_bool(S_ISDIR(st.st_mode));
 }
 
@@ -409,25 +440,20 @@ static Value native_split(Value* args, int arg_count, Env* env) {
     }
     
     Value arr = value_array();
-    char* str = args[0].as.string;
-    char* delim = args[1].as.string;
-    int delim_len = strlen(delim);
+    const char* str = args[0].as.string->chars;
+    const char* delim = args[1].as.string->chars;
+    int delim_len = args[1].as.string->length;
     
     if (delim_len == 0) {
         array_push(arr.as.array, value_copy(args[0]));
         return arr;
     }
     
-    char* current = str;
-    char* next;
+    const char* current = str;
+    const char* next;
     
     while ((next = strstr(current, delim)) != NULL) {
-        int len = next - current;
-        char* part = malloc(len + 1);
-        strncpy(part, current, len);
-        part[len] = '\0';
-        array_push(arr.as.array, value_string(part));
-        free(part);
+        array_push(arr.as.array, value_string_len(current, (int)(next - current)));
         current = next + delim_len;
     }
     
@@ -436,6 +462,36 @@ static Value native_split(Value* args, int arg_count, Env* env) {
     return arr;
 }
 
+static Value native_sb_new(Value* args, int arg_count, Env* env) {
+    (void)args; (void)arg_count; (void)env;
+    return value_builder();
+}
+
+/* sb_append(sb, values...) -> sb */
+static Value native_sb_append(Value* args, int arg_count, Env* env) {
+    (void)env;
+    if (arg_count < 1 || args[0].type != VAL_BUILDER) return value_null();
+    
+    StringBuilder* sb = args[0].as.builder;
+    for (int i = 1; i < arg_count; i++) {
+        if (args[i].type == VAL_STRING) {
+            builder_append(sb, args[i].as.string->chars, args[i].as.string->length);
+        } else {
+            char* str = value_to_string(args[i]);
+            builder_append(sb, str, (int)strlen(str));
+            free(str);
+        }
+    }
+    return args[0];
+}
+
+/* sb_finish(sb) -> string; the builder keeps its contents */
+static Value native_sb_finish(Value* args, int arg_count, Env* env) {
+    (void)env;
+    if (arg_count < 1 || args[0].type != VAL_BUILDER) return value_string("");
+    return value_string_len(args[0].as.builder->chars, args[0].as.builder->length);
+}
+
 static Value native_join(Value* args, int arg_count, Env* env) {
     (void)env;
     if (arg_count < 2 || args[0].type != VAL_ARRAY || args[1].type != VAL_STRING) {
@@ -443,7 +499,7 @@ static Value native_join(Value* args, int arg_count, Env* env) {
     }
     
     Array* arr = args[0].as.array;
-    char* sep = args[1].as.string;
+    const char* sep = args[1].as.string->chars;
     
     if (arr->count == 0) return value_string("");
     
@@ -466,43 +522,31 @@ static Value native_trim(Value* args, int arg_count, Env* env) {
     (void)env;
     if (arg_count < 1 || args[0].type != VAL_STRING) return value_string("");
     
-    char* str = args[0].as.string;
+    const char* str = args[0].as.string->chars;
     while (isspace((unsigned char)*str)) str++;
     
     if (*str == 0) return value_string("");
     
-    char* end = str + strlen(str) - 1;
+    const char* end = args[0].as.string->chars + args[0].as.string->length - 1;
     while (end > str && isspace((unsigned char)*end)) end--;
     
-    int len = (int)(end - str + 1);
-    char* trimmed = malloc(len + 1);
-    strncpy(trimmed, str, len);
-    trimmed[len] = '\0';
-    
-    Value v = value_string(trimmed);
-    free(trimmed);
-    return v;
+    return value_string_len(str, (int)(end - str + 1));
 }
 
 static Value native_substr(Value* args, int arg_count, Env* env) {
     (void)env;
     if (arg_count < 2 || args[0].type != VAL_STRING) return value_string("");
     
-    char* str = args[0].as.string;
+    String* str = args[0].as.string;
     int start = (int)args[1].as.number;
-    int len = arg_count >= 3 ? (int)args[2].as.number : (int)strlen(str) - start;
+    int len = arg_count >= 3 ? (int)args[2].as.number : str->length - start;
     
     if (start < 0) start = 0;
-    if (start >= (int)strlen(str)) return value_string("");
+    if (start >= str->length) return value_string("");
     if (len < 0) len = 0;
+    if (len > str->length - start) len = str->length - start;
     
-    char* result = malloc(len + 1);
-    strncpy(result, str + start, len);
-    result[len] = '\0';
-    
-    Value v = value_string(result);
-    free(result);
-    return v;
+    return value_string_len(str->chars + start, len);
 }
 
 static Value native_floor(Value* args, int arg_count, Env* env) {
@@ -536,12 +580,21 @@ static Value native_uptime(Value* args, int arg_count, Env* env) {
 }
 
 static Value native_gc(Value* args, int arg_count, Env* env) {
-    (void)args; (void)arg_count;
-    // Trigger Mark-and-Sweep
-    gc_collect(env);
+    (void)args; (void)arg_count; (void)env;
+    // Mark-and-Sweep needs every root, so it runs at the next statement
+    gc_request();
     return value_null();
 }
 
+/* Old-space bytes the collector counts, and the frames closures kept alive */
+static Value native_gc_stats(Value* args, int arg_count, Env* env) {
+    (void)args; (void)arg_count; (void)env;
+    Value stats = value_map();
+    map_set(stats.as.map, "heap", value_number((double)gc_bytes_allocated));
+    map_set(stats.as.map, "frames", value_number((double)gc_frame_count()));
+    return stats;
+}
+
 /* ============================================================================
  * REGISTER STDLIB
  * ============================================================================ */
@@ -572,6 +625,7 @@ void stdlib_register(Env* env) {
     register_native(env, "pop", native_pop);
     register_native(env, "native_keys", native_keys);
     register_native(env, "native_values", native_values);
+    register_native(env, "remove", native_remove);
     register_native(env, "native_get_fields", native_get_fields);
     
     // Strings
@@ -579,6 +633,9 @@ void stdlib_register(Env* env) {
     register_native(env, "join", native_join);
     register_native(env, "substr", native_substr);
     register_native(env, "trim", native_trim);
+    register_native(env, "sb_new", native_sb_new);
+    register_native(env, "sb_append", native_sb_append);
+    register_native(env, "sb_finish", native_sb_finish);
     
     // Math
     register_native(env, "floor", native_floor);
@@ -603,6 +660,8 @@ void stdlib_register(Env* env) {
     register_native(env, "native_fs_list", native_fs_list);
     register_native(env, "native_fs_is_dir", native_fs_is_dir);
     register_native(env, "gc", native_gc);
+    register_native(env, "gc_stats", native_gc_stats);
+    register_native(env, "ic_stats", native_ic_stats);
 
     // Network
     register_native(env, "native_net_listen", native_net_listen);
@@ -610,6 +669,26 @@ void stdlib_register(Env* env) {
     register_native(env, "native_net_read", native_net_read);
     register_native(env, "native_net_write", native_net_write);
     register_native(env, "native_net_close", native_net_close);
+    register_native(env, "native_net_accept_all", native_net_accept_all);
+    register_native(env, "native_net_set_nonblocking", native_net_set_nonblocking);
+    register_native(env, "native_net_poll_create", native_net_poll_create);
+    register_native(env, "native_net_poll_add", native_net_poll_add);
+    register_native(env, "native_net_poll_mod", native_net_poll_mod);
+    register_native(env, "native_net_poll_del", native_net_poll_del);
+    register_native(env, "native_net_poll_wait", native_net_poll_wait);
+    register_native(env, "native_net_conn_open", native_net_conn_open);
+    register_native(env, "native_net_conn_read", native_net_conn_read);
+    register_native(env, "native_net_conn_next", native_net_conn_next);
+    register_native(env, "native_net_conn_flush", native_net_conn_flush);
+    register_native(env, "native_net_conn_end", native_net_conn_end);
+    register_native(env, "native_net_conn_close", native_net_conn_close);
+    register_native(env, "native_net_conn_sweep", native_net_conn_sweep);
+    register_native(env, "native_net_conn_count", native_net_conn_count);
+    register_native(env, "native_net_draining", native_net_draining);
+    register_native(env, "native_net_file_info", native_net_file_info);
+    register_native(env, "native_net_sendfile", native_net_sendfile);
+    register_native(env, "native_net_write_blob", native_net_write_blob);
+    register_native(env, "native_http_parse", native_http_parse);
     
     // SQL
     register_native(env, "native_sql_connect", native_sql_connect);
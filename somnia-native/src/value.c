@@ -8,6 +8,240 @@
 /* Global object list */
 Obj* vm_objects = NULL;
 
+/* Heap accounting: a collection is due once gc_bytes_allocated passes this */
+size_t gc_bytes_allocated = 0;
+size_t gc_next_collection = GC_INITIAL_THRESHOLD;
+
+/* Call and loop frames that closures may outlive the scope with */
+static Env** tracked_frames = NULL;
+static int tracked_count = 0;
+static int tracked_capacity = 0;
+
+/* Old-space objects join vm_objects; nursery objects are found by tracing */
+static void object_init(Obj* obj, ObjType type) {
+    obj->type = type;
+    obj->marked = false;
+    obj->remembered = false;
+    if (nursery_contains(obj)) {
+        obj->next = NULL;
+    } else {
+        obj->next = vm_objects;
+        vm_objects = obj;
+    }
+}
+
+/* ============================================================================
+ * STRINGS
+ * ============================================================================ */
+
+/* Intern table: open addressing over String*, NULL = empty */
+static String** interned = NULL;
+static int interned_count = 0;
+static int interned_capacity = 0;
+
+/* FNV-1a, resumable: hash(a + b) == hash_continue(hash(a), b) */
+static uint32_t hash_continue(uint32_t hash, const char* chars, int length) {
+    for (int i = 0; i < length; i++) {
+        hash ^= (uint8_t)chars[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+static uint32_t hash_bytes(const char* chars, int length) {
+    return hash_continue(2166136261u, chars, length);
+}
+
+static int intern_find_bucket(const char* chars, int length, uint32_t hash) {
+    int mask = interned_capacity - 1;
+    int bucket = (int)(hash & (uint32_t)mask);
+    
+    while (interned[bucket] != NULL) {
+        String* s = interned[bucket];
+        if (s->hash == hash && s->length == length && memcmp(s->chars, chars, length) == 0) {
+            return bucket;
+        }
+        bucket = (bucket + 1) & mask;
+    }
+    return bucket;
+}
+
+static void intern_insert(String* s) {
+    if ((interned_count + 1) * 4 > interned_capacity * 3) {
+        String** old = interned;
+        int old_capacity = interned_capacity;
+        
+        interned_capacity = interned_capacity < 64 ? 64 : interned_capacity * 2;
+        interned = calloc(interned_capacity, sizeof(String*));
+        for (int i = 0; i < old_capacity; i++) {
+            if (old[i] == NULL) continue;
+            int bucket = (int)(old[i]->hash & (uint32_t)(interned_capacity - 1));
+            while (interned[bucket] != NULL) bucket = (bucket + 1) & (interned_capacity - 1);
+            interned[bucket] = old[i];
+        }
+        free(old);
+    }
+    
+    interned[intern_find_bucket(s->chars, s->length, s->hash)] = s;
+    interned_count++;
+    s->interned = true;
+}
+
+/* Backward-shift delete, called when an interned string is swept */
+static void intern_remove(String* s) {
+    int mask = interned_capacity - 1;
+    int hole = intern_find_bucket(s->chars, s->length, s->hash);
+    if (interned[hole] != s) return;
+    
+    int next = (hole + 1) & mask;
+    while (interned[next] != NULL) {
+        int home = (int)(interned[next]->hash & (uint32_t)mask);
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            interned[hole] = interned[next];
+            hole = next;
+        }
+        next = (next + 1) & mask;
+    }
+    interned[hole] = NULL;
+    interned_count--;
+}
+
+static String* string_alloc_capacity(const char* chars, int length, int capacity, uint32_t hash) {
+    String* s = malloc(sizeof(String) + capacity + 1);
+    gc_bytes_allocated += sizeof(String) + capacity + 1;
+    object_init(&s->obj, OBJ_STRING);
+    
+    s->length = length;
+    s->capacity = capacity;
+    s->hash = hash;
+    s->interned = false;
+    s->pinned = false;
+    s->unique = false;
+    if (chars != NULL) memcpy(s->chars, chars, length);
+    s->chars[length] = '\0';
+    return s;
+}
+
+/* Malloc'd, NUL-terminated copy of `length` bytes, for names the runtime owns */
+char* copy_string(const char* chars, int length) {
+    char* copy = malloc(length + 1);
+    memcpy(copy, chars, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+static String* string_alloc(const char* chars, int length, uint32_t hash) {
+    return string_alloc_capacity(chars, length, length, hash);
+}
+
+static String* string_intern(const char* chars, int length) {
+    uint32_t hash = hash_bytes(chars, length);
+    if (interned_capacity > 0) {
+        String* found = interned[intern_find_bucket(chars, length, hash)];
+        if (found != NULL) return found;
+    }
+    
+    String* s = string_alloc(chars, length, hash);
+    intern_insert(s);
+    return s;
+}
+
+static Value string_value(String* s) {
+    Value v;
+    v.type = VAL_STRING;
+    v.as.string = s;
+    return v;
+}
+
+Value value_string_len(const char* s, int length) {
+    if (length <= STRING_INTERN_MAX) return string_value(string_intern(s, length));
+    return string_value(string_alloc(s, length, hash_bytes(s, length)));
+}
+
+/* Literals are created once by the lexer and live as long as the AST */
+Value value_string_literal(const char* s) {
+    String* str = string_intern(s, (int)strlen(s));
+    str->pinned = true;
+    return string_value(str);
+}
+
+Value value_string_concat(String* a, String* b) {
+    int length = a->length + b->length;
+    if (length <= STRING_INTERN_MAX) {
+        char buf[STRING_INTERN_MAX + 1];
+        memcpy(buf, a->chars, a->length);
+        memcpy(buf + a->length, b->chars, b->length);
+        return value_string_len(buf, length);
+    }
+    
+    String* s = string_alloc(NULL, length, hash_continue(a->hash, b->chars, b->length));
+    memcpy(s->chars, a->chars, a->length);
+    memcpy(s->chars + a->length, b->chars, b->length);
+    return string_value(s);
+}
+
+/*
+ * Append for `x = x + ...`: writes into `s` when it is unique and has room,
+ * otherwise copies into a new unique string with doubled capacity, so a
+ * loop of appends is linear overall.
+ */
+String* string_append(String* s, const char* chars, int length) {
+    int needed = s->length + length;
+    if (!s->unique || needed > s->capacity) {
+        int capacity = needed * 2 < 64 ? 64 : needed * 2;
+        String* grown = string_alloc_capacity(s->chars, s->length, capacity, s->hash);
+        grown->unique = true;
+        s = grown;
+    }
+    
+    memcpy(s->chars + s->length, chars, length);
+    s->hash = hash_continue(s->hash, chars, length);
+    s->length = needed;
+    s->chars[needed] = '\0';
+    return s;
+}
+
+/* ============================================================================
+ * STRING BUILDER
+ * ============================================================================ */
+
+Value value_builder(void) {
+    Value v;
+    v.type = VAL_BUILDER;
+    v.as.builder = malloc(sizeof(StringBuilder));
+    object_init(&v.as.builder->obj, OBJ_BUILDER);
+    
+    v.as.builder->chars = malloc(64);
+    gc_bytes_allocated += sizeof(StringBuilder) + 64;
+    v.as.builder->length = 0;
+    v.as.builder->capacity = 64;
+    return v;
+}
+
+void builder_append(StringBuilder* sb, const char* chars, int length) {
+    if (sb->length + length > sb->capacity) {
+        int old_capacity = sb->capacity;
+        while (sb->length + length > sb->capacity) sb->capacity *= 2;
+        sb->chars = realloc(sb->chars, sb->capacity);
+        gc_bytes_allocated += sb->capacity - old_capacity;
+    }
+    memcpy(sb->chars + sb->length, chars, length);
+    sb->length += length;
+}
+
+bool string_equals(String* a, String* b) {
+    if (a == b) return true;
+    if (a->length != b->length || a->hash != b->hash) return false;
+    // Two distinct interned strings are never equal
+    if (a->interned && b->interned) return false;
+    return memcmp(a->chars, b->chars, a->length) == 0;
+}
+
+static void string_free(String* s) {
+    if (s->interned) intern_remove(s);
+    free(s);
+}
+
 /* ============================================================================
  * VALUE CONSTRUCTORS
  * ============================================================================ */
@@ -33,24 +267,24 @@ Value value_number(double n) {
 }
 
 Value value_string(const char* s) {
-    Value v;
-    v.type = VAL_STRING;
-    v.as.string = strdup(s);
-    return v;
+    return value_string_len(s, (int)strlen(s));
 }
 
 Value value_array(void) {
     Value v;
     v.type = VAL_ARRAY;
-    v.as.array = malloc(sizeof(Array));
     
-    // GC Init
-    v.as.array->obj.type = OBJ_ARRAY;
-    v.as.array->obj.marked = false;
-    v.as.array->obj.next = vm_objects;
-    vm_objects = (Obj*)v.as.array;
+    // Header and first items in one nursery block when there is room
+    v.as.array = nursery_alloc(sizeof(Array) + sizeof(Value) * 8);
+    if (v.as.array != NULL) {
+        v.as.array->items = (Value*)(v.as.array + 1);
+    } else {
+        v.as.array = malloc(sizeof(Array));
+        v.as.array->items = malloc(sizeof(Value) * 8);
+        gc_bytes_allocated += sizeof(Array) + sizeof(Value) * 8;
+    }
+    object_init(&v.as.array->obj, OBJ_ARRAY);
     
-    v.as.array->items = malloc(sizeof(Value) * 8);
     v.as.array->count = 0;
     v.as.array->capacity = 8;
     return v;
@@ -59,34 +293,68 @@ Value value_array(void) {
 Value value_map(void) {
     Value v;
     v.type = VAL_MAP;
-    v.as.map = malloc(sizeof(Map));
     
-    // GC Init
-    v.as.map->obj.type = OBJ_MAP;
-    v.as.map->obj.marked = false;
-    v.as.map->obj.next = vm_objects;
-    vm_objects = (Obj*)v.as.map;
+    v.as.map = nursery_alloc(sizeof(Map) + sizeof(MapEntry) * 8 + sizeof(int) * 16);
+    if (v.as.map != NULL) {
+        v.as.map->entries = (MapEntry*)(v.as.map + 1);
+        v.as.map->index = (int*)(v.as.map->entries + 8);
+    } else {
+        v.as.map = malloc(sizeof(Map));
+        v.as.map->entries = malloc(sizeof(MapEntry) * 8);
+        v.as.map->index = malloc(sizeof(int) * 16);
+        gc_bytes_allocated += sizeof(Map) + sizeof(MapEntry) * 8 + sizeof(int) * 16;
+    }
+    object_init(&v.as.map->obj, OBJ_MAP);
     
-    v.as.map->entries = malloc(sizeof(MapEntry) * 8);
     v.as.map->count = 0;
+    v.as.map->used = 0;
     v.as.map->capacity = 8;
+    v.as.map->index_capacity = 16;
+    for (int i = 0; i < 16; i++) v.as.map->index[i] = -1;
     return v;
 }
 
-Value value_object(const char* class_name, Env* fields) {
+Value value_object(Class* klass) {
     Value val;
     val.type = VAL_OBJECT;
-    val.as.object = malloc(sizeof(Object));
     
-    // GC Init
-    val.as.object->obj.type = OBJ_OBJECT;
-    val.as.object->obj.marked = false;
-    val.as.object->obj.next = vm_objects;
-    vm_objects = (Obj*)val.as.object;
+    // Start with the declared fields, all null
+    Shape* shape = klass->instance_shape;
+    size_t slots_size = sizeof(Value) * shape->field_count;
+    val.as.object = nursery_alloc(sizeof(Object) + slots_size);
+    if (val.as.object != NULL) {
+        val.as.object->slots = shape->field_count > 0 ? (Value*)(val.as.object + 1) : NULL;
+    } else {
+        val.as.object = malloc(sizeof(Object));
+        val.as.object->slots = shape->field_count > 0 ? malloc(slots_size) : NULL;
+        gc_bytes_allocated += sizeof(Object) + slots_size;
+    }
+    object_init(&val.as.object->obj, OBJ_OBJECT);
+    
+    val.as.object->klass = klass;
+    val.as.object->shape = shape;
+    val.as.object->slot_capacity = shape->field_count;
+    for (int i = 0; i < shape->field_count; i++) {
+        val.as.object->slots[i] = value_null();
+    }
+    return val;
+}
+
+Value value_class(const char* name, struct ASTNode* ast, Env* methods) {
+    Value val;
+    val.type = VAL_CLASS;
+    val.as.klass = malloc(sizeof(Class));
+    object_init(&val.as.klass->obj, OBJ_CLASS);
     
-    val.as.object->class_name = strdup(class_name);
-    val.as.object->fields = fields;
-    val.as.object->ast = NULL;
+    static uint32_t next_class_id = 1;
+    val.as.klass->name = copy_string(name, (int)strlen(name));
+    val.as.klass->id = next_class_id++;
+    val.as.klass->methods = methods;
+    val.as.klass->ast = ast;
+    val.as.klass->instance_shape = shape_root();
+    gc_bytes_allocated += sizeof(Class);
+    // Classes are old from the start; minor collections scan their methods
+    gc_remember_env(methods);
     return val;
 }
 
@@ -99,7 +367,7 @@ bool value_is_truthy(Value val) {
         case VAL_NULL: return false;
         case VAL_BOOL: return val.as.boolean;
         case VAL_NUMBER: return val.as.number != 0;
-        case VAL_STRING: return val.as.string != NULL && strlen(val.as.string) > 0;
+        case VAL_STRING: return val.as.string->length > 0;
         case VAL_ARRAY: return val.as.array->count > 0;
         case VAL_MAP: return val.as.map->count > 0;
         default: return true;
@@ -113,7 +381,7 @@ bool value_equals(Value a, Value b) {
         case VAL_NULL: return true;
         case VAL_BOOL: return a.as.boolean == b.as.boolean;
         case VAL_NUMBER: return a.as.number == b.as.number;
-        case VAL_STRING: return strcmp(a.as.string, b.as.string) == 0;
+        case VAL_STRING: return string_equals(a.as.string, b.as.string);
         default: return false; // Reference equality for complex types
     }
 }
@@ -138,8 +406,8 @@ char* value_to_string(Value val) {
             break;
         }
         case VAL_STRING:
-            strcpy(buf, val.as.string);
-            break;
+            free(buf);
+            return copy_string(val.as.string->chars, val.as.string->length);
         case VAL_ARRAY: {
             strcpy(buf, "[");
             for (int i = 0; i < val.as.array->count; i++) {
@@ -153,8 +421,11 @@ char* value_to_string(Value val) {
         }
         case VAL_MAP: {
             strcpy(buf, "{");
-            for (int i = 0; i < val.as.map->count; i++) {
-                if (i > 0) strcat(buf, ", ");
+            bool first = true;
+            for (int i = 0; i < val.as.map->used; i++) {
+                if (val.as.map->entries[i].key == NULL) continue;
+                if (!first) strcat(buf, ", ");
+                first = false;
                 strcat(buf, "\"");
                 strcat(buf, val.as.map->entries[i].key);
                 strcat(buf, "\": ");
@@ -162,7 +433,7 @@ char* value_to_string(Value val) {
                 Value v = val.as.map->entries[i].value;
                 if (v.type == VAL_STRING) {
                     strcat(buf, "\"");
-                    strcat(buf, v.as.string);
+                    strcat(buf, v.as.string->chars);
                     strcat(buf, "\"");
                 } else {
                     char* vs = value_to_string(v);
@@ -180,7 +451,13 @@ char* value_to_string(Value val) {
             strcpy(buf, "<native function>");
             break;
         case VAL_OBJECT:
-            sprintf(buf, "<object %s>", val.as.object->class_name);
+            sprintf(buf, "<object %s>", val.as.object->klass->name);
+            break;
+        case VAL_CLASS:
+            sprintf(buf, "<class %s>", val.as.klass->name);
+            break;
+        case VAL_BUILDER:
+            sprintf(buf, "<string builder %d bytes>", val.as.builder->length);
             break;
         default:
             strcpy(buf, "<unknown>");
@@ -206,7 +483,7 @@ Value value_copy(Value val) {
             copy = val;
             break;
         case VAL_STRING:
-            copy.as.string = strdup(val.as.string);
+            copy = val; // Immutable, shared
             break;
         case VAL_ARRAY:
             copy = value_array();
@@ -216,7 +493,8 @@ Value value_copy(Value val) {
             break;
         case VAL_MAP:
             copy = value_map();
-            for (int i = 0; i < val.as.map->count; i++) {
+            for (int i = 0; i < val.as.map->used; i++) {
+                if (val.as.map->entries[i].key == NULL) continue;
                 map_set(copy.as.map, val.as.map->entries[i].key, 
                         value_copy(val.as.map->entries[i].value));
             }
@@ -228,22 +506,25 @@ Value value_copy(Value val) {
     return copy;
 }
 
-Value value_function(void) {
+Value value_function(Env* closure) {
     Value v;
     v.type = VAL_FUNCTION;
-    v.as.function = malloc(sizeof(Function));
-    
-    // GC Init
-    v.as.function->obj.type = OBJ_FUNCTION;
-    v.as.function->obj.marked = false;
-    v.as.function->obj.next = vm_objects;
-    vm_objects = (Obj*)v.as.function;
+    v.as.function = nursery_alloc(sizeof(Function));
+    if (v.as.function == NULL) {
+        v.as.function = malloc(sizeof(Function));
+        gc_bytes_allocated += sizeof(Function);
+        // Old functions' closures are scanned by every minor collection
+        gc_remember_env(closure);
+    }
+    object_init(&v.as.function->obj, OBJ_FUNCTION);
     
     v.as.function->name = NULL;
     v.as.function->params = NULL;
     v.as.function->param_count = 0;
     v.as.function->body = NULL;
-    v.as.function->closure = NULL;
+    v.as.function->closure = closure;
+    v.as.function->local_count = 0;
+    v.as.function->captured = false;
     return v;
 }
 
@@ -255,21 +536,18 @@ void gc_mark_object(Obj* obj);
 void gc_mark_value(Value val);
 void gc_mark_env(Env* env);
 
+/* Bumped per collection; an Env whose mark_epoch matches was already scanned */
+uint32_t gc_epoch = 0;
+
 void gc_mark_env(Env* env) {
-    if (env == NULL) return;
-    // Env is NOT an Obj, but it holds refs.
-    // We must assume Env itself is reachable if we are scanning it.
-    // But we need to avoid cycles? Env parent loop? Env is tree/stack.
-    // Marked? Env doesn't have marked bit.
-    // Wait, Env is usually owned by Function (closure) or Interpreter (stack).
-    // If we reach Env via Function, we scan it.
-    // Function -> Env -> Parent -> ...
-    // If multiple functions share Env, we re-scan. Performance hit but correct.
-    
-    for (int i = 0; i < env->var_count; i++) {
-        gc_mark_value(env->vars[i].value);
+    // Env is not an Obj: closures, classes and frames share it, so scan each
+    // chain once per collection. Parents of a scanned Env are scanned too.
+    for (; env != NULL && env->mark_epoch != gc_epoch; env = env->parent) {
+        env->mark_epoch = gc_epoch;
+        for (int i = 0; i < env->var_count; i++) {
+            gc_mark_value(env->vars[i].value);
+        }
     }
-    if (env->parent) gc_mark_env(env->parent);
 }
 
 void gc_mark_value(Value val) {
@@ -283,9 +561,18 @@ void gc_mark_value(Value val) {
         case VAL_OBJECT: 
             if (val.as.object) gc_mark_object((Obj*)val.as.object); 
             break;
+        case VAL_CLASS: 
+            if (val.as.klass) gc_mark_object((Obj*)val.as.klass); 
+            break;
+        case VAL_BUILDER: 
+            val.as.builder->obj.marked = true; 
+            break;
         case VAL_FUNCTION: 
             if (val.as.function) gc_mark_object((Obj*)val.as.function); 
             break;
+        case VAL_STRING: 
+            val.as.string->obj.marked = true; 
+            break;
         default: break;
     }
 }
@@ -304,15 +591,22 @@ void gc_mark_object(Obj* obj) {
         }
         case OBJ_MAP: {
             Map* map = (Map*)obj;
-            for (int i = 0; i < map->count; i++) {
+            for (int i = 0; i < map->used; i++) {
                 gc_mark_value(map->entries[i].value);
             }
             break;
         }
         case OBJ_OBJECT: {
             Object* o = (Object*)obj;
-            // Fields are in an Env
-            gc_mark_env(o->fields);
+            for (int i = 0; i < o->shape->field_count; i++) {
+                gc_mark_value(o->slots[i]);
+            }
+            gc_mark_object((Obj*)o->klass);
+            break;
+        }
+        case OBJ_CLASS: {
+            Class* klass = (Class*)obj;
+            gc_mark_env(klass->methods);
             break;
         }
         case OBJ_FUNCTION: {
@@ -324,143 +618,201 @@ void gc_mark_object(Obj* obj) {
     }
 }
 
-void gc_collect(Env* env) {
+/* Bytes an object accounts for in gc_bytes_allocated */
+static size_t object_size(Obj* obj) {
+    switch (obj->type) {
+        case OBJ_ARRAY:
+            return sizeof(Array) + sizeof(Value) * ((Array*)obj)->capacity;
+        case OBJ_MAP: {
+            Map* map = (Map*)obj;
+            return sizeof(Map) + sizeof(MapEntry) * map->capacity + sizeof(int) * map->index_capacity;
+        }
+        case OBJ_OBJECT:
+            return sizeof(Object) + sizeof(Value) * ((Object*)obj)->slot_capacity;
+        case OBJ_CLASS:
+            return sizeof(Class);
+        case OBJ_FUNCTION:
+            return sizeof(Function);
+        case OBJ_STRING:
+            return sizeof(String) + ((String*)obj)->capacity + 1;
+        case OBJ_BUILDER:
+            return sizeof(StringBuilder) + ((StringBuilder*)obj)->capacity;
+        default:
+            return 0;
+    }
+}
+
+static void object_free(Obj* object) {
+    switch (object->type) {
+        case OBJ_ARRAY: {
+            Array* array = (Array*)object;
+            free(array->items);
+            free(array);
+            break;
+        }
+        case OBJ_MAP: {
+            Map* map = (Map*)object;
+            for (int i = 0; i < map->used; i++) {
+                // Keys are copied in map_set; values are objects of their own
+                free(map->entries[i].key);
+            }
+            free(map->entries);
+            free(map->index);
+            free(map);
+            break;
+        }
+        case OBJ_OBJECT: {
+            // Fields live in the slots array; there is no per-object Env
+            Object* obj = (Object*)object;
+            free(obj->slots);
+            free(obj);
+            break;
+        }
+        case OBJ_CLASS: {
+            Class* klass = (Class*)object;
+            free(klass->name);
+            env_free(klass->methods);
+            free(klass);
+            break;
+        }
+        case OBJ_FUNCTION:
+            // Name and params belong to the AST, the closure Env to its scope
+            free(object);
+            break;
+        case OBJ_STRING:
+            string_free((String*)object);
+            break;
+        case OBJ_BUILDER: {
+            StringBuilder* sb = (StringBuilder*)object;
+            free(sb->chars);
+            free(sb);
+            break;
+        }
+    }
+}
+
+static size_t frame_size(Env* frame) {
+    return sizeof(Env) + sizeof(Variable) * (size_t)frame->var_capacity;
+}
+
+/*
+ * A frame the interpreter can't release when its scope exits, because an
+ * inner function or class may still reference it: gc_collect returns it to
+ * the frame pool once no marked Env or object reaches it.
+ */
+void gc_track_frame(Env* frame) {
+    if (tracked_count >= tracked_capacity) {
+        tracked_capacity = tracked_capacity < 64 ? 64 : tracked_capacity * 2;
+        tracked_frames = realloc(tracked_frames, sizeof(Env*) * tracked_capacity);
+    }
+    tracked_frames[tracked_count++] = frame;
+    gc_bytes_allocated += frame_size(frame);
+}
+
+/* Tracked frames not yet found dead */
+int gc_frame_count(void) {
+    return tracked_count;
+}
+
+/* Make the next statement boundary collect, whatever the heap size */
+void gc_request(void) {
+    gc_next_collection = 0;
+}
+
+/*
+ * Mark-and-sweep over the old space, once a minor collection has emptied
+ * the nursery. Only called at statement boundaries
+ * (see execute), where each value the interpreter still needs is reachable
+ * from an Env on the frame stack or from the shadow temp stack.
+ */
+void gc_collect(Interpreter* interp) {
+    // A root stack overflowed: its untracked entries are unknown, so wait
+    if (interp->temp_count > MAX_TEMP_STACK || interp->frame_count > MAX_FRAME_STACK) return;
+    
+    // 0. Empty the nursery: afterwards every live object is in vm_objects
+    gc_collect_young(interp);
+    
     // 1. Mark Roots
-    if (env) {
-        gc_mark_env(env);
+    gc_epoch++;
+    gc_mark_env(interp->global_env);
+    gc_mark_env(interp->current_env);
+    for (int i = 0; i < interp->frame_count; i++) {
+        gc_mark_env(interp->frame_stack[i]);
+    }
+    for (int i = 0; i < interp->temp_count; i++) {
+        gc_mark_value(interp->temp_stack[i]);
     }
+    gc_mark_value(interp->return_value);
+    gc_mark_env(interp->cognitive_state);
+    gc_mark_object((Obj*)interp->vfs);
+    gc_rebuild_remembered_envs();
     
-    // 2. Sweep
+    // 2. Sweep, re-counting what survives
+    size_t live = 0;
     Obj** object = &vm_objects;
     while (*object != NULL) {
-        if (!(*object)->marked) {
+        bool pinned = (*object)->type == OBJ_STRING && ((String*)*object)->pinned;
+        if (!(*object)->marked && !pinned) {
             // Unreached
             Obj* unreached = *object;
             *object = unreached->next;
-            
-            // Free
-            switch (unreached->type) {
-                case OBJ_ARRAY: {
-                    Array* arr = (Array*)unreached;
-                    free(arr->items);
-                    free(arr);
-                    break;
-                }
-                case OBJ_MAP: {
-                    Map* map = (Map*)unreached;
-                    for (int i = 0; i < map->count; i++) {
-                        free(map->entries[i].key);
-                        Value v = map->entries[i].value;
-                        if (v.type == VAL_STRING) free(v.as.string);
-                    }
-                    free(map->entries);
-                    free(map);
-                    break;
-                }
-                case OBJ_OBJECT: {
-                    Object* o = (Object*)unreached;
-                    free(o->class_name);
-                    // o->fields (Env) is NOT freed here because Env isn't an Obj.
-                    // Env lifecycle is managed manually?
-                    // Object instances own their Env (scope).
-                    // If Object dies, Env should die.
-                    // But we don't have gc_free_variable_array exposed.
-                    // Memory leak in Env structs attached to Objects!
-                    // Fix: We need to free Env here.
-                    // env_free(o->fields); // Assuming env_free exists
-                    free(o);
-                    break;
-                    }
-                case OBJ_FUNCTION: {
-                    Function* fn = (Function*)unreached;
-                    if (fn->name) free(fn->name);
-                    if (fn->params) {
-                        for (int i=0; i<fn->param_count; i++) free(fn->params[i]);
-                        free(fn->params);
-                    }
-                    free(fn);
-                    break;
-                }
-                default: break;
-            }
+            object_free(unreached);
         } else {
             // Reached
             (*object)->marked = false;
+            live += object_size(*object);
             object = &(*object)->next;
         }
     }
+    
+    // Tracked frames the marking did not stamp are unreachable: reuse them
+    int kept = 0;
+    for (int i = 0; i < tracked_count; i++) {
+        if (tracked_frames[i]->mark_epoch == gc_epoch) {
+            live += frame_size(tracked_frames[i]);
+            tracked_frames[kept++] = tracked_frames[i];
+        } else {
+            env_release(&interp->frame_pool, tracked_frames[i]);
+        }
+    }
+    tracked_count = kept;
+    
+    // 3. Let the heap grow with the live set before the next collection
+    gc_bytes_allocated = live;
+    gc_next_collection = live * GC_HEAP_GROW_FACTOR;
+    if (gc_next_collection < GC_INITIAL_THRESHOLD) gc_next_collection = GC_INITIAL_THRESHOLD;
 }
 
-/* Old helper */
+/* Free every object at exit */
 void free_objects(void) {
     Obj* object = vm_objects;
     while (object != NULL) {
         Obj* next = object->next;
-        
-        switch (object->type) {
-            case OBJ_ARRAY: {
-                Array* array = (Array*)object;
-                free(array->items);
-                free(array);
-                break;
-            }
-            case OBJ_MAP: {
-                Map* map = (Map*)object;
-                for (int i = 0; i < map->count; i++) {
-                    // Keys are usually strdup'd in map_set
-                    free(map->entries[i].key);
-                    // Value freeing is recursive, handled by manual calls?
-                    // No, free_objects blindly frees memory.
-                    // Values inside might be objects, which will be freed as we iterate vm_objects.
-                    // But strings inside values need freeing if they are char*.
-                    // Value.as.string IS a char* and needs freeing.
-                    Value v = map->entries[i].value;
-                    if (v.type == VAL_STRING) free(v.as.string);
-                }
-                free(map->entries);
-                free(map);
-                break;
-            }
-            case OBJ_OBJECT: {
-                Object* obj = (Object*)object;
-                free(obj->class_name);
-                // Env freeing is complex? Env is usually malloc'd separately.
-                // Env tracking? Env is NOT an Obj in our current scheme.
-                // Env is managed by interpreter recursion usually.
-                // If Env is heap allocated, it should be tracked or freed.
-                // Currently env_free is manual. 
-                // We'll leave env_free to interpreter cleanup for now.
-                free(obj);
-                break;
-            }
-            case OBJ_FUNCTION: {
-                Function* fn = (Function*)object;
-                if (fn->name) free(fn->name);
-                if (fn->params) {
-                    for (int i = 0; i < fn->param_count; i++) free(fn->params[i]);
-                    free(fn->params);
-                }
-                // Closure is Env*, handled elsewhere?
-                free(fn);
-                break;
-            }
-            case OBJ_STRING:
-                // Not implemented yet
-                break;
-        }
-        
+        object_free(object);
         object = next;
     }
     vm_objects = NULL;
+    gc_bytes_allocated = 0;
+    nursery_free();
+    
+    for (int i = 0; i < tracked_count; i++) {
+        env_free(tracked_frames[i]);
+    }
+    free(tracked_frames);
+    tracked_frames = NULL;
+    tracked_count = 0;
+    tracked_capacity = 0;
+    
+    free(interned);
+    interned = NULL;
+    interned_count = 0;
+    interned_capacity = 0;
 }
 
 void value_free(Value* val) {
     // Deprecated in favor of GC/free_objects, but kept for stack values
     if (val == NULL) return;
     
-    if (val->type == VAL_STRING) {
-        free(val->as.string);
-    }
     // Deep free for arrays/maps only if not using GC?
     // If GC is active, value_free shouldn't free heap objects that are tracked.
     // For now, we disable recursive free here to avoid double-free with free_objects.
@@ -473,10 +825,12 @@ void value_free(Value* val) {
 
 void array_push(Array* arr, Value val) {
     if (arr->count >= arr->capacity) {
+        arr->items = gc_grow_buffer(&arr->obj, arr->items, sizeof(Value) * arr->capacity,
+                                    sizeof(Value) * arr->capacity * 2);
         arr->capacity *= 2;
-        arr->items = realloc(arr->items, sizeof(Value) * arr->capacity);
     }
     arr->items[arr->count++] = val;
+    gc_write_barrier(&arr->obj, val);
 }
 
 Value array_get(Array* arr, int index) {
@@ -489,6 +843,7 @@ Value array_get(Array* arr, int index) {
 void array_set(Array* arr, int index, Value val) {
     if (index >= 0 && index < arr->count) {
         arr->items[index] = val;
+        gc_write_barrier(&arr->obj, val);
     }
 }
 
@@ -496,40 +851,131 @@ void array_set(Array* arr, int index, Value val) {
  * MAP OPERATIONS
  * ============================================================================ */
 
+static uint32_t map_hash(const char* key) {
+    return hash_bytes(key, (int)strlen(key));
+}
+
+/* Bucket holding `key`, or the empty bucket where it would be inserted */
+static int map_find_bucket(Map* m, const char* key, uint32_t hash) {
+    int mask = m->index_capacity - 1;
+    int bucket = (int)(hash & (uint32_t)mask);
+    
+    for (;;) {
+        int pos = m->index[bucket];
+        if (pos < 0) return bucket;
+        
+        MapEntry* entry = &m->entries[pos];
+        if (entry->hash == hash && strcmp(entry->key, key) == 0) return bucket;
+        bucket = (bucket + 1) & mask;
+    }
+}
+
+static void map_rebuild_index(Map* m, int index_capacity) {
+    m->index = gc_grow_buffer(&m->obj, m->index, sizeof(int) * m->index_capacity,
+                              sizeof(int) * index_capacity);
+    m->index_capacity = index_capacity;
+    for (int i = 0; i < index_capacity; i++) m->index[i] = -1;
+    
+    int mask = index_capacity - 1;
+    for (int i = 0; i < m->used; i++) {
+        if (m->entries[i].key == NULL) continue;
+        int bucket = (int)(m->entries[i].hash & (uint32_t)mask);
+        while (m->index[bucket] >= 0) bucket = (bucket + 1) & mask;
+        m->index[bucket] = i;
+    }
+}
+
+/* Slides live entries over deleted ones, keeping their order */
+static void map_compact(Map* m) {
+    int live = 0;
+    for (int i = 0; i < m->used; i++) {
+        if (m->entries[i].key != NULL) m->entries[live++] = m->entries[i];
+    }
+    m->used = live;
+    map_rebuild_index(m, m->index_capacity);
+}
+
 void map_set(Map* m, const char* key, Value val) {
-    // Check if key exists
-    for (int i = 0; i < m->count; i++) {
-        if (strcmp(m->entries[i].key, key) == 0) {
-            m->entries[i].value = val;
-            return;
-        }
+    uint32_t hash = map_hash(key);
+    int bucket = map_find_bucket(m, key, hash);
+    
+    // Update existing key
+    if (m->index[bucket] >= 0) {
+        m->entries[m->index[bucket]].value = val;
+        gc_write_barrier(&m->obj, val);
+        return;
     }
     
-    // Add new entry
-    if (m->count >= m->capacity) {
-        m->capacity *= 2;
-        m->entries = realloc(m->entries, sizeof(MapEntry) * m->capacity);
+    // Add new entry: a full array is compacted if deletes left it at most
+    // half live, and grown otherwise
+    if (m->used >= m->capacity) {
+        if (m->count * 2 <= m->capacity) {
+            map_compact(m);
+        } else {
+            m->entries = gc_grow_buffer(&m->obj, m->entries, sizeof(MapEntry) * m->capacity,
+                                        sizeof(MapEntry) * m->capacity * 2);
+            m->capacity *= 2;
+        }
+        bucket = map_find_bucket(m, key, hash);
     }
     
-    m->entries[m->count].key = strdup(key);
-    m->entries[m->count].value = val;
+    // A young map's keys die with it in the nursery
+    char* copy = nursery_contains(m) ? nursery_strdup(key) : NULL;
+    if (copy == NULL) {
+        copy = copy_string(key, (int)strlen(key));
+        if (nursery_contains(m)) nursery_track(&m->obj);
+    }
+    gc_write_barrier(&m->obj, val);
+    m->entries[m->used].key = copy;
+    m->entries[m->used].hash = hash;
+    m->entries[m->used].value = val;
+    m->index[bucket] = m->used;
+    m->used++;
     m->count++;
+    
+    // Keep the index at most 3/4 full
+    if (m->count * 4 > m->index_capacity * 3) {
+        map_rebuild_index(m, m->index_capacity * 2);
+    }
 }
 
 Value* map_get(Map* m, const char* key) {
-    for (int i = 0; i < m->count; i++) {
-        if (strcmp(m->entries[i].key, key) == 0) {
-            return &m->entries[i].value;
-        }
-    }
-    return NULL;
+    int pos = m->index[map_find_bucket(m, key, map_hash(key))];
+    return pos >= 0 ? &m->entries[pos].value : NULL;
 }
 
 bool map_has(Map* m, const char* key) {
-    for (int i = 0; i < m->count; i++) {
-        if (strcmp(m->entries[i].key, key) == 0) {
-            return true;
+    return m->index[map_find_bucket(m, key, map_hash(key))] >= 0;
+}
+
+/*
+ * The bucket is emptied with backward-shift deletion, so lookups never see
+ * tombstones. The entry only loses its key, keeping the positions of later
+ * entries; map_set compacts the array when it fills up.
+ */
+bool map_delete(Map* m, const char* key) {
+    int mask = m->index_capacity - 1;
+    int bucket = map_find_bucket(m, key, map_hash(key));
+    int pos = m->index[bucket];
+    if (pos < 0) return false;
+    
+    // Shift later probes back into the hole
+    int hole = bucket;
+    int next = (hole + 1) & mask;
+    while (m->index[next] >= 0) {
+        int home = (int)(m->entries[m->index[next]].hash & (uint32_t)mask);
+        // Move if `home` is not cyclically within (hole, next]
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            m->index[hole] = m->index[next];
+            hole = next;
         }
+        next = (next + 1) & mask;
     }
-    return false;
+    m->index[hole] = -1;
+    
+    gc_free_buffer(m->entries[pos].key);
+    m->entries[pos].key = NULL;
+    m->entries[pos].value = value_null();
+    m->count--;
+    return true;
 }
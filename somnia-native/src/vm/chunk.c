@@ -1,5 +1,6 @@
 #include "chunk.h"
 #include "memory.h"
+#include "object.h"
 #include "value.h"
 
 void initChunk(Chunk* chunk) {
@@ -8,12 +9,16 @@ void initChunk(Chunk* chunk) {
     chunk->code = NULL;
     chunk->lines = NULL;
     initValueArray(&chunk->constants);
+    chunk->caches = NULL;
+    chunk->cacheCount = 0;
+    chunk->cacheCapacity = 0;
 }
 
 void freeChunk(Chunk* chunk) {
     FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
     FREE_ARRAY(int, chunk->lines, chunk->capacity);
     freeValueArray(&chunk->constants);
+    FREE_ARRAY(InlineCache, chunk->caches, chunk->cacheCapacity);
     initChunk(chunk);
 }
 
@@ -34,3 +39,64 @@ int addConstant(Chunk* chunk, Value value) {
     writeValueArray(&chunk->constants, value);
     return chunk->constants.count - 1;
 }
+
+/* A fresh, empty inline cache; returns its index */
+int addCache(Chunk* chunk) {
+    if (chunk->cacheCapacity < chunk->cacheCount + 1) {
+        int oldCapacity = chunk->cacheCapacity;
+        chunk->cacheCapacity = GROW_CAPACITY(oldCapacity);
+        chunk->caches = GROW_ARRAY(InlineCache, chunk->caches, oldCapacity, chunk->cacheCapacity);
+    }
+    
+    InlineCache* cache = &chunk->caches[chunk->cacheCount];
+    cache->count = 0;
+    cache->megamorphic = false;
+    return chunk->cacheCount++;
+}
+
+int instructionLength(Chunk* chunk, int offset) {
+    switch (chunk->code[offset]) {
+        case OP_CONSTANT:
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+        case OP_CALL:
+        case OP_CLASS:
+        case OP_METHOD:
+        case OP_GET_SUPER:
+        case OP_ARRAY:
+        case OP_MAP:
+        case OP_IMPORT:
+        case OP_ADD_CONSTANT:
+            return 2;
+        case OP_GET_GLOBAL_SLOT:
+        case OP_DEFINE_GLOBAL_SLOT:
+        case OP_SET_GLOBAL_SLOT:
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_LOOP:
+        case OP_SUPER_INVOKE:
+        case OP_TRY:
+        case OP_GET_LOCAL2:
+        case OP_INCREMENT_LOCAL:
+        case OP_JUMP_IF_NOT_LESS:
+        case OP_JUMP_IF_NOT_LESS_EQUAL:
+        case OP_JUMP_IF_NOT_GREATER:
+        case OP_JUMP_IF_NOT_GREATER_EQUAL:
+            return 3;
+        case OP_GET_PROPERTY:
+        case OP_SET_PROPERTY:
+        case OP_FOR_ITER:
+            return 4;
+        case OP_INVOKE:
+            return 5;
+        case OP_CLOSURE: {
+            // Two bytes per upvalue follow the function constant
+            ObjFunction* function = AS_FUNCTION(chunk->constants.values[chunk->code[offset + 1]]);
+            return 2 + function->upvalueCount * 2;
+        }
+        default:
+            return 1;
+    }
+}
@@ -0,0 +1,34 @@
+#include "engine.h"
+#include "vm.h"
+#include "compiler/compiler.h"
+#include "jit.h"
+
+EngineResult engine_run_bytecode(const char* source, EngineOptions options) {
+    initVM();
+    vm.gcIncremental = !options.full_gc;
+    if (options.gc_pause_target > 0) vm.gcPauseTarget = options.gc_pause_target;
+    if (options.jit) {
+#if BASELINE_JIT
+        vm.jitEnabled = initJit();
+        if (options.jit_threshold > 0) {
+            vm.jitCallThreshold = options.jit_threshold;
+            vm.jitLoopThreshold = options.jit_threshold;
+        }
+#else
+        fprintf(stderr, "[VM] This build has no JIT; interpreting\n");
+#endif
+    }
+    
+    // Compile errors include constructs the compiler leaves to the
+    // tree-walker; nothing has run yet, so the caller can fall back
+    ObjFunction* function = compile(source);
+    if (function == NULL) {
+        freeVM();
+        return ENGINE_FALLBACK;
+    }
+    
+    InterpretResult result = interpretFunction(function);
+    fflush(stdout);
+    freeVM();
+    return result == INTERPRET_OK ? ENGINE_OK : ENGINE_RUNTIME_ERROR;
+}
@@ -0,0 +1,996 @@
+#include "jit.h"
+#include "object.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if BASELINE_JIT
+
+/* x86-64 registers. Native code keeps the VM's hot state in callee-saved
+ * ones, which survive every helper call */
+typedef enum {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15,
+} Register;
+
+#define STACK_TOP RBX   // vm.stackTop
+#define SLOTS R12       // frame->slots
+#define FRAME R13       // The CallFrame being run
+#define VM_BASE R14     // &vm
+
+// Condition codes, the low nibble of Jcc and SETcc. `cc ^ 1` negates one
+typedef enum {
+    CC_O = 0x0,
+    CC_B = 0x2,
+    CC_AE = 0x3,
+    CC_E = 0x4,
+    CC_NE = 0x5,
+    CC_BE = 0x6,
+    CC_A = 0x7,
+    CC_S = 0x8,
+    CC_L = 0xc,
+    CC_GE = 0xd,
+    CC_LE = 0xe,
+    CC_G = 0xf,
+} Condition;
+
+#define JUMP_ALWAYS -1
+
+// ALU opcodes taking `r/m64, r64`
+#define ALU_ADD 0x01
+#define ALU_OR  0x09
+#define ALU_AND 0x21
+#define ALU_SUB 0x29
+#define ALU_CMP 0x39
+#define ALU_TEST 0x85
+#define ALU_MOV 0x89
+
+// Shift group extensions
+#define SHIFT_SHL 4
+#define SHIFT_SHR 5
+#define SHIFT_SAR 7
+
+// Scalar double opcodes (F2 0F xx)
+#define SSE_ADD 0x58
+#define SSE_MUL 0x59
+#define SSE_SUB 0x5c
+
+#define NO_ENTRY UINT32_MAX
+
+/* rel32 of a jump to an instruction, filled in once every instruction
+ * has an address */
+typedef struct {
+    int end;                // Offset just past the rel32
+    int target;             // Bytecode offset
+} JumpPatch;
+
+typedef struct {
+    Chunk* chunk;
+    uint8_t* code;
+    int count;
+    int capacity;
+    uint8_t* address;       // Where code[0] is installed
+    uint32_t* entries;
+    JumpPatch* patches;
+    int patchCount;
+    int patchCapacity;
+} Assembler;
+
+/* One mapping holds the entry trampoline, then every compiled function */
+static struct {
+    uint8_t* base;
+    size_t used;
+    size_t pageSize;
+    JitStatus (*enter)(CallFrame* frame, uint8_t* target);
+    uint8_t* exit;          // Restores the caller's registers, returns eax
+    FILE* perfMap;
+} cache;
+
+static void emitByte(Assembler* as, uint8_t byte) {
+    if (as->count == as->capacity) {
+        as->capacity = as->capacity < 256 ? 256 : as->capacity * 2;
+        as->code = realloc(as->code, as->capacity);
+    }
+    as->code[as->count++] = byte;
+}
+
+static void emitBytes(Assembler* as, const uint8_t* bytes, int count) {
+    for (int i = 0; i < count; i++) emitByte(as, bytes[i]);
+}
+
+static void emit32(Assembler* as, uint32_t value) {
+    for (int i = 0; i < 4; i++) emitByte(as, (uint8_t)(value >> (i * 8)));
+}
+
+static void emit64(Assembler* as, uint64_t value) {
+    emit32(as, (uint32_t)value);
+    emit32(as, (uint32_t)(value >> 32));
+}
+
+/* REX.W prefix for `reg` in ModRM.reg and `rm` in ModRM.rm */
+static void emitRexW(Assembler* as, int reg, int rm) {
+    emitByte(as, 0x48 | ((reg & 8) >> 1) | ((rm & 8) >> 3));
+}
+
+/* ModRM (plus SIB) and displacement of a [base + disp] operand */
+static void emitMemory(Assembler* as, int reg, int base, int32_t disp) {
+    bool short8 = disp >= -128 && disp <= 127;
+    emitByte(as, (short8 ? 0x40 : 0x80) | ((reg & 7) << 3) | (base & 7));
+    if ((base & 7) == RSP) emitByte(as, 0x24);
+    if (short8) {
+        emitByte(as, (uint8_t)disp);
+    } else {
+        emit32(as, (uint32_t)disp);
+    }
+}
+
+static void load(Assembler* as, int dst, int base, int32_t disp) {
+    emitRexW(as, dst, base);
+    emitByte(as, 0x8b);
+    emitMemory(as, dst, base, disp);
+}
+
+static void store(Assembler* as, int base, int32_t disp, int src) {
+    emitRexW(as, src, base);
+    emitByte(as, 0x89);
+    emitMemory(as, src, base, disp);
+}
+
+/* lea, so adjusting the stack top leaves the flags alone */
+static void addressOf(Assembler* as, int dst, int base, int32_t disp) {
+    emitRexW(as, dst, base);
+    emitByte(as, 0x8d);
+    emitMemory(as, dst, base, disp);
+}
+
+static void moveImmediate(Assembler* as, int dst, uint64_t value) {
+    if (value <= UINT32_MAX) {
+        if (dst & 8) emitByte(as, 0x41);
+        emitByte(as, 0xb8 + (dst & 7));
+        emit32(as, (uint32_t)value);
+    } else {
+        emitRexW(as, 0, dst);
+        emitByte(as, 0xb8 + (dst & 7));
+        emit64(as, value);
+    }
+}
+
+/* `dst op= src` for one of the ALU_ opcodes */
+static void alu(Assembler* as, uint8_t opcode, int dst, int src) {
+    emitRexW(as, src, dst);
+    emitByte(as, opcode);
+    emitByte(as, 0xc0 | ((src & 7) << 3) | (dst & 7));
+}
+
+static void multiply(Assembler* as, int dst, int src) {
+    emitRexW(as, dst, src);
+    emitByte(as, 0x0f);
+    emitByte(as, 0xaf);
+    emitByte(as, 0xc0 | ((dst & 7) << 3) | (src & 7));
+}
+
+static void shift(Assembler* as, int extension, int reg, uint8_t count) {
+    emitRexW(as, 0, reg);
+    emitByte(as, 0xc1);
+    emitByte(as, 0xc0 | (extension << 3) | (reg & 7));
+    emitByte(as, count);
+}
+
+static void compareImmediate(Assembler* as, int reg, int32_t value) {
+    emitRexW(as, 0, reg);
+    emitByte(as, 0x81);
+    emitByte(as, 0xc0 | (7 << 3) | (reg & 7));
+    emit32(as, (uint32_t)value);
+}
+
+static void callAddress(Assembler* as, void* function) {
+    moveImmediate(as, RAX, (uint64_t)(uintptr_t)function);
+    emitByte(as, 0xff);
+    emitByte(as, 0xd0);
+}
+
+static void testStatus(Assembler* as) {
+    emitByte(as, 0x85);
+    emitByte(as, 0xc0);
+}
+
+static void emitJumpOpcode(Assembler* as, int condition) {
+    if (condition == JUMP_ALWAYS) {
+        emitByte(as, 0xe9);
+    } else {
+        emitByte(as, 0x0f);
+        emitByte(as, 0x80 | condition);
+    }
+}
+
+/* Jump within the instruction being emitted; returns what patchJump takes */
+static int jumpForward(Assembler* as, int condition) {
+    emitJumpOpcode(as, condition);
+    emit32(as, 0);
+    return as->count;
+}
+
+/* Lands a jumpForward here */
+static void patchJump(Assembler* as, int end) {
+    int32_t distance = as->count - end;
+    memcpy(as->code + end - 4, &distance, 4);
+}
+
+/* Jump to a fixed address in the cache, such as the exit */
+static void jumpToAddress(Assembler* as, int condition, uint8_t* target) {
+    emitJumpOpcode(as, condition);
+    emit32(as, (uint32_t)(int32_t)(target - (as->address + as->count + 4)));
+}
+
+static void jumpToInstruction(Assembler* as, int condition, int target) {
+    emitJumpOpcode(as, condition);
+    emit32(as, 0);
+    if (as->patchCount == as->patchCapacity) {
+        as->patchCapacity = as->patchCapacity < 16 ? 16 : as->patchCapacity * 2;
+        as->patches = realloc(as->patches, sizeof(JumpPatch) * as->patchCapacity);
+    }
+    as->patches[as->patchCount].end = as->count;
+    as->patches[as->patchCount].target = target;
+    as->patchCount++;
+}
+
+static void pushRegister(Assembler* as, int reg) {
+    store(as, STACK_TOP, 0, reg);
+    addressOf(as, STACK_TOP, STACK_TOP, 8);
+}
+
+static void peekRegister(Assembler* as, int reg, int distance) {
+    load(as, reg, STACK_TOP, -8 * (distance + 1));
+}
+
+static void drop(Assembler* as, int count) {
+    addressOf(as, STACK_TOP, STACK_TOP, -8 * count);
+}
+
+static void pushImmediate(Assembler* as, Value value) {
+    moveImmediate(as, RAX, value);
+    pushRegister(as, RAX);
+}
+
+/* Writes the frame's ip and the stack top back to the VM, calls a helper
+ * with its arguments already in place and reloads the stack top */
+static void callHelper(Assembler* as, uint8_t* ip, void* helper) {
+    moveImmediate(as, RAX, (uint64_t)(uintptr_t)ip);
+    store(as, FRAME, offsetof(CallFrame, ip), RAX);
+    store(as, VM_BASE, offsetof(VM, stackTop), STACK_TOP);
+    callAddress(as, helper);
+    load(as, STACK_TOP, VM_BASE, offsetof(VM, stackTop));
+}
+
+/* Leaves native code unless the helper returned JIT_CONTINUE */
+static void exitUnlessContinue(Assembler* as) {
+    testStatus(as);
+    jumpToAddress(as, CC_NE, cache.exit);
+}
+
+/* Hands the frame to the interpreter at `ip`, before the instruction runs */
+static void bailout(Assembler* as, uint8_t* ip) {
+    moveImmediate(as, RAX, (uint64_t)(uintptr_t)ip);
+    store(as, FRAME, offsetof(CallFrame, ip), RAX);
+    store(as, VM_BASE, offsetof(VM, stackTop), STACK_TOP);
+    moveImmediate(as, RAX, JIT_BAILOUT);
+    jumpToAddress(as, JUMP_ALWAYS, cache.exit);
+}
+
+/* Jumps to the returned patch unless `reg` holds an int; clobbers RDX */
+static int guardInt(Assembler* as, int reg) {
+    alu(as, ALU_MOV, RDX, reg);
+    shift(as, SHIFT_SHR, RDX, 49);
+    compareImmediate(as, RDX, (int32_t)((QNAN | INT_TAG) >> 49));
+    return jumpForward(as, CC_NE);
+}
+
+static void unboxInt(Assembler* as, int reg) {
+    shift(as, SHIFT_SHL, reg, 16);
+    shift(as, SHIFT_SAR, reg, 16);
+}
+
+/* Jumps to the returned patch unless RAX fits a boxed int; clobbers RDX */
+static int guardIntRange(Assembler* as) {
+    alu(as, ALU_MOV, RDX, RAX);
+    unboxInt(as, RDX);
+    alu(as, ALU_CMP, RDX, RAX);
+    return jumpForward(as, CC_NE);
+}
+
+/* RAX = INT_VAL(RAX) for a value guardIntRange let through */
+static void boxInt(Assembler* as) {
+    shift(as, SHIFT_SHL, RAX, 16);
+    shift(as, SHIFT_SHR, RAX, 16);
+    moveImmediate(as, RCX, QNAN | INT_TAG);
+    alu(as, ALU_OR, RAX, RCX);
+}
+
+/* Both operands on the stack unboxed into RAX and RCX, or a jump to each
+ * of the two returned patches */
+static void unboxIntOperands(Assembler* as, int* slow) {
+    peekRegister(as, RAX, 1);
+    peekRegister(as, RCX, 0);
+    slow[0] = guardInt(as, RAX);
+    slow[1] = guardInt(as, RCX);
+    unboxInt(as, RAX);
+    unboxInt(as, RCX);
+}
+
+/* xmm`dst` op= xmm`src` */
+static void sse(Assembler* as, uint8_t opcode, int dst, int src) {
+    emitBytes(as, (const uint8_t[]){0xf2, 0x0f, opcode}, 3);
+    emitByte(as, 0xc0 | (dst << 3) | src);
+}
+
+/* xmm`xmm` = the int or double in `reg` as a double, or a jump to the
+ * returned patch; clobbers RDX and R8 */
+static int convertNumber(Assembler* as, int reg, int xmm) {
+    alu(as, ALU_MOV, RDX, reg);
+    shift(as, SHIFT_SHR, RDX, 49);
+    compareImmediate(as, RDX, (int32_t)((QNAN | INT_TAG) >> 49));
+    int notInt = jumpForward(as, CC_NE);
+    unboxInt(as, reg);
+    emitByte(as, 0xf2);
+    emitRexW(as, xmm, reg);
+    emitBytes(as, (const uint8_t[]){0x0f, 0x2a}, 2);       // cvtsi2sd
+    emitByte(as, 0xc0 | (xmm << 3) | (reg & 7));
+    int converted = jumpForward(as, JUMP_ALWAYS);
+    
+    patchJump(as, notInt);
+    moveImmediate(as, R8, QNAN);
+    alu(as, ALU_MOV, RDX, reg);
+    alu(as, ALU_AND, RDX, R8);
+    alu(as, ALU_CMP, RDX, R8);
+    int notNumber = jumpForward(as, CC_E);
+    emitByte(as, 0x66);
+    emitRexW(as, xmm, reg);
+    emitBytes(as, (const uint8_t[]){0x0f, 0x6e}, 2);       // movq
+    emitByte(as, 0xc0 | (xmm << 3) | (reg & 7));
+    patchJump(as, converted);
+    return notNumber;
+}
+
+/* Both operands on the stack into xmm0 and xmm1 as doubles */
+static void convertNumberOperands(Assembler* as, int* notNumbers) {
+    peekRegister(as, RAX, 1);
+    peekRegister(as, RCX, 0);
+    notNumbers[0] = convertNumber(as, RAX, 0);
+    notNumbers[1] = convertNumber(as, RCX, 1);
+}
+
+/* cmp dword/qword [base + disp], imm8 */
+static void compareMemory(Assembler* as, bool wide, int base, int32_t disp, int8_t value) {
+    if (wide) {
+        emitRexW(as, 0, base);
+    } else if (base & 8) {
+        emitByte(as, 0x41);
+    }
+    emitByte(as, 0x83);
+    emitMemory(as, 7, base, disp);
+    emitByte(as, (uint8_t)value);
+}
+
+/* Fast path of a property site: RAX = the instance `distance` down the
+ * stack and RDX = the field slot of its shape in the site's first cache
+ * entry, or a jump to one of the patches added to `slow`. The entry is
+ * read as the code runs, so it follows the cache as it fills */
+static void guardCachedField(Assembler* as, int distance, InlineCache* cache, int* slow, int* slowCount) {
+    CacheEntry* entry = &cache->entries[0];
+    peekRegister(as, RAX, distance);
+    alu(as, ALU_MOV, RDX, RAX);
+    shift(as, SHIFT_SHR, RDX, 48);
+    compareImmediate(as, RDX, (int32_t)((SIGN_BIT | QNAN) >> 48));
+    slow[(*slowCount)++] = jumpForward(as, CC_NE);
+    shift(as, SHIFT_SHL, RAX, 16);
+    shift(as, SHIFT_SHR, RAX, 16);
+    compareMemory(as, false, RAX, offsetof(Obj, type), OBJ_INSTANCE);
+    slow[(*slowCount)++] = jumpForward(as, CC_NE);
+    
+    moveImmediate(as, RCX, (uint64_t)(uintptr_t)cache);
+    compareMemory(as, false, RCX, offsetof(InlineCache, count), 0);
+    slow[(*slowCount)++] = jumpForward(as, CC_E);
+    load(as, RDX, RAX, offsetof(ObjInstance, shape));
+    emitRexW(as, RDX, RCX);
+    emitByte(as, 0x3b);     // cmp rdx, [rcx + shape]
+    emitMemory(as, RDX, RCX, (int32_t)((uint8_t*)&entry->shape - (uint8_t*)cache));
+    slow[(*slowCount)++] = jumpForward(as, CC_NE);
+    compareMemory(as, true, RCX, (int32_t)((uint8_t*)&entry->transition - (uint8_t*)cache), 0);
+    slow[(*slowCount)++] = jumpForward(as, CC_NE);
+    emitRexW(as, RDX, RCX);
+    emitByte(as, 0x63);     // movsxd rdx, [rcx + slot]
+    emitMemory(as, RDX, RCX, (int32_t)((uint8_t*)&entry->slot - (uint8_t*)cache));
+    alu(as, ALU_TEST, RDX, RDX);
+    slow[(*slowCount)++] = jumpForward(as, CC_S);
+    
+    emitRexW(as, 0, VM_BASE);
+    emitByte(as, 0xff);     // inc qword [vm.cacheHits]
+    emitMemory(as, 0, VM_BASE, offsetof(VM, cacheHits));
+    load(as, RAX, RAX, offsetof(ObjInstance, slots));
+}
+
+/* Jumps to the returned patch while a GC cycle is marking, when stores
+ * into objects need the write barrier */
+static int guardNotMarking(Assembler* as) {
+    compareMemory(as, false, VM_BASE, offsetof(VM, gcPhase), GC_MARK);
+    return jumpForward(as, CC_E);
+}
+
+/* GET_PROPERTY and SET_PROPERTY on a field the site has cached inline,
+ * anything else through the helper */
+static void emitPropertyAccess(Assembler* as, uint8_t op, ObjString* name, InlineCache* cache, uint8_t* next) {
+    int slow[7];
+    int slowCount = 0;
+    if (op == OP_GET_PROPERTY) {
+        guardCachedField(as, 0, cache, slow, &slowCount);
+        emitBytes(as, (const uint8_t[]){0x48, 0x8b, 0x04, 0xd0}, 4);     // mov rax, [rax + rdx * 8]
+        store(as, STACK_TOP, -8, RAX);
+    } else {
+        slow[slowCount++] = guardNotMarking(as);
+        guardCachedField(as, 1, cache, slow, &slowCount);
+        peekRegister(as, RCX, 0);
+        emitBytes(as, (const uint8_t[]){0x48, 0x89, 0x0c, 0xd0}, 4);     // mov [rax + rdx * 8], rcx
+        store(as, STACK_TOP, -16, RCX);
+        drop(as, 1);
+    }
+    int done = jumpForward(as, JUMP_ALWAYS);
+    
+    for (int i = 0; i < slowCount; i++) patchJump(as, slow[i]);
+    moveImmediate(as, RDI, (uint64_t)(uintptr_t)name);
+    moveImmediate(as, RSI, (uint64_t)(uintptr_t)cache);
+    callHelper(as, next, op == OP_GET_PROPERTY ? (void*)jitGetProperty : (void*)jitSetProperty);
+    patchJump(as, done);
+}
+
+/* The generic instruction on the stack through jitOperator */
+static void emitOperator(Assembler* as, uint8_t op, uint8_t* next) {
+    moveImmediate(as, RDI, op);
+    callHelper(as, next, (void*)jitOperator);
+    exitUnlessContinue(as);
+}
+
+/* +, - and * inline on ints that stay ints, then on any two numbers in
+ * doubles; anything else in jitOperator */
+static void emitArithmetic(Assembler* as, uint8_t op, uint8_t* next) {
+    int slow[4];
+    int slowCount = 2;
+    unboxIntOperands(as, slow);
+    if (op == OP_ADD) alu(as, ALU_ADD, RAX, RCX);
+    if (op == OP_SUBTRACT) alu(as, ALU_SUB, RAX, RCX);
+    if (op == OP_MULTIPLY) {
+        multiply(as, RAX, RCX);
+        slow[slowCount++] = jumpForward(as, CC_O);
+    }
+    slow[slowCount++] = guardIntRange(as);
+    boxInt(as);
+    store(as, STACK_TOP, -16, RAX);
+    drop(as, 1);
+    int done = jumpForward(as, JUMP_ALWAYS);
+    
+    for (int i = 0; i < slowCount; i++) patchJump(as, slow[i]);
+    int notNumbers[2];
+    convertNumberOperands(as, notNumbers);
+    sse(as, op == OP_ADD ? SSE_ADD : op == OP_SUBTRACT ? SSE_SUB : SSE_MUL, 0, 1);
+    emitBytes(as, (const uint8_t[]){0x66, 0x48, 0x0f, 0x7e, 0xc0}, 5);    // movq rax, xmm0
+    store(as, STACK_TOP, -16, RAX);
+    drop(as, 1);
+    int doneDouble = jumpForward(as, JUMP_ALWAYS);
+    
+    patchJump(as, notNumbers[0]);
+    patchJump(as, notNumbers[1]);
+    emitOperator(as, op, next);
+    patchJump(as, done);
+    patchJump(as, doneDouble);
+}
+
+static Condition intComparison(uint8_t op) {
+    switch (op) {
+        case OP_LESS:          return CC_L;
+        case OP_LESS_EQUAL:    return CC_LE;
+        case OP_GREATER:       return CC_G;
+        default:               return CC_GE;
+    }
+}
+
+/* Compares xmm0 (a) with xmm1 (b) and returns the condition that holds when
+ * `a op b` does. < and <= compare the other way round, so a NaN operand
+ * makes every comparison false */
+static Condition doubleComparison(Assembler* as, uint8_t op) {
+    bool swap = op == OP_LESS || op == OP_LESS_EQUAL;
+    emitBytes(as, (const uint8_t[]){0x66, 0x0f, 0x2e}, 3);     // ucomisd
+    emitByte(as, swap ? 0xc8 : 0xc1);
+    return op == OP_LESS || op == OP_GREATER ? CC_A : CC_AE;
+}
+
+/* RAX = BOOL_VAL(condition) */
+static void boxCondition(Assembler* as, Condition condition) {
+    emitByte(as, 0x0f);
+    emitByte(as, 0x90 | condition);     // setcc dl
+    emitByte(as, 0xc2);
+    emitBytes(as, (const uint8_t[]){0x0f, 0xb6, 0xd2}, 3);     // movzx edx, dl
+    moveImmediate(as, RAX, FALSE_VAL);
+    alu(as, ALU_OR, RAX, RDX);
+}
+
+/* <, <=, > and >= into a bool */
+static void emitComparison(Assembler* as, uint8_t op, uint8_t* next) {
+    int slow[2];
+    unboxIntOperands(as, slow);
+    alu(as, ALU_CMP, RAX, RCX);
+    boxCondition(as, intComparison(op));
+    store(as, STACK_TOP, -16, RAX);
+    drop(as, 1);
+    int done = jumpForward(as, JUMP_ALWAYS);
+    
+    patchJump(as, slow[0]);
+    patchJump(as, slow[1]);
+    int notNumbers[2];
+    convertNumberOperands(as, notNumbers);
+    boxCondition(as, doubleComparison(as, op));
+    store(as, STACK_TOP, -16, RAX);
+    drop(as, 1);
+    int doneDouble = jumpForward(as, JUMP_ALWAYS);
+    
+    patchJump(as, notNumbers[0]);
+    patchJump(as, notNumbers[1]);
+    emitOperator(as, op, next);
+    patchJump(as, done);
+    patchJump(as, doneDouble);
+}
+
+/* JUMP_IF_NOT_*: both operands popped, then a jump unless `a op b` */
+static void emitCompareJump(Assembler* as, uint8_t op, int target, uint8_t* next) {
+    int slow[2];
+    unboxIntOperands(as, slow);
+    alu(as, ALU_CMP, RAX, RCX);
+    drop(as, 2);
+    jumpToInstruction(as, intComparison(op) ^ 1, target);
+    int done = jumpForward(as, JUMP_ALWAYS);
+    
+    patchJump(as, slow[0]);
+    patchJump(as, slow[1]);
+    int notNumbers[2];
+    convertNumberOperands(as, notNumbers);
+    Condition holds = doubleComparison(as, op);
+    drop(as, 2);
+    jumpToInstruction(as, holds ^ 1, target);
+    int doneDouble = jumpForward(as, JUMP_ALWAYS);
+    
+    // Only the error for non-numbers is left to the helper
+    patchJump(as, notNumbers[0]);
+    patchJump(as, notNumbers[1]);
+    emitOperator(as, op, next);
+    patchJump(as, done);
+    patchJump(as, doneDouble);
+}
+
+/* JUMP_IF_FALSE leaves the condition on the stack. Bools are tested
+ * inline, everything else through valueTruthy */
+static void emitJumpIfFalse(Assembler* as, int target) {
+    peekRegister(as, RAX, 0);
+    moveImmediate(as, RCX, TRUE_VAL);
+    alu(as, ALU_CMP, RAX, RCX);
+    int isTrue = jumpForward(as, CC_E);
+    moveImmediate(as, RCX, FALSE_VAL);
+    alu(as, ALU_CMP, RAX, RCX);
+    jumpToInstruction(as, CC_E, target);
+    
+    alu(as, ALU_MOV, RDI, RAX);
+    callAddress(as, (void*)valueTruthy);
+    moveImmediate(as, RCX, TRUE_VAL);
+    alu(as, ALU_CMP, RAX, RCX);
+    jumpToInstruction(as, CC_NE, target);
+    patchJump(as, isTrue);
+}
+
+/* locals[slot] += constant, inline when both are ints */
+static void emitIncrementLocal(Assembler* as, int slot, Value constant, uint8_t* next) {
+    int32_t local = slot * (int32_t)sizeof(Value);
+    int slow[2];
+    int slowCount = 0;
+    int done = -1;
+    if (IS_INT(constant)) {
+        load(as, RAX, SLOTS, local);
+        slow[slowCount++] = guardInt(as, RAX);
+        unboxInt(as, RAX);
+        moveImmediate(as, RCX, (uint64_t)AS_INT(constant));
+        alu(as, ALU_ADD, RAX, RCX);
+        slow[slowCount++] = guardIntRange(as);
+        boxInt(as);
+        store(as, SLOTS, local, RAX);
+        done = jumpForward(as, JUMP_ALWAYS);
+    }
+    
+    for (int i = 0; i < slowCount; i++) patchJump(as, slow[i]);
+    load(as, RAX, SLOTS, local);
+    pushRegister(as, RAX);
+    pushImmediate(as, constant);
+    emitOperator(as, OP_ADD, next);
+    peekRegister(as, RAX, 0);
+    drop(as, 1);
+    store(as, SLOTS, local, RAX);
+    if (done >= 0) patchJump(as, done);
+}
+
+/* Index of a global's value, reloaded each time: defining a new global
+ * can move the array */
+static void loadGlobals(Assembler* as, int reg) {
+    load(as, reg, VM_BASE, offsetof(VM, globalValues) + offsetof(ValueArray, values));
+}
+
+/* Errors out unless `reg` is defined; clobbers RCX */
+static void guardDefined(Assembler* as, int reg, int slot, uint8_t* next) {
+    moveImmediate(as, RCX, UNDEFINED_VAL);
+    alu(as, ALU_CMP, reg, RCX);
+    int defined = jumpForward(as, CC_NE);
+    moveImmediate(as, RDI, (uint64_t)slot);
+    callHelper(as, next, (void*)jitUndefinedGlobal);
+    jumpToAddress(as, JUMP_ALWAYS, cache.exit);
+    patchJump(as, defined);
+}
+
+/* RAX = the upvalue's location */
+static void loadUpvalue(Assembler* as, int slot) {
+    load(as, RAX, FRAME, offsetof(CallFrame, closure));
+    load(as, RAX, RAX, offsetof(ObjClosure, upvalues));
+    load(as, RAX, RAX, slot * (int32_t)sizeof(ObjUpvalue*));
+    load(as, RAX, RAX, offsetof(ObjUpvalue, location));
+}
+
+/* Generic form of a quickened instruction: the interpreter may rewrite
+ * either into the other at any time, so the JIT treats them alike */
+static uint8_t genericOp(uint8_t op) {
+    switch (op) {
+        case OP_ADD_INT:
+        case OP_ADD_STR:             return OP_ADD;
+        case OP_SUBTRACT_INT:        return OP_SUBTRACT;
+        case OP_MULTIPLY_INT:        return OP_MULTIPLY;
+        case OP_GREATER_INT:         return OP_GREATER;
+        case OP_GREATER_EQUAL_INT:   return OP_GREATER_EQUAL;
+        case OP_LESS_INT:            return OP_LESS;
+        case OP_LESS_EQUAL_INT:      return OP_LESS_EQUAL;
+        case OP_INDEX_GET_ARRAY_INT: return OP_INDEX_GET;
+        case OP_INDEX_SET_ARRAY_INT: return OP_INDEX_SET;
+        default:                     return op;
+    }
+}
+
+static void emitInstruction(Assembler* as, int offset, int length) {
+    Chunk* chunk = as->chunk;
+    uint8_t* ip = chunk->code + offset;
+    uint8_t* next = ip + length;
+    Value* constants = chunk->constants.values;
+    int end = offset + length;
+    uint16_t jump = length >= 3 ? (uint16_t)((ip[length - 2] << 8) | ip[length - 1]) : 0;
+    
+    switch (genericOp(ip[0])) {
+        case OP_CONSTANT: pushImmediate(as, constants[ip[1]]); break;
+        case OP_NULL: pushImmediate(as, NULL_VAL); break;
+        case OP_TRUE: pushImmediate(as, TRUE_VAL); break;
+        case OP_FALSE: pushImmediate(as, FALSE_VAL); break;
+        case OP_POP: drop(as, 1); break;
+        case OP_DUP:
+            peekRegister(as, RAX, 0);
+            pushRegister(as, RAX);
+            break;
+        
+        case OP_GET_LOCAL:
+            load(as, RAX, SLOTS, ip[1] * (int32_t)sizeof(Value));
+            pushRegister(as, RAX);
+            break;
+        case OP_SET_LOCAL:
+            peekRegister(as, RAX, 0);
+            store(as, SLOTS, ip[1] * (int32_t)sizeof(Value), RAX);
+            break;
+        case OP_GET_LOCAL2:
+            load(as, RAX, SLOTS, ip[1] * (int32_t)sizeof(Value));
+            pushRegister(as, RAX);
+            load(as, RAX, SLOTS, ip[2] * (int32_t)sizeof(Value));
+            pushRegister(as, RAX);
+            break;
+        case OP_GET_GLOBAL_SLOT: {
+            int slot = (ip[1] << 8) | ip[2];
+            loadGlobals(as, RAX);
+            load(as, RAX, RAX, slot * (int32_t)sizeof(Value));
+            guardDefined(as, RAX, slot, next);
+            pushRegister(as, RAX);
+            break;
+        }
+        case OP_DEFINE_GLOBAL_SLOT: {
+            int slot = (ip[1] << 8) | ip[2];
+            peekRegister(as, RCX, 0);
+            drop(as, 1);
+            loadGlobals(as, RAX);
+            store(as, RAX, slot * (int32_t)sizeof(Value), RCX);
+            break;
+        }
+        case OP_SET_GLOBAL_SLOT: {
+            int slot = (ip[1] << 8) | ip[2];
+            loadGlobals(as, RAX);
+            load(as, RDX, RAX, slot * (int32_t)sizeof(Value));
+            guardDefined(as, RDX, slot, next);
+            loadGlobals(as, RAX);
+            peekRegister(as, RCX, 0);
+            store(as, RAX, slot * (int32_t)sizeof(Value), RCX);
+            break;
+        }
+        case OP_GET_UPVALUE:
+            loadUpvalue(as, ip[1]);
+            load(as, RAX, RAX, 0);
+            pushRegister(as, RAX);
+            break;
+        case OP_SET_UPVALUE: {
+            // A closed upvalue is an object: the interpreter has the barrier
+            int marking = guardNotMarking(as);
+            loadUpvalue(as, ip[1]);
+            peekRegister(as, RCX, 0);
+            store(as, RAX, 0, RCX);
+            int done = jumpForward(as, JUMP_ALWAYS);
+            patchJump(as, marking);
+            bailout(as, ip);
+            patchJump(as, done);
+            break;
+        }
+        case OP_CLOSE_UPVALUE:
+            callHelper(as, next, (void*)jitCloseUpvalue);
+            break;
+        
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+            emitArithmetic(as, genericOp(ip[0]), next);
+            break;
+        case OP_ADD_CONSTANT:
+            pushImmediate(as, constants[ip[1]]);
+            emitArithmetic(as, OP_ADD, next);
+            break;
+        case OP_INCREMENT_LOCAL:
+            emitIncrementLocal(as, ip[1], constants[ip[2]], next);
+            break;
+        case OP_GREATER:
+        case OP_GREATER_EQUAL:
+        case OP_LESS:
+        case OP_LESS_EQUAL:
+            emitComparison(as, genericOp(ip[0]), next);
+            break;
+        case OP_DIVIDE:
+        case OP_MODULO:
+        case OP_NEGATE:
+        case OP_IN:
+        case OP_EQUAL:
+        case OP_NOT_EQUAL:
+        case OP_NOT:
+            emitOperator(as, ip[0], next);
+            break;
+        
+        case OP_JUMP: jumpToInstruction(as, JUMP_ALWAYS, end + jump); break;
+        case OP_LOOP: jumpToInstruction(as, JUMP_ALWAYS, end - jump); break;
+        case OP_JUMP_IF_FALSE: emitJumpIfFalse(as, end + jump); break;
+        case OP_JUMP_IF_NOT_LESS: emitCompareJump(as, OP_LESS, end + jump, next); break;
+        case OP_JUMP_IF_NOT_LESS_EQUAL: emitCompareJump(as, OP_LESS_EQUAL, end + jump, next); break;
+        case OP_JUMP_IF_NOT_GREATER: emitCompareJump(as, OP_GREATER, end + jump, next); break;
+        case OP_JUMP_IF_NOT_GREATER_EQUAL:
+            emitCompareJump(as, OP_GREATER_EQUAL, end + jump, next);
+            break;
+        case OP_FOR_ITER:
+            addressOf(as, RDI, SLOTS, ip[1] * (int32_t)sizeof(Value));
+            callAddress(as, (void*)jitForIter);
+            emitBytes(as, (const uint8_t[]){0x84, 0xc0}, 2);    // test al, al
+            jumpToInstruction(as, CC_E, end + jump);
+            break;
+        
+        case OP_CALL:
+            moveImmediate(as, RDI, ip[1]);
+            callHelper(as, next, (void*)jitCall);
+            exitUnlessContinue(as);
+            break;
+        case OP_INVOKE:
+            moveImmediate(as, RDI, (uint64_t)(uintptr_t)AS_STRING(constants[ip[1]]));
+            moveImmediate(as, RSI, ip[2]);
+            moveImmediate(as, RDX, (uint64_t)(uintptr_t)&chunk->caches[(ip[3] << 8) | ip[4]]);
+            callHelper(as, next, (void*)jitInvoke);
+            exitUnlessContinue(as);
+            break;
+        case OP_SUPER_INVOKE:
+            moveImmediate(as, RDI, (uint64_t)(uintptr_t)AS_STRING(constants[ip[1]]));
+            moveImmediate(as, RSI, ip[2]);
+            callHelper(as, next, (void*)jitSuperInvoke);
+            exitUnlessContinue(as);
+            break;
+        case OP_RETURN:
+            callHelper(as, next, (void*)jitReturn);
+            jumpToAddress(as, JUMP_ALWAYS, cache.exit);
+            break;
+        
+        case OP_GET_PROPERTY:
+        case OP_SET_PROPERTY:
+            emitPropertyAccess(as, ip[0], AS_STRING(constants[ip[1]]),
+                               &chunk->caches[(ip[2] << 8) | ip[3]], next);
+            break;
+        case OP_GET_SUPER:
+            moveImmediate(as, RDI, (uint64_t)(uintptr_t)AS_STRING(constants[ip[1]]));
+            callHelper(as, next, (void*)jitGetSuper);
+            exitUnlessContinue(as);
+            break;
+        case OP_NEW:
+            callHelper(as, next, (void*)jitNew);
+            exitUnlessContinue(as);
+            break;
+        
+        case OP_ARRAY:
+        case OP_MAP:
+            moveImmediate(as, RDI, ip[1]);
+            callHelper(as, next, ip[0] == OP_ARRAY ? (void*)jitArray : (void*)jitMap);
+            break;
+        case OP_INDEX_GET: callHelper(as, next, (void*)jitIndexGet); break;
+        case OP_INDEX_SET: callHelper(as, next, (void*)jitIndexSet); break;
+        
+        // Class definitions, imports, closures and try blocks run once per
+        // execution of the code around them: the interpreter does them
+        default:
+            bailout(as, ip);
+            break;
+    }
+}
+
+/* Entry trampoline and exit, at the start of the cache. The entry saves
+ * the callee-saved registers, loads the VM state into them and jumps to
+ * the instruction; the exit restores them and returns eax */
+static void emitTrampoline(Assembler* as) {
+    emitBytes(as, (const uint8_t[]){
+        0x53,                       // push rbx
+        0x41, 0x54,                 // push r12
+        0x41, 0x55,                 // push r13
+        0x41, 0x56,                 // push r14
+        0x48, 0x83, 0xec, 0x08,     // sub rsp, 8
+    }, 11);
+    alu(as, ALU_MOV, FRAME, RDI);
+    moveImmediate(as, VM_BASE, (uint64_t)(uintptr_t)&vm);
+    load(as, SLOTS, FRAME, offsetof(CallFrame, slots));
+    load(as, STACK_TOP, VM_BASE, offsetof(VM, stackTop));
+    emitBytes(as, (const uint8_t[]){0xff, 0xe6}, 2);       // jmp rsi
+    
+    cache.exit = as->address + as->count;
+    emitBytes(as, (const uint8_t[]){
+        0x48, 0x83, 0xc4, 0x08,     // add rsp, 8
+        0x41, 0x5e,                 // pop r14
+        0x41, 0x5d,                 // pop r13
+        0x41, 0x5c,                 // pop r12
+        0x5b,                       // pop rbx
+        0xc3,                       // ret
+    }, 12);
+}
+
+/* Copies assembled code to its address in the cache, flipping the pages it
+ * touches writable and back to executable around the copy */
+static bool install(Assembler* as, const char* name) {
+    size_t start = (size_t)(as->address - cache.base);
+    if (start + as->count > JIT_CACHE_SIZE) return false;
+    
+    uintptr_t first = (uintptr_t)as->address & ~(cache.pageSize - 1);
+    uintptr_t last = ((uintptr_t)as->address + as->count + cache.pageSize - 1) & ~(cache.pageSize - 1);
+    if (mprotect((void*)first, last - first, PROT_READ | PROT_WRITE) != 0) return false;
+    memcpy(as->address, as->code, as->count);
+    if (mprotect((void*)first, last - first, PROT_READ | PROT_EXEC) != 0) return false;
+    cache.used = start + as->count;
+    
+    if (cache.perfMap != NULL) {
+        fprintf(cache.perfMap, "%lx %x somnia:%s\n",
+                (unsigned long)(uintptr_t)as->address, (unsigned)as->count, name);
+        fflush(cache.perfMap);
+    }
+    return true;
+}
+
+static void initAssembler(Assembler* as, Chunk* chunk) {
+    as->chunk = chunk;
+    as->code = NULL;
+    as->count = 0;
+    as->capacity = 0;
+    as->address = cache.base + ((cache.used + 15) & ~(size_t)15);
+    as->entries = NULL;
+    as->patches = NULL;
+    as->patchCount = 0;
+    as->patchCapacity = 0;
+}
+
+bool initJit(void) {
+    cache.pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    cache.base = mmap(NULL, JIT_CACHE_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (cache.base == MAP_FAILED) {
+        cache.base = NULL;
+        fprintf(stderr, "[VM] Could not map the JIT code cache; interpreting\n");
+        return false;
+    }
+    cache.used = 0;
+    
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/perf-%d.map", (int)getpid());
+    cache.perfMap = fopen(path, "w");
+    
+    Assembler as;
+    initAssembler(&as, NULL);
+    emitTrampoline(&as);
+    bool installed = install(&as, "jit_entry");
+    free(as.code);
+    if (!installed) {
+        freeJit();
+        fprintf(stderr, "[VM] Could not install the JIT trampoline; interpreting\n");
+        return false;
+    }
+    cache.enter = (JitStatus (*)(CallFrame*, uint8_t*))(void*)cache.base;
+    return true;
+}
+
+void freeJit(void) {
+    if (cache.base != NULL) munmap(cache.base, JIT_CACHE_SIZE);
+    if (cache.perfMap != NULL) fclose(cache.perfMap);
+    cache.base = NULL;
+    cache.perfMap = NULL;
+}
+
+bool jitCompile(ObjFunction* function) {
+    Chunk* chunk = &function->chunk;
+    Assembler as;
+    initAssembler(&as, chunk);
+    as.entries = malloc(sizeof(uint32_t) * (chunk->count + 1));
+    for (int i = 0; i <= chunk->count; i++) as.entries[i] = NO_ENTRY;
+    
+    for (int offset = 0; offset < chunk->count;) {
+        int length = instructionLength(chunk, offset);
+        as.entries[offset] = (uint32_t)as.count;
+        emitInstruction(&as, offset, length);
+        offset += length;
+    }
+    as.entries[chunk->count] = (uint32_t)as.count;
+    bailout(&as, chunk->code + chunk->count);
+    
+    // A jump into the middle of an instruction means a chunk we misread
+    bool complete = true;
+    for (int i = 0; i < as.patchCount; i++) {
+        JumpPatch* patch = &as.patches[i];
+        uint32_t entry = patch->target >= 0 && patch->target <= chunk->count
+            ? as.entries[patch->target] : NO_ENTRY;
+        if (entry == NO_ENTRY) {
+            complete = false;
+            break;
+        }
+        int32_t distance = (int32_t)entry - patch->end;
+        memcpy(as.code + patch->end - 4, &distance, 4);
+    }
+    
+    const char* name = function->name != NULL ? function->name->chars : "script";
+    bool installed = complete && install(&as, name);
+    free(as.code);
+    free(as.patches);
+    if (!installed) {
+        free(as.entries);
+        function->jitFailed = true;
+        return false;
+    }
+    
+    JitCode* jit = malloc(sizeof(JitCode));
+    jit->code = as.address;
+    jit->size = (size_t)as.count;
+    jit->entries = as.entries;
+    jit->entryCount = chunk->count + 1;
+    function->jit = jit;
+    return true;
+}
+
+/* The code itself stays in the cache, which only grows */
+void freeJitCode(JitCode* code) {
+    free(code->entries);
+    free(code);
+}
+
+JitStatus jitEnter(CallFrame* frame) {
+    ObjFunction* function = frame->closure->function;
+    uint32_t entry = function->jit->entries[frame->ip - function->chunk.code];
+    if (entry == NO_ENTRY) return JIT_BAILOUT;
+    return cache.enter(frame, function->jit->code + entry);
+}
+
+#endif
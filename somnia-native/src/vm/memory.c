@@ -1,31 +1,92 @@
 #include "memory.h"
 #include "vm.h"
+#include "compiler/compiler.h"
+#include "jit.h"
+#include "slab.h"
 #include <stdlib.h>
+#include <time.h>
 
 // GC metrics
-static GCMetrics gcMetrics = {0, 0, 0, 0};
+static GCMetrics gcMetrics = {0};
+
+const uint64_t gcPauseBounds[GC_PAUSE_BUCKETS - 1] = {50, 100, 250, 500, 1000, 2500, 10000};
 
 #define GC_HEAP_GROW_FACTOR 2
 
+// Incremental mode: a step every GC_STEP_BYTES allocated, doing up to
+// GC_STEP_WORK units (an object, or one value it references), and
+// reading the clock every GC_CLOCK_WORK units to keep to the pause target
+#define GC_STEP_BYTES (64 * 1024)
+#define GC_STEP_WORK 8192
+#define GC_CLOCK_WORK 512
+
+// Arrays and maps longer than this are blackened a slice at a time, so
+// that one large container is not one long pause
+#define GC_SLICE 1024
+
+// The container being blackened in slices, and the next element to mark
+static Obj* slicing = NULL;
+static int sliceIndex = 0;
+
+static void gcStep(size_t budget);
+
+static uint64_t nowMicros(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + (uint64_t)now.tv_nsec / 1000;
+}
+
 void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
-    vm.bytesAllocated += newSize - oldSize;
+    // Counted by the blocks really taken, so small sizes round up to their class
+    vm.bytesAllocated += slabBlockSize(newSize) - slabBlockSize(oldSize);
     gcMetrics.bytesAllocated = vm.bytesAllocated;
     
     if (newSize > oldSize) {
 #if DEBUG_STRESS_GC
-        collectGarbage();
-#endif
-        if (vm.bytesAllocated > vm.nextGC) {
+        if (vm.gcIncremental) {
+            gcStep(16);
+        } else {
             collectGarbage();
         }
+#endif
+        if (!vm.gcIncremental) {
+            if (vm.bytesAllocated > vm.nextGC) collectGarbage();
+        } else if (vm.gcPhase != GC_IDLE || vm.bytesAllocated > vm.nextGC) {
+            vm.gcDebt += newSize - oldSize;
+            if (vm.gcDebt >= GC_STEP_BYTES) {
+                vm.gcDebt = 0;
+                gcStep(GC_STEP_WORK);
+            }
+        }
     }
     
+    bool wasSmall = oldSize > 0 && oldSize <= SLAB_MAX_BLOCK;
     if (newSize == 0) {
-        free(pointer);
+        if (wasSmall) {
+            slabFree(pointer);
+        } else {
+            free(pointer);
+        }
         return NULL;
     }
     
-    void* result = realloc(pointer, newSize);
+    void* result;
+    if (newSize > SLAB_MAX_BLOCK && !wasSmall) {
+        result = realloc(pointer, newSize);
+    } else if (wasSmall && slabBlockSize(oldSize) == slabBlockSize(newSize)) {
+        return pointer;
+    } else {
+        // Moving between a slab class and another class or the system
+        result = newSize <= SLAB_MAX_BLOCK ? slabAllocate(newSize) : malloc(newSize);
+        if (result != NULL && pointer != NULL) {
+            memcpy(result, pointer, oldSize < newSize ? oldSize : newSize);
+            if (wasSmall) {
+                slabFree(pointer);
+            } else {
+                free(pointer);
+            }
+        }
+    }
     if (result == NULL) {
         fprintf(stderr, "[Somnia] Out of memory!\n");
         exit(1);
@@ -48,6 +109,9 @@ void freeObject(Obj* object) {
         case OBJ_FUNCTION: {
             ObjFunction* function = (ObjFunction*)object;
             freeChunk(&function->chunk);
+#if BASELINE_JIT
+            if (function->jit != NULL) freeJitCode(function->jit);
+#endif
             FREE(ObjFunction, object);
             break;
         }
@@ -71,7 +135,7 @@ void freeObject(Obj* object) {
         }
         case OBJ_INSTANCE: {
             ObjInstance* instance = (ObjInstance*)object;
-            freeTable(&instance->fields);
+            FREE_ARRAY(Value, instance->slots, instance->slotCapacity);
             FREE(ObjInstance, object);
             break;
         }
@@ -86,7 +150,9 @@ void freeObject(Obj* object) {
         }
         case OBJ_MAP: {
             ObjMap* map = (ObjMap*)object;
-            freeTable(&map->entries);
+            freeTable(&map->index);
+            freeValueArray(&map->keys);
+            freeValueArray(&map->values);
             FREE(ObjMap, object);
             break;
         }
@@ -100,7 +166,7 @@ void markValue(Value value) {
 void markObject(Obj* object) {
     if (object == NULL) return;
     if (object->isMarked) return;
-    
+
 #if DEBUG_LOG_GC
     printf("%p mark ", (void*)object);
     printValue(OBJ_VAL(object));
@@ -134,23 +200,34 @@ static void markRoots(void) {
         markObject((Obj*)upvalue);
     }
     
-    // Mark globals
+    // Mark globals and the loaded-module set
     markTable(&vm.globals);
+    for (int i = 0; i < vm.globalValues.count; i++) {
+        markValue(vm.globalValues.values[i]);
+    }
+    markTable(&vm.modules);
     
-    // Mark init string
+    // Mark functions still being compiled
+    markCompilerRoots();
+    
+    // Mark init string and the field names shapes hold
     markObject((Obj*)vm.initString);
+    markShapes(vm.rootShape);
 }
 
-static void blackenObject(Obj* object) {
+/* Grays what the object references; returns the work done */
+static size_t blackenObject(Obj* object) {
 #if DEBUG_LOG_GC
     printf("%p blacken ", (void*)object);
     printValue(OBJ_VAL(object));
     printf("\n");
 #endif
     
+    size_t work = 1;
     switch (object->type) {
         case OBJ_CLOSURE: {
             ObjClosure* closure = (ObjClosure*)object;
+            work += closure->upvalueCount;
             markObject((Obj*)closure->function);
             for (int i = 0; i < closure->upvalueCount; i++) {
                 markObject((Obj*)closure->upvalues[i]);
@@ -159,10 +236,19 @@ static void blackenObject(Obj* object) {
         }
         case OBJ_FUNCTION: {
             ObjFunction* function = (ObjFunction*)object;
+            work += function->chunk.constants.count + function->chunk.cacheCount;
             markObject((Obj*)function->name);
             for (int i = 0; i < function->chunk.constants.count; i++) {
                 markValue(function->chunk.constants.values[i]);
             }
+            // Cached methods stay alive with the code that calls them
+            for (int i = 0; i < function->chunk.cacheCount; i++) {
+                InlineCache* cache = &function->chunk.caches[i];
+                for (int j = 0; j < cache->count; j++) {
+                    markObject((Obj*)cache->entries[j].klass);
+                    markObject((Obj*)cache->entries[j].method);
+                }
+            }
             break;
         }
         case OBJ_UPVALUE:
@@ -170,6 +256,7 @@ static void blackenObject(Obj* object) {
             break;
         case OBJ_CLASS: {
             ObjClass* klass = (ObjClass*)object;
+            work += klass->methods.capacity;
             markObject((Obj*)klass->name);
             markTable(&klass->methods);
             if (klass->superclass) markObject((Obj*)klass->superclass);
@@ -177,8 +264,11 @@ static void blackenObject(Obj* object) {
         }
         case OBJ_INSTANCE: {
             ObjInstance* instance = (ObjInstance*)object;
+            work += instance->shape->fieldCount;
             markObject((Obj*)instance->klass);
-            markTable(&instance->fields);
+            for (int i = 0; i < instance->shape->fieldCount; i++) {
+                markValue(instance->slots[i]);
+            }
             break;
         }
         case OBJ_BOUND_METHOD: {
@@ -189,69 +279,209 @@ static void blackenObject(Obj* object) {
         }
         case OBJ_ARRAY: {
             ObjArray* array = (ObjArray*)object;
+            work += array->elements.count;
             for (int i = 0; i < array->elements.count; i++) {
                 markValue(array->elements.values[i]);
             }
             break;
         }
-        case OBJ_MAP:
-            markTable(&((ObjMap*)object)->entries);
+        case OBJ_MAP: {
+            ObjMap* map = (ObjMap*)object;
+            work += map->index.capacity + map->values.count;
+            markTable(&map->index);
+            for (int i = 0; i < map->values.count; i++) {
+                markValue(map->values.values[i]);
+            }
             break;
+        }
         case OBJ_NATIVE:
         case OBJ_STRING:
             break;
     }
+    return work;
 }
 
-static void traceReferences(void) {
-    while (vm.grayCount > 0) {
-        Obj* object = vm.grayStack[--vm.grayCount];
-        blackenObject(object);
+
+static int sliceLength(Obj* object) {
+    if (object->type == OBJ_ARRAY) return ((ObjArray*)object)->elements.count;
+    if (object->type == OBJ_MAP) return ((ObjMap*)object)->values.count;
+    return 0;
+}
+
+/* Marks the next GC_SLICE elements of `slicing`. The container may have
+ * changed since the last slice: values stored into it meanwhile went
+ * through the write barrier, and its length is read again */
+static size_t blackenSlice(void) {
+    int end = sliceLength(slicing);
+    if (end > sliceIndex + GC_SLICE) end = sliceIndex + GC_SLICE;
+    
+    for (int i = sliceIndex; i < end; i++) {
+        if (slicing->type == OBJ_ARRAY) {
+            markValue(((ObjArray*)slicing)->elements.values[i]);
+        } else {
+            ObjMap* map = (ObjMap*)slicing;
+            markValue(map->keys.values[i]);
+            markValue(map->values.values[i]);
+        }
+    }
+    
+    size_t work = 1 + (end > sliceIndex ? (size_t)(end - sliceIndex) : 0);
+    sliceIndex = end;
+    if (sliceIndex >= sliceLength(slicing)) slicing = NULL;
+    return work;
+}
+
+static bool markingDone(void) {
+    return vm.grayCount == 0 && slicing == NULL;
+}
+
+/* Blackens gray objects until `budget` work is done, or `deadline` passes
+ * if it is not 0; returns the work done */
+static size_t markObjects(size_t budget, uint64_t deadline) {
+    size_t work = 0;
+    size_t nextClock = GC_CLOCK_WORK;
+    
+    while (work < budget && !markingDone()) {
+        if (slicing != NULL) {
+            work += blackenSlice();
+        } else {
+            Obj* object = vm.grayStack[--vm.grayCount];
+            if (sliceLength(object) > GC_SLICE) {
+                slicing = object;
+                sliceIndex = 0;
+                work++;
+            } else {
+                work += blackenObject(object);
+            }
+        }
+        
+        if (deadline != 0 && work >= nextClock) {
+            if (nowMicros() >= deadline) break;
+            nextClock = work + GC_CLOCK_WORK;
+        }
     }
+    return work;
+}
+
+static void traceReferences(void) {
+    markObjects(SIZE_MAX, 0);
+}
+
+static void recordPause(uint64_t pause) {
+    int bucket = 0;
+    while (bucket < GC_PAUSE_BUCKETS - 1 && pause > gcPauseBounds[bucket]) bucket++;
+    gcMetrics.pauseHistogram[bucket]++;
+    gcMetrics.pauses++;
+    gcMetrics.totalPause += pause;
+    if (pause > gcMetrics.maxPause) gcMetrics.maxPause = pause;
+}
+
+static void startCycle(void) {
+    vm.gcPhase = GC_MARK;
+    markRoots();
+}
+
+/* Ends marking in one go: roots take no barrier, so they are marked again.
+ * The sweep then begins over every object that existed until now */
+static void finishMark(void) {
+    markRoots();
+    traceReferences();
+    
+    vm.sweeping = vm.objects;
+    vm.objects = NULL;
+    vm.gcPhase = GC_SWEEP;
 }
 
-static void sweep(void) {
-    Obj* previous = NULL;
-    Obj* object = vm.objects;
+/* Frees the white objects among the next `budget` of vm.sweeping and moves
+ * the rest, whitened for the next cycle, back to vm.objects. Objects
+ * allocated meanwhile are already there, so the sweep never meets them */
+static size_t sweepObjects(size_t budget) {
+    size_t visited = 0;
     size_t freed = 0;
     
-    while (object != NULL) {
+    while (vm.sweeping != NULL && visited < budget) {
+        Obj* object = vm.sweeping;
+        vm.sweeping = object->next;
+        visited++;
+        
         if (object->isMarked) {
             object->isMarked = false;
-            previous = object;
-            object = object->next;
+            object->next = vm.objects;
+            vm.objects = object;
         } else {
-            Obj* unreached = object;
-            object = object->next;
-            if (previous != NULL) {
-                previous->next = object;
-            } else {
-                vm.objects = object;
-            }
-            
-            freeObject(unreached);
+            if (object->type == OBJ_STRING) tableDelete(&vm.strings, (ObjString*)object);
+            freeObject(object);
             freed++;
         }
     }
     
     gcMetrics.totalFreed += freed;
+    return visited;
+}
+
+static void finishCycle(void) {
+    vm.gcPhase = GC_IDLE;
+    vm.nextGC = vm.bytesAllocated * GC_HEAP_GROW_FACTOR;
+    gcMetrics.nextGC = vm.nextGC;
+    gcMetrics.totalCollections++;
+}
+
+/* One slice of the incremental cycle, starting one if none runs: up to
+ * `budget` work, cut short at vm.gcPauseTarget */
+static void gcStep(size_t budget) {
+    uint64_t start = nowMicros();
+    uint64_t deadline = start + (uint64_t)vm.gcPauseTarget;
+    size_t work = 0;
+    
+    if (vm.gcPhase == GC_IDLE) startCycle();
+    
+    if (vm.gcPhase == GC_MARK) {
+        work = markObjects(budget, deadline);
+        if (markingDone()) finishMark();
+    }
+    
+    while (vm.gcPhase == GC_SWEEP && work < budget) {
+        work += sweepObjects(GC_CLOCK_WORK < budget - work ? GC_CLOCK_WORK : budget - work);
+        if (vm.sweeping == NULL) {
+            finishCycle();
+        } else if (nowMicros() >= deadline) {
+            break;
+        }
+    }
+    
+    recordPause(nowMicros() - start);
 }
 
+/* A whole cycle at once. An incremental cycle under way is finished if it
+ * is sweeping, or dropped if it is marking: its marks may hold objects
+ * that died since */
 void collectGarbage(void) {
 #if DEBUG_LOG_GC
     printf("-- gc begin\n");
     size_t before = vm.bytesAllocated;
 #endif
+    uint64_t start = nowMicros();
     
-    markRoots();
+    if (vm.gcPhase == GC_SWEEP) {
+        sweepObjects(SIZE_MAX);
+        finishCycle();
+    }
+    if (vm.gcPhase == GC_MARK) {
+        for (Obj* object = vm.objects; object != NULL; object = object->next) {
+            object->isMarked = false;
+        }
+        vm.grayCount = 0;
+        slicing = NULL;
+    }
+    startCycle();
     traceReferences();
-    tableRemoveWhite(&vm.strings);
-    sweep();
-    
-    vm.nextGC = vm.bytesAllocated * GC_HEAP_GROW_FACTOR;
-    gcMetrics.nextGC = vm.nextGC;
-    gcMetrics.totalCollections++;
+    finishMark();
+    sweepObjects(SIZE_MAX);
+    finishCycle();
+    vm.gcDebt = 0;
     
+    recordPause(nowMicros() - start);
+
 #if DEBUG_LOG_GC
     printf("-- gc end\n");
     printf("   collected %zu bytes (from %zu to %zu) next at %zu\n",
@@ -260,5 +490,6 @@ void collectGarbage(void) {
 }
 
 GCMetrics* getGCMetrics(void) {
+    gcMetrics.pauseTarget = (uint64_t)vm.gcPauseTarget;
     return &gcMetrics;
 }
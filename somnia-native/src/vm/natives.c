@@ -0,0 +1,510 @@
+/**
+ * Standard library for the bytecode VM.
+ *
+ * Each native mirrors the tree-walker function of the same name in
+ * src/stdlib.c (argument checks, return values, output format), so a
+ * program prints the same thing on either engine.
+ */
+
+#include "vm.h"
+#include "memory.h"
+#include "object.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <math.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+
+// Tree-walker natives with no ObjNative counterpart yet: a module that
+// names one is compiled by neither engine but run on the tree-walker
+static const char* walkerOnlyNatives[] = {
+    "native_get_fields", "gc_stats", "sb_new", "sb_append", "sb_finish",
+    "native_fs_read_blob", "native_fs_write_blob", "native_blob_create",
+    "native_blob_append_string", "native_blob_append_u16", "native_blob_append_u32",
+    "native_net_listen", "native_net_accept", "native_net_read",
+    "native_net_write", "native_net_close", "native_net_accept_all",
+    "native_net_set_nonblocking", "native_net_poll_create", "native_net_poll_add",
+    "native_net_poll_mod", "native_net_poll_del", "native_net_poll_wait",
+    "native_net_conn_open", "native_net_conn_read", "native_net_conn_next",
+    "native_net_conn_flush", "native_net_conn_end", "native_net_conn_close",
+    "native_net_conn_sweep", "native_net_conn_count",
+    "native_net_draining", "native_net_file_info", "native_net_sendfile",
+    "native_net_write_blob", "native_http_parse",
+    "native_sql_connect", "native_sql_query", "native_sql_exec",
+    NULL
+};
+
+bool isWalkerOnlyNative(const char* name, int length) {
+    for (const char** native = walkerOnlyNatives; *native != NULL; native++) {
+        if ((int)strlen(*native) == length && memcmp(*native, name, length) == 0) return true;
+    }
+    return false;
+}
+
+static Value stringValue(const char* chars) {
+    return OBJ_VAL(copyString(chars, (int)strlen(chars)));
+}
+
+/* Display form as a string value; strings are returned as they are */
+static Value toStringValue(Value value) {
+    if (IS_STRING(value)) return value;
+    int length;
+    char* chars = valueToChars(value, &length);
+    char* heapChars = ALLOCATE(char, length + 1);
+    memcpy(heapChars, chars, length + 1);
+    free(chars);
+    return OBJ_VAL(takeString(heapChars, length));
+}
+
+/* ===== I/O ===== */
+
+static Value printlnNative(int argCount, Value* args) {
+    for (int i = 0; i < argCount; i++) {
+        printValue(args[i]);
+        if (i < argCount - 1) printf(" ");
+    }
+    printf("\n");
+    fflush(stdout);
+    return NULL_VAL;
+}
+
+static Value eprintlnNative(int argCount, Value* args) {
+    for (int i = 0; i < argCount; i++) {
+        char* chars = valueToChars(args[i], NULL);
+        fprintf(stderr, "%s", chars);
+        if (i < argCount - 1) fprintf(stderr, " ");
+        free(chars);
+    }
+    fprintf(stderr, "\n");
+    fflush(stderr);
+    return NULL_VAL;
+}
+
+static Value printNative(int argCount, Value* args) {
+    for (int i = 0; i < argCount; i++) {
+        printValue(args[i]);
+    }
+    return NULL_VAL;
+}
+
+static Value inputNative(int argCount, Value* args) {
+    if (argCount > 0) printValue(args[0]);
+    
+    char buf[1024];
+    if (fgets(buf, sizeof(buf), stdin)) {
+        size_t len = strlen(buf);
+        if (len > 0 && buf[len - 1] == '\n') buf[len - 1] = '\0';
+        return stringValue(buf);
+    }
+    return stringValue("");
+}
+
+/* ===== TYPES ===== */
+
+static Value toStringNative(int argCount, Value* args) {
+    if (argCount < 1) return stringValue("");
+    return toStringValue(args[0]);
+}
+
+static Value typeNative(int argCount, Value* args) {
+    if (argCount < 1) return stringValue("null");
+    
+    Value v = args[0];
+    if (IS_NULL(v)) return stringValue("null");
+    if (IS_BOOL(v)) return stringValue("bool");
+    if (IS_NUMBER(v)) return stringValue("number");
+    
+    switch (OBJ_TYPE(v)) {
+        case OBJ_STRING: return stringValue("string");
+        case OBJ_ARRAY: return stringValue("array");
+        case OBJ_MAP: return stringValue("map");
+        case OBJ_FUNCTION:
+        case OBJ_CLOSURE:
+        case OBJ_BOUND_METHOD: return stringValue("function");
+        case OBJ_NATIVE: return stringValue("native_function");
+        case OBJ_INSTANCE: return stringValue("object");
+        case OBJ_CLASS: return stringValue("class");
+        default: return stringValue("unknown");
+    }
+}
+
+static Value toNumberNative(int argCount, Value* args) {
+    if (argCount < 1) return INT_VAL(0);
+    
+    if (IS_NUMBER(args[0])) return args[0];
+    if (IS_STRING(args[0])) return DOUBLE_VAL(atof(AS_CSTRING(args[0])));
+    if (IS_BOOL(args[0])) return INT_VAL(AS_BOOL(args[0]) ? 1 : 0);
+    return INT_VAL(0);
+}
+
+/* ===== COLLECTIONS ===== */
+
+static Value lenNative(int argCount, Value* args) {
+    if (argCount < 1) return INT_VAL(0);
+    
+    if (IS_STRING(args[0])) return INT_VAL(AS_STRING(args[0])->length);
+    if (IS_ARRAY(args[0])) return INT_VAL(AS_ARRAY(args[0])->elements.count);
+    if (IS_MAP(args[0])) return INT_VAL(AS_MAP(args[0])->keys.count);
+    return INT_VAL(0);
+}
+
+static Value rangeNative(int argCount, Value* args) {
+    ObjArray* array = newArray();
+    if (argCount < 2) return OBJ_VAL(array);
+    
+    int start = (int)valueToDouble(args[0]);
+    int end = (int)valueToDouble(args[1]);
+    int step = argCount >= 3 ? (int)valueToDouble(args[2]) : 1;
+    
+    push(OBJ_VAL(array));
+    if (step > 0) {
+        for (int i = start; i < end; i += step) writeValueArray(&array->elements, INT_VAL(i));
+    } else if (step < 0) {
+        for (int i = start; i > end; i += step) writeValueArray(&array->elements, INT_VAL(i));
+    }
+    pop();
+    return OBJ_VAL(array);
+}
+
+static Value pushNative(int argCount, Value* args) {
+    if (argCount < 2 || !IS_ARRAY(args[0])) return NULL_VAL;
+    writeValueArray(&AS_ARRAY(args[0])->elements, args[1]);
+    WRITE_BARRIER(AS_OBJ(args[0]), args[1]);
+    return args[0];
+}
+
+static Value popNative(int argCount, Value* args) {
+    if (argCount < 1 || !IS_ARRAY(args[0])) return NULL_VAL;
+    
+    ValueArray* elements = &AS_ARRAY(args[0])->elements;
+    if (elements->count == 0) return NULL_VAL;
+    return elements->values[--elements->count];
+}
+
+/* Copy of a map's keys or values, in insertion order */
+static Value mapColumn(int argCount, Value* args, bool keys) {
+    ObjArray* array = newArray();
+    if (argCount < 1 || !IS_MAP(args[0])) return OBJ_VAL(array);
+    
+    ObjMap* map = AS_MAP(args[0]);
+    ValueArray* column = keys ? &map->keys : &map->values;
+    push(OBJ_VAL(array));
+    for (int i = 0; i < column->count; i++) {
+        writeValueArray(&array->elements, column->values[i]);
+        WRITE_BARRIER(array, column->values[i]);
+    }
+    pop();
+    return OBJ_VAL(array);
+}
+
+static Value keysNative(int argCount, Value* args) {
+    return mapColumn(argCount, args, true);
+}
+
+static Value valuesNative(int argCount, Value* args) {
+    return mapColumn(argCount, args, false);
+}
+
+static Value removeNative(int argCount, Value* args) {
+    if (argCount < 2 || !IS_MAP(args[0]) || !IS_STRING(args[1])) return BOOL_VAL(false);
+    return BOOL_VAL(mapDelete(AS_MAP(args[0]), AS_STRING(args[1])));
+}
+
+/* ===== STRINGS ===== */
+
+static Value splitNative(int argCount, Value* args) {
+    ObjArray* array = newArray();
+    if (argCount < 2 || !IS_STRING(args[0]) || !IS_STRING(args[1])) return OBJ_VAL(array);
+    
+    push(OBJ_VAL(array));
+    const char* current = AS_CSTRING(args[0]);
+    const char* delim = AS_CSTRING(args[1]);
+    int delimLength = AS_STRING(args[1])->length;
+    
+    if (delimLength == 0) {
+        writeValueArray(&array->elements, args[0]);
+        WRITE_BARRIER(array, args[0]);
+        pop();
+        return OBJ_VAL(array);
+    }
+    
+    const char* next;
+    while ((next = strstr(current, delim)) != NULL) {
+        push(OBJ_VAL(copyString(current, (int)(next - current))));
+        writeValueArray(&array->elements, peek(0));
+        WRITE_BARRIER(array, peek(0));
+        pop();
+        current = next + delimLength;
+    }
+    push(stringValue(current));
+    writeValueArray(&array->elements, peek(0));
+    WRITE_BARRIER(array, peek(0));
+    pop();
+    
+    pop();
+    return OBJ_VAL(array);
+}
+
+static Value joinNative(int argCount, Value* args) {
+    if (argCount < 2 || !IS_ARRAY(args[0]) || !IS_STRING(args[1])) return stringValue("");
+    
+    ValueArray* elements = &AS_ARRAY(args[0])->elements;
+    ObjString* sep = AS_STRING(args[1]);
+    
+    int length = 0;
+    int capacity = 64;
+    char* chars = malloc(capacity);
+    for (int i = 0; i < elements->count; i++) {
+        int partLength;
+        char* part = valueToChars(elements->values[i], &partLength);
+        int needed = length + (i > 0 ? sep->length : 0) + partLength + 1;
+        if (needed > capacity) {
+            while (needed > capacity) capacity *= 2;
+            chars = realloc(chars, capacity);
+        }
+        if (i > 0) {
+            memcpy(chars + length, sep->chars, sep->length);
+            length += sep->length;
+        }
+        memcpy(chars + length, part, partLength);
+        length += partLength;
+        free(part);
+    }
+    
+    ObjString* result = copyString(chars, length);
+    free(chars);
+    return OBJ_VAL(result);
+}
+
+static Value substrNative(int argCount, Value* args) {
+    if (argCount < 2 || !IS_STRING(args[0])) return stringValue("");
+    
+    ObjString* str = AS_STRING(args[0]);
+    int start = (int)valueToDouble(args[1]);
+    int len = argCount >= 3 ? (int)valueToDouble(args[2]) : str->length - start;
+    
+    if (start < 0) start = 0;
+    if (start >= str->length) return stringValue("");
+    if (len < 0) len = 0;
+    if (len > str->length - start) len = str->length - start;
+    
+    return OBJ_VAL(copyString(str->chars + start, len));
+}
+
+static Value trimNative(int argCount, Value* args) {
+    if (argCount < 1 || !IS_STRING(args[0])) return stringValue("");
+    
+    const char* str = AS_CSTRING(args[0]);
+    while (isspace((unsigned char)*str)) str++;
+    if (*str == '\0') return stringValue("");
+    
+    const char* end = AS_CSTRING(args[0]) + AS_STRING(args[0])->length - 1;
+    while (end > str && isspace((unsigned char)*end)) end--;
+    
+    return OBJ_VAL(copyString(str, (int)(end - str + 1)));
+}
+
+static Value hashNative(int argCount, Value* args) {
+    if (argCount < 1 || !IS_STRING(args[0])) return stringValue("0000");
+    unsigned long hash = 5381;
+    int c;
+    const char* str = AS_CSTRING(args[0]);
+    while ((c = *str++)) hash = ((hash << 5) + hash) + c;
+    
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%lx", hash);
+    return stringValue(buf);
+}
+
+static Value parseNumberNative(int argCount, Value* args) {
+    if (argCount < 1 || !IS_STRING(args[0])) return INT_VAL(0);
+    return DOUBLE_VAL(atof(AS_CSTRING(args[0])));
+}
+
+/* ===== MATH ===== */
+
+static Value floorNative(int argCount, Value* args) {
+    if (argCount < 1 || !IS_NUMBER(args[0])) return INT_VAL(0);
+    return DOUBLE_VAL(floor(valueToDouble(args[0])));
+}
+
+static Value ceilNative(int argCount, Value* args) {
+    if (argCount < 1 || !IS_NUMBER(args[0])) return INT_VAL(0);
+    return DOUBLE_VAL(ceil(valueToDouble(args[0])));
+}
+
+static Value absNative(int argCount, Value* args) {
+    if (argCount < 1 || !IS_NUMBER(args[0])) return INT_VAL(0);
+    return DOUBLE_VAL(fabs(valueToDouble(args[0])));
+}
+
+static Value randomNative(int argCount, Value* args) {
+    (void)argCount; (void)args;
+    return DOUBLE_VAL((double)rand() / RAND_MAX);
+}
+
+/* ===== TIME ===== */
+
+static Value timeMsNative(int argCount, Value* args) {
+    (void)argCount; (void)args;
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return DOUBLE_VAL((double)tv.tv_sec * 1000 + (double)tv.tv_usec / 1000);
+}
+
+static Value uptimeNative(int argCount, Value* args) {
+    (void)argCount; (void)args;
+    static time_t startTime = 0;
+    if (startTime == 0) startTime = time(NULL);
+    return DOUBLE_VAL((double)(time(NULL) - startTime));
+}
+
+static Value parseTimestampNative(int argCount, Value* args) {
+    if (argCount < 1 || !IS_NUMBER(args[0])) return NULL_VAL;
+    time_t ts = (time_t)(valueToDouble(args[0]) / 1000);
+    struct tm* info = gmtime(&ts);
+    if (!info) return NULL_VAL;
+    
+    static const char* fields[] = {"year", "month", "day", "hour", "minute", "second"};
+    int values[] = {info->tm_year + 1900, info->tm_mon + 1, info->tm_mday,
+                    info->tm_hour, info->tm_min, info->tm_sec};
+    
+    ObjMap* map = newMap();
+    push(OBJ_VAL(map));
+    for (int i = 0; i < 6; i++) {
+        push(stringValue(fields[i]));
+        mapSet(map, AS_STRING(peek(0)), INT_VAL(values[i]));
+        pop();
+    }
+    pop();
+    return OBJ_VAL(map);
+}
+
+/* Property inline cache counters; the walker's ic_stats() counts its own */
+static Value icStatsNative(int argCount, Value* args) {
+    (void)argCount; (void)args;
+    static const char* fields[] = {"hits", "misses", "megamorphic"};
+    uint64_t values[] = {vm.cacheHits, vm.cacheMisses, vm.megamorphicSites};
+    
+    ObjMap* map = newMap();
+    push(OBJ_VAL(map));
+    for (int i = 0; i < 3; i++) {
+        push(stringValue(fields[i]));
+        mapSet(map, AS_STRING(peek(0)), INT_VAL((int64_t)values[i]));
+        pop();
+    }
+    pop();
+    return OBJ_VAL(map);
+}
+
+/* ===== FILE SYSTEM ===== */
+
+static Value fsReadNative(int argCount, Value* args) {
+    if (argCount < 1 || !IS_STRING(args[0])) return NULL_VAL;
+    
+    FILE* file = fopen(AS_CSTRING(args[0]), "rb");
+    if (!file) return NULL_VAL;
+    
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    
+    char* buffer = malloc(size + 1);
+    size_t read = fread(buffer, 1, size, file);
+    buffer[read] = '\0';
+    fclose(file);
+    
+    // Every byte, NULs included, as the tree-walker reads it
+    Value result = OBJ_VAL(copyString(buffer, (int)read));
+    free(buffer);
+    return result;
+}
+
+static Value fsWriteNative(int argCount, Value* args) {
+    if (argCount < 2 || !IS_STRING(args[0]) || !IS_STRING(args[1])) return BOOL_VAL(false);
+    
+    FILE* file = fopen(AS_CSTRING(args[0]), "wb");
+    if (!file) return BOOL_VAL(false);
+    
+    size_t written = fwrite(AS_CSTRING(args[1]), 1, AS_STRING(args[1])->length, file);
+    fclose(file);
+    return BOOL_VAL(written == (size_t)AS_STRING(args[1])->length);
+}
+
+static Value fsListNative(int argCount, Value* args) {
+    ObjArray* array = newArray();
+    if (argCount < 1 || !IS_STRING(args[0])) return OBJ_VAL(array);
+    
+    DIR* dir = opendir(AS_CSTRING(args[0]));
+    if (!dir) return OBJ_VAL(array);
+    
+    push(OBJ_VAL(array));
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        push(stringValue(entry->d_name));
+        writeValueArray(&array->elements, peek(0));
+        WRITE_BARRIER(array, peek(0));
+        pop();
+    }
+    closedir(dir);
+    pop();
+    return OBJ_VAL(array);
+}
+
+static Value fsIsDirNative(int argCount, Value* args) {
+    if (argCount < 1 || !IS_STRING(args[0])) return BOOL_VAL(false);
+    
+    struct stat st;
+    if (stat(AS_CSTRING(args[0]), &st) != 0) return BOOL_VAL(false);
+    return BOOL_VAL(S_ISDIR(st.st_mode));
+}
+
+/* ===== REGISTRATION ===== */
+
+void defineStdlibNatives(void) {
+    // I/O
+    defineNative("println", printlnNative, -1);
+    defineNative("eprintln", eprintlnNative, -1);
+    defineNative("print", printNative, -1);
+    defineNative("input", inputNative, -1);
+    
+    // Types
+    defineNative("native_to_string", toStringNative, -1);
+    defineNative("native_type", typeNative, -1);
+    defineNative("native_to_number", toNumberNative, -1);
+    
+    // Collections
+    defineNative("len", lenNative, -1);
+    defineNative("range", rangeNative, -1);
+    defineNative("push", pushNative, -1);
+    defineNative("pop", popNative, -1);
+    defineNative("native_keys", keysNative, -1);
+    defineNative("native_values", valuesNative, -1);
+    defineNative("remove", removeNative, -1);
+    
+    // Strings
+    defineNative("split", splitNative, -1);
+    defineNative("join", joinNative, -1);
+    defineNative("substr", substrNative, -1);
+    defineNative("trim", trimNative, -1);
+    
+    // Math
+    defineNative("floor", floorNative, -1);
+    defineNative("ceil", ceilNative, -1);
+    defineNative("abs", absNative, -1);
+    defineNative("random", randomNative, -1);
+    
+    // System
+    defineNative("native_time_ms", timeMsNative, -1);
+    defineNative("native_uptime", uptimeNative, -1);
+    defineNative("native_hash", hashNative, -1);
+    defineNative("native_parse_number", parseNumberNative, -1);
+    defineNative("native_parse_timestamp", parseTimestampNative, -1);
+    defineNative("ic_stats", icStatsNative, -1);
+    defineNative("native_fs_read", fsReadNative, -1);
+    defineNative("native_fs_write", fsWriteNative, -1);
+    defineNative("native_fs_list", fsListNative, -1);
+    defineNative("native_fs_is_dir", fsIsDirNative, -1);
+}
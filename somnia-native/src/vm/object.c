@@ -29,7 +29,10 @@ static ObjString* allocateString(char* chars, int length, uint32_t hash) {
     string->chars = chars;
     string->hash = hash;
     
+    // Growing the intern table may collect; keep the new string rooted
+    push(OBJ_VAL(string));
     tableSet(&vm.strings, string, NULL_VAL);
+    pop();
     return string;
 }
 
@@ -42,9 +45,18 @@ static uint32_t hashString(const char* key, int length) {
     return hash;
 }
 
+/* vm.strings holds strings weakly, and a sweep drops each one only as it
+ * frees it. A string it has yet to reach may be garbage, so using one
+ * again during the sweep marks it to keep it */
+static ObjString* findInterned(const char* chars, int length, uint32_t hash) {
+    ObjString* interned = tableFindString(&vm.strings, chars, length, hash);
+    if (interned != NULL && vm.gcPhase == GC_SWEEP) interned->obj.isMarked = true;
+    return interned;
+}
+
 ObjString* takeString(char* chars, int length) {
     uint32_t hash = hashString(chars, length);
-    ObjString* interned = tableFindString(&vm.strings, chars, length, hash);
+    ObjString* interned = findInterned(chars, length, hash);
     if (interned != NULL) {
         FREE_ARRAY(char, chars, length + 1);
         return interned;
@@ -54,7 +66,7 @@ ObjString* takeString(char* chars, int length) {
 
 ObjString* copyString(const char* chars, int length) {
     uint32_t hash = hashString(chars, length);
-    ObjString* interned = tableFindString(&vm.strings, chars, length, hash);
+    ObjString* interned = findInterned(chars, length, hash);
     if (interned != NULL) return interned;
     
     char* heapChars = ALLOCATE(char, length + 1);
@@ -69,6 +81,10 @@ ObjFunction* newFunction(void) {
     function->upvalueCount = 0;
     function->name = NULL;
     initChunk(&function->chunk);
+    function->jit = NULL;
+    function->calls = 0;
+    function->backedges = 0;
+    function->jitFailed = false;
     return function;
 }
 
@@ -112,7 +128,9 @@ ObjClass* newClass(ObjString* name) {
 ObjInstance* newInstance(ObjClass* klass) {
     ObjInstance* instance = ALLOCATE_OBJ(ObjInstance, OBJ_INSTANCE);
     instance->klass = klass;
-    initTable(&instance->fields);
+    instance->shape = vm.rootShape;
+    instance->slots = NULL;
+    instance->slotCapacity = 0;
     return instance;
 }
 
@@ -131,58 +149,88 @@ ObjArray* newArray(void) {
 
 ObjMap* newMap(void) {
     ObjMap* map = ALLOCATE_OBJ(ObjMap, OBJ_MAP);
-    initTable(&map->entries);
+    initTable(&map->index);
+    initValueArray(&map->keys);
+    initValueArray(&map->values);
     return map;
 }
 
-void printObject(Value value) {
-    switch (OBJ_TYPE(value)) {
-        case OBJ_STRING:
-            printf("%s", AS_CSTRING(value));
-            break;
-        case OBJ_FUNCTION: {
-            ObjFunction* fn = AS_FUNCTION(value);
-            if (fn->name == NULL) {
-                printf("<script>");
-            } else {
-                printf("<fn %s>", fn->name->chars);
-            }
-            break;
-        }
-        case OBJ_NATIVE:
-            printf("<native fn %s>", AS_NATIVE(value)->name);
-            break;
-        case OBJ_CLOSURE:
-            if (AS_CLOSURE(value)->function->name == NULL) {
-                printf("<script>");
-            } else {
-                printf("<fn %s>", AS_CLOSURE(value)->function->name->chars);
-            }
-            break;
-        case OBJ_UPVALUE:
-            printf("<upvalue>");
-            break;
-        case OBJ_CLASS:
-            printf("<class %s>", AS_CLASS(value)->name->chars);
-            break;
-        case OBJ_INSTANCE:
-            printf("<%s instance>", AS_INSTANCE(value)->klass->name->chars);
-            break;
-        case OBJ_BOUND_METHOD:
-            printf("<bound method>");
-            break;
-        case OBJ_ARRAY: {
-            ObjArray* arr = AS_ARRAY(value);
-            printf("[");
-            for (int i = 0; i < arr->elements.count; i++) {
-                if (i > 0) printf(", ");
-                printValue(arr->elements.values[i]);
-            }
-            printf("]");
-            break;
-        }
-        case OBJ_MAP:
-            printf("<map>");
-            break;
+bool mapGet(ObjMap* map, ObjString* key, Value* value) {
+    Value position;
+    if (!tableGet(&map->index, key, &position)) return false;
+    *value = map->values.values[AS_INT(position)];
+    return true;
+}
+
+void mapSet(ObjMap* map, ObjString* key, Value value) {
+    Value position;
+    if (tableGet(&map->index, key, &position)) {
+        map->values.values[AS_INT(position)] = value;
+        WRITE_BARRIER(map, value);
+        return;
     }
+    
+    tableSet(&map->index, key, INT_VAL(map->keys.count));
+    writeValueArray(&map->keys, OBJ_VAL(key));
+    writeValueArray(&map->values, value);
+    WRITE_BARRIER_OBJ(map, key);
+    WRITE_BARRIER(map, value);
+}
+
+/* Compacts the entries so the remaining keys keep their order */
+bool mapDelete(ObjMap* map, ObjString* key) {
+    Value position;
+    if (!tableGet(&map->index, key, &position)) return false;
+    tableDelete(&map->index, key);
+    
+    int pos = (int)AS_INT(position);
+    int moved = map->keys.count - pos - 1;
+    memmove(&map->keys.values[pos], &map->keys.values[pos + 1], sizeof(Value) * moved);
+    memmove(&map->values.values[pos], &map->values.values[pos + 1], sizeof(Value) * moved);
+    map->keys.count--;
+    map->values.count--;
+    
+    for (int i = pos; i < map->keys.count; i++) {
+        tableSet(&map->index, AS_STRING(map->keys.values[i]), INT_VAL(i));
+        // Moved down, maybe behind a sliced scan of the map
+        WRITE_BARRIER(map, map->keys.values[i]);
+        WRITE_BARRIER(map, map->values.values[i]);
+    }
+    return true;
+}
+
+bool instanceGet(ObjInstance* instance, ObjString* name, Value* value) {
+    int slot = shapeSlot(instance->shape, name);
+    if (slot < 0) return false;
+    *value = instance->slots[slot];
+    return true;
+}
+
+void instanceSet(ObjInstance* instance, ObjString* name, Value value) {
+    int slot = shapeSlot(instance->shape, name);
+    if (slot >= 0) {
+        instance->slots[slot] = value;
+        WRITE_BARRIER(instance, value);
+        return;
+    }
+    instanceAddField(instance, shapeTransition(instance->shape, name), value);
+}
+
+/* Moves the instance to `shape`, its current shape plus one field, and
+ * stores `value` in the new slot */
+void instanceAddField(ObjInstance* instance, Shape* shape, Value value) {
+    int slot = shape->fieldCount - 1;
+    if (slot >= instance->slotCapacity) {
+        int oldCapacity = instance->slotCapacity;
+        int capacity = oldCapacity < 4 ? 4 : oldCapacity * 2;
+        instance->slots = GROW_ARRAY(Value, instance->slots, oldCapacity, capacity);
+        instance->slotCapacity = capacity;
+    }
+    instance->slots[slot] = value;
+    instance->shape = shape;
+    WRITE_BARRIER(instance, value);
+}
+
+void printObject(Value value) {
+    printValue(value);
 }
@@ -0,0 +1,62 @@
+#include "shape.h"
+#include "memory.h"
+
+static Shape* newShape(Shape* parent, ObjString* key) {
+    Shape* shape = ALLOCATE(Shape, 1);
+    shape->parent = parent;
+    shape->key = key;
+    shape->fieldCount = parent != NULL ? parent->fieldCount + 1 : 0;
+    shape->transitions = NULL;
+    shape->transitionCount = 0;
+    shape->transitionCapacity = 0;
+    return shape;
+}
+
+Shape* newRootShape(void) {
+    return newShape(NULL, NULL);
+}
+
+/* Shape reached by adding `key` as the next field; the caller keeps `key`
+ * reachable until it is linked in */
+Shape* shapeTransition(Shape* shape, ObjString* key) {
+    for (int i = 0; i < shape->transitionCount; i++) {
+        if (shape->transitions[i]->key == key) return shape->transitions[i];
+    }
+    
+    Shape* child = newShape(shape, key);
+    if (shape->transitionCount == shape->transitionCapacity) {
+        int oldCapacity = shape->transitionCapacity;
+        shape->transitionCapacity = oldCapacity < 4 ? 4 : oldCapacity * 2;
+        shape->transitions = GROW_ARRAY(Shape*, shape->transitions,
+                                        oldCapacity, shape->transitionCapacity);
+    }
+    shape->transitions[shape->transitionCount++] = child;
+    return child;
+}
+
+/* Slot of field `key` in instances of this shape, or -1. Keys are interned,
+ * so the walk compares pointers */
+int shapeSlot(Shape* shape, ObjString* key) {
+    for (Shape* s = shape; s->parent != NULL; s = s->parent) {
+        if (s->key == key) return s->fieldCount - 1;
+    }
+    return -1;
+}
+
+/* Instances hold field values only: the shapes keep the names alive */
+void markShapes(Shape* shape) {
+    if (shape == NULL) return;
+    markObject((Obj*)shape->key);
+    for (int i = 0; i < shape->transitionCount; i++) {
+        markShapes(shape->transitions[i]);
+    }
+}
+
+void freeShapes(Shape* shape) {
+    if (shape == NULL) return;
+    for (int i = 0; i < shape->transitionCount; i++) {
+        freeShapes(shape->transitions[i]);
+    }
+    FREE_ARRAY(Shape*, shape->transitions, shape->transitionCapacity);
+    FREE(Shape, shape);
+}
@@ -0,0 +1,124 @@
+#include "slab.h"
+
+/* Header at the start of every slab. Slabs are SLAB_SIZE-aligned, so a
+ * block finds its slab by masking its address */
+typedef struct Slab {
+    struct Slab* prev;          // Neighbours in the class's list of slabs with room
+    struct Slab* next;
+    void* freeList;             // Blocks given back, linked through their first word
+    uint8_t* unused;            // First block never handed out
+    uint8_t* end;
+    int used;
+    int sizeClass;
+    bool listed;                // In the class's list: has a free or unused block
+} Slab;
+
+typedef struct {
+    Slab* partial;              // Slabs with room, the one allocated from first
+    size_t slabs;
+    size_t used;
+} SlabClass;
+
+static const size_t classSizes[SLAB_CLASS_COUNT] = {16, 32, 48, 64, 96, 128};
+
+// Size class by size in 16-byte steps: classIndex[(size + 15) / 16]
+static const uint8_t classIndex[SLAB_MAX_BLOCK / 16 + 1] = {0, 0, 1, 2, 3, 4, 4, 5, 5};
+
+// Blocks start past the header, 16-byte aligned like malloc's
+#define SLAB_FIRST_BLOCK ((sizeof(Slab) + 15) & ~(size_t)15)
+
+static SlabClass classes[SLAB_CLASS_COUNT];
+
+static size_t blocksPerSlab(int sizeClass) {
+    return (SLAB_SIZE - SLAB_FIRST_BLOCK) / classSizes[sizeClass];
+}
+
+static void listSlab(SlabClass* sizeClass, Slab* slab) {
+    slab->prev = NULL;
+    slab->next = sizeClass->partial;
+    if (sizeClass->partial != NULL) sizeClass->partial->prev = slab;
+    sizeClass->partial = slab;
+    slab->listed = true;
+}
+
+static void unlistSlab(SlabClass* sizeClass, Slab* slab) {
+    if (slab->prev != NULL) {
+        slab->prev->next = slab->next;
+    } else {
+        sizeClass->partial = slab->next;
+    }
+    if (slab->next != NULL) slab->next->prev = slab->prev;
+    slab->listed = false;
+}
+
+static Slab* newSlab(int index) {
+    void* memory;
+    if (posix_memalign(&memory, SLAB_SIZE, SLAB_SIZE) != 0) {
+        fprintf(stderr, "[Somnia] Out of memory!\n");
+        exit(1);
+    }
+    
+    Slab* slab = (Slab*)memory;
+    slab->freeList = NULL;
+    slab->unused = (uint8_t*)memory + SLAB_FIRST_BLOCK;
+    slab->end = slab->unused + blocksPerSlab(index) * classSizes[index];
+    slab->used = 0;
+    slab->sizeClass = index;
+    listSlab(&classes[index], slab);
+    classes[index].slabs++;
+    return slab;
+}
+
+size_t slabBlockSize(size_t size) {
+    if (size == 0 || size > SLAB_MAX_BLOCK) return size;
+    return classSizes[classIndex[(size + 15) / 16]];
+}
+
+void* slabAllocate(size_t size) {
+    int index = classIndex[(size + 15) / 16];
+    SlabClass* sizeClass = &classes[index];
+    Slab* slab = sizeClass->partial;
+    if (slab == NULL) slab = newSlab(index);
+    
+    void* block;
+    if (slab->freeList != NULL) {
+        block = slab->freeList;
+        slab->freeList = *(void**)block;
+    } else {
+        block = slab->unused;
+        slab->unused += classSizes[index];
+    }
+    slab->used++;
+    sizeClass->used++;
+    
+    if (slab->freeList == NULL && slab->unused == slab->end) unlistSlab(sizeClass, slab);
+    return block;
+}
+
+void slabFree(void* block) {
+    Slab* slab = (Slab*)((uintptr_t)block & ~(uintptr_t)(SLAB_SIZE - 1));
+    SlabClass* sizeClass = &classes[slab->sizeClass];
+    
+    *(void**)block = slab->freeList;
+    slab->freeList = block;
+    slab->used--;
+    sizeClass->used--;
+    if (!slab->listed) listSlab(sizeClass, slab);
+    
+    // Keep one slab with room so a class that frees and allocates in
+    // turn does not map and unmap a slab each time
+    if (slab->used == 0 && (sizeClass->partial != slab || slab->next != NULL)) {
+        unlistSlab(sizeClass, slab);
+        sizeClass->slabs--;
+        free(slab);
+    }
+}
+
+void slabStats(SlabClassStats stats[SLAB_CLASS_COUNT]) {
+    for (int i = 0; i < SLAB_CLASS_COUNT; i++) {
+        stats[i].blockSize = classSizes[i];
+        stats[i].slabs = classes[i].slabs;
+        stats[i].used = classes[i].used;
+        stats[i].free = classes[i].slabs * blocksPerSlab(i) - classes[i].used;
+    }
+}
@@ -1,7 +1,10 @@
 #include "value.h"
 #include "object.h"
 #include "memory.h"
+#include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 void initValueArray(ValueArray* array) {
     array->values = NULL;
@@ -25,46 +28,183 @@ void freeValueArray(ValueArray* array) {
     initValueArray(array);
 }
 
-void printValue(Value value) {
-    switch (value.type) {
+/* Growable buffer for the display form of a value */
+typedef struct {
+    char* chars;
+    int length;
+    int capacity;
+} CharBuffer;
+
+static void appendChars(CharBuffer* buffer, const char* chars, int length) {
+    if (buffer->length + length + 1 > buffer->capacity) {
+        while (buffer->length + length + 1 > buffer->capacity) {
+            buffer->capacity = buffer->capacity < 64 ? 64 : buffer->capacity * 2;
+        }
+        buffer->chars = realloc(buffer->chars, buffer->capacity);
+    }
+    memcpy(buffer->chars + buffer->length, chars, length);
+    buffer->length += length;
+    buffer->chars[buffer->length] = '\0';
+}
+
+static void appendString(CharBuffer* buffer, const char* chars) {
+    appendChars(buffer, chars, (int)strlen(chars));
+}
+
+static const char* functionName(ObjFunction* function) {
+    return function->name != NULL ? function->name->chars : "script";
+}
+
+/* Same formats as the tree-walker's value_to_string */
+static void appendValue(CharBuffer* buffer, Value value) {
+    char number[64];
+    
+    switch (VALUE_TYPE(value)) {
         case VAL_NULL:
-            printf("null");
-            break;
+            appendString(buffer, "null");
+            return;
         case VAL_BOOL:
-            printf(AS_BOOL(value) ? "true" : "false");
+            appendString(buffer, AS_BOOL(value) ? "true" : "false");
+            return;
+        case VAL_INT: {
+            // Past int range the tree-walker's doubles print with %g
+            int64_t n = AS_INT(value);
+            if (n >= INT_MIN && n <= INT_MAX) {
+                snprintf(number, sizeof(number), "%d", (int)n);
+            } else {
+                snprintf(number, sizeof(number), "%g", (double)n);
+            }
+            appendString(buffer, number);
+            return;
+        }
+        case VAL_DOUBLE: {
+            double n = AS_DOUBLE(value);
+            if (n == (int)n) {
+                snprintf(number, sizeof(number), "%d", (int)n);
+            } else {
+                snprintf(number, sizeof(number), "%g", n);
+            }
+            appendString(buffer, number);
+            return;
+        }
+        case VAL_OBJECT:
             break;
-        case VAL_INT:
-            printf("%lld", (long long)AS_INT(value));
+    }
+    
+    switch (OBJ_TYPE(value)) {
+        case OBJ_STRING:
+            appendChars(buffer, AS_STRING(value)->chars, AS_STRING(value)->length);
             break;
-        case VAL_DOUBLE:
-            printf("%g", AS_DOUBLE(value));
+        case OBJ_FUNCTION:
+            appendString(buffer, "<function ");
+            appendString(buffer, functionName(AS_FUNCTION(value)));
+            appendString(buffer, ">");
             break;
-        case VAL_OBJECT:
-            printObject(value);
+        case OBJ_CLOSURE:
+            appendString(buffer, "<function ");
+            appendString(buffer, functionName(AS_CLOSURE(value)->function));
+            appendString(buffer, ">");
             break;
+        case OBJ_BOUND_METHOD:
+            appendString(buffer, "<function ");
+            appendString(buffer, functionName(AS_BOUND_METHOD(value)->method->function));
+            appendString(buffer, ">");
+            break;
+        case OBJ_NATIVE:
+            appendString(buffer, "<native function>");
+            break;
+        case OBJ_UPVALUE:
+            appendString(buffer, "<upvalue>");
+            break;
+        case OBJ_CLASS:
+            appendString(buffer, "<class ");
+            appendString(buffer, AS_CLASS(value)->name->chars);
+            appendString(buffer, ">");
+            break;
+        case OBJ_INSTANCE:
+            appendString(buffer, "<object ");
+            appendString(buffer, AS_INSTANCE(value)->klass->name->chars);
+            appendString(buffer, ">");
+            break;
+        case OBJ_ARRAY: {
+            ObjArray* array = AS_ARRAY(value);
+            appendString(buffer, "[");
+            for (int i = 0; i < array->elements.count; i++) {
+                if (i > 0) appendString(buffer, ", ");
+                appendValue(buffer, array->elements.values[i]);
+            }
+            appendString(buffer, "]");
+            break;
+        }
+        case OBJ_MAP: {
+            ObjMap* map = AS_MAP(value);
+            appendString(buffer, "{");
+            for (int i = 0; i < map->keys.count; i++) {
+                if (i > 0) appendString(buffer, ", ");
+                appendString(buffer, "\"");
+                appendValue(buffer, map->keys.values[i]);
+                appendString(buffer, "\": ");
+                
+                Value entry = map->values.values[i];
+                if (IS_STRING(entry)) appendString(buffer, "\"");
+                appendValue(buffer, entry);
+                if (IS_STRING(entry)) appendString(buffer, "\"");
+            }
+            appendString(buffer, "}");
+            break;
+        }
     }
 }
 
+char* valueToChars(Value value, int* length) {
+    CharBuffer buffer = {NULL, 0, 0};
+    appendChars(&buffer, "", 0);
+    appendValue(&buffer, value);
+    if (length != NULL) *length = buffer.length;
+    return buffer.chars;
+}
+
+void printValue(Value value) {
+    if (IS_STRING(value)) {
+        fwrite(AS_CSTRING(value), 1, AS_STRING(value)->length, stdout);
+        return;
+    }
+    char* chars = valueToChars(value, NULL);
+    fputs(chars, stdout);
+    free(chars);
+}
+
+/* Same rule as the tree-walker: numbers by value, strings by contents
+ * (interned, so by pointer), every other object compares unequal */
 bool valuesEqual(Value a, Value b) {
-    if (a.type != b.type) return false;
+    if (IS_NUMBER(a) && IS_NUMBER(b)) {
+        if (IS_INT(a) && IS_INT(b)) return AS_INT(a) == AS_INT(b);
+        return valueToDouble(a) == valueToDouble(b);
+    }
+    if (VALUE_TYPE(a) != VALUE_TYPE(b)) return false;
     
-    switch (a.type) {
+    switch (VALUE_TYPE(a)) {
         case VAL_NULL:   return true;
         case VAL_BOOL:   return AS_BOOL(a) == AS_BOOL(b);
-        case VAL_INT:    return AS_INT(a) == AS_INT(b);
-        case VAL_DOUBLE: return AS_DOUBLE(a) == AS_DOUBLE(b);
-        case VAL_OBJECT: return AS_OBJ(a) == AS_OBJ(b);
+        case VAL_OBJECT: return IS_STRING(a) && AS_OBJ(a) == AS_OBJ(b);
         default:         return false;
     }
 }
 
+/* Empty strings, arrays and maps are falsy, as in the tree-walker */
 Value valueTruthy(Value value) {
-    switch (value.type) {
+    switch (VALUE_TYPE(value)) {
         case VAL_NULL:   return BOOL_VAL(false);
         case VAL_BOOL:   return value;
         case VAL_INT:    return BOOL_VAL(AS_INT(value) != 0);
         case VAL_DOUBLE: return BOOL_VAL(AS_DOUBLE(value) != 0.0);
-        case VAL_OBJECT: return BOOL_VAL(true);
+        case VAL_OBJECT:
+            switch (OBJ_TYPE(value)) {
+                case OBJ_STRING: return BOOL_VAL(AS_STRING(value)->length > 0);
+                case OBJ_ARRAY:  return BOOL_VAL(AS_ARRAY(value)->elements.count > 0);
+                case OBJ_MAP:    return BOOL_VAL(AS_MAP(value)->keys.count > 0);
+                default:         return BOOL_VAL(true);
+            }
         default:         return BOOL_VAL(false);
     }
 }
@@ -2,6 +2,8 @@
 #include "memory.h"
 #include "object.h"
 #include "compiler/compiler.h"
+#include "jit.h"
+#include "slab.h"
 #include <stdio.h>
 #include <stdarg.h>
 #include <string.h>
@@ -13,6 +15,7 @@ VM vm;
 
 // Forward declarations
 static InterpretResult run(void);
+static InterpretResult dispatch(void);
 static bool callValue(Value callee, int argCount);
 static bool call(ObjClosure* closure, int argCount);
 static ObjUpvalue* captureUpvalue(Value* local);
@@ -28,29 +31,12 @@ static Value clockNative(int argCount, Value* args) {
     return DOUBLE_VAL((double)clock() / CLOCKS_PER_SEC);
 }
 
-static Value printNative(int argCount, Value* args) {
-    for (int i = 0; i < argCount; i++) {
-        if (i > 0) printf(" ");
-        printValue(args[i]);
-    }
-    return NULL_VAL;
-}
-
-static Value printlnNative(int argCount, Value* args) {
-    for (int i = 0; i < argCount; i++) {
-        if (i > 0) printf(" ");
-        printValue(args[i]);
-    }
-    printf("\n");
-    return NULL_VAL;
-}
-
 static Value typeNative(int argCount, Value* args) {
     if (argCount != 1) return NULL_VAL;
     
     Value v = args[0];
     const char* name;
-    switch (v.type) {
+    switch (VALUE_TYPE(v)) {
         case VAL_NULL:   name = "null"; break;
         case VAL_BOOL:   name = "bool"; break;
         case VAL_INT:    name = "int"; break;
@@ -74,26 +60,11 @@ static Value typeNative(int argCount, Value* args) {
     return OBJ_VAL(copyString(name, (int)strlen(name)));
 }
 
-static Value lenNative(int argCount, Value* args) {
-    if (argCount != 1) return INT_VAL(0);
-    
-    Value v = args[0];
-    if (IS_STRING(v)) return INT_VAL(AS_STRING(v)->length);
-    if (IS_ARRAY(v)) return INT_VAL(AS_ARRAY(v)->elements.count);
-    return INT_VAL(0);
-}
-
 static Value sqrtNative(int argCount, Value* args) {
     if (argCount != 1) return DOUBLE_VAL(0);
     return DOUBLE_VAL(sqrt(valueToDouble(args[0])));
 }
 
-static Value absNative(int argCount, Value* args) {
-    if (argCount != 1) return DOUBLE_VAL(0);
-    double v = valueToDouble(args[0]);
-    return DOUBLE_VAL(v < 0 ? -v : v);
-}
-
 static Value gcRunNative(int argCount, Value* args) {
     (void)argCount; (void)args;
     collectGarbage();
@@ -105,10 +76,145 @@ static Value memoryUsedNative(int argCount, Value* args) {
     return INT_VAL((int64_t)getGCMetrics()->bytesAllocated);
 }
 
+static void setStat(ObjMap* map, const char* name, int64_t value) {
+    push(OBJ_VAL(copyString(name, (int)strlen(name))));
+    mapSet(map, AS_STRING(peek(0)), INT_VAL(value));
+    pop();
+}
+
+/* {"bytesAllocated": n, "slabBytes": n, "classes": [{"size": n, "slabs": n,
+ * "used": n, "free": n}, ...]} with one entry per slab size class */
+static Value memoryStatsNative(int argCount, Value* args) {
+    (void)argCount; (void)args;
+    SlabClassStats classes[SLAB_CLASS_COUNT];
+    slabStats(classes);
+    
+    ObjMap* stats = newMap();
+    push(OBJ_VAL(stats));
+    ObjArray* list = newArray();
+    push(OBJ_VAL(list));
+    size_t slabs = 0;
+    for (int i = 0; i < SLAB_CLASS_COUNT; i++) {
+        ObjMap* entry = newMap();
+        push(OBJ_VAL(entry));
+        setStat(entry, "size", (int64_t)classes[i].blockSize);
+        setStat(entry, "slabs", (int64_t)classes[i].slabs);
+        setStat(entry, "used", (int64_t)classes[i].used);
+        setStat(entry, "free", (int64_t)classes[i].free);
+        writeValueArray(&list->elements, OBJ_VAL(entry));
+        WRITE_BARRIER_OBJ(list, entry);
+        pop();
+        slabs += classes[i].slabs;
+    }
+    
+    setStat(stats, "bytesAllocated", (int64_t)vm.bytesAllocated);
+    setStat(stats, "slabBytes", (int64_t)(slabs * SLAB_SIZE));
+    push(OBJ_VAL(copyString("classes", 7)));
+    mapSet(stats, AS_STRING(peek(0)), OBJ_VAL(list));
+    pop();
+    pop();
+    pop();
+    return OBJ_VAL(stats);
+}
+
+/* Collector counters, pauses in microseconds: {"collections": n, "freed": n,
+ * "incremental": bool, "pauseTarget": n, "pauses": n, "maxPause": n,
+ * "totalPause": n, "histogram": [{"upTo": n, "count": n}, ...]}. The last
+ * bucket's "upTo" is null */
+static Value gcStatsNative(int argCount, Value* args) {
+    (void)argCount; (void)args;
+    GCMetrics* metrics = getGCMetrics();
+    
+    ObjMap* stats = newMap();
+    push(OBJ_VAL(stats));
+    setStat(stats, "collections", (int64_t)metrics->totalCollections);
+    setStat(stats, "freed", (int64_t)metrics->totalFreed);
+    setStat(stats, "pauseTarget", (int64_t)metrics->pauseTarget);
+    setStat(stats, "pauses", (int64_t)metrics->pauses);
+    setStat(stats, "maxPause", (int64_t)metrics->maxPause);
+    setStat(stats, "totalPause", (int64_t)metrics->totalPause);
+    push(OBJ_VAL(copyString("incremental", 11)));
+    mapSet(stats, AS_STRING(peek(0)), BOOL_VAL(vm.gcIncremental));
+    pop();
+    
+    ObjArray* histogram = newArray();
+    push(OBJ_VAL(histogram));
+    for (int i = 0; i < GC_PAUSE_BUCKETS; i++) {
+        ObjMap* bucket = newMap();
+        push(OBJ_VAL(bucket));
+        if (i < GC_PAUSE_BUCKETS - 1) {
+            setStat(bucket, "upTo", (int64_t)gcPauseBounds[i]);
+        } else {
+            push(OBJ_VAL(copyString("upTo", 4)));
+            mapSet(bucket, AS_STRING(peek(0)), NULL_VAL);
+            pop();
+        }
+        setStat(bucket, "count", (int64_t)metrics->pauseHistogram[i]);
+        writeValueArray(&histogram->elements, OBJ_VAL(bucket));
+        WRITE_BARRIER_OBJ(histogram, bucket);
+        pop();
+    }
+    push(OBJ_VAL(copyString("histogram", 9)));
+    mapSet(stats, AS_STRING(peek(0)), OBJ_VAL(histogram));
+    pop();
+    pop();
+    pop();
+    return OBJ_VAL(stats);
+}
+
+static const struct {
+    OpCode opcode;
+    const char* name;
+} quickenedOps[] = {
+    {OP_ADD_INT, "ADD_INT"},
+    {OP_ADD_STR, "ADD_STR"},
+    {OP_SUBTRACT_INT, "SUBTRACT_INT"},
+    {OP_MULTIPLY_INT, "MULTIPLY_INT"},
+    {OP_GREATER_INT, "GREATER_INT"},
+    {OP_GREATER_EQUAL_INT, "GREATER_EQUAL_INT"},
+    {OP_LESS_INT, "LESS_INT"},
+    {OP_LESS_EQUAL_INT, "LESS_EQUAL_INT"},
+    {OP_INDEX_GET_ARRAY_INT, "INDEX_GET_ARRAY_INT"},
+    {OP_INDEX_SET_ARRAY_INT, "INDEX_SET_ARRAY_INT"},
+};
+
+/* {"ADD_INT": {"quickened": n, "deopts": n}, ...} for every quickened opcode */
+static Value quickenStatsNative(int argCount, Value* args) {
+    (void)argCount; (void)args;
+    ObjMap* stats = newMap();
+    push(OBJ_VAL(stats));
+    
+    for (size_t i = 0; i < sizeof(quickenedOps) / sizeof(quickenedOps[0]); i++) {
+        OpCode opcode = quickenedOps[i].opcode;
+        ObjMap* counts = newMap();
+        push(OBJ_VAL(counts));
+        push(OBJ_VAL(copyString("quickened", 9)));
+        mapSet(counts, AS_STRING(peek(0)), INT_VAL((int64_t)vm.quickened[opcode]));
+        pop();
+        push(OBJ_VAL(copyString("deopts", 6)));
+        mapSet(counts, AS_STRING(peek(0)), INT_VAL((int64_t)vm.deopts[opcode]));
+        pop();
+        
+        const char* name = quickenedOps[i].name;
+        push(OBJ_VAL(copyString(name, (int)strlen(name))));
+        mapSet(stats, AS_STRING(peek(0)), OBJ_VAL(counts));
+        pop();
+        pop();
+    }
+    
+    pop();
+    return OBJ_VAL(stats);
+}
+
 void initVM(void) {
     vm.stackTop = vm.stack;
     vm.frameCount = 0;
     vm.objects = NULL;
+    vm.sweeping = NULL;
+    vm.gcPhase = GC_IDLE;
+    vm.gcIncremental = true;
+    vm.gcPauseTarget = GC_PAUSE_TARGET;
+    vm.gcDebt = 0;
     vm.bytesAllocated = 0;
     vm.nextGC = 1024 * 1024;  // 1MB initial threshold
     
@@ -119,37 +225,65 @@ void initVM(void) {
     vm.openUpvalues = NULL;
     
     initTable(&vm.globals);
+    initValueArray(&vm.globalValues);
+    initTable(&vm.modules);
     initTable(&vm.strings);
+    vm.handlerCount = 0;
+    memset(vm.quickened, 0, sizeof(vm.quickened));
+    memset(vm.deopts, 0, sizeof(vm.deopts));
+    vm.cacheHits = 0;
+    vm.cacheMisses = 0;
+    vm.megamorphicSites = 0;
+    vm.jitEnabled = false;
+    vm.jitCallThreshold = JIT_CALL_THRESHOLD;
+    vm.jitLoopThreshold = JIT_LOOP_THRESHOLD;
     
     vm.initString = NULL;
+    vm.rootShape = NULL;
     vm.initString = copyString("init", 4);
+    vm.rootShape = newRootShape();
     
     // Register native functions
     defineNative("clock", clockNative, 0);
-    defineNative("print", printNative, -1);
-    defineNative("println", printlnNative, -1);
     defineNative("type", typeNative, 1);
-    defineNative("len", lenNative, 1);
     defineNative("sqrt", sqrtNative, 1);
-    defineNative("abs", absNative, 1);
-    defineNative("gc", gcRunNative, 0);
+    defineNative("gc", gcRunNative, -1);
     defineNative("memoryUsed", memoryUsedNative, 0);
+    defineNative("memoryStats", memoryStatsNative, 0);
+    defineNative("gcStats", gcStatsNative, 0);
+    defineNative("quickenStats", quickenStatsNative, -1);
+    defineStdlibNatives();
 }
 
 void freeVM(void) {
     freeTable(&vm.globals);
+    freeValueArray(&vm.globalValues);
+    freeTable(&vm.modules);
     freeTable(&vm.strings);
     vm.initString = NULL;
+    freeShapes(vm.rootShape);
+    vm.rootShape = NULL;
     
-    // Free all objects
-    Obj* object = vm.objects;
-    while (object != NULL) {
-        Obj* next = object->next;
-        freeObject(object);
-        object = next;
+    // Free all objects, with those an unfinished sweep still holds
+    vm.gcPhase = GC_IDLE;
+    Obj* lists[] = {vm.objects, vm.sweeping};
+    for (int i = 0; i < 2; i++) {
+        Obj* object = lists[i];
+        while (object != NULL) {
+            Obj* next = object->next;
+            freeObject(object);
+            object = next;
+        }
     }
+    vm.objects = NULL;
+    vm.sweeping = NULL;
     
     free(vm.grayStack);
+    
+#if BASELINE_JIT
+    if (vm.jitEnabled) freeJit();
+    vm.jitEnabled = false;
+#endif
 }
 
 void push(Value value) {
@@ -166,10 +300,32 @@ Value peek(int distance) {
     return vm.stackTop[-1 - distance];
 }
 
+int globalSlot(ObjString* name) {
+    Value slot;
+    if (tableGet(&vm.globals, name, &slot)) return (int)AS_INT(slot);
+    
+    push(OBJ_VAL(name));
+    int index = vm.globalValues.count;
+    writeValueArray(&vm.globalValues, UNDEFINED_VAL);
+    tableSet(&vm.globals, name, INT_VAL(index));
+    pop();
+    return index;
+}
+
+/* Name of a global slot, for error messages */
+static ObjString* globalName(int slot) {
+    for (int i = 0; i < vm.globals.capacity; i++) {
+        Entry* entry = &vm.globals.entries[i];
+        if (entry->key != NULL && AS_INT(entry->value) == slot) return entry->key;
+    }
+    return NULL;
+}
+
 void defineNative(const char* name, NativeFn function, int arity) {
     push(OBJ_VAL(copyString(name, (int)strlen(name))));
     push(OBJ_VAL(newNative(function, name, arity)));
-    tableSet(&vm.globals, AS_STRING(vm.stack[0]), vm.stack[1]);
+    int slot = globalSlot(AS_STRING(vm.stack[0]));
+    vm.globalValues.values[slot] = vm.stack[1];
     pop();
     pop();
 }
@@ -177,9 +333,13 @@ void defineNative(const char* name, NativeFn function, int arity) {
 void runtimeError(const char* format, ...) {
     va_list args;
     va_start(args, format);
-    vfprintf(stderr, format, args);
+    vsnprintf(vm.errorMessage, sizeof(vm.errorMessage), format, args);
     va_end(args);
-    fputs("\n", stderr);
+    
+    // Inside a try block the message goes to the catch block instead
+    if (vm.handlerCount > 0) return;
+    
+    fprintf(stderr, "%s\n", vm.errorMessage);
     
     // Stack trace
     for (int i = vm.frameCount - 1; i >= 0; i--) {
@@ -202,10 +362,15 @@ InterpretResult interpret(const char* source) {
     ObjFunction* function = compile(source);
     if (function == NULL) return INTERPRET_COMPILE_ERROR;
     
+    return interpretFunction(function);
+}
+
+InterpretResult interpretFunction(ObjFunction* function) {
     push(OBJ_VAL(function));
     ObjClosure* closure = newClosure(function);
     pop();
     push(OBJ_VAL(closure));
+    vm.handlerCount = 0;
     call(closure, 0);
     
     return run();
@@ -239,9 +404,15 @@ InterpretResult interpretFile(const char* path) {
 }
 
 static bool call(ObjClosure* closure, int argCount) {
-    if (closure->function->arity != -1 && argCount != closure->function->arity) {
-        runtimeError("Expected %d arguments but got %d.", closure->function->arity, argCount);
-        return false;
+    // Missing arguments are null and extra ones dropped, as in the tree-walker
+    int arity = closure->function->arity;
+    while (argCount < arity) {
+        push(NULL_VAL);
+        argCount++;
+    }
+    if (argCount > arity) {
+        vm.stackTop -= argCount - arity;
+        argCount = arity;
     }
     
     if (vm.frameCount == FRAMES_MAX) {
@@ -253,6 +424,14 @@ static bool call(ObjClosure* closure, int argCount) {
     frame->closure = closure;
     frame->ip = closure->function->chunk.code;
     frame->slots = vm.stackTop - argCount - 1;
+    
+#if BASELINE_JIT
+    ObjFunction* function = closure->function;
+    if (vm.jitEnabled && function->jit == NULL && !function->jitFailed &&
+        ++function->calls >= vm.jitCallThreshold) {
+        jitCompile(function);
+    }
+#endif
     return true;
 }
 
@@ -279,10 +458,8 @@ static bool callValue(Value callee, int argCount) {
                 Value initializer;
                 if (tableGet(&klass->methods, vm.initString, &initializer)) {
                     return call(AS_CLOSURE(initializer), argCount);
-                } else if (argCount != 0) {
-                    runtimeError("Expected 0 arguments but got %d.", argCount);
-                    return false;
                 }
+                vm.stackTop -= argCount;
                 return true;
             }
             case OBJ_BOUND_METHOD: {
@@ -327,6 +504,7 @@ static void closeUpvalues(Value* last) {
         ObjUpvalue* upvalue = vm.openUpvalues;
         upvalue->closed = *upvalue->location;
         upvalue->location = &upvalue->closed;
+        WRITE_BARRIER(upvalue, upvalue->closed);
         vm.openUpvalues = upvalue->next;
     }
 }
@@ -335,6 +513,8 @@ static void defineMethod(ObjString* name) {
     Value method = peek(0);
     ObjClass* klass = AS_CLASS(peek(1));
     tableSet(&klass->methods, name, method);
+    WRITE_BARRIER_OBJ(klass, name);
+    WRITE_BARRIER(klass, method);
     pop();
 }
 
@@ -363,6 +543,14 @@ static bool invokeFromClass(ObjClass* klass, ObjString* name, int argCount) {
 static bool invoke(ObjString* name, int argCount) {
     Value receiver = peek(argCount);
     
+    // A map entry is called as a plain function, without self
+    if (IS_MAP(receiver)) {
+        Value value;
+        if (!mapGet(AS_MAP(receiver), name, &value)) value = NULL_VAL;
+        vm.stackTop[-argCount - 1] = value;
+        return callValue(value, argCount);
+    }
+    
     if (!IS_INSTANCE(receiver)) {
         runtimeError("Only instances have methods.");
         return false;
@@ -371,7 +559,7 @@ static bool invoke(ObjString* name, int argCount) {
     ObjInstance* instance = AS_INSTANCE(receiver);
     
     Value value;
-    if (tableGet(&instance->fields, name, &value)) {
+    if (instanceGet(instance, name, &value)) {
         vm.stackTop[-argCount - 1] = value;
         return callValue(value, argCount);
     }
@@ -379,30 +567,694 @@ static bool invoke(ObjString* name, int argCount) {
     return invokeFromClass(instance->klass, name, argCount);
 }
 
-static InterpretResult run(void) {
+/* Entry of a site's inline cache that answers for this receiver, or NULL.
+ * Field slots depend on the shape alone; methods also on the class */
+static inline CacheEntry* findCacheEntry(InlineCache* cache, ObjInstance* instance) {
+    for (int i = 0; i < cache->count; i++) {
+        CacheEntry* entry = &cache->entries[i];
+        if (entry->shape == instance->shape &&
+            (entry->slot >= 0 || entry->klass == instance->klass)) {
+            vm.cacheHits++;
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/* Adds a resolved entry to the site; past CACHE_ENTRIES_MAX shapes the site
+ * is megamorphic and `entry` is used once without being kept */
+static CacheEntry* cacheEntry(InlineCache* cache, CacheEntry* entry) {
+    vm.cacheMisses++;
+    if (cache->count == CACHE_ENTRIES_MAX) {
+        if (!cache->megamorphic) {
+            cache->megamorphic = true;
+            vm.megamorphicSites++;
+        }
+        return entry;
+    }
+    cache->entries[cache->count] = *entry;
+    // Every cache belongs to the chunk of the function running
+    ObjFunction* owner = vm.frames[vm.frameCount - 1].closure->function;
+    WRITE_BARRIER_OBJ(owner, entry->klass);
+    WRITE_BARRIER_OBJ(owner, entry->method);
+    return &cache->entries[cache->count++];
+}
+
+/* Field first, then a method of the class; false if the name is neither */
+static bool lookupProperty(ObjInstance* instance, ObjString* name, CacheEntry* entry) {
+    entry->shape = instance->shape;
+    entry->slot = shapeSlot(instance->shape, name);
+    entry->transition = NULL;
+    entry->klass = NULL;
+    entry->method = NULL;
+    if (entry->slot >= 0) return true;
+    
+    Value method;
+    if (!tableGet(&instance->klass->methods, name, &method)) return false;
+    entry->klass = instance->klass;
+    entry->method = AS_CLOSURE(method);
+    return true;
+}
+
+/* invoke() through the site's inline cache when the receiver is an instance */
+static bool invokeCached(ObjString* name, int argCount, InlineCache* cache) {
+    Value receiver = peek(argCount);
+    if (!IS_INSTANCE(receiver)) return invoke(name, argCount);
+    
+    ObjInstance* instance = AS_INSTANCE(receiver);
+    CacheEntry* entry = findCacheEntry(cache, instance);
+    CacheEntry found;
+    if (entry == NULL) {
+        if (!lookupProperty(instance, name, &found)) {
+            runtimeError("Undefined property '%s'.", name->chars);
+            return false;
+        }
+        entry = cacheEntry(cache, &found);
+    }
+    
+    if (entry->slot >= 0) {
+        Value value = instance->slots[entry->slot];
+        vm.stackTop[-argCount - 1] = value;
+        return callValue(value, argCount);
+    }
+    return call(entry->method, argCount);
+}
+
+/* Display form of a string operand without copying it; `temp` is set when freed */
+static const char* operandChars(Value value, int* length, char** temp) {
+    *temp = NULL;
+    if (IS_STRING(value)) {
+        *length = AS_STRING(value)->length;
+        return AS_STRING(value)->chars;
+    }
+    *temp = valueToChars(value, length);
+    return *temp;
+}
+
+/* String + anything: both operands stay on the stack until the result exists */
+static void concatenate(void) {
+    int aLength, bLength;
+    char* aTemp;
+    char* bTemp;
+    const char* a = operandChars(peek(1), &aLength, &aTemp);
+    const char* b = operandChars(peek(0), &bLength, &bTemp);
+    
+    int length = aLength + bLength;
+    char* chars = ALLOCATE(char, length + 1);
+    memcpy(chars, a, aLength);
+    memcpy(chars + aLength, b, bLength);
+    chars[length] = '\0';
+    free(aTemp);
+    free(bTemp);
+    
+    ObjString* result = takeString(chars, length);
+    pop();
+    pop();
+    push(OBJ_VAL(result));
+}
+
+static void concatenateArrays(void) {
+    ObjArray* result = newArray();
+    push(OBJ_VAL(result));
+    ValueArray* a = &AS_ARRAY(peek(2))->elements;
+    ValueArray* b = &AS_ARRAY(peek(1))->elements;
+    for (int i = 0; i < a->count; i++) {
+        writeValueArray(&result->elements, a->values[i]);
+        WRITE_BARRIER(result, a->values[i]);
+    }
+    for (int i = 0; i < b->count; i++) {
+        writeValueArray(&result->elements, b->values[i]);
+        WRITE_BARRIER(result, b->values[i]);
+    }
+    vm.stackTop -= 3;
+    push(OBJ_VAL(result));
+}
+
+/* `+` on anything but two numbers: strings concatenate, arrays join, the
+ * rest is null */
+static void addObjects(void) {
+    if (IS_STRING(peek(0)) || IS_STRING(peek(1))) {
+        concatenate();
+    } else if (IS_ARRAY(peek(0)) && IS_ARRAY(peek(1))) {
+        concatenateArrays();
+    } else {
+        vm.stackTop -= 2;
+        push(NULL_VAL);
+    }
+}
+
+/* `item in container`: null when the operand types don't support it */
+static Value contains(Value container, Value item) {
+    if (IS_ARRAY(container)) {
+        ValueArray* elements = &AS_ARRAY(container)->elements;
+        for (int i = 0; i < elements->count; i++) {
+            if (valuesEqual(item, elements->values[i])) return BOOL_VAL(true);
+        }
+        return BOOL_VAL(false);
+    }
+    if (IS_MAP(container) && IS_STRING(item)) {
+        Value value;
+        return BOOL_VAL(mapGet(AS_MAP(container), AS_STRING(item), &value));
+    }
+    if (IS_STRING(container) && IS_STRING(item)) {
+        return BOOL_VAL(strstr(AS_CSTRING(container), AS_CSTRING(item)) != NULL);
+    }
+    return NULL_VAL;
+}
+
+/* Resume at the innermost catch block with the error message on the stack */
+static void unwindToHandler(void) {
+    TryHandler* handler = &vm.handlers[--vm.handlerCount];
+    closeUpvalues(handler->stackTop);
+    vm.frameCount = handler->frameCount;
+    vm.stackTop = handler->stackTop;
+    vm.frames[vm.frameCount - 1].ip = handler->catchIp;
+    push(OBJ_VAL(copyString(vm.errorMessage, (int)strlen(vm.errorMessage))));
+}
+
+#if BASELINE_JIT
+/* Helpers for native code (jit.h). Each runs one instruction the way its
+ * generic handler in dispatch() does, on vm.stackTop */
+
+JitStatus jitOperator(uint8_t op) {
+    Value b = peek(0);
+    
+    if (op == OP_NOT) {
+        vm.stackTop[-1] = BOOL_VAL(!AS_BOOL(valueTruthy(b)));
+        return JIT_CONTINUE;
+    }
+    if (op == OP_NEGATE) {
+        if (IS_INT(b) && AS_INT(b) != INT64_MIN) {
+            vm.stackTop[-1] = INT_VAL(-AS_INT(b));
+        } else if (IS_NUMBER(b)) {
+            vm.stackTop[-1] = DOUBLE_VAL(-valueToDouble(b));
+        } else {
+            runtimeError("Operand must be a number.");
+            return JIT_ERROR;
+        }
+        return JIT_CONTINUE;
+    }
+    
+    Value a = peek(1);
+    if (op == OP_ADD && (!IS_NUMBER(a) || !IS_NUMBER(b))) {
+        addObjects();
+        return JIT_CONTINUE;
+    }
+    if (op != OP_EQUAL && op != OP_NOT_EQUAL && op != OP_IN &&
+        (!IS_NUMBER(a) || !IS_NUMBER(b))) {
+        runtimeError("Operands must be numbers.");
+        return JIT_ERROR;
+    }
+    
+    bool ints = IS_INT(a) && IS_INT(b);
+    double x = valueToDouble(a);
+    double y = valueToDouble(b);
+    int64_t integer;
+    Value result;
+    switch (op) {
+        case OP_ADD:
+            result = ints && addInts(AS_INT(a), AS_INT(b), &integer) ? INT_VAL(integer) : DOUBLE_VAL(x + y);
+            break;
+        case OP_SUBTRACT:
+            result = ints && subtractInts(AS_INT(a), AS_INT(b), &integer) ? INT_VAL(integer) : DOUBLE_VAL(x - y);
+            break;
+        case OP_MULTIPLY:
+            result = ints && multiplyInts(AS_INT(a), AS_INT(b), &integer) ? INT_VAL(integer) : DOUBLE_VAL(x * y);
+            break;
+        case OP_DIVIDE:
+            if (y == 0) {
+                fprintf(stderr, "[ERROR] Division by zero\n");
+                result = INT_VAL(0);
+            } else {
+                result = ints && divideInts(AS_INT(a), AS_INT(b), &integer) ? INT_VAL(integer) : DOUBLE_VAL(x / y);
+            }
+            break;
+        case OP_MODULO:
+            result = ints && moduloInts(AS_INT(a), AS_INT(b), &integer) ? INT_VAL(integer) : DOUBLE_VAL(fmod(x, y));
+            break;
+        case OP_GREATER: result = BOOL_VAL(ints ? AS_INT(a) > AS_INT(b) : x > y); break;
+        case OP_GREATER_EQUAL: result = BOOL_VAL(ints ? AS_INT(a) >= AS_INT(b) : x >= y); break;
+        case OP_LESS: result = BOOL_VAL(ints ? AS_INT(a) < AS_INT(b) : x < y); break;
+        case OP_LESS_EQUAL: result = BOOL_VAL(ints ? AS_INT(a) <= AS_INT(b) : x <= y); break;
+        case OP_EQUAL: result = BOOL_VAL(valuesEqual(a, b)); break;
+        case OP_NOT_EQUAL: result = BOOL_VAL(!valuesEqual(a, b)); break;
+        default: result = contains(b, a); break;   // OP_IN
+    }
+    vm.stackTop -= 2;
+    push(result);
+    return JIT_CONTINUE;
+}
+
+JitStatus jitUndefinedGlobal(int slot) {
+    runtimeError("Undefined variable '%s'.", globalName(slot)->chars);
+    return JIT_ERROR;
+}
+
+/* After a call pushed a frame: native code runs it to completion if the
+ * callee is compiled, otherwise the interpreter takes over from here */
+static JitStatus runCallee(int frameCount) {
+    if (vm.frameCount == frameCount) return JIT_CONTINUE;
+    
     CallFrame* frame = &vm.frames[vm.frameCount - 1];
+    if (frame->closure->function->jit == NULL) return JIT_BAILOUT;
+    JitStatus status = jitEnter(frame);
+    return status == JIT_RETURNED ? JIT_CONTINUE : status;
+}
+
+JitStatus jitCall(int argCount) {
+    int frameCount = vm.frameCount;
+    if (!callValue(peek(argCount), argCount)) return JIT_ERROR;
+    return runCallee(frameCount);
+}
+
+JitStatus jitInvoke(ObjString* name, int argCount, InlineCache* cache) {
+    int frameCount = vm.frameCount;
+    if (!invokeCached(name, argCount, cache)) return JIT_ERROR;
+    return runCallee(frameCount);
+}
+
+JitStatus jitSuperInvoke(ObjString* name, int argCount) {
+    int frameCount = vm.frameCount;
+    ObjClass* superclass = AS_CLASS(pop());
+    if (!invokeFromClass(superclass, name, argCount)) return JIT_ERROR;
+    return runCallee(frameCount);
+}
+
+JitStatus jitReturn(void) {
+    CallFrame* frame = &vm.frames[vm.frameCount - 1];
+    Value result = pop();
+    closeUpvalues(frame->slots);
+    vm.frameCount--;
+    
+    while (vm.handlerCount > 0 &&
+           vm.handlers[vm.handlerCount - 1].frameCount > vm.frameCount) {
+        vm.handlerCount--;
+    }
+    
+    if (vm.frameCount == 0) {
+        vm.stackTop--;
+        return JIT_RETURNED;
+    }
+    vm.stackTop = frame->slots;
+    push(result);
+    return JIT_RETURNED;
+}
+
+void jitGetProperty(ObjString* name, InlineCache* cache) {
+    Value receiver = peek(0);
+    Value value = NULL_VAL;
+    
+    if (IS_INSTANCE(receiver)) {
+        ObjInstance* instance = AS_INSTANCE(receiver);
+        CacheEntry* entry = findCacheEntry(cache, instance);
+        CacheEntry found;
+        if (entry == NULL && lookupProperty(instance, name, &found)) {
+            entry = cacheEntry(cache, &found);
+        }
+        if (entry != NULL && entry->slot >= 0) {
+            value = instance->slots[entry->slot];
+        } else if (entry != NULL) {
+            value = OBJ_VAL(newBoundMethod(receiver, entry->method));
+        }
+    } else if (IS_MAP(receiver)) {
+        mapGet(AS_MAP(receiver), name, &value);
+    }
+    vm.stackTop[-1] = value;
+}
+
+void jitSetProperty(ObjString* name, InlineCache* cache) {
+    Value target = peek(1);
+    
+    if (IS_INSTANCE(target)) {
+        ObjInstance* instance = AS_INSTANCE(target);
+        CacheEntry* entry = findCacheEntry(cache, instance);
+        CacheEntry found = {instance->shape, -1, NULL, NULL, NULL};
+        if (entry == NULL) {
+            found.slot = shapeSlot(instance->shape, name);
+            if (found.slot < 0) {
+                found.transition = shapeTransition(instance->shape, name);
+                found.slot = found.transition->fieldCount - 1;
+            }
+            entry = cacheEntry(cache, &found);
+        }
+        if (entry->transition != NULL) {
+            instanceAddField(instance, entry->transition, peek(0));
+        } else {
+            instance->slots[entry->slot] = peek(0);
+            WRITE_BARRIER(instance, peek(0));
+        }
+    } else if (IS_MAP(target)) {
+        mapSet(AS_MAP(target), name, peek(0));
+    }
+    Value value = pop();
+    vm.stackTop[-1] = value;
+}
+
+JitStatus jitGetSuper(ObjString* name) {
+    ObjClass* superclass = AS_CLASS(pop());
+    return bindMethod(superclass, name) ? JIT_CONTINUE : JIT_ERROR;
+}
+
+JitStatus jitNew(void) {
+    if (!IS_CLASS(peek(0))) {
+        runtimeError("Can only instantiate classes.");
+        return JIT_ERROR;
+    }
+    ObjInstance* instance = newInstance(AS_CLASS(peek(0)));
+    vm.stackTop[-1] = OBJ_VAL(instance);
+    return JIT_CONTINUE;
+}
+
+void jitArray(int count) {
+    ObjArray* array = newArray();
+    push(OBJ_VAL(array));
+    Value* elements = vm.stackTop - 1 - count;
+    for (int i = 0; i < count; i++) {
+        writeValueArray(&array->elements, elements[i]);
+        WRITE_BARRIER(array, elements[i]);
+    }
+    vm.stackTop -= count + 1;
+    push(OBJ_VAL(array));
+}
+
+void jitMap(int count) {
+    ObjMap* map = newMap();
+    push(OBJ_VAL(map));
+    Value* entries = vm.stackTop - 1 - count * 2;
+    for (int i = 0; i < count; i++) {
+        mapSet(map, AS_STRING(entries[i * 2]), entries[i * 2 + 1]);
+    }
+    vm.stackTop -= count * 2 + 1;
+    push(OBJ_VAL(map));
+}
+
+void jitIndexGet(void) {
+    Value index = peek(0);
+    Value container = peek(1);
+    Value result = NULL_VAL;
+    
+    if (IS_ARRAY(container) && IS_NUMBER(index)) {
+        ObjArray* array = AS_ARRAY(container);
+        int64_t idx = IS_INT(index) ? AS_INT(index) : (int)valueToDouble(index);
+        if (idx >= 0 && idx < array->elements.count) {
+            result = array->elements.values[idx];
+        }
+    } else if (IS_MAP(container) && IS_STRING(index)) {
+        mapGet(AS_MAP(container), AS_STRING(index), &result);
+    } else if (IS_STRING(container) && IS_NUMBER(index)) {
+        ObjString* string = AS_STRING(container);
+        int idx = (int)valueToDouble(index);
+        bool inRange = idx >= 0 && idx < string->length;
+        result = OBJ_VAL(copyString(inRange ? string->chars + idx : "", inRange ? 1 : 0));
+    }
+    
+    vm.stackTop -= 2;
+    push(result);
+}
+
+void jitIndexSet(void) {
+    Value value = peek(0);
+    Value index = peek(1);
+    Value container = peek(2);
+    
+    if (IS_ARRAY(container) && IS_NUMBER(index)) {
+        ObjArray* array = AS_ARRAY(container);
+        int64_t idx = IS_INT(index) ? AS_INT(index) : (int)valueToDouble(index);
+        if (idx >= 0 && idx < array->elements.count) {
+            array->elements.values[idx] = value;
+            WRITE_BARRIER(array, value);
+        }
+    } else if (IS_MAP(container) && IS_STRING(index)) {
+        mapSet(AS_MAP(container), AS_STRING(index), value);
+    }
+    
+    vm.stackTop -= 3;
+    push(value);
+}
+
+void jitCloseUpvalue(void) {
+    closeUpvalues(vm.stackTop - 1);
+    vm.stackTop--;
+}
+
+/* Locals: iterable, next index, loop variable */
+bool jitForIter(Value* locals) {
+    Value iterable = locals[0];
+    int64_t index = AS_INT(locals[1]);
+    if (!IS_ARRAY(iterable) || index >= AS_ARRAY(iterable)->elements.count) return false;
+    locals[1] = INT_VAL(index + 1);
+    locals[2] = AS_ARRAY(iterable)->elements.values[index];
+    return true;
+}
+#endif
+
+static InterpretResult run(void) {
+    for (;;) {
+        InterpretResult result = dispatch();
+        if (result != INTERPRET_RUNTIME_ERROR || vm.handlerCount == 0) return result;
+        unwindToHandler();
+    }
+}
+
+static InterpretResult dispatch(void) {
+    // Hot state lives in locals. SAVE_STATE writes it back before anything
+    // that can allocate, call or report an error looks at the VM.
+    CallFrame* frame;
+    uint8_t* ip;
+    Value* sp;
+    Value* constants;
+    InlineCache* caches;
+    uint8_t instruction;
     
-#define READ_BYTE() (*frame->ip++)
+#define LOAD_STATE() \
+    (frame = &vm.frames[vm.frameCount - 1], ip = frame->ip, sp = vm.stackTop, \
+     constants = frame->closure->function->chunk.constants.values, \
+     caches = frame->closure->function->chunk.caches)
+#define SAVE_STATE() (frame->ip = ip, vm.stackTop = sp)
+#define PUSH(value) (*sp++ = (value))
+#define POP() (*--sp)
+#define PEEK(distance) (sp[-1 - (distance)])
+#define READ_BYTE() (*ip++)
 #define READ_SHORT() \
-    (frame->ip += 2, (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
-#define READ_CONSTANT() \
-    (frame->closure->function->chunk.constants.values[READ_BYTE()])
+    (ip += 2, (uint16_t)((ip[-2] << 8) | ip[-1]))
+#define READ_CONSTANT() (constants[READ_BYTE()])
 #define READ_STRING() AS_STRING(READ_CONSTANT())
-#define BINARY_OP(valueType, op) \
+#define RUNTIME_ERROR(...) \
+    do { \
+        SAVE_STATE(); \
+        runtimeError(__VA_ARGS__); \
+        return INTERPRET_RUNTIME_ERROR; \
+    } while (false)
+// The generic handlers rewrite their own opcode byte (just behind ip) into
+// a quickened form; a quickened handler whose guard fails rewrites it back
+// and re-executes the instruction as the generic one
+#define QUICKEN(opcode) (ip[-1] = (opcode), vm.quickened[opcode]++)
+#define DEOPTIMIZE(generic) (vm.deopts[ip[-1]]++, ip[-1] = (generic), ip--)
+#if BASELINE_JIT
+// A frame whose function is compiled goes back to native code wherever the
+// interpreter enters it: calls, returns into it and loop backedges
+#define RESUME_JIT() \
+    do { \
+        if (vm.jitEnabled && frame->closure->function->jit != NULL) goto enterJit; \
+    } while (false)
+#define COUNT_BACKEDGE() \
     do { \
-        if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
-            runtimeError("Operands must be numbers."); \
-            return INTERPRET_RUNTIME_ERROR; \
+        ObjFunction* function = frame->closure->function; \
+        if (vm.jitEnabled && function->jit == NULL && !function->jitFailed && \
+            ++function->backedges >= vm.jitLoopThreshold) { \
+            jitCompile(function); \
         } \
-        double b = valueToDouble(pop()); \
-        double a = valueToDouble(pop()); \
-        push(valueType(a op b)); \
+        RESUME_JIT(); \
     } while (false)
+#else
+#define RESUME_JIT() ((void)0)
+#define COUNT_BACKEDGE() ((void)0)
+#endif
+#define ARITHMETIC_OP(intOp, op, quickOp) \
+    do { \
+        Value b = PEEK(0); \
+        Value a = PEEK(1); \
+        int64_t result; \
+        if (IS_INT(a) && IS_INT(b) && intOp(AS_INT(a), AS_INT(b), &result)) { \
+            QUICKEN(quickOp); \
+            sp--; \
+            sp[-1] = INT_VAL(result); \
+        } else if (IS_NUMBER(a) && IS_NUMBER(b)) { \
+            sp--; \
+            sp[-1] = DOUBLE_VAL(valueToDouble(a) op valueToDouble(b)); \
+        } else { \
+            RUNTIME_ERROR("Operands must be numbers."); \
+        } \
+    } while (false)
+#define COMPARISON_OP(op, quickOp) \
+    do { \
+        Value b = PEEK(0); \
+        Value a = PEEK(1); \
+        if (IS_INT(a) && IS_INT(b)) { \
+            QUICKEN(quickOp); \
+            sp--; \
+            sp[-1] = BOOL_VAL(AS_INT(a) op AS_INT(b)); \
+        } else if (IS_NUMBER(a) && IS_NUMBER(b)) { \
+            sp--; \
+            sp[-1] = BOOL_VAL(valueToDouble(a) op valueToDouble(b)); \
+        } else { \
+            RUNTIME_ERROR("Operands must be numbers."); \
+        } \
+    } while (false)
+// Quickened handlers: each ends in its own DISPATCH, so not do/while
+#define INT_ARITHMETIC_OP(intOp, generic) \
+    { \
+        Value b = PEEK(0); \
+        Value a = PEEK(1); \
+        int64_t result; \
+        if (IS_INT(a) && IS_INT(b) && intOp(AS_INT(a), AS_INT(b), &result)) { \
+            sp--; \
+            sp[-1] = INT_VAL(result); \
+        } else { \
+            DEOPTIMIZE(generic); \
+        } \
+        DISPATCH(); \
+    }
+#define INT_COMPARISON_OP(op, generic) \
+    { \
+        Value b = PEEK(0); \
+        Value a = PEEK(1); \
+        if (IS_INT(a) && IS_INT(b)) { \
+            sp--; \
+            sp[-1] = BOOL_VAL(AS_INT(a) op AS_INT(b)); \
+        } else { \
+            DEOPTIMIZE(generic); \
+        } \
+        DISPATCH(); \
+    }
+// Superinstruction helpers. ADD_INTO stores a + b in `target`, taking
+// anything but two numbers through addObjects on the stack
+#define ADD_INTO(target, a, b) \
+    do { \
+        int64_t result; \
+        if (IS_INT(a) && IS_INT(b) && addInts(AS_INT(a), AS_INT(b), &result)) { \
+            target = INT_VAL(result); \
+        } else if (IS_NUMBER(a) && IS_NUMBER(b)) { \
+            target = DOUBLE_VAL(valueToDouble(a) + valueToDouble(b)); \
+        } else { \
+            PUSH(a); \
+            PUSH(b); \
+            SAVE_STATE(); \
+            addObjects(); \
+            sp = vm.stackTop; \
+            target = POP(); \
+        } \
+    } while (false)
+// Compare-and-branch: pops both operands and jumps unless `a op b` holds.
+// The target is already past the POP that would have dropped the flag
+#define COMPARE_JUMP_OP(op) \
+    { \
+        uint16_t offset = READ_SHORT(); \
+        Value b = PEEK(0); \
+        Value a = PEEK(1); \
+        bool holds; \
+        if (IS_INT(a) && IS_INT(b)) { \
+            holds = AS_INT(a) op AS_INT(b); \
+        } else if (IS_NUMBER(a) && IS_NUMBER(b)) { \
+            holds = valueToDouble(a) op valueToDouble(b); \
+        } else { \
+            RUNTIME_ERROR("Operands must be numbers."); \
+        } \
+        sp -= 2; \
+        if (!holds) ip += offset; \
+        DISPATCH(); \
+    }
+
+#if COMPUTED_GOTO
+    // Every handler ends in its own indirect jump to the next one
+    static void* dispatchTable[] = {
+        [OP_CONSTANT] = &&op_CONSTANT,
+        [OP_NULL] = &&op_NULL,
+        [OP_TRUE] = &&op_TRUE,
+        [OP_FALSE] = &&op_FALSE,
+        [OP_POP] = &&op_POP,
+        [OP_DUP] = &&op_DUP,
+        [OP_GET_LOCAL] = &&op_GET_LOCAL,
+        [OP_SET_LOCAL] = &&op_SET_LOCAL,
+        [OP_GET_GLOBAL_SLOT] = &&op_GET_GLOBAL_SLOT,
+        [OP_DEFINE_GLOBAL_SLOT] = &&op_DEFINE_GLOBAL_SLOT,
+        [OP_SET_GLOBAL_SLOT] = &&op_SET_GLOBAL_SLOT,
+        [OP_GET_UPVALUE] = &&op_GET_UPVALUE,
+        [OP_SET_UPVALUE] = &&op_SET_UPVALUE,
+        [OP_CLOSE_UPVALUE] = &&op_CLOSE_UPVALUE,
+        [OP_ADD] = &&op_ADD,
+        [OP_SUBTRACT] = &&op_SUBTRACT,
+        [OP_MULTIPLY] = &&op_MULTIPLY,
+        [OP_DIVIDE] = &&op_DIVIDE,
+        [OP_MODULO] = &&op_MODULO,
+        [OP_NEGATE] = &&op_NEGATE,
+        [OP_IN] = &&op_IN,
+        [OP_EQUAL] = &&op_EQUAL,
+        [OP_NOT_EQUAL] = &&op_NOT_EQUAL,
+        [OP_GREATER] = &&op_GREATER,
+        [OP_GREATER_EQUAL] = &&op_GREATER_EQUAL,
+        [OP_LESS] = &&op_LESS,
+        [OP_LESS_EQUAL] = &&op_LESS_EQUAL,
+        [OP_NOT] = &&op_NOT,
+        [OP_AND] = &&op_UNKNOWN,
+        [OP_OR] = &&op_UNKNOWN,
+        [OP_JUMP] = &&op_JUMP,
+        [OP_JUMP_IF_FALSE] = &&op_JUMP_IF_FALSE,
+        [OP_LOOP] = &&op_LOOP,
+        [OP_FOR_ITER] = &&op_FOR_ITER,
+        [OP_CALL] = &&op_CALL,
+        [OP_CLOSURE] = &&op_CLOSURE,
+        [OP_RETURN] = &&op_RETURN,
+        [OP_CLASS] = &&op_CLASS,
+        [OP_INHERIT] = &&op_INHERIT,
+        [OP_METHOD] = &&op_METHOD,
+        [OP_GET_PROPERTY] = &&op_GET_PROPERTY,
+        [OP_SET_PROPERTY] = &&op_SET_PROPERTY,
+        [OP_GET_SUPER] = &&op_GET_SUPER,
+        [OP_INVOKE] = &&op_INVOKE,
+        [OP_SUPER_INVOKE] = &&op_SUPER_INVOKE,
+        [OP_NEW] = &&op_NEW,
+        [OP_ARRAY] = &&op_ARRAY,
+        [OP_MAP] = &&op_MAP,
+        [OP_INDEX_GET] = &&op_INDEX_GET,
+        [OP_INDEX_SET] = &&op_INDEX_SET,
+        [OP_IMPORT] = &&op_IMPORT,
+        [OP_TRY] = &&op_TRY,
+        [OP_END_TRY] = &&op_END_TRY,
+        [OP_GET_LOCAL2] = &&op_GET_LOCAL2,
+        [OP_ADD_CONSTANT] = &&op_ADD_CONSTANT,
+        [OP_INCREMENT_LOCAL] = &&op_INCREMENT_LOCAL,
+        [OP_JUMP_IF_NOT_LESS] = &&op_JUMP_IF_NOT_LESS,
+        [OP_JUMP_IF_NOT_LESS_EQUAL] = &&op_JUMP_IF_NOT_LESS_EQUAL,
+        [OP_JUMP_IF_NOT_GREATER] = &&op_JUMP_IF_NOT_GREATER,
+        [OP_JUMP_IF_NOT_GREATER_EQUAL] = &&op_JUMP_IF_NOT_GREATER_EQUAL,
+        [OP_ADD_INT] = &&op_ADD_INT,
+        [OP_ADD_STR] = &&op_ADD_STR,
+        [OP_SUBTRACT_INT] = &&op_SUBTRACT_INT,
+        [OP_MULTIPLY_INT] = &&op_MULTIPLY_INT,
+        [OP_GREATER_INT] = &&op_GREATER_INT,
+        [OP_GREATER_EQUAL_INT] = &&op_GREATER_EQUAL_INT,
+        [OP_LESS_INT] = &&op_LESS_INT,
+        [OP_LESS_EQUAL_INT] = &&op_LESS_EQUAL_INT,
+        [OP_INDEX_GET_ARRAY_INT] = &&op_INDEX_GET_ARRAY_INT,
+        [OP_INDEX_SET_ARRAY_INT] = &&op_INDEX_SET_ARRAY_INT,
+    };
+#define CASE(name) op_##name
+#define DISPATCH() goto *dispatchTable[instruction = READ_BYTE()]
+#else
+#define CASE(name) case OP_##name
+#define DISPATCH() break
+#endif
 
+    LOAD_STATE();
+    RESUME_JIT();
+#if COMPUTED_GOTO
+    DISPATCH();
+#else
     for (;;) {
 #if DEBUG_TRACE_EXECUTION
         printf("          ");
-        for (Value* slot = vm.stack; slot < vm.stackTop; slot++) {
+        for (Value* slot = vm.stack; slot < sp; slot++) {
             printf("[ ");
             printValue(*slot);
             printf(" ]");
@@ -410,162 +1262,210 @@ static InterpretResult run(void) {
         printf("\n");
 #endif
         
-        uint8_t instruction = READ_BYTE();
+        instruction = READ_BYTE();
         switch (instruction) {
-            case OP_CONSTANT: {
+#endif
+            CASE(CONSTANT): {
                 Value constant = READ_CONSTANT();
-                push(constant);
-                break;
+                PUSH(constant);
+                DISPATCH();
+            }
+            CASE(NULL): PUSH(NULL_VAL); DISPATCH();
+            CASE(TRUE): PUSH(BOOL_VAL(true)); DISPATCH();
+            CASE(FALSE): PUSH(BOOL_VAL(false)); DISPATCH();
+            CASE(POP): sp--; DISPATCH();
+            CASE(DUP): {
+                Value top = PEEK(0);
+                PUSH(top);
+                DISPATCH();
             }
-            case OP_NULL: push(NULL_VAL); break;
-            case OP_TRUE: push(BOOL_VAL(true)); break;
-            case OP_FALSE: push(BOOL_VAL(false)); break;
-            case OP_POP: pop(); break;
-            case OP_DUP: push(peek(0)); break;
             
-            case OP_GET_LOCAL: {
+            CASE(GET_LOCAL): {
                 uint8_t slot = READ_BYTE();
-                push(frame->slots[slot]);
-                break;
+                PUSH(frame->slots[slot]);
+                DISPATCH();
             }
-            case OP_SET_LOCAL: {
+            CASE(SET_LOCAL): {
                 uint8_t slot = READ_BYTE();
-                frame->slots[slot] = peek(0);
-                break;
+                frame->slots[slot] = PEEK(0);
+                DISPATCH();
             }
-            case OP_GET_GLOBAL: {
-                ObjString* name = READ_STRING();
-                Value value;
-                if (!tableGet(&vm.globals, name, &value)) {
-                    runtimeError("Undefined variable '%s'.", name->chars);
-                    return INTERPRET_RUNTIME_ERROR;
+            CASE(GET_GLOBAL_SLOT): {
+                uint16_t slot = READ_SHORT();
+                Value value = vm.globalValues.values[slot];
+                if (IS_UNDEFINED(value)) {
+                    RUNTIME_ERROR("Undefined variable '%s'.", globalName(slot)->chars);
                 }
-                push(value);
-                break;
+                PUSH(value);
+                DISPATCH();
             }
-            case OP_DEFINE_GLOBAL: {
-                ObjString* name = READ_STRING();
-                tableSet(&vm.globals, name, peek(0));
-                pop();
-                break;
+            CASE(DEFINE_GLOBAL_SLOT): {
+                uint16_t slot = READ_SHORT();
+                vm.globalValues.values[slot] = POP();
+                DISPATCH();
             }
-            case OP_SET_GLOBAL: {
-                ObjString* name = READ_STRING();
-                if (tableSet(&vm.globals, name, peek(0))) {
-                    tableDelete(&vm.globals, name);
-                    runtimeError("Undefined variable '%s'.", name->chars);
-                    return INTERPRET_RUNTIME_ERROR;
+            CASE(SET_GLOBAL_SLOT): {
+                uint16_t slot = READ_SHORT();
+                if (IS_UNDEFINED(vm.globalValues.values[slot])) {
+                    RUNTIME_ERROR("Undefined variable '%s'.", globalName(slot)->chars);
                 }
-                break;
+                vm.globalValues.values[slot] = PEEK(0);
+                DISPATCH();
             }
-            case OP_GET_UPVALUE: {
+            CASE(GET_UPVALUE): {
                 uint8_t slot = READ_BYTE();
-                push(*frame->closure->upvalues[slot]->location);
-                break;
+                PUSH(*frame->closure->upvalues[slot]->location);
+                DISPATCH();
             }
-            case OP_SET_UPVALUE: {
+            CASE(SET_UPVALUE): {
                 uint8_t slot = READ_BYTE();
-                *frame->closure->upvalues[slot]->location = peek(0);
-                break;
+                ObjUpvalue* upvalue = frame->closure->upvalues[slot];
+                *upvalue->location = PEEK(0);
+                WRITE_BARRIER(upvalue, PEEK(0));
+                DISPATCH();
             }
-            case OP_CLOSE_UPVALUE:
-                closeUpvalues(vm.stackTop - 1);
-                pop();
-                break;
+            CASE(CLOSE_UPVALUE):
+                closeUpvalues(sp - 1);
+                sp--;
+                DISPATCH();
                 
-            case OP_ADD: {
-                if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
-                    ObjString* b = AS_STRING(pop());
-                    ObjString* a = AS_STRING(pop());
-                    int length = a->length + b->length;
-                    char* chars = ALLOCATE(char, length + 1);
-                    memcpy(chars, a->chars, a->length);
-                    memcpy(chars + a->length, b->chars, b->length);
-                    chars[length] = '\0';
-                    ObjString* result = takeString(chars, length);
-                    push(OBJ_VAL(result));
-                } else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
-                    double b = valueToDouble(pop());
-                    double a = valueToDouble(pop());
-                    push(DOUBLE_VAL(a + b));
+            CASE(ADD): {
+                if (IS_NUMBER(PEEK(0)) && IS_NUMBER(PEEK(1))) {
+                    ARITHMETIC_OP(addInts, +, OP_ADD_INT);
                 } else {
-                    runtimeError("Operands must be two numbers or two strings.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    if (IS_STRING(PEEK(0)) && IS_STRING(PEEK(1))) QUICKEN(OP_ADD_STR);
+                    SAVE_STATE();
+                    addObjects();
+                    sp = vm.stackTop;
                 }
-                break;
+                DISPATCH();
             }
-            case OP_SUBTRACT: BINARY_OP(DOUBLE_VAL, -); break;
-            case OP_MULTIPLY: BINARY_OP(DOUBLE_VAL, *); break;
-            case OP_DIVIDE: BINARY_OP(DOUBLE_VAL, /); break;
-            case OP_MODULO: {
-                if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {
-                    runtimeError("Operands must be numbers.");
-                    return INTERPRET_RUNTIME_ERROR;
+            CASE(SUBTRACT): ARITHMETIC_OP(subtractInts, -, OP_SUBTRACT_INT); DISPATCH();
+            CASE(MULTIPLY): ARITHMETIC_OP(multiplyInts, *, OP_MULTIPLY_INT); DISPATCH();
+            CASE(DIVIDE): {
+                Value b = POP();
+                Value a = POP();
+                if (!IS_NUMBER(a) || !IS_NUMBER(b)) {
+                    sp += 2;
+                    RUNTIME_ERROR("Operands must be numbers.");
                 }
-                double b = valueToDouble(pop());
-                double a = valueToDouble(pop());
-                push(DOUBLE_VAL(fmod(a, b)));
-                break;
+                int64_t result;
+                if (valueToDouble(b) == 0) {
+                    // Reported but not fatal, as in the tree-walker
+                    fprintf(stderr, "[ERROR] Division by zero\n");
+                    PUSH(INT_VAL(0));
+                } else if (IS_INT(a) && IS_INT(b) && divideInts(AS_INT(a), AS_INT(b), &result)) {
+                    PUSH(INT_VAL(result));
+                } else {
+                    PUSH(DOUBLE_VAL(valueToDouble(a) / valueToDouble(b)));
+                }
+                DISPATCH();
             }
-            case OP_NEGATE:
-                if (!IS_NUMBER(peek(0))) {
-                    runtimeError("Operand must be a number.");
-                    return INTERPRET_RUNTIME_ERROR;
+            CASE(MODULO): {
+                Value b = POP();
+                Value a = POP();
+                if (!IS_NUMBER(a) || !IS_NUMBER(b)) {
+                    sp += 2;
+                    RUNTIME_ERROR("Operands must be numbers.");
                 }
-                push(DOUBLE_VAL(-valueToDouble(pop())));
-                break;
+                int64_t result;
+                if (IS_INT(a) && IS_INT(b) && moduloInts(AS_INT(a), AS_INT(b), &result)) {
+                    PUSH(INT_VAL(result));
+                } else {
+                    PUSH(DOUBLE_VAL(fmod(valueToDouble(a), valueToDouble(b))));
+                }
+                DISPATCH();
+            }
+            CASE(NEGATE): {
+                Value a = PEEK(0);
+                if (IS_INT(a) && AS_INT(a) != INT64_MIN) {
+                    sp[-1] = INT_VAL(-AS_INT(a));
+                } else if (IS_NUMBER(a)) {
+                    sp[-1] = DOUBLE_VAL(-valueToDouble(a));
+                } else {
+                    RUNTIME_ERROR("Operand must be a number.");
+                }
+                DISPATCH();
+            }
+            CASE(IN): {
+                Value container = POP();
+                Value item = POP();
+                PUSH(contains(container, item));
+                DISPATCH();
+            }
                 
-            case OP_EQUAL: {
-                Value b = pop();
-                Value a = pop();
-                push(BOOL_VAL(valuesEqual(a, b)));
-                break;
+            CASE(EQUAL): {
+                Value b = POP();
+                Value a = POP();
+                PUSH(BOOL_VAL(valuesEqual(a, b)));
+                DISPATCH();
             }
-            case OP_NOT_EQUAL: {
-                Value b = pop();
-                Value a = pop();
-                push(BOOL_VAL(!valuesEqual(a, b)));
-                break;
+            CASE(NOT_EQUAL): {
+                Value b = POP();
+                Value a = POP();
+                PUSH(BOOL_VAL(!valuesEqual(a, b)));
+                DISPATCH();
             }
-            case OP_GREATER: BINARY_OP(BOOL_VAL, >); break;
-            case OP_GREATER_EQUAL: BINARY_OP(BOOL_VAL, >=); break;
-            case OP_LESS: BINARY_OP(BOOL_VAL, <); break;
-            case OP_LESS_EQUAL: BINARY_OP(BOOL_VAL, <=); break;
+            CASE(GREATER): COMPARISON_OP(>, OP_GREATER_INT); DISPATCH();
+            CASE(GREATER_EQUAL): COMPARISON_OP(>=, OP_GREATER_EQUAL_INT); DISPATCH();
+            CASE(LESS): COMPARISON_OP(<, OP_LESS_INT); DISPATCH();
+            CASE(LESS_EQUAL): COMPARISON_OP(<=, OP_LESS_EQUAL_INT); DISPATCH();
             
-            case OP_NOT:
-                push(BOOL_VAL(!AS_BOOL(valueTruthy(pop()))));
-                break;
+            CASE(NOT): {
+                Value a = POP();
+                PUSH(BOOL_VAL(!AS_BOOL(valueTruthy(a))));
+                DISPATCH();
+            }
                 
-            case OP_JUMP: {
+            CASE(JUMP): {
                 uint16_t offset = READ_SHORT();
-                frame->ip += offset;
-                break;
+                ip += offset;
+                DISPATCH();
             }
-            case OP_JUMP_IF_FALSE: {
+            CASE(JUMP_IF_FALSE): {
                 uint16_t offset = READ_SHORT();
-                if (!AS_BOOL(valueTruthy(peek(0)))) {
-                    frame->ip += offset;
+                if (!AS_BOOL(valueTruthy(PEEK(0)))) {
+                    ip += offset;
                 }
-                break;
+                DISPATCH();
             }
-            case OP_LOOP: {
+            CASE(LOOP): {
                 uint16_t offset = READ_SHORT();
-                frame->ip -= offset;
-                break;
+                ip -= offset;
+                COUNT_BACKEDGE();
+                DISPATCH();
+            }
+            CASE(FOR_ITER): {
+                // Locals: iterable at `slot`, then the next index, then x
+                uint8_t slot = READ_BYTE();
+                uint16_t offset = READ_SHORT();
+                Value iterable = frame->slots[slot];
+                int64_t index = AS_INT(frame->slots[slot + 1]);
+                if (IS_ARRAY(iterable) && index < AS_ARRAY(iterable)->elements.count) {
+                    frame->slots[slot + 1] = INT_VAL(index + 1);
+                    frame->slots[slot + 2] = AS_ARRAY(iterable)->elements.values[index];
+                } else {
+                    ip += offset;
+                }
+                DISPATCH();
             }
             
-            case OP_CALL: {
+            CASE(CALL): {
                 int argCount = READ_BYTE();
-                if (!callValue(peek(argCount), argCount)) {
+                SAVE_STATE();
+                if (!callValue(PEEK(argCount), argCount)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                frame = &vm.frames[vm.frameCount - 1];
-                break;
+                LOAD_STATE();
+                RESUME_JIT();
+                DISPATCH();
             }
-            case OP_CLOSURE: {
+            CASE(CLOSURE): {
                 ObjFunction* function = AS_FUNCTION(READ_CONSTANT());
+                SAVE_STATE();
                 ObjClosure* closure = newClosure(function);
-                push(OBJ_VAL(closure));
+                PUSH(OBJ_VAL(closure));
+                vm.stackTop = sp;
                 for (int i = 0; i < closure->upvalueCount; i++) {
                     uint8_t isLocal = READ_BYTE();
                     uint8_t index = READ_BYTE();
@@ -574,177 +1474,407 @@ static InterpretResult run(void) {
                     } else {
                         closure->upvalues[i] = frame->closure->upvalues[index];
                     }
+                    WRITE_BARRIER_OBJ(closure, closure->upvalues[i]);
                 }
-                break;
+                DISPATCH();
             }
-            case OP_RETURN: {
-                Value result = pop();
+            CASE(RETURN): {
+                Value result = POP();
                 closeUpvalues(frame->slots);
                 vm.frameCount--;
+                
+                // try blocks left open by the returning frame are gone
+                while (vm.handlerCount > 0 &&
+                       vm.handlers[vm.handlerCount - 1].frameCount > vm.frameCount) {
+                    vm.handlerCount--;
+                }
+                
                 if (vm.frameCount == 0) {
-                    pop();
+                    vm.stackTop = sp - 1;
                     return INTERPRET_OK;
                 }
-                vm.stackTop = frame->slots;
-                push(result);
-                frame = &vm.frames[vm.frameCount - 1];
-                break;
+                sp = frame->slots;
+                PUSH(result);
+                vm.stackTop = sp;
+                LOAD_STATE();
+                RESUME_JIT();
+                DISPATCH();
             }
             
-            case OP_CLASS:
-                push(OBJ_VAL(newClass(READ_STRING())));
-                break;
-            case OP_INHERIT: {
-                Value superclass = peek(1);
+            CASE(CLASS): {
+                ObjString* name = READ_STRING();
+                SAVE_STATE();
+                ObjClass* klass = newClass(name);
+                PUSH(OBJ_VAL(klass));
+                DISPATCH();
+            }
+            CASE(INHERIT): {
+                Value superclass = PEEK(1);
                 if (!IS_CLASS(superclass)) {
-                    runtimeError("Superclass must be a class.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    RUNTIME_ERROR("Superclass must be a class.");
                 }
-                ObjClass* subclass = AS_CLASS(peek(0));
+                ObjClass* subclass = AS_CLASS(PEEK(0));
+                SAVE_STATE();
                 tableAddAll(&AS_CLASS(superclass)->methods, &subclass->methods);
                 subclass->superclass = AS_CLASS(superclass);
-                pop();
-                break;
+                // The copied methods are reachable from the superclass too
+                WRITE_BARRIER_OBJ(subclass, subclass->superclass);
+                sp--;
+                DISPATCH();
             }
-            case OP_METHOD:
-                defineMethod(READ_STRING());
-                break;
-            case OP_GET_PROPERTY: {
-                if (!IS_INSTANCE(peek(0))) {
-                    runtimeError("Only instances have properties.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                ObjInstance* instance = AS_INSTANCE(peek(0));
+            CASE(METHOD): {
                 ObjString* name = READ_STRING();
-                
+                SAVE_STATE();
+                defineMethod(name);
+                sp = vm.stackTop;
+                DISPATCH();
+            }
+            CASE(GET_PROPERTY): {
+                ObjString* name = READ_STRING();
+                InlineCache* cache = &caches[READ_SHORT()];
                 Value value;
-                if (tableGet(&instance->fields, name, &value)) {
-                    pop();
-                    push(value);
-                    break;
-                }
                 
-                if (!bindMethod(instance->klass, name)) {
-                    return INTERPRET_RUNTIME_ERROR;
+                if (IS_INSTANCE(PEEK(0))) {
+                    ObjInstance* instance = AS_INSTANCE(PEEK(0));
+                    CacheEntry* entry = findCacheEntry(cache, instance);
+                    CacheEntry found;
+                    if (entry == NULL && lookupProperty(instance, name, &found)) {
+                        entry = cacheEntry(cache, &found);
+                    }
+                    if (entry != NULL && entry->slot >= 0) {
+                        sp[-1] = instance->slots[entry->slot];
+                        DISPATCH();
+                    }
+                    if (entry != NULL) {
+                        SAVE_STATE();
+                        ObjBoundMethod* bound = newBoundMethod(PEEK(0), entry->method);
+                        sp[-1] = OBJ_VAL(bound);
+                        DISPATCH();
+                    }
+                } else if (IS_MAP(PEEK(0))) {
+                    if (mapGet(AS_MAP(PEEK(0)), name, &value)) {
+                        sp[-1] = value;
+                        DISPATCH();
+                    }
                 }
-                break;
+                
+                // Missing properties read as null
+                sp[-1] = NULL_VAL;
+                DISPATCH();
             }
-            case OP_SET_PROPERTY: {
-                if (!IS_INSTANCE(peek(1))) {
-                    runtimeError("Only instances have fields.");
-                    return INTERPRET_RUNTIME_ERROR;
+            CASE(SET_PROPERTY): {
+                ObjString* name = READ_STRING();
+                InlineCache* cache = &caches[READ_SHORT()];
+                
+                if (IS_INSTANCE(PEEK(1))) {
+                    ObjInstance* instance = AS_INSTANCE(PEEK(1));
+                    CacheEntry* entry = findCacheEntry(cache, instance);
+                    CacheEntry found = {instance->shape, -1, NULL, NULL, NULL};
+                    if (entry == NULL) {
+                        // A new field is cached as the shape transition it makes
+                        found.slot = shapeSlot(instance->shape, name);
+                        if (found.slot < 0) {
+                            SAVE_STATE();
+                            found.transition = shapeTransition(instance->shape, name);
+                            found.slot = found.transition->fieldCount - 1;
+                        }
+                        entry = cacheEntry(cache, &found);
+                    }
+                    if (entry->transition != NULL) {
+                        SAVE_STATE();
+                        instanceAddField(instance, entry->transition, PEEK(0));
+                    } else {
+                        instance->slots[entry->slot] = PEEK(0);
+                        WRITE_BARRIER(instance, PEEK(0));
+                    }
+                } else if (IS_MAP(PEEK(1))) {
+                    SAVE_STATE();
+                    mapSet(AS_MAP(PEEK(1)), name, PEEK(0));
                 }
-                ObjInstance* instance = AS_INSTANCE(peek(1));
-                tableSet(&instance->fields, READ_STRING(), peek(0));
-                Value value = pop();
-                pop();
-                push(value);
-                break;
+                Value value = POP();
+                sp[-1] = value;
+                DISPATCH();
             }
-            case OP_INVOKE: {
+            CASE(INVOKE): {
                 ObjString* method = READ_STRING();
                 int argCount = READ_BYTE();
-                if (!invoke(method, argCount)) {
+                InlineCache* cache = &caches[READ_SHORT()];
+                SAVE_STATE();
+                if (!invokeCached(method, argCount, cache)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                frame = &vm.frames[vm.frameCount - 1];
-                break;
+                LOAD_STATE();
+                RESUME_JIT();
+                DISPATCH();
             }
-            case OP_GET_SUPER: {
+            CASE(GET_SUPER): {
                 ObjString* name = READ_STRING();
-                ObjClass* superclass = AS_CLASS(pop());
+                ObjClass* superclass = AS_CLASS(POP());
+                SAVE_STATE();
                 if (!bindMethod(superclass, name)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                break;
+                sp = vm.stackTop;
+                DISPATCH();
             }
-            case OP_SUPER_INVOKE: {
+            CASE(SUPER_INVOKE): {
                 ObjString* method = READ_STRING();
                 int argCount = READ_BYTE();
-                ObjClass* superclass = AS_CLASS(pop());
+                ObjClass* superclass = AS_CLASS(POP());
+                SAVE_STATE();
                 if (!invokeFromClass(superclass, method, argCount)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                frame = &vm.frames[vm.frameCount - 1];
-                break;
-            }
-            
-            case OP_PRINT: {
-                printValue(pop());
-                break;
+                LOAD_STATE();
+                RESUME_JIT();
+                DISPATCH();
             }
-            case OP_PRINTLN: {
-                printValue(pop());
-                printf("\n");
-                break;
+            CASE(NEW): {
+                if (!IS_CLASS(PEEK(0))) {
+                    RUNTIME_ERROR("Can only instantiate classes.");
+                }
+                SAVE_STATE();
+                ObjInstance* instance = newInstance(AS_CLASS(PEEK(0)));
+                sp[-1] = OBJ_VAL(instance);
+                DISPATCH();
             }
             
-            case OP_ARRAY: {
+            CASE(ARRAY): {
                 int count = READ_BYTE();
+                SAVE_STATE();
                 ObjArray* array = newArray();
-                for (int i = count - 1; i >= 0; i--) {
-                    writeValueArray(&array->elements, peek(i));
+                PUSH(OBJ_VAL(array));
+                vm.stackTop = sp;
+                Value* elements = sp - 1 - count;
+                for (int i = 0; i < count; i++) {
+                    writeValueArray(&array->elements, elements[i]);
+                    WRITE_BARRIER(array, elements[i]);
                 }
-                for (int i = 0; i < count; i++) pop();
-                push(OBJ_VAL(array));
-                break;
+                sp -= count + 1;
+                PUSH(OBJ_VAL(array));
+                DISPATCH();
+            }
+            CASE(MAP): {
+                // Stack: key1, value1, ... keyN, valueN
+                int count = READ_BYTE();
+                SAVE_STATE();
+                ObjMap* map = newMap();
+                PUSH(OBJ_VAL(map));
+                vm.stackTop = sp;
+                Value* entries = sp - 1 - count * 2;
+                for (int i = 0; i < count; i++) {
+                    mapSet(map, AS_STRING(entries[i * 2]), entries[i * 2 + 1]);
+                }
+                sp -= count * 2 + 1;
+                PUSH(OBJ_VAL(map));
+                DISPATCH();
             }
-            case OP_INDEX_GET: {
-                Value index = pop();
-                Value container = pop();
+            CASE(INDEX_GET): {
+                // Out-of-range and mismatched lookups read as null (or "" for strings)
+                Value index = PEEK(0);
+                Value container = PEEK(1);
+                Value result = NULL_VAL;
                 
-                if (IS_ARRAY(container)) {
-                    if (!IS_INT(index)) {
-                        runtimeError("Array index must be an integer.");
-                        return INTERPRET_RUNTIME_ERROR;
-                    }
+                if (IS_ARRAY(container) && IS_NUMBER(index)) {
+                    if (IS_INT(index)) QUICKEN(OP_INDEX_GET_ARRAY_INT);
                     ObjArray* array = AS_ARRAY(container);
-                    int idx = (int)AS_INT(index);
-                    if (idx < 0 || idx >= array->elements.count) {
-                        runtimeError("Array index out of bounds.");
-                        return INTERPRET_RUNTIME_ERROR;
+                    int64_t idx = IS_INT(index) ? AS_INT(index) : (int)valueToDouble(index);
+                    if (idx >= 0 && idx < array->elements.count) {
+                        result = array->elements.values[idx];
                     }
-                    push(array->elements.values[idx]);
-                } else {
-                    runtimeError("Only arrays can be indexed.");
-                    return INTERPRET_RUNTIME_ERROR;
+                } else if (IS_MAP(container) && IS_STRING(index)) {
+                    mapGet(AS_MAP(container), AS_STRING(index), &result);
+                } else if (IS_STRING(container) && IS_NUMBER(index)) {
+                    ObjString* string = AS_STRING(container);
+                    int idx = (int)valueToDouble(index);
+                    bool inRange = idx >= 0 && idx < string->length;
+                    SAVE_STATE();
+                    result = OBJ_VAL(copyString(inRange ? string->chars + idx : "", inRange ? 1 : 0));
                 }
-                break;
+                
+                sp -= 2;
+                PUSH(result);
+                DISPATCH();
             }
-            case OP_INDEX_SET: {
-                Value value = pop();
-                Value index = pop();
-                Value container = pop();
+            CASE(INDEX_SET): {
+                Value value = PEEK(0);
+                Value index = PEEK(1);
+                Value container = PEEK(2);
                 
-                if (IS_ARRAY(container)) {
-                    if (!IS_INT(index)) {
-                        runtimeError("Array index must be an integer.");
-                        return INTERPRET_RUNTIME_ERROR;
-                    }
+                if (IS_ARRAY(container) && IS_NUMBER(index)) {
+                    if (IS_INT(index)) QUICKEN(OP_INDEX_SET_ARRAY_INT);
                     ObjArray* array = AS_ARRAY(container);
-                    int idx = (int)AS_INT(index);
-                    if (idx < 0 || idx >= array->elements.count) {
-                        runtimeError("Array index out of bounds.");
-                        return INTERPRET_RUNTIME_ERROR;
+                    int64_t idx = IS_INT(index) ? AS_INT(index) : (int)valueToDouble(index);
+                    if (idx >= 0 && idx < array->elements.count) {
+                        array->elements.values[idx] = value;
+                        WRITE_BARRIER(array, value);
                     }
-                    array->elements.values[idx] = value;
-                    push(value);
-                } else {
-                    runtimeError("Only arrays can be indexed.");
+                } else if (IS_MAP(container) && IS_STRING(index)) {
+                    SAVE_STATE();
+                    mapSet(AS_MAP(container), AS_STRING(index), value);
+                }
+                
+                sp -= 3;
+                PUSH(value);
+                DISPATCH();
+            }
+            
+            CASE(IMPORT): {
+                // Pushes the module's result, null when it already ran
+                ObjFunction* module = AS_FUNCTION(READ_CONSTANT());
+                Value loaded;
+                if (tableGet(&vm.modules, module->name, &loaded)) {
+                    PUSH(NULL_VAL);
+                    DISPATCH();
+                }
+                SAVE_STATE();
+                tableSet(&vm.modules, module->name, BOOL_VAL(true));
+                
+                ObjClosure* closure = newClosure(module);
+                PUSH(OBJ_VAL(closure));
+                vm.stackTop = sp;
+                if (!call(closure, 0)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                break;
+                LOAD_STATE();
+                DISPATCH();
             }
             
+            CASE(TRY): {
+                uint16_t offset = READ_SHORT();
+                if (vm.handlerCount == HANDLERS_MAX) {
+                    RUNTIME_ERROR("Too many nested try blocks.");
+                }
+                TryHandler* handler = &vm.handlers[vm.handlerCount++];
+                handler->frameCount = vm.frameCount;
+                handler->stackTop = sp;
+                handler->catchIp = ip + offset;
+                DISPATCH();
+            }
+            CASE(END_TRY):
+                vm.handlerCount--;
+                DISPATCH();
+            
+            CASE(GET_LOCAL2): {
+                uint8_t first = READ_BYTE();
+                uint8_t second = READ_BYTE();
+                PUSH(frame->slots[first]);
+                PUSH(frame->slots[second]);
+                DISPATCH();
+            }
+            CASE(ADD_CONSTANT): {
+                Value b = READ_CONSTANT();
+                Value a = POP();
+                Value sum;
+                ADD_INTO(sum, a, b);
+                PUSH(sum);
+                DISPATCH();
+            }
+            CASE(INCREMENT_LOCAL): {
+                uint8_t slot = READ_BYTE();
+                Value b = READ_CONSTANT();
+                Value a = frame->slots[slot];
+                ADD_INTO(frame->slots[slot], a, b);
+                DISPATCH();
+            }
+            CASE(JUMP_IF_NOT_LESS): COMPARE_JUMP_OP(<);
+            CASE(JUMP_IF_NOT_LESS_EQUAL): COMPARE_JUMP_OP(<=);
+            CASE(JUMP_IF_NOT_GREATER): COMPARE_JUMP_OP(>);
+            CASE(JUMP_IF_NOT_GREATER_EQUAL): COMPARE_JUMP_OP(>=);
+            
+            CASE(ADD_INT): INT_ARITHMETIC_OP(addInts, OP_ADD);
+            CASE(ADD_STR): {
+                if (IS_STRING(PEEK(0)) && IS_STRING(PEEK(1))) {
+                    SAVE_STATE();
+                    concatenate();
+                    sp = vm.stackTop;
+                } else {
+                    DEOPTIMIZE(OP_ADD);
+                }
+                DISPATCH();
+            }
+            CASE(SUBTRACT_INT): INT_ARITHMETIC_OP(subtractInts, OP_SUBTRACT);
+            CASE(MULTIPLY_INT): INT_ARITHMETIC_OP(multiplyInts, OP_MULTIPLY);
+            CASE(GREATER_INT): INT_COMPARISON_OP(>, OP_GREATER);
+            CASE(GREATER_EQUAL_INT): INT_COMPARISON_OP(>=, OP_GREATER_EQUAL);
+            CASE(LESS_INT): INT_COMPARISON_OP(<, OP_LESS);
+            CASE(LESS_EQUAL_INT): INT_COMPARISON_OP(<=, OP_LESS_EQUAL);
+            CASE(INDEX_GET_ARRAY_INT): {
+                Value index = PEEK(0);
+                Value container = PEEK(1);
+                if (IS_ARRAY(container) && IS_INT(index)) {
+                    ValueArray* elements = &AS_ARRAY(container)->elements;
+                    int64_t idx = AS_INT(index);
+                    sp--;
+                    sp[-1] = idx >= 0 && idx < elements->count ? elements->values[idx] : NULL_VAL;
+                } else {
+                    DEOPTIMIZE(OP_INDEX_GET);
+                }
+                DISPATCH();
+            }
+            CASE(INDEX_SET_ARRAY_INT): {
+                Value value = PEEK(0);
+                Value index = PEEK(1);
+                Value container = PEEK(2);
+                if (IS_ARRAY(container) && IS_INT(index)) {
+                    ValueArray* elements = &AS_ARRAY(container)->elements;
+                    int64_t idx = AS_INT(index);
+                    if (idx >= 0 && idx < elements->count) {
+                        elements->values[idx] = value;
+                        WRITE_BARRIER(AS_OBJ(container), value);
+                    }
+                    sp -= 2;
+                    sp[-1] = value;
+                } else {
+                    DEOPTIMIZE(OP_INDEX_SET);
+                }
+                DISPATCH();
+            }
+            
+#if BASELINE_JIT
+            enterJit: {
+                // Native code runs until the frame returns or hands it back
+                SAVE_STATE();
+                JitStatus status = jitEnter(frame);
+                if (status == JIT_ERROR) return INTERPRET_RUNTIME_ERROR;
+                if (vm.frameCount == 0) return INTERPRET_OK;
+                LOAD_STATE();
+                if (status == JIT_RETURNED) RESUME_JIT();
+                DISPATCH();
+            }
+            
+#endif
+#if COMPUTED_GOTO
+            op_UNKNOWN:
+#else
             default:
-                runtimeError("Unknown opcode: %d", instruction);
-                return INTERPRET_RUNTIME_ERROR;
+#endif
+                RUNTIME_ERROR("Unknown opcode: %d", instruction);
+#if !COMPUTED_GOTO
         }
     }
+#endif
 
+#undef LOAD_STATE
+#undef SAVE_STATE
+#undef PUSH
+#undef POP
+#undef PEEK
 #undef READ_BYTE
 #undef READ_SHORT
 #undef READ_CONSTANT
 #undef READ_STRING
-#undef BINARY_OP
+#undef RUNTIME_ERROR
+#undef QUICKEN
+#undef DEOPTIMIZE
+#undef RESUME_JIT
+#undef COUNT_BACKEDGE
+#undef ARITHMETIC_OP
+#undef COMPARISON_OP
+#undef INT_ARITHMETIC_OP
+#undef INT_COMPARISON_OP
+#undef ADD_INTO
+#undef COMPARE_JUMP_OP
+#undef CASE
+#undef DISPATCH
 }
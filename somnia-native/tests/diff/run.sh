@@ -0,0 +1,31 @@
+#!/bin/sh
+# Runs every program here on both engines, and on the VM with every
+# function compiled by the JIT, and diffs their stdout.
+# Usage: tests/diff/run.sh [path/to/somnia]
+
+SOMNIA=${1:-./somnia}
+case "$SOMNIA" in /*) ;; *) SOMNIA="$(pwd)/$SOMNIA" ;; esac
+
+cd "$(dirname "$0")" || exit 1
+
+failed=0
+for program in *.somnia; do
+    "$SOMNIA" run "$program" > /tmp/somnia_diff_tree.out 2>/dev/null
+    "$SOMNIA" run --engine=vm "$program" > /tmp/somnia_diff_vm.out 2>/tmp/somnia_diff_vm.err
+    "$SOMNIA" run --jit --jit-threshold=1 "$program" > /tmp/somnia_diff_jit.out 2>/dev/null
+
+    if grep -q "Falling back" /tmp/somnia_diff_vm.err; then
+        echo "FALLBACK $program"
+        failed=1
+    elif diff -u /tmp/somnia_diff_tree.out /tmp/somnia_diff_vm.out &&
+         diff -u /tmp/somnia_diff_tree.out /tmp/somnia_diff_jit.out; then
+        echo "ok       $program"
+    else
+        echo "DIFF     $program"
+        failed=1
+    fi
+done
+
+rm -f /tmp/somnia_diff_tree.out /tmp/somnia_diff_vm.out /tmp/somnia_diff_jit.out \
+      /tmp/somnia_diff_vm.err
+exit $failed
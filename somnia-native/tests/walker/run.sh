@@ -0,0 +1,38 @@
+#!/bin/sh
+# Runs every program here on the tree-walker and diffs what it prints
+# between [EXECUTING] and [DONE] with <program>.expected. Anything written
+# to stderr is a failure too.
+# Usage: tests/walker/run.sh [path/to/somnia]
+
+SOMNIA=${1:-./somnia}
+case "$SOMNIA" in /*) ;; *) SOMNIA="$(pwd)/$SOMNIA" ;; esac
+
+cd "$(dirname "$0")" || exit 1
+
+failed=0
+for program in *.somnia; do
+    "$SOMNIA" run "$program" 2>/tmp/somnia_walker.err |
+        awk '/^\[DONE\]/ { on = 0 }
+             on { lines[n++] = $0 }
+             /^\[EXECUTING\]/ { on = 1 }
+             END {
+                 first = 0; last = n - 1
+                 if (n > 0 && lines[first] == "") first++
+                 if (n > 0 && lines[last] == "") last--
+                 for (i = first; i <= last; i++) print lines[i]
+             }' > /tmp/somnia_walker.out
+
+    if [ -s /tmp/somnia_walker.err ]; then
+        echo "STDERR   $program"
+        cat /tmp/somnia_walker.err
+        failed=1
+    elif diff -u "${program%.somnia}.expected" /tmp/somnia_walker.out; then
+        echo "ok       $program"
+    else
+        echo "DIFF     $program"
+        failed=1
+    fi
+done
+
+rm -f /tmp/somnia_walker.out /tmp/somnia_walker.err
+exit $failed